@@ -0,0 +1,148 @@
+#include "protocol.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using Compiler::ExitCode;
+
+namespace {
+
+constexpr std::string_view Usage = R"(Usage: CompilerClient [options] <input>
+
+Sends <input> to a compile server started with 'Compiler --serve <socket>' and writes the
+assembly next to it with the extension .asm unless -o is given. An input of '-' is read from
+stdin, and its assembly written to stdout.
+
+Options:
+  -o <file>          write the assembly to <file>, '-' for stdout
+  --socket <socket>  the server's socket, $COMPILER_SOCKET by default
+  -h, --help         print this message
+
+Any other option, such as -O<level> or -Rpass=<regex>, is passed on to the server.
+)";
+
+int Fail(ExitCode code, std::string_view message) {
+    std::cerr << std::format("CompilerClient: error: {}\n", message);
+    if (code == ExitCode::UsageError) {
+        std::cerr << "Run 'CompilerClient --help' for usage.\n";
+    }
+    return static_cast<int>(code);
+}
+
+int Connect(const std::string& path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        int error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    return fd;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Compiler::CompileRequest request;
+    std::optional<std::string> input;
+    std::optional<std::string> output;
+    std::optional<std::string> socketPath;
+    if (const char* env = std::getenv("COMPILER_SOCKET")) {
+        socketPath = env;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        auto value = [&](std::string_view option) -> std::optional<std::string> {
+            if (arg.size() > option.size()) {
+                return std::string(arg.substr(option.size()));
+            } else if (i + 1 < argc) {
+                return argv[++i];
+            }
+            return std::nullopt;
+        };
+
+        if (arg == "-h" || arg == "--help") {
+            std::cout << Usage;
+            return static_cast<int>(ExitCode::Success);
+        } else if (arg == "--socket") {
+            if (!(socketPath = value("--socket"))) {
+                return Fail(ExitCode::UsageError, "missing argument to --socket");
+            }
+        } else if (arg.starts_with("-o")) {
+            if (!(output = value("-o"))) {
+                return Fail(ExitCode::UsageError, "missing argument to -o");
+            }
+        } else if (arg.size() > 1 && arg.starts_with("-")) {
+            request.Arguments.emplace_back(arg);
+        } else if (!input) {
+            input = arg;
+        } else {
+            return Fail(ExitCode::UsageError, "only one input file can be given");
+        }
+    }
+    if (!input) {
+        return Fail(ExitCode::UsageError, "no input file");
+    }
+    if (!socketPath) {
+        return Fail(ExitCode::UsageError, "no socket given with --socket or $COMPILER_SOCKET");
+    }
+
+    if (*input == "-") {
+        request.Name = "<stdin>";
+        request.Source.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+    } else {
+        std::ifstream file(*input);
+        if (!file) {
+            return Fail(ExitCode::CompileFailed, std::format("failed to open file: {}", *input));
+        }
+        request.Name = *input;
+        request.Source.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    int fd = Connect(*socketPath);
+    if (fd < 0) {
+        return Fail(
+            ExitCode::ServerUnavailable, std::format("cannot connect to {}: {}", *socketPath, std::strerror(errno)));
+    }
+    Compiler::CompileResponse response;
+    bool answered = Compiler::Send(fd, request) && Compiler::Receive(fd, response);
+    close(fd);
+    if (!answered) {
+        return Fail(ExitCode::ServerUnavailable, "the server closed the connection");
+    }
+
+    std::cerr << response.Diagnostics;
+    if (response.Code != ExitCode::Success) {
+        return static_cast<int>(response.Code);
+    }
+
+    if (output == "-" || (!output && *input == "-")) {
+        std::cout << response.Assembly;
+    } else {
+        std::string path = output.value_or(std::filesystem::path(*input).replace_extension(".asm").string());
+        std::ofstream file(path);
+        file << response.Assembly;
+        file.close();
+        if (!file) {
+            return Fail(ExitCode::CompileFailed, std::format("failed to write to file: {}", path));
+        }
+    }
+    return static_cast<int>(ExitCode::Success);
+}
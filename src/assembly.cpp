@@ -0,0 +1,102 @@
+#include "assembly.h"
+#include "utils.h"
+#include <algorithm>
+
+namespace Compiler {
+
+int64_t CodeStatistics::Total() const {
+    int64_t total = 0;
+    for (const auto& [mnemonic, count] : Instructions) {
+        total += count;
+    }
+    return total;
+}
+
+int64_t CodeStatistics::Count(std::string_view mnemonic) const {
+    auto it = Instructions.find(mnemonic);
+    return it != Instructions.end() ? it->second : 0;
+}
+
+int64_t CodeStatistics::Branches() const {
+    int64_t branches = 0;
+    for (const auto& [mnemonic, count] : Instructions) {
+        if (mnemonic.starts_with('j')) {
+            branches += count;
+        }
+    }
+    return branches;
+}
+
+void CodeStatistics::Print(std::ostream& out, std::string_view file) const {
+    out << std::format("{}: statistics: {} instructions, {} branches, {} calls, {} pushes, {} pops, {} spills, "
+                       "{} stack bytes\n",
+        file, Total(), Branches(), Count("call"), Count("push"), Count("pop"), Spills, StackBytes);
+
+    // the most frequent first
+    std::vector<std::pair<std::string_view, int64_t>> kinds(Instructions.begin(), Instructions.end());
+    std::ranges::stable_sort(kinds, [](const auto& a, const auto& b) { return a.second > b.second; });
+    out << std::format("{}: statistics:", file);
+    for (size_t i = 0; i < kinds.size(); i++) {
+        out << std::format("{} {} {}", i ? "," : "", kinds[i].first, kinds[i].second);
+    }
+    out << '\n';
+}
+
+CodeStatistics Assembly::Statistics() const {
+    CodeStatistics stats;
+    stats.Spills = m_Spills;
+    stats.StackBytes = m_Deepest * 8;
+    for (std::string_view text : { std::string_view(m_Text), std::string_view(m_ColdText) }) {
+        while (!text.empty()) {
+            const size_t end = text.find('\n');
+            const std::string_view line = text.substr(0, end);
+            text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+            if (line.empty() || line.ends_with(':')) {
+                continue; // a label
+            }
+            const std::string_view mnemonic = line.substr(0, line.find(' '));
+            if (mnemonic == "global" || mnemonic == "section" || mnemonic == "extern" || mnemonic == "align") {
+                continue;
+            }
+            auto it = stats.Instructions.find(mnemonic);
+            if (it == stats.Instructions.end()) {
+                it = stats.Instructions.emplace(mnemonic, 0).first;
+            }
+            it->second++;
+        }
+    }
+    return stats;
+}
+
+void Assembly::Push(std::string_view operand) {
+    Emit("push {}", operand);
+    SetStackSize(m_StackSize + 1);
+}
+
+void Assembly::Spill(std::string_view reg) {
+    Push(reg);
+    m_Spills++;
+}
+
+void Assembly::Pop(std::string_view reg) {
+    if (m_StackSize <= 0) {
+        Error("Stack underflow");
+    }
+    Emit("pop {}", reg);
+    m_StackSize--;
+}
+
+int64_t Assembly::Allocate(int64_t count) {
+    Emit("sub rsp, {}", count * 8);
+    SetStackSize(m_StackSize + count);
+    return m_StackSize - 1;
+}
+
+void Assembly::Release(int64_t count) {
+    if (count != 0) {
+        Emit("add rsp, {}", count * 8);
+    }
+    m_StackSize -= count;
+}
+
+} // namespace Compiler
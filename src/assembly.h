@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <format>
+#include <map>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace Compiler {
+
+// What the code generated for a program is made of, to follow its quality across compiler versions.
+struct CodeStatistics {
+    std::map<std::string, int64_t, std::less<>> Instructions; // by mnemonic
+    int64_t Spills = 0;     // intermediate values pushed for want of a register to stay in
+    int64_t StackBytes = 0; // the deepest any frame gets below its frame pointer
+
+    int64_t Total() const;
+    int64_t Count(std::string_view mnemonic) const;
+    int64_t Branches() const; // jumps, conditional or not
+
+    void Print(std::ostream& out, std::string_view file) const;
+};
+
+// The assembly text being generated, and the number of qwords pushed below the frame pointer.
+// Variables live at fixed offsets from rbp, so the stack depth only has to be tracked to keep
+// pushes and pops balanced across branches.
+//
+// Code emitted between BeginCold and EndCold goes after all the rest, so that the code that runs
+// often is laid out without it in the way.
+class Assembly {
+  public:
+    void Emit(std::string_view instr) {
+        m_Text += instr;
+        m_Text += '\n';
+    }
+
+    template <typename... Args>
+    void Emit(std::format_string<Args...> fmt, Args&&... args) {
+        Emit(std::string_view(std::format(fmt, std::forward<Args>(args)...)));
+    }
+
+    void Label(std::string_view label) {
+        m_Text += label;
+        m_Text += ":\n";
+    }
+
+    // pads the code with nops up to the next multiple of bytes
+    void Align(int bytes) { Emit("align {}", bytes); }
+
+    // may nest: each cold piece is moved out of line whole, after the pieces nested in it
+    void BeginCold() { m_Outer.push_back(std::exchange(m_Text, {})); }
+    void EndCold() {
+        m_ColdText += m_Text;
+        m_Text = std::move(m_Outer.back());
+        m_Outer.pop_back();
+    }
+
+    void Push(std::string_view operand);
+    void Pop(std::string_view reg);
+    // pushes an intermediate value, to be popped back when it is needed
+    void Spill(std::string_view reg);
+
+    // a declaration reserves the next count qwords below the frame pointer; returns the slot of the
+    // lowest, so that an array's element i is at slot - i
+    int64_t Allocate(int64_t count = 1);
+    void Release(int64_t count);
+
+    int64_t StackSize() const { return m_StackSize; }
+    void SetStackSize(int64_t size) {
+        m_StackSize = size;
+        m_Deepest = std::max(m_Deepest, size);
+    }
+
+    static std::string Slot(int64_t slot) { return std::format("qword [rbp - {}]", (slot + 1) * 8); }
+    // element index of the array whose element 0 is at slot
+    static std::string Element(int64_t slot, std::string_view index) {
+        return std::format("qword [rbp + {}*8 - {}]", index, (slot + 1) * 8);
+    }
+
+    std::string Text() const { return m_Text + m_ColdText; }
+    // counts the instructions of the text, so it costs nothing until asked for
+    CodeStatistics Statistics() const;
+
+  private:
+    std::string m_Text;
+    std::string m_ColdText;
+    std::vector<std::string> m_Outer; // the text around the cold pieces being emitted
+    int64_t m_StackSize = 0;
+    int64_t m_Deepest = 0;
+    int64_t m_Spills = 0;
+};
+
+} // namespace Compiler
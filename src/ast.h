@@ -24,18 +24,31 @@ struct AssignmentExpression;
 struct Expression;
 struct Statement;
 struct Block;
+struct Declaration;
+struct FunctionDefinition;
+struct VectorLoop;
+
+struct Subscript { // an array element
+    Subscript(std::string_view ident, Expression* index) : Ident(ident), Index(index) {}
+    std::string Ident;
+    Expression* Index;
+    const Declaration* Decl = nullptr; // of the array, resolved by the semantic analyzer
+};
 
 struct Primary {
     explicit Primary(Expression* e) : Value(e) {}
     explicit Primary(const std::string& s) : Value(s) {}
     explicit Primary(int64_t i) : Value(i) {}
-    std::variant<Expression*, std::string, int64_t> Value;
+    explicit Primary(Subscript* s) : Value(s) {}
+    std::variant<Expression*, std::string, int64_t, Subscript*> Value;
+    const Declaration* Decl = nullptr; // of a variable, resolved by the semantic analyzer
 };
 
 struct PostfixExpression {
     explicit PostfixExpression(Primary* p) : Prim(p) {}
     Primary* Prim;
     std::vector<std::vector<AssignmentExpression*>> CallList;
+    const FunctionDefinition* Callee = nullptr; // of a call, resolved by the semantic analyzer
 };
 
 struct MultiplicativeExpression { // '*' | '/'
@@ -65,8 +78,11 @@ struct EqualityExpression { // '==' | '!='
 struct AssignmentExpression { // '='
     AssignmentExpression(EqualityExpression* e) : Expr(e) {}
     AssignmentExpression(std::string_view name, EqualityExpression* e) : Ident(name), Expr(e) {}
+    AssignmentExpression(Subscript* element, EqualityExpression* e) : Expr(e), Element(element) {}
     std::optional<std::string> Ident = std::nullopt;
     EqualityExpression* Expr;
+    const Declaration* Decl = nullptr; // resolved by the semantic analyzer
+    Subscript* Element = nullptr;      // stored to instead of a variable, without tracing
 };
 
 struct Expression {
@@ -75,13 +91,19 @@ struct Expression {
 };
 
 struct Declaration {
-    explicit Declaration(std::string_view ident) : Ident(ident) {}
+    explicit Declaration(std::string_view ident, bool synthetic = false) : Ident(ident), Synthetic(synthetic) {}
     std::string Ident;
+    bool Synthetic = false; // introduced by the optimizer, assignments are not traced
+    int64_t Size = 0;       // of an array, in elements; 0 for an int
+
+    // far more than fits on the stack, but keeps every frame offset within 32 bits
+    static constexpr int64_t MaxSize = 1 << 24;
 };
 
 struct ExpressionStatement {
     explicit ExpressionStatement(Expression* e) : Expr(e) {}
     Expression* Expr;
+    SourceLocation Loc;
 };
 
 struct IfStatement {
@@ -90,17 +112,23 @@ struct IfStatement {
     Expression* Cond;
     Statement* Then;
     Statement* Else = nullptr; // optional
+    SourceLocation Loc;
+    bool Select = false; // both arms assign one variable, lowered to a conditional move
 };
 
 struct ReturnStatement {
     explicit ReturnStatement(Expression* e = nullptr) : Expr(e) {}
     Expression* Expr;
+    SourceLocation Loc;
 };
 
 struct WhileStatement {
     WhileStatement(Expression* cond, Statement* loop) : Cond(cond), Loop(loop) {}
     Expression* Cond;
     Statement* Loop;
+    SourceLocation Loc;
+    bool Rotated = false;             // lowered as a guarded do-while with the test at the bottom
+    const VectorLoop* Vector = nullptr; // SIMD code running the leading iterations, if vectorized
 };
 
 struct Statement {
@@ -122,8 +150,18 @@ struct Block {
     std::vector<BlockItem*> Items;
 };
 
+struct FunctionDefinition {
+    FunctionDefinition(std::string_view name, std::vector<Declaration*> params, Block* body)
+        : Name(name), Params(std::move(params)), Body(body) {}
+    std::string Name;
+    std::vector<Declaration*> Params;
+    Block* Body;
+    SourceLocation Loc;
+};
+
 struct Program {
     explicit Program(Block* b) : GlobalBlock(b) {}
+    std::vector<FunctionDefinition*> Functions; // defined before the main block
     Block* GlobalBlock;
 };
 
@@ -0,0 +1,619 @@
+#include "ast_image.h"
+#include "ast_utils.h"
+#include "stack.h"
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <format>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace Compiler {
+
+static_assert(std::endian::native == std::endian::little, "AST images are little-endian");
+
+namespace {
+
+[[noreturn]] void Corrupt() {
+    Error("Corrupt AST image");
+}
+
+uint32_t Index(size_t size) {
+    if (size >= Image::None) {
+        Error("Program too large to save as an AST image");
+    }
+    return static_cast<uint32_t>(size);
+}
+
+// Appends the nodes of a program to the tables of an image, children first.
+class Writer {
+  public:
+    std::string Write(const Program* program) {
+        Image::Header header{};
+        std::memcpy(header.Magic, Image::Magic, sizeof(header.Magic));
+        header.Version = Image::Version;
+        for (const FunctionDefinition* function : program->Functions) {
+            m_FunctionIndex[function] = Index(m_FunctionIndex.size());
+        }
+        for (const FunctionDefinition* function : program->Functions) {
+            Add(function);
+        }
+        header.Root = Add(program->GlobalBlock);
+
+        std::string image(sizeof(header), '\0');
+        auto append = [&]<typename T>(const std::vector<T>& records) {
+            image.resize((image.size() + 7) / 8 * 8);
+            Image::Table table{ image.size(), records.size() };
+            image.append(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(T));
+            return table;
+        };
+        header.Strings = append(m_Strings);
+        header.Declarations = append(m_Declarations);
+        header.Primaries = append(m_Primaries);
+        header.Chains = append(m_Chains);
+        header.Operands = append(m_Operands);
+        header.Expressions = append(m_Expressions);
+        header.Statements = append(m_Statements);
+        header.Blocks = append(m_Blocks);
+        header.Items = append(m_Items);
+        header.Functions = append(m_Functions);
+        header.Calls = append(m_Calls);
+        header.Arguments = append(m_Arguments);
+        header.Size = image.size();
+        std::memcpy(image.data(), &header, sizeof(header));
+        return image;
+    }
+
+  private:
+    uint32_t String(std::string_view text) {
+        const uint32_t offset = Index(m_Strings.size());
+        m_Strings.insert(m_Strings.end(), text.begin(), text.end());
+        return offset;
+    }
+
+    uint32_t Declare(const Declaration* decl) {
+        m_Declarations.push_back({ String(decl->Ident), Index(decl->Ident.size()), decl->Synthetic,
+            static_cast<uint32_t>(decl->Size) });
+        return m_DeclarationIndex[decl] = Index(m_Declarations.size() - 1);
+    }
+
+    void Add(const FunctionDefinition* function) {
+        const uint32_t first = Index(m_Declarations.size());
+        for (const Declaration* param : function->Params) {
+            Declare(param);
+        }
+        const uint32_t name = String(function->Name);
+        const uint32_t body = Add(function->Body);
+        m_Functions.push_back({ name, Index(function->Name.size()), first, Index(function->Params.size()),
+            body, function->Loc.Line, function->Loc.Column });
+    }
+
+    uint32_t Find(const Declaration* decl) const {
+        auto found = m_DeclarationIndex.find(decl);
+        if (found == m_DeclarationIndex.end()) {
+            Error("Cannot save a program that was not analyzed");
+        }
+        return found->second;
+    }
+
+    uint32_t Add(const Primary* primary) {
+        using Kind = Image::PrimaryKind;
+        m_Primaries.push_back(std::visit(
+            overloaded{ [&](int64_t value) { return Image::Primary{ Kind::Literal, 0, value }; },
+                [&](const std::string&) { return Image::Primary{ Kind::Variable, Find(primary->Decl), 0 }; },
+                [&](const Expression* e) { return Image::Primary{ Kind::Parenthesized, Add(e), 0 }; },
+                [&](const Subscript* element) {
+                    const uint32_t index = Add(element->Index);
+                    return Image::Primary{ Kind::Element, Find(element->Decl), index };
+                } },
+            primary->Value));
+        return Index(m_Primaries.size() - 1);
+    }
+
+    uint32_t Add(const PostfixExpression* expr) {
+        if (expr->CallList.empty()) {
+            return Add(expr->Prim);
+        }
+        if (!expr->Callee) {
+            Error("Cannot save a program that was not analyzed");
+        }
+        std::vector<Image::Argument> args;
+        for (const AssignmentExpression* arg : expr->CallList.front()) {
+            args.push_back(Add(arg));
+        }
+        const uint32_t first = Index(m_Arguments.size());
+        m_Arguments.insert(m_Arguments.end(), args.begin(), args.end());
+        m_Calls.push_back({ m_FunctionIndex.at(expr->Callee), first, Index(args.size()), 0 });
+        m_Primaries.push_back({ Image::PrimaryKind::Call, Index(m_Calls.size() - 1), 0 });
+        return Index(m_Primaries.size() - 1);
+    }
+
+    template <typename T>
+    uint32_t Add(const T* expr) {
+        const uint32_t left = Add(expr->Left);
+        std::vector<Image::Operand> operands;
+        for (const auto& [op, right] : expr->Right) {
+            operands.push_back({ static_cast<uint32_t>(op), Add(right) });
+        }
+        const uint32_t first = Index(m_Operands.size());
+        m_Operands.insert(m_Operands.end(), operands.begin(), operands.end());
+        m_Chains.push_back({ left, first, Index(operands.size()), 0 });
+        return Index(m_Chains.size() - 1);
+    }
+
+    uint32_t Add(const Expression* expr) { return Add(expr->Expr); }
+
+    uint32_t Add(const AssignmentExpression* assign) {
+        if (assign->Element) {
+            const uint32_t index = Add(assign->Element->Index);
+            const uint32_t value = EnsureStack([&] { return Add(assign->Expr); });
+            m_Expressions.push_back({ Find(assign->Element->Decl), value, index, 0 });
+            return Index(m_Expressions.size() - 1);
+        }
+        const uint32_t value = EnsureStack([&] { return Add(assign->Expr); });
+        m_Expressions.push_back({ assign->Ident ? Find(assign->Decl) : Image::None, value, Image::None, 0 });
+        return Index(m_Expressions.size() - 1);
+    }
+
+    uint32_t Add(const Block* block) {
+        std::vector<Image::Item> items;
+        for (const BlockItem* item : block->Items) {
+            items.push_back(std::visit(
+                overloaded{ [&](const Statement* stmt) { return Image::Item{ 0, Add(stmt) }; },
+                    [&](const Declaration* decl) { return Image::Item{ 1, Declare(decl) }; } },
+                item->Item));
+        }
+        const uint32_t first = Index(m_Items.size());
+        m_Items.insert(m_Items.end(), items.begin(), items.end());
+        m_Blocks.push_back({ first, Index(items.size()) });
+        return Index(m_Blocks.size() - 1);
+    }
+
+    uint32_t Add(const Statement* stmt) {
+        return EnsureStack([&] { return AddHere(stmt); });
+    }
+
+    uint32_t AddHere(const Statement* stmt) {
+        using Kind = Image::StatementKind;
+        auto optional = [&](const auto* node) { return node ? Add(node) : Image::None; };
+        auto record = [](Kind kind, SourceLocation loc, uint32_t expr, uint32_t first = Image::None,
+                          uint32_t second = Image::None) {
+            return Image::Statement{ kind, expr, first, second, loc.Line, loc.Column, 0 };
+        };
+        m_Statements.push_back(std::visit(
+            overloaded{ [&](const ExpressionStatement* s) {
+                           return record(Kind::Expression, s->Loc, Add(s->Expr));
+                       },
+                [&](const ReturnStatement* s) { return record(Kind::Return, s->Loc, optional(s->Expr)); },
+                [&](const IfStatement* s) {
+                    const uint32_t cond = Add(s->Cond);
+                    const uint32_t then = Add(s->Then);
+                    return record(Kind::If, s->Loc, cond, then, optional(s->Else));
+                },
+                [&](const WhileStatement* s) {
+                    const uint32_t cond = Add(s->Cond);
+                    return record(Kind::While, s->Loc, cond, Add(s->Loop));
+                },
+                [&](const Block* b) { return record(Kind::Block, {}, Image::None, Add(b)); } },
+            stmt->Stmt));
+        return Index(m_Statements.size() - 1);
+    }
+
+    std::vector<char> m_Strings;
+    std::vector<Image::Declaration> m_Declarations;
+    std::vector<Image::Primary> m_Primaries;
+    std::vector<Image::Chain> m_Chains;
+    std::vector<Image::Operand> m_Operands;
+    std::vector<Image::Expression> m_Expressions;
+    std::vector<Image::Statement> m_Statements;
+    std::vector<Image::Block> m_Blocks;
+    std::vector<Image::Item> m_Items;
+    std::vector<Image::Function> m_Functions;
+    std::vector<Image::Call> m_Calls;
+    std::vector<Image::Argument> m_Arguments;
+    std::unordered_map<const Declaration*, uint32_t> m_DeclarationIndex;
+    std::unordered_map<const FunctionDefinition*, uint32_t> m_FunctionIndex;
+};
+
+// Rebuilds the program from an image. Every node may be used once, so a corrupt image can
+// neither loop nor share nodes.
+class Loader {
+  public:
+    Loader(const AstImage& image, ArenaAllocator& allocator) : m_Image(image), m_Allocator(allocator) {}
+
+    Program* Load() {
+        for (const Image::Declaration& decl : m_Image.Declarations()) {
+            if (decl.Size > Declaration::MaxSize) {
+                Corrupt();
+            }
+            Declaration* declaration = m_Allocator.alloc<Declaration>(m_Image.Name(decl), decl.Synthetic != 0);
+            declaration->Size = decl.Size;
+            m_Declarations.push_back(declaration);
+        }
+
+        // every function exists before any body is loaded, as the bodies may call any of them
+        std::vector<FunctionDefinition*> functions;
+        for (const Image::Function& record : m_Image.Functions()) {
+            std::vector<Declaration*> params;
+            for (uint32_t i = 0; i < record.Parameters; i++) {
+                const uint32_t param = record.FirstParameter + i;
+                if (Claim(m_Image.Declarations(), m_UsedDeclarations, param).Size != 0) {
+                    Corrupt();
+                }
+                params.push_back(m_Declarations[param]);
+            }
+            auto* function =
+                m_Allocator.alloc<FunctionDefinition>(m_Image.Name(record), std::move(params), nullptr);
+            function->Loc = { record.Line, record.Column };
+            m_Functions.push_back(function);
+        }
+        for (size_t i = 0; i < m_Functions.size(); i++) {
+            m_Functions[i]->Body = LoadBlock(m_Image.Functions()[i].Body);
+        }
+
+        Program* program = m_Allocator.alloc<Program>(LoadBlock(m_Image.Header().Root));
+        program->Functions = m_Functions;
+        return program;
+    }
+
+  private:
+    template <typename T>
+    static const T& Claim(std::span<const T> table, std::vector<bool>& used, uint32_t index) {
+        used.resize(table.size());
+        if (index >= table.size() || used[index]) {
+            Corrupt();
+        }
+        used[index] = true;
+        return table[index];
+    }
+
+    template <typename T>
+    std::span<const T> Range(std::span<const T> table, uint32_t first, uint32_t count) {
+        if (uint64_t{ first } + count > table.size()) {
+            Corrupt();
+        }
+        return table.subspan(first, count);
+    }
+
+    // an int, or an array when array is set
+    const Declaration* Find(uint32_t index, bool array = false) {
+        if (index >= m_Declarations.size() || (m_Declarations[index]->Size != 0) != array) {
+            Corrupt();
+        }
+        return m_Declarations[index];
+    }
+
+    Subscript* LoadSubscript(uint32_t decl, uint64_t index) {
+        const Declaration* array = Find(decl, true);
+        if (index >= Image::None) {
+            Corrupt();
+        }
+        auto* element = m_Allocator.alloc<Subscript>(array->Ident, LoadExpression(static_cast<uint32_t>(index)));
+        element->Decl = array;
+        return element;
+    }
+
+    Primary* LoadPrimary(uint32_t index) {
+        const Image::Primary& record = Claim(m_Image.Primaries(), m_UsedPrimaries, index);
+        switch (record.Kind) {
+        case Image::PrimaryKind::Literal: return m_Allocator.alloc<Primary>(record.Value);
+        case Image::PrimaryKind::Variable: {
+            const Declaration* decl = Find(record.Index);
+            Primary* primary = m_Allocator.alloc<Primary>(decl->Ident);
+            primary->Decl = decl;
+            return primary;
+        }
+        case Image::PrimaryKind::Parenthesized:
+            return m_Allocator.alloc<Primary>(LoadExpression(record.Index));
+        case Image::PrimaryKind::Element:
+            return m_Allocator.alloc<Primary>(LoadSubscript(record.Index, static_cast<uint64_t>(record.Value)));
+        case Image::PrimaryKind::Call: break; // see LoadPostfix
+        }
+        Corrupt();
+    }
+
+    PostfixExpression* LoadPostfix(uint32_t index) {
+        const auto primaries = m_Image.Primaries();
+        if (index >= primaries.size() || primaries[index].Kind != Image::PrimaryKind::Call) {
+            return m_Allocator.alloc<PostfixExpression>(LoadPrimary(index));
+        }
+        const Image::Primary& primary = Claim(m_Image.Primaries(), m_UsedPrimaries, index);
+        const Image::Call& call = Claim(m_Image.Calls(), m_UsedCalls, primary.Index);
+        if (call.Function >= m_Functions.size() || call.Count != m_Functions[call.Function]->Params.size() ||
+            call.Reserved != 0) {
+            Corrupt();
+        }
+        const FunctionDefinition* callee = m_Functions[call.Function];
+        auto* expr = m_Allocator.alloc<PostfixExpression>(m_Allocator.alloc<Primary>(callee->Name));
+        expr->Callee = callee;
+        auto& args = expr->CallList.emplace_back();
+        for (const Image::Argument arg : Range(m_Image.Arguments(), call.First, call.Count)) {
+            args.push_back(EnsureStack([&] { return LoadAssignment(arg); }));
+        }
+        return expr;
+    }
+
+    template <typename T>
+    static bool Accepts(BinaryOp op) {
+        if constexpr (std::is_same_v<T, MultiplicativeExpression>) {
+            return op == BinaryOp::Mul || op == BinaryOp::Div || op == BinaryOp::Mod;
+        } else if constexpr (std::is_same_v<T, AdditiveExpression>) {
+            return op == BinaryOp::Add || op == BinaryOp::Sub;
+        } else if constexpr (std::is_same_v<T, RelationalExpression>) {
+            return op == BinaryOp::Lt || op == BinaryOp::Le || op == BinaryOp::Gt || op == BinaryOp::Ge;
+        } else {
+            return op == BinaryOp::Eq || op == BinaryOp::Ne;
+        }
+    }
+
+    template <typename T>
+    OperandOf_t<T>* LoadOperand(uint32_t index) {
+        if constexpr (std::is_same_v<T, MultiplicativeExpression>) {
+            return LoadPostfix(index);
+        } else {
+            return LoadChain<OperandOf_t<T>>(index);
+        }
+    }
+
+    template <typename T>
+    T* LoadChain(uint32_t index) {
+        const Image::Chain& chain = Claim(m_Image.Chains(), m_UsedChains, index);
+        if (chain.Reserved != 0) {
+            Corrupt();
+        }
+        T* expr = m_Allocator.alloc<T>(LoadOperand<T>(chain.Left));
+        for (const Image::Operand& operand : Range(m_Image.Operands(), chain.First, chain.Count)) {
+            const auto op = static_cast<BinaryOp>(operand.Op);
+            if (!Accepts<T>(op)) {
+                Corrupt();
+            }
+            expr->Right.emplace_back(op, LoadOperand<T>(operand.Node));
+        }
+        return expr;
+    }
+
+    Expression* LoadExpression(uint32_t index) {
+        return m_Allocator.alloc<Expression>(LoadAssignment(index));
+    }
+
+    AssignmentExpression* LoadAssignment(uint32_t index) {
+        const Image::Expression& record = Claim(m_Image.Expressions(), m_UsedExpressions, index);
+        if (record.Reserved != 0) {
+            Corrupt();
+        }
+        if (record.Element != Image::None) {
+            Subscript* element = LoadSubscript(record.Decl, record.Element);
+            auto* value = EnsureStack([&] { return LoadChain<EqualityExpression>(record.Value); });
+            return m_Allocator.alloc<AssignmentExpression>(element, value);
+        }
+        auto* value = EnsureStack([&] { return LoadChain<EqualityExpression>(record.Value); });
+        if (record.Decl == Image::None) {
+            return m_Allocator.alloc<AssignmentExpression>(value);
+        }
+        const Declaration* decl = Find(record.Decl);
+        auto* assign = m_Allocator.alloc<AssignmentExpression>(decl->Ident, value);
+        assign->Decl = decl;
+        return assign;
+    }
+
+    Block* LoadBlock(uint32_t index) {
+        const Image::Block& record = Claim(m_Image.Blocks(), m_UsedBlocks, index);
+        Block* block = m_Allocator.alloc<Block>();
+        for (const Image::Item& item : Range(m_Image.Items(), record.First, record.Count)) {
+            if (item.IsDeclaration) {
+                Claim(m_Image.Declarations(), m_UsedDeclarations, item.Index);
+                block->Items.push_back(m_Allocator.alloc<BlockItem>(m_Declarations[item.Index]));
+            } else {
+                block->Items.push_back(m_Allocator.alloc<BlockItem>(LoadStatement(item.Index)));
+            }
+        }
+        return block;
+    }
+
+    Statement* LoadStatement(uint32_t index) {
+        return EnsureStack([&] { return LoadStatementHere(index); });
+    }
+
+    Statement* LoadStatementHere(uint32_t index) {
+        const Image::Statement& record = Claim(m_Image.Statements(), m_UsedStatements, index);
+        if (record.Reserved != 0) {
+            Corrupt();
+        }
+        const SourceLocation loc{ record.Line, record.Column };
+        auto optional = [&](uint32_t expr) { return expr == Image::None ? nullptr : LoadExpression(expr); };
+        switch (record.Kind) {
+        case Image::StatementKind::Expression: {
+            auto* stmt = m_Allocator.alloc<ExpressionStatement>(LoadExpression(record.Expr));
+            stmt->Loc = loc;
+            return m_Allocator.alloc<Statement>(stmt);
+        }
+        case Image::StatementKind::Return: {
+            auto* stmt = m_Allocator.alloc<ReturnStatement>(optional(record.Expr));
+            stmt->Loc = loc;
+            return m_Allocator.alloc<Statement>(stmt);
+        }
+        case Image::StatementKind::If: {
+            Expression* cond = LoadExpression(record.Expr);
+            Statement* then = LoadStatement(record.First);
+            Statement* other = record.Second == Image::None ? nullptr : LoadStatement(record.Second);
+            auto* stmt = m_Allocator.alloc<IfStatement>(cond, then, other);
+            stmt->Loc = loc;
+            return m_Allocator.alloc<Statement>(stmt);
+        }
+        case Image::StatementKind::While: {
+            Expression* cond = LoadExpression(record.Expr);
+            auto* stmt = m_Allocator.alloc<WhileStatement>(cond, LoadStatement(record.First));
+            stmt->Loc = loc;
+            return m_Allocator.alloc<Statement>(stmt);
+        }
+        case Image::StatementKind::Block: return m_Allocator.alloc<Statement>(LoadBlock(record.First));
+        }
+        Corrupt();
+    }
+
+    const AstImage& m_Image;
+    ArenaAllocator& m_Allocator;
+    std::vector<Declaration*> m_Declarations;
+    std::vector<FunctionDefinition*> m_Functions;
+    // the records used so far
+    std::vector<bool> m_UsedDeclarations;
+    std::vector<bool> m_UsedPrimaries;
+    std::vector<bool> m_UsedChains;
+    std::vector<bool> m_UsedExpressions;
+    std::vector<bool> m_UsedStatements;
+    std::vector<bool> m_UsedBlocks;
+    std::vector<bool> m_UsedCalls;
+};
+
+} // namespace
+
+std::string WriteAstImage(const Program* program) {
+    return Writer().Write(program);
+}
+
+bool IsAstImage(std::string_view bytes) {
+    return bytes.starts_with(std::string_view(Image::Magic, sizeof(Image::Magic)));
+}
+
+AstImage::AstImage(std::string_view bytes) : m_Bytes(bytes) {
+    if (!IsAstImage(bytes) || bytes.size() < sizeof(Image::Header) ||
+        reinterpret_cast<uintptr_t>(bytes.data()) % alignof(Image::Header) != 0) {
+        Error("Not an AST image");
+    }
+    const Image::Header& header = Header();
+    if (header.Version != Image::Version) {
+        Error(std::format(
+            "AST image version {} is not supported, expected {}", header.Version, Image::Version));
+    }
+    if (header.Size != bytes.size()) {
+        Corrupt();
+    }
+    Check<char>(header.Strings);
+    Check<Image::Declaration>(header.Declarations);
+    Check<Image::Primary>(header.Primaries);
+    Check<Image::Chain>(header.Chains);
+    Check<Image::Operand>(header.Operands);
+    Check<Image::Expression>(header.Expressions);
+    Check<Image::Statement>(header.Statements);
+    Check<Image::Block>(header.Blocks);
+    Check<Image::Item>(header.Items);
+    Check<Image::Function>(header.Functions);
+    Check<Image::Call>(header.Calls);
+    Check<Image::Argument>(header.Arguments);
+}
+
+template <typename T>
+void AstImage::Check(const Image::Table& table) const {
+    if (table.Offset % alignof(T) != 0 || table.Offset > m_Bytes.size() ||
+        table.Count > (m_Bytes.size() - table.Offset) / sizeof(T)) {
+        Corrupt();
+    }
+}
+
+AstImage AstImage::Open(const std::filesystem::path& path) {
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat status {};
+    if (fd < 0 || fstat(fd, &status) != 0) {
+        const int error = errno;
+        if (fd >= 0) {
+            close(fd);
+        }
+        Error(std::format("Failed to open '{}': {}", path.string(), std::strerror(error)));
+    }
+    const auto size = static_cast<size_t>(status.st_size);
+    void* data =
+        size < sizeof(Image::Header) ? MAP_FAILED : mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        Error("Not an AST image");
+    }
+
+    try {
+        AstImage image(std::string_view(static_cast<const char*>(data), size));
+        image.m_Mapping = data;
+        return image;
+    } catch (...) {
+        munmap(data, size);
+        throw;
+    }
+}
+
+AstImage::~AstImage() {
+    if (m_Mapping) {
+        munmap(m_Mapping, m_Bytes.size());
+    }
+}
+
+AstImage::AstImage(AstImage&& other) noexcept : m_Bytes(other.m_Bytes), m_Mapping(other.m_Mapping) {
+    other.m_Mapping = nullptr;
+}
+
+std::span<const Image::Declaration> AstImage::Declarations() const {
+    return View<Image::Declaration>(Header().Declarations);
+}
+
+std::span<const Image::Primary> AstImage::Primaries() const {
+    return View<Image::Primary>(Header().Primaries);
+}
+
+std::span<const Image::Chain> AstImage::Chains() const {
+    return View<Image::Chain>(Header().Chains);
+}
+
+std::span<const Image::Operand> AstImage::Operands() const {
+    return View<Image::Operand>(Header().Operands);
+}
+
+std::span<const Image::Expression> AstImage::Expressions() const {
+    return View<Image::Expression>(Header().Expressions);
+}
+
+std::span<const Image::Statement> AstImage::Statements() const {
+    return View<Image::Statement>(Header().Statements);
+}
+
+std::span<const Image::Block> AstImage::Blocks() const {
+    return View<Image::Block>(Header().Blocks);
+}
+
+std::span<const Image::Item> AstImage::Items() const {
+    return View<Image::Item>(Header().Items);
+}
+
+std::span<const Image::Function> AstImage::Functions() const {
+    return View<Image::Function>(Header().Functions);
+}
+
+std::span<const Image::Call> AstImage::Calls() const {
+    return View<Image::Call>(Header().Calls);
+}
+
+std::span<const Image::Argument> AstImage::Arguments() const {
+    return View<Image::Argument>(Header().Arguments);
+}
+
+std::string_view AstImage::Name(const Image::Declaration& decl) const {
+    return String(decl.Name, decl.NameSize);
+}
+
+std::string_view AstImage::Name(const Image::Function& function) const {
+    return String(function.Name, function.NameSize);
+}
+
+std::string_view AstImage::String(uint32_t offset, uint32_t size) const {
+    const std::span<const char> strings = View<char>(Header().Strings);
+    if (uint64_t{ offset } + size > strings.size()) {
+        Corrupt();
+    }
+    return { strings.data() + offset, size };
+}
+
+Program* AstImage::Load(ArenaAllocator& allocator) const {
+    return Loader(*this, allocator).Load();
+}
+
+} // namespace Compiler
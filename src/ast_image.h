@@ -0,0 +1,184 @@
+#pragma once
+
+#include "ast.h"
+#include "utils.h"
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace Compiler {
+
+// The records of an AST image: a parsed and analyzed program saved in a binary form that is used
+// where it lies, mapped or in any buffer 8-byte aligned. Nodes of each kind are stored in a table
+// of fixed-size records and refer to each other by index, never by address, so an image needs no
+// relocation. Children come before their parents, except that calls name their function by index,
+// as functions may call each other. Integers are little-endian, and Reserved fields are zero.
+namespace Image {
+
+constexpr char Magic[8] = { 'C', 'A', 'S', 'T', '\r', '\n', '\x1a', '\n' };
+constexpr uint32_t Version = 4; // bumped whenever a record changes
+constexpr uint32_t None = UINT32_MAX;
+
+// Count records starting Offset bytes into the image.
+struct Table {
+    uint64_t Offset;
+    uint64_t Count;
+};
+
+struct Header {
+    char Magic[8];
+    uint32_t Version;
+    uint32_t Root; // the global block
+    uint64_t Size; // of the whole image
+    Table Strings;
+    Table Declarations;
+    Table Primaries;
+    Table Chains;
+    Table Operands;
+    Table Expressions;
+    Table Statements;
+    Table Blocks;
+    Table Items;
+    Table Functions;
+    Table Calls;
+    Table Arguments;
+};
+
+struct Declaration {
+    uint32_t Name; // offset of the name in Strings
+    uint32_t NameSize;
+    uint32_t Synthetic;
+    uint32_t Size; // of an array, in elements; 0 for an int
+};
+
+enum class PrimaryKind : uint32_t { Literal, Variable, Parenthesized, Call, Element };
+
+struct Primary {
+    PrimaryKind Kind;
+    uint32_t Index; // Variable, Element: the declaration; Parenthesized: the expression; Call: the call
+    int64_t Value;  // Literal; Element: the index, an expression
+};
+
+struct Function {
+    uint32_t Name; // offset of the name in Strings
+    uint32_t NameSize;
+    uint32_t FirstParameter; // the parameters, [FirstParameter, FirstParameter + Parameters) in Declarations
+    uint32_t Parameters;
+    uint32_t Body; // a block
+    uint16_t Line;
+    uint16_t Column;
+};
+
+struct Call {
+    uint32_t Function;
+    uint32_t First; // the arguments, [First, First + Count) in Arguments
+    uint32_t Count;
+    uint32_t Reserved;
+};
+
+// An argument of a call: an expression.
+using Argument = uint32_t;
+
+// A multiplicative, additive, relational or equality expression, told apart by where it is used:
+// Left is a primary for a multiplicative expression and a chain of the level below otherwise.
+struct Chain {
+    uint32_t Left;
+    uint32_t First; // the operands following Left, [First, First + Count) in Operands
+    uint32_t Count;
+    uint32_t Reserved;
+};
+
+struct Operand {
+    uint32_t Op;   // a BinaryOp
+    uint32_t Node; // same level as the chain's Left
+};
+
+struct Expression {
+    uint32_t Decl;    // the variable or array assigned, or None
+    uint32_t Value;   // an equality chain
+    uint32_t Element; // the index of the element assigned, an expression, or None
+    uint32_t Reserved;
+};
+
+enum class StatementKind : uint32_t { Expression, If, Return, While, Block };
+
+struct Statement {
+    StatementKind Kind;
+    uint32_t Expr;   // Expression, Return (None for none): the value; If, While: the condition
+    uint32_t First;  // If: then; While: the body; Block: the block rather than a statement
+    uint32_t Second; // If: else, or None
+    uint16_t Line;
+    uint16_t Column;
+    uint32_t Reserved;
+};
+
+struct Block {
+    uint32_t First; // the items, [First, First + Count) in Items
+    uint32_t Count;
+};
+
+struct Item {
+    uint32_t IsDeclaration;
+    uint32_t Index; // a declaration or a statement
+};
+
+} // namespace Image
+
+// Saves a program, parsed and analyzed but not yet optimized, as an image. What the passes decide,
+// such as which ifs become selects and which loops are rotated, is not saved.
+std::string WriteAstImage(const Program* program);
+
+// True if bytes start like an image; anything else is taken for source text.
+bool IsAstImage(std::string_view bytes);
+
+// A read-only view of an image. Opening one checks its header and that every table lies inside
+// it, but reads nothing else: tools walk the tables in place, with no parsing and no allocation
+// per node. Load rebuilds the program the compiler's passes work on, as it was when saved, and
+// checks every reference and every Reserved field on the way.
+class AstImage {
+  public:
+    // views bytes, which must outlive the image
+    explicit AstImage(std::string_view bytes);
+    // maps the file, for as long as the image lives
+    static AstImage Open(const std::filesystem::path& path);
+    ~AstImage();
+
+    AstImage(AstImage&& other) noexcept;
+    AstImage& operator=(AstImage&&) = delete;
+
+    std::string_view Bytes() const { return m_Bytes; }
+    const Image::Header& Header() const { return *reinterpret_cast<const Image::Header*>(m_Bytes.data()); }
+
+    std::span<const Image::Declaration> Declarations() const;
+    std::span<const Image::Primary> Primaries() const;
+    std::span<const Image::Chain> Chains() const;
+    std::span<const Image::Operand> Operands() const;
+    std::span<const Image::Expression> Expressions() const;
+    std::span<const Image::Statement> Statements() const;
+    std::span<const Image::Block> Blocks() const;
+    std::span<const Image::Item> Items() const;
+    std::span<const Image::Function> Functions() const;
+    std::span<const Image::Call> Calls() const;
+    std::span<const Image::Argument> Arguments() const;
+    std::string_view Name(const Image::Declaration& decl) const;
+    std::string_view Name(const Image::Function& function) const;
+
+    Program* Load(ArenaAllocator& allocator) const;
+
+  private:
+    template <typename T>
+    std::span<const T> View(const Image::Table& table) const {
+        const auto* data = reinterpret_cast<const T*>(m_Bytes.data() + table.Offset);
+        return { data, static_cast<size_t>(table.Count) };
+    }
+    template <typename T>
+    void Check(const Image::Table& table) const;
+    std::string_view String(uint32_t offset, uint32_t size) const;
+
+    std::string_view m_Bytes;
+    void* m_Mapping = nullptr;
+};
+
+} // namespace Compiler
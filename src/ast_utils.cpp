@@ -0,0 +1,269 @@
+#include "ast_utils.h"
+
+namespace Compiler {
+
+const Primary* AsPrimary(const Primary* primary) {
+    if (const auto* expr = std::get_if<Expression*>(&primary->Value)) {
+        return EnsureStack([&] { return AsPrimary(*expr); });
+    }
+    return primary;
+}
+
+const Primary* AsPrimary(const PostfixExpression* expr) {
+    if (!expr->CallList.empty()) {
+        return nullptr;
+    }
+    return AsPrimary(expr->Prim);
+}
+
+const Primary* AsPrimary(const Expression* expr) {
+    if (expr->Expr->Ident || expr->Expr->Element) {
+        return nullptr;
+    }
+    return AsPrimary(expr->Expr->Expr);
+}
+
+std::optional<int64_t> ConstantIndex(const Subscript* element) {
+    const auto index = AsLiteral(element->Index);
+    return index && *index >= 0 && *index < element->Decl->Size ? index : std::nullopt;
+}
+
+void ForEachExpression(Statement* stmt, const std::function<void(Expression*)>& fn) {
+    EnsureStack([&] {
+        std::visit(overloaded{ [&](ExpressionStatement* exprStmt) { fn(exprStmt->Expr); },
+                       [&](ReturnStatement* retStmt) {
+                           if (retStmt->Expr) {
+                               fn(retStmt->Expr);
+                           }
+                       },
+                       [&](IfStatement* ifStmt) {
+                           fn(ifStmt->Cond);
+                           ForEachExpression(ifStmt->Then, fn);
+                           if (ifStmt->Else) {
+                               ForEachExpression(ifStmt->Else, fn);
+                           }
+                       },
+                       [&](WhileStatement* whileStmt) {
+                           fn(whileStmt->Cond);
+                           ForEachExpression(whileStmt->Loop, fn);
+                       },
+                       [&](Block* block) {
+                           for (auto* item : block->Items) {
+                               if (auto* s = std::get_if<Statement*>(&item->Item)) {
+                                   ForEachExpression(*s, fn);
+                               }
+                           }
+                       } },
+            stmt->Stmt);
+    });
+}
+
+int EstimateCost(Statement* stmt) {
+    int cost = 0;
+    ForEachExpression(stmt, [&](Expression* expr) {
+        cost += EstimateCost(expr->Expr->Expr) + 1;
+        if (expr->Expr->Ident) {
+            cost += 3; // store and trace
+        } else if (expr->Expr->Element) {
+            cost += EstimateCost(expr->Expr->Element->Index->Expr->Expr) + 4; // index, check and store
+        }
+    });
+    return cost;
+}
+
+std::string ToString(const Expression* expr) {
+    return ToString(expr->Expr);
+}
+
+std::string ToString(const AssignmentExpression* expr) {
+    std::string value = EnsureStack([&] { return ToString(expr->Expr); });
+    if (expr->Element) {
+        return ToString(expr->Element) + " = " + value;
+    }
+    return expr->Ident ? *expr->Ident + " = " + value : value;
+}
+
+std::string ToString(const Primary* primary) {
+    return std::visit(overloaded{ [](int64_t value) { return std::to_string(value); },
+                          [](const std::string& ident) { return ident; },
+                          [](const Expression* e) { return "(" + ToString(e) + ")"; },
+                          [](const Subscript* s) { return ToString(s); } },
+        primary->Value);
+}
+
+std::string ToString(const Subscript* element) {
+    return element->Ident + "[" + EnsureStack([&] { return ToString(element->Index); }) + "]";
+}
+
+AssignmentExpression* AsSingleAssignment(const Statement* stmt) {
+    if (const auto* block = std::get_if<Block*>(&stmt->Stmt)) {
+        if ((*block)->Items.size() != 1) {
+            return nullptr;
+        }
+        const auto* inner = std::get_if<Statement*>(&(*block)->Items.front()->Item);
+        return inner ? EnsureStack([&] { return AsSingleAssignment(*inner); }) : nullptr;
+    }
+    if (const auto* exprStmt = std::get_if<ExpressionStatement*>(&stmt->Stmt)) {
+        AssignmentExpression* assign = (*exprStmt)->Expr->Expr;
+        return assign->Ident ? assign : nullptr;
+    }
+    return nullptr;
+}
+
+Declaration* AstBuilder::CreateTemporary(std::string_view prefix) {
+    // '.' cannot appear in a source identifier, so temporaries never clash with user names
+    return m_Allocator.alloc<Declaration>(std::string(prefix) + "." + std::to_string(m_TemporaryCount++), true);
+}
+
+Primary* AstBuilder::Var(const Declaration* decl) {
+    Primary* primary = m_Allocator.alloc<Primary>(decl->Ident);
+    primary->Decl = decl;
+    return primary;
+}
+
+Primary* AstBuilder::Literal(int64_t value) {
+    return m_Allocator.alloc<Primary>(value);
+}
+
+Expression* AstBuilder::Assign(const Declaration* decl, EqualityExpression* value) {
+    AssignmentExpression* assign = m_Allocator.alloc<AssignmentExpression>(decl->Ident, value);
+    assign->Decl = decl;
+    return m_Allocator.alloc<Expression>(assign);
+}
+
+Expression* AstBuilder::Value(EqualityExpression* value) {
+    return m_Allocator.alloc<Expression>(m_Allocator.alloc<AssignmentExpression>(value));
+}
+
+Statement* AstBuilder::ExpressionStmt(Expression* expr) {
+    return m_Allocator.alloc<Statement>(m_Allocator.alloc<ExpressionStatement>(expr));
+}
+
+BlockItem* AstBuilder::Item(Statement* stmt) {
+    return m_Allocator.alloc<BlockItem>(stmt);
+}
+
+BlockItem* AstBuilder::Item(Declaration* decl) {
+    return m_Allocator.alloc<BlockItem>(decl);
+}
+
+
+static const Declaration* Resolve(const Declaration* decl, const std::unordered_map<const Declaration*, const Declaration*>& decls) {
+    auto it = decls.find(decl);
+    return it != decls.end() ? it->second : decl;
+}
+
+Statement* AstBuilder::Clone(const Statement* stmt) {
+    DeclarationMap decls;
+    return Clone(stmt, decls);
+}
+
+Expression* AstBuilder::Clone(const Expression* expr) {
+    DeclarationMap decls;
+    return Clone(expr, decls);
+}
+
+Block* AstBuilder::CloneRenaming(const Block* block, DeclarationMap renames) {
+    return Clone(block, renames);
+}
+
+Statement* AstBuilder::Clone(const Statement* stmt, DeclarationMap& decls) {
+    return EnsureStack([&] { return CloneHere(stmt, decls); });
+}
+
+Statement* AstBuilder::CloneHere(const Statement* stmt, DeclarationMap& decls) {
+    return std::visit(overloaded{ [&](const ExpressionStatement* exprStmt) {
+                                     ExpressionStatement* copy = m_Allocator.alloc<ExpressionStatement>(*exprStmt);
+                                     copy->Expr = Clone(exprStmt->Expr, decls);
+                                     return m_Allocator.alloc<Statement>(copy);
+                                 },
+                          [&](const ReturnStatement* retStmt) {
+                              ReturnStatement* copy = m_Allocator.alloc<ReturnStatement>(*retStmt);
+                              copy->Expr = retStmt->Expr ? Clone(retStmt->Expr, decls) : nullptr;
+                              return m_Allocator.alloc<Statement>(copy);
+                          },
+                          [&](const IfStatement* ifStmt) {
+                              IfStatement* copy = m_Allocator.alloc<IfStatement>(*ifStmt);
+                              copy->Cond = Clone(ifStmt->Cond, decls);
+                              copy->Then = Clone(ifStmt->Then, decls);
+                              copy->Else = ifStmt->Else ? Clone(ifStmt->Else, decls) : nullptr;
+                              return m_Allocator.alloc<Statement>(copy);
+                          },
+                          [&](const WhileStatement* whileStmt) {
+                              WhileStatement* copy = m_Allocator.alloc<WhileStatement>(*whileStmt);
+                              copy->Cond = Clone(whileStmt->Cond, decls);
+                              copy->Loop = Clone(whileStmt->Loop, decls);
+                              copy->Vector = nullptr; // planned for the original's declarations
+                              return m_Allocator.alloc<Statement>(copy);
+                          },
+                          [&](const Block* block) { return m_Allocator.alloc<Statement>(Clone(block, decls)); } },
+        stmt->Stmt);
+}
+
+Block* AstBuilder::Clone(const Block* block, DeclarationMap& decls) {
+    Block* copy = m_Allocator.alloc<Block>();
+    for (const auto* item : block->Items) {
+        std::visit(overloaded{ [&](const Statement* stmt) { copy->Items.push_back(Item(Clone(stmt, decls))); },
+                       [&](const Declaration* decl) {
+                           Declaration* dup = m_Allocator.alloc<Declaration>(*decl);
+                           decls[decl] = dup;
+                           copy->Items.push_back(Item(dup));
+                       } },
+            item->Item);
+    }
+    return copy;
+}
+
+Expression* AstBuilder::Clone(const Expression* expr, DeclarationMap& decls) {
+    return m_Allocator.alloc<Expression>(Clone(expr->Expr, decls));
+}
+
+AssignmentExpression* AstBuilder::Clone(const AssignmentExpression* expr, DeclarationMap& decls) {
+    AssignmentExpression* copy = m_Allocator.alloc<AssignmentExpression>(*expr);
+    copy->Expr = EnsureStack([&] { return Clone(expr->Expr, decls); });
+    copy->Decl = expr->Decl ? Resolve(expr->Decl, decls) : nullptr;
+    if (copy->Decl != expr->Decl) {
+        copy->Ident = copy->Decl->Ident;
+    }
+    copy->Element = expr->Element ? Clone(expr->Element, decls) : nullptr;
+    return copy;
+}
+
+Primary* AstBuilder::Clone(const Primary* primary, DeclarationMap& decls) {
+    Primary* copy = m_Allocator.alloc<Primary>(*primary);
+    if (const auto* expr = std::get_if<Expression*>(&primary->Value)) {
+        copy->Value = Clone(*expr, decls);
+    } else if (const auto* element = std::get_if<Subscript*>(&primary->Value)) {
+        copy->Value = Clone(*element, decls);
+    } else if (primary->Decl) {
+        copy->Decl = Resolve(primary->Decl, decls);
+        if (copy->Decl != primary->Decl) {
+            copy->Value = copy->Decl->Ident;
+        }
+    }
+    return copy;
+}
+
+Subscript* AstBuilder::Clone(const Subscript* element, DeclarationMap& decls) {
+    Subscript* copy = m_Allocator.alloc<Subscript>(*element);
+    copy->Index = EnsureStack([&] { return Clone(element->Index, decls); });
+    copy->Decl = Resolve(element->Decl, decls);
+    if (copy->Decl != element->Decl) {
+        copy->Ident = copy->Decl->Ident;
+    }
+    return copy;
+}
+
+PostfixExpression* AstBuilder::Clone(const PostfixExpression* expr, DeclarationMap& decls) {
+    PostfixExpression* copy = m_Allocator.alloc<PostfixExpression>(Clone(expr->Prim, decls));
+    copy->Callee = expr->Callee;
+    for (const auto& args : expr->CallList) {
+        auto& list = copy->CallList.emplace_back();
+        for (const auto* arg : args) {
+            list.push_back(Clone(arg, decls));
+        }
+    }
+    return copy;
+}
+
+} // namespace Compiler
@@ -0,0 +1,226 @@
+#pragma once
+
+#include "ast.h"
+#include "stack.h"
+#include "utils.h"
+#include <functional>
+#include <type_traits>
+#include <unordered_map>
+
+namespace Compiler {
+
+// Operand type of an expression level: the type of Left and of each Right entry.
+template <typename T>
+struct OperandOf {
+    using Type = std::remove_pointer_t<decltype(T::Left)>;
+};
+
+template <>
+struct OperandOf<PostfixExpression> {
+    using Type = Primary;
+};
+
+template <typename T>
+using OperandOf_t = typename OperandOf<T>::Type;
+
+// Returns the primary that a single-operand expression reduces to, looking through parentheses.
+const Primary* AsPrimary(const Primary* primary);
+const Primary* AsPrimary(const PostfixExpression* expr);
+const Primary* AsPrimary(const Expression* expr);
+
+template <typename T>
+const Primary* AsPrimary(const T* expr) {
+    if (!expr->Right.empty()) {
+        return nullptr;
+    }
+    return AsPrimary(expr->Left);
+}
+
+template <typename T>
+std::optional<int64_t> AsLiteral(const T* expr) {
+    const Primary* p = AsPrimary(expr);
+    if (p && std::holds_alternative<int64_t>(p->Value)) {
+        return std::get<int64_t>(p->Value);
+    }
+    return std::nullopt;
+}
+
+template <typename T>
+const Declaration* AsVariable(const T* expr) {
+    const Primary* p = AsPrimary(expr);
+    if (p && std::holds_alternative<std::string>(p->Value)) {
+        return p->Decl;
+    }
+    return nullptr;
+}
+
+// The index of an element known to be within bounds when compiled: a literal one, which makes the
+// element a variable of its own.
+std::optional<int64_t> ConstantIndex(const Subscript* element);
+
+// A value computed speculatively, before it is known to be needed, must not trap.
+template <typename T>
+bool CanSpeculate(BinaryOp op, const T* right) {
+    return (op != BinaryOp::Div && op != BinaryOp::Mod) || AsLiteral(right).value_or(0) > 0;
+}
+
+// True if the expression can be evaluated early or without being needed: it assigns nothing,
+// calls nothing and cannot trap.
+template <typename T>
+bool IsSpeculatable(const T* expr) {
+    if constexpr (std::is_same_v<T, Primary>) {
+        if (const auto* s = std::get_if<Subscript*>(&expr->Value)) {
+            return ConstantIndex(*s).has_value(); // otherwise the index may be out of bounds
+        }
+        const auto* e = std::get_if<Expression*>(&expr->Value);
+        return !e || (!(*e)->Expr->Ident && !(*e)->Expr->Element &&
+                         EnsureStack([&] { return IsSpeculatable((*e)->Expr->Expr); }));
+    } else if constexpr (std::is_same_v<T, PostfixExpression>) {
+        return expr->CallList.empty() && IsSpeculatable(expr->Prim);
+    } else {
+        if (!IsSpeculatable(expr->Left)) {
+            return false;
+        }
+        for (const auto& [op, right] : expr->Right) {
+            if (!CanSpeculate(op, right) || !IsSpeculatable(right)) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+// Rough size of the code the generator emits, in instructions.
+template <typename T>
+int EstimateCost(const T* expr) {
+    if constexpr (std::is_same_v<T, Primary>) {
+        return std::visit(overloaded{ [](int64_t) { return 2; }, [](const std::string&) { return 1; },
+                              [](const Expression* e) {
+                                  return EnsureStack([&] { return EstimateCost(e->Expr->Expr); }) + 1;
+                              },
+                              [](const Subscript* s) { // the bounds check and the load
+                                  return EnsureStack([&] { return EstimateCost(s->Index->Expr->Expr); }) + 3;
+                              } },
+            expr->Value);
+    } else if constexpr (std::is_same_v<T, PostfixExpression>) {
+        int cost = EstimateCost(expr->Prim);
+        for (const auto& args : expr->CallList) {
+            cost += 4; // the call and the stack adjustments around it
+            for (const auto* arg : args) {
+                cost += EnsureStack([&] { return EstimateCost(arg->Expr); }) + 2;
+            }
+        }
+        return cost;
+    } else {
+        int cost = EstimateCost(expr->Left);
+        for (const auto& [op, right] : expr->Right) {
+            cost += EstimateCost(right) + 5;
+        }
+        return cost;
+    }
+}
+
+int EstimateCost(Statement* stmt);
+
+// Source form of an expression, for remarks.
+std::string ToString(const Expression* expr);
+std::string ToString(const AssignmentExpression* expr);
+std::string ToString(const Primary* primary);
+std::string ToString(const Subscript* element);
+
+template <typename T>
+std::string ToString(const T* expr) {
+    if constexpr (std::is_same_v<T, PostfixExpression>) {
+        std::string str = ToString(expr->Prim);
+        for (const auto& args : expr->CallList) {
+            str += "(";
+            for (size_t i = 0; i < args.size(); ++i) {
+                str += (i ? ", " : "") + ToString(args[i]);
+            }
+            str += ")";
+        }
+        return str;
+    } else {
+        std::string str = ToString(expr->Left);
+        for (const auto& [op, right] : expr->Right) {
+            str += " " + std::string(TokenToStr(static_cast<TokenType>(op))) + " " + ToString(right);
+        }
+        return str;
+    }
+}
+
+// The assignment if stmt consists of exactly one assignment statement, possibly in a block.
+AssignmentExpression* AsSingleAssignment(const Statement* stmt);
+
+// Calls fn on every full expression inside stmt: expression statements, return values and the
+// conditions of nested ifs and whiles.
+void ForEachExpression(Statement* stmt, const std::function<void(Expression*)>& fn);
+
+// Creates AST nodes for the optimizer. Every node is allocated from the given arena and
+// comes out already resolved, so it can be inserted after semantic analysis.
+class AstBuilder {
+  public:
+    explicit AstBuilder(ArenaAllocator& allocator) : m_Allocator(allocator) {}
+
+    Declaration* CreateTemporary(std::string_view prefix);
+
+    Primary* Var(const Declaration* decl);
+    Primary* Literal(int64_t value);
+
+    // Wraps a node into the chain of single-operand levels up to T.
+    template <typename T, typename Leaf>
+    T* Wrap(Leaf* leaf) {
+        if constexpr (std::is_same_v<T, Leaf>) {
+            return leaf;
+        } else {
+            return m_Allocator.alloc<T>(Wrap<OperandOf_t<T>>(leaf));
+        }
+    }
+
+    Expression* Assign(const Declaration* decl, EqualityExpression* value);
+    Expression* Value(EqualityExpression* value);
+
+    Statement* ExpressionStmt(Expression* expr);
+    BlockItem* Item(Statement* stmt);
+    BlockItem* Item(Declaration* decl);
+
+    template <typename T, typename... Args>
+    T* Make(Args&&... args) {
+        return m_Allocator.alloc<T>(std::forward<Args>(args)...);
+    }
+
+    using DeclarationMap = std::unordered_map<const Declaration*, const Declaration*>;
+
+    // Deep copy. Declarations inside the statement are duplicated and the uses inside the copy
+    // are resolved to the duplicates; uses of outer variables keep their declaration.
+    Statement* Clone(const Statement* stmt);
+    Expression* Clone(const Expression* expr);
+    // Deep copy in which the uses of the outer variables in renames are resolved to, and named
+    // after, the declarations they map to.
+    Block* CloneRenaming(const Block* block, DeclarationMap renames);
+
+  private:
+
+    Statement* Clone(const Statement* stmt, DeclarationMap& decls);
+    Statement* CloneHere(const Statement* stmt, DeclarationMap& decls); // on the current stack
+    Block* Clone(const Block* block, DeclarationMap& decls);
+    Expression* Clone(const Expression* expr, DeclarationMap& decls);
+    AssignmentExpression* Clone(const AssignmentExpression* expr, DeclarationMap& decls);
+    Primary* Clone(const Primary* primary, DeclarationMap& decls);
+    Subscript* Clone(const Subscript* element, DeclarationMap& decls);
+    PostfixExpression* Clone(const PostfixExpression* expr, DeclarationMap& decls);
+
+    template <typename T>
+    T* Clone(const T* expr, DeclarationMap& decls) {
+        T* copy = m_Allocator.alloc<T>(Clone(expr->Left, decls));
+        for (const auto& [op, right] : expr->Right) {
+            copy->Right.emplace_back(op, Clone(right, decls));
+        }
+        return copy;
+    }
+
+    ArenaAllocator& m_Allocator;
+    int m_TemporaryCount = 0;
+};
+
+} // namespace Compiler
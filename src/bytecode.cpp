@@ -0,0 +1,513 @@
+#include "bytecode.h"
+#include "ast_utils.h"
+#include "stack.h"
+#include "symbol_table.h"
+#include "utils.h"
+#include <algorithm>
+#include <array>
+#include <format>
+#include <unordered_map>
+
+namespace Compiler {
+
+namespace {
+
+constexpr std::array<std::string_view, static_cast<size_t>(Opcode::Count)> Names = { "loadi", "move", "ldel",
+    "stel", "chkidx", "add",
+    "sub", "mul", "div", "mod", "eq", "ne", "lt", "le", "gt", "ge", "addi", "subi", "muli", "divi", "modi", "eqi",
+    "nei", "lti", "lei", "gti", "gei", "jump", "jz", "jnz", "jeq", "jne", "jlt", "jle", "jgt", "jge", "jeqi",
+    "jnei", "jlti", "jlei", "jgti", "jgei", "decjnz", "call", "ret", "print", "exit", "halt" };
+
+Opcode Offset(Opcode base, int offset) {
+    return static_cast<Opcode>(static_cast<int>(base) + offset);
+}
+
+// Position of an operator in the runs of arithmetic and comparison opcodes.
+int Index(BinaryOp op) {
+    switch (op) {
+    case BinaryOp::Add: return 0;
+    case BinaryOp::Sub: return 1;
+    case BinaryOp::Mul: return 2;
+    case BinaryOp::Div: return 3;
+    case BinaryOp::Mod: return 4;
+    case BinaryOp::Eq: return 5;
+    case BinaryOp::Ne: return 6;
+    case BinaryOp::Lt: return 7;
+    case BinaryOp::Le: return 8;
+    case BinaryOp::Gt: return 9;
+    case BinaryOp::Ge: return 10;
+    }
+    Error("Unknown operator");
+}
+
+BinaryOp Negate(BinaryOp op) {
+    switch (op) {
+    case BinaryOp::Eq: return BinaryOp::Ne;
+    case BinaryOp::Ne: return BinaryOp::Eq;
+    case BinaryOp::Lt: return BinaryOp::Ge;
+    case BinaryOp::Le: return BinaryOp::Gt;
+    case BinaryOp::Gt: return BinaryOp::Le;
+    case BinaryOp::Ge: return BinaryOp::Lt;
+    default: Error("Unknown condition");
+    }
+}
+
+bool IsBranch(Opcode op) {
+    return op >= Opcode::Jump && op <= Opcode::DecJumpIfNotZero;
+}
+
+// True if the instruction holds the index of another, a branch target or a function entry.
+bool HasTarget(Opcode op) {
+    return IsBranch(op) || op == Opcode::Call;
+}
+
+bool HasImmediateOperand(Opcode op) {
+    return op >= Opcode::JumpIfEqI && op <= Opcode::JumpIfGeI;
+}
+
+// The instruction a jump goes to, held in C, or B if C holds an immediate.
+size_t TargetOf(const Instruction& inst) {
+    return static_cast<size_t>(HasImmediateOperand(inst.Op) ? inst.B : inst.C);
+}
+
+void SetTarget(Instruction& inst, size_t target) {
+    if (HasImmediateOperand(inst.Op)) {
+        inst.B = static_cast<int32_t>(target);
+    } else {
+        inst.C = static_cast<int64_t>(target);
+    }
+}
+
+// True if evaluating the expression assigns a variable.
+template <typename T>
+bool Assigns(const T* expr) {
+    if constexpr (std::is_same_v<T, Primary>) {
+        const Expression* e = nullptr;
+        if (const auto* group = std::get_if<Expression*>(&expr->Value)) {
+            e = *group;
+        } else if (const auto* element = std::get_if<Subscript*>(&expr->Value)) {
+            e = (*element)->Index;
+        }
+        return e && (e->Expr->Ident || e->Expr->Element || EnsureStack([&] { return Assigns(e->Expr->Expr); }));
+    } else if constexpr (std::is_same_v<T, PostfixExpression>) {
+        // a callee can't assign the caller's variables, but its arguments can
+        for (const auto& args : expr->CallList) {
+            for (const AssignmentExpression* arg : args) {
+                if (arg->Ident || arg->Element || EnsureStack([&] { return Assigns(arg->Expr); })) {
+                    return true;
+                }
+            }
+        }
+        return Assigns(expr->Prim);
+    } else {
+        if (Assigns(expr->Left)) {
+            return true;
+        }
+        for (const auto& [op, right] : expr->Right) {
+            if (Assigns(right)) {
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+} // namespace
+
+std::string ToString(const Chunk& chunk) {
+    std::string text = std::format("; {} registers\n", chunk.RegisterCount);
+    for (size_t i = 0; i < chunk.Code.size(); ++i) {
+        const Instruction& inst = chunk.Code[i];
+        const std::string_view name = Names[static_cast<size_t>(inst.Op)];
+        switch (inst.Op) {
+        case Opcode::LoadI: text += std::format("{:>5}  {} r{}, {}\n", i, name, inst.A, inst.C); break;
+        case Opcode::Move: text += std::format("{:>5}  {} r{}, r{}\n", i, name, inst.A, inst.B); break;
+        case Opcode::LoadElement:
+            text += std::format("{:>5}  {} r{}, r{}[r{}]\n", i, name, inst.A, inst.C, inst.B);
+            break;
+        case Opcode::StoreElement:
+            text += std::format("{:>5}  {} r{}[r{}], r{}\n", i, name, inst.C, inst.B, inst.A);
+            break;
+        case Opcode::CheckIndex: text += std::format("{:>5}  {} r{}, {}\n", i, name, inst.A, inst.C); break;
+        case Opcode::Jump: text += std::format("{:>5}  {} @{}\n", i, name, inst.C); break;
+        case Opcode::JumpIfZero:
+        case Opcode::JumpIfNotZero: text += std::format("{:>5}  {} r{}, @{}\n", i, name, inst.A, inst.C); break;
+        case Opcode::DecJumpIfNotZero:
+            text += std::format("{:>5}  {} r{}{}, @{}\n", i, name, inst.A, inst.B ? " print" : "", inst.C);
+            break;
+        case Opcode::Call:
+            text += std::format("{:>5}  {} r{}, r{}, @{}, {}\n", i, name, inst.A, inst.B, inst.C, inst.D);
+            break;
+        case Opcode::Return:
+        case Opcode::Print:
+        case Opcode::Exit: text += std::format("{:>5}  {} r{}\n", i, name, inst.A); break;
+        case Opcode::Halt: text += std::format("{:>5}  {}\n", i, name); break;
+        default:
+            if (inst.Op >= Opcode::JumpIfEqI) {
+                text += std::format("{:>5}  {} r{}, {}, @{}\n", i, name, inst.A, inst.C, inst.B);
+            } else if (inst.Op >= Opcode::JumpIfEq) {
+                text += std::format("{:>5}  {} r{}, r{}, @{}\n", i, name, inst.A, inst.B, inst.C);
+            } else if (inst.Op >= Opcode::AddI) {
+                text += std::format("{:>5}  {} r{}, r{}, {}\n", i, name, inst.A, inst.B, inst.C);
+            } else {
+                text += std::format("{:>5}  {} r{}, r{}, r{}\n", i, name, inst.A, inst.B, inst.C);
+            }
+        }
+    }
+    return text;
+}
+
+BytecodeGenerator::BytecodeGenerator(Program* prog, ScopeStack& scopes) : m_Program(prog), m_Scopes(scopes) {}
+
+Chunk BytecodeGenerator::Generate() {
+    m_Chunk = Chunk();
+    m_Variables = m_NextRegister = 0;
+    m_Calls.clear();
+
+    m_InFunction = false;
+    m_Parameters = 0;
+    GenerateBlock(m_Program->GlobalBlock);
+    Emit(Opcode::Halt);
+
+    std::unordered_map<const FunctionDefinition*, size_t> entries;
+    for (const FunctionDefinition* function : m_Program->Functions) {
+        entries[function] = m_Chunk.Code.size();
+        GenerateFunction(function);
+    }
+    for (const auto& [call, callee] : m_Calls) {
+        m_Chunk.Code[call].C = static_cast<int64_t>(entries.at(callee));
+    }
+    Fuse();
+
+    return std::move(m_Chunk);
+}
+
+size_t BytecodeGenerator::Emit(Opcode op, int32_t a, int32_t b, int64_t c) {
+    m_Chunk.Code.push_back({ op, a, b, c });
+    return m_Chunk.Code.size() - 1;
+}
+
+void BytecodeGenerator::Patch(size_t jump, size_t target) {
+    SetTarget(m_Chunk.Code[jump], target);
+}
+
+int32_t BytecodeGenerator::Temporary(int32_t count) {
+    const int32_t reg = m_NextRegister;
+    m_NextRegister += count;
+    m_Chunk.RegisterCount = std::max(m_Chunk.RegisterCount, m_NextRegister);
+    return reg;
+}
+
+void BytecodeGenerator::GenerateFunction(const FunctionDefinition* function) {
+    m_InFunction = true;
+    m_Parameters = static_cast<int32_t>(function->Params.size());
+    m_Variables = m_NextRegister = 0;
+    m_Scopes.EnterScope();
+    for (const Declaration* param : function->Params) {
+        m_Scopes.Insert(param->Ident, { VARIABLE, Temporary(), param });
+    }
+    m_Variables = m_NextRegister;
+    GenerateBlock(function->Body);
+    m_Scopes.ExitScope();
+
+    // falling off the end returns 0
+    const int32_t zero = Temporary();
+    Emit(Opcode::LoadI, zero, 0, 0);
+    Emit(Opcode::Return, zero);
+}
+
+void BytecodeGenerator::GenerateBlock(const Block* scope) {
+    m_Scopes.EnterScope();
+    const int32_t variablesBefore = m_Variables;
+
+    for (const auto& item : scope->Items) {
+        std::visit(overloaded{ [&](const Statement* stmt) { GenerateStatement(stmt); },
+                       [&](const Declaration* decl) {
+                           const auto count = static_cast<int32_t>(std::max<int64_t>(decl->Size, 1));
+                           m_Scopes.Insert(decl->Ident, { VARIABLE, Temporary(count), decl });
+                           m_Variables = m_NextRegister;
+                       } },
+            item->Item);
+    }
+
+    m_Scopes.ExitScope();
+    m_Variables = m_NextRegister = variablesBefore;
+}
+
+void BytecodeGenerator::GenerateStatement(const Statement* stmt) {
+    EnsureStack([&] { GenerateStatementHere(stmt); });
+}
+
+void BytecodeGenerator::GenerateStatementHere(const Statement* stmt) {
+    std::visit(overloaded{ [&](const ExpressionStatement* exprStmt) { Lower(exprStmt->Expr); },
+                   [&](const ReturnStatement* retStmt) {
+                       if (!m_InFunction) {
+                           if (retStmt->Expr) {
+                               Emit(Opcode::Exit, Lower(retStmt->Expr));
+                           } else {
+                               Emit(Opcode::Halt);
+                           }
+                           return;
+                       }
+                       int32_t value;
+                       if (retStmt->Expr) {
+                           value = Lower(retStmt->Expr);
+                       } else {
+                           value = Temporary();
+                           Emit(Opcode::LoadI, value, 0, 0);
+                       }
+                       Emit(Opcode::Return, value);
+                   },
+                   [&](const IfStatement* ifStmt) {
+                       // a select is an ordinary if here: a branch is as cheap as anything else
+                       const size_t toElse = GenerateBranch(ifStmt->Cond, false);
+                       GenerateStatement(ifStmt->Then);
+                       if (ifStmt->Else) {
+                           const size_t toEnd = Emit(Opcode::Jump);
+                           Patch(toElse, m_Chunk.Code.size());
+                           GenerateStatement(ifStmt->Else);
+                           Patch(toEnd, m_Chunk.Code.size());
+                       } else {
+                           Patch(toElse, m_Chunk.Code.size());
+                       }
+                   },
+                   [&](const WhileStatement* whileStmt) {
+                       if (whileStmt->Rotated) {
+                           const size_t toEnd = GenerateBranch(whileStmt->Cond, false);
+                           const size_t start = m_Chunk.Code.size();
+                           GenerateStatement(whileStmt->Loop);
+                           Patch(GenerateBranch(whileStmt->Cond, true), start);
+                           Patch(toEnd, m_Chunk.Code.size());
+                           return;
+                       }
+
+                       const size_t start = m_Chunk.Code.size();
+                       const size_t toEnd = GenerateBranch(whileStmt->Cond, false);
+                       GenerateStatement(whileStmt->Loop);
+                       Emit(Opcode::Jump, 0, 0, static_cast<int64_t>(start));
+                       Patch(toEnd, m_Chunk.Code.size());
+                   },
+                   [&](const Block* scope) { GenerateBlock(scope); } },
+        stmt->Stmt);
+
+    // temporaries live within a statement
+    m_NextRegister = m_Variables;
+}
+
+size_t BytecodeGenerator::GenerateBranch(const Expression* cond, bool jumpIf) {
+    const AssignmentExpression* assign = cond->Expr;
+    const EqualityExpression* equality = assign->Expr;
+    size_t jump;
+    if (assign->Ident || assign->Element) {
+        jump = Emit(jumpIf ? Opcode::JumpIfNotZero : Opcode::JumpIfZero, Lower(cond));
+    } else if (equality->Right.size() == 1) {
+        jump = GenerateCompare(equality->Right[0].first, equality->Left, equality->Right[0].second, jumpIf);
+    } else if (equality->Right.empty() && equality->Left->Right.size() == 1) {
+        const RelationalExpression* relational = equality->Left;
+        jump =
+            GenerateCompare(relational->Right[0].first, relational->Left, relational->Right[0].second, jumpIf);
+    } else {
+        jump = Emit(jumpIf ? Opcode::JumpIfNotZero : Opcode::JumpIfZero, Lower(cond));
+    }
+    m_NextRegister = m_Variables;
+    return jump;
+}
+
+template <typename T>
+size_t BytecodeGenerator::GenerateCompare(BinaryOp op, const T* left, const T* right, bool jumpIf) {
+    if (!jumpIf) {
+        op = Negate(op);
+    }
+    const int32_t a = Protect(Lower(left), right);
+    if (const auto literal = AsLiteral(right)) {
+        if (*literal == 0 && (op == BinaryOp::Eq || op == BinaryOp::Ne)) {
+            return Emit(op == BinaryOp::Ne ? Opcode::JumpIfNotZero : Opcode::JumpIfZero, a);
+        }
+        return Emit(Offset(Opcode::JumpIfEqI, Index(op) - Index(BinaryOp::Eq)), a, 0, *literal);
+    }
+    return Emit(Offset(Opcode::JumpIfEq, Index(op) - Index(BinaryOp::Eq)), a, Lower(right));
+}
+
+template <typename T>
+int32_t BytecodeGenerator::Protect(int32_t left, const T* right) {
+    if (IsTemporary(left) || !Assigns(right)) {
+        return left;
+    }
+    const int32_t copy = Temporary();
+    Emit(Opcode::Move, copy, left);
+    return copy;
+}
+
+int32_t BytecodeGenerator::Lower(const Expression* expr, std::optional<int32_t> dest) {
+    return EnsureStack([&] { return Lower(expr->Expr, dest); });
+}
+
+int32_t BytecodeGenerator::Lower(const AssignmentExpression* expr, std::optional<int32_t> dest) {
+    const Subscript* element = expr->Element;
+    const auto constantIndex = element ? ConstantIndex(element) : std::nullopt;
+    if (element && !constantIndex) {
+        const auto base = m_Scopes.Lookup(element->Ident).StackOffset;
+        const int32_t index = Protect(Lower(element->Index), expr->Expr);
+        // not computed into dest, which may be the index
+        const int32_t value = Lower(expr->Expr);
+        Emit(Opcode::CheckIndex, index, 0, element->Decl->Size);
+        Emit(Opcode::StoreElement, value, index, base);
+        if (dest && *dest != value) {
+            Emit(Opcode::Move, *dest, value);
+            return *dest;
+        }
+        return value;
+    }
+    if (!expr->Ident && !element) {
+        return Lower(expr->Expr, dest);
+    }
+
+    const int32_t var = element ? Element(element->Ident, *constantIndex) : Variable(*expr->Ident);
+    const int32_t value = Lower(expr->Expr, var);
+    if (value != var) {
+        Emit(Opcode::Move, var, value);
+    }
+    if (!element && !expr->Decl->Synthetic) {
+        Emit(Opcode::Print, var);
+    }
+    if (dest && *dest != var) {
+        Emit(Opcode::Move, *dest, var);
+        return *dest;
+    }
+    return var;
+}
+
+int32_t BytecodeGenerator::Lower(const Primary* primary, std::optional<int32_t> dest) {
+    return std::visit(overloaded{ [&](int64_t value) {
+                                     const int32_t reg = dest ? *dest : Temporary();
+                                     Emit(Opcode::LoadI, reg, 0, value);
+                                     return reg;
+                                 },
+                          [&](const std::string& name) {
+                              const int32_t reg = Variable(name);
+                              if (dest && *dest != reg) {
+                                  Emit(Opcode::Move, *dest, reg);
+                                  return *dest;
+                              }
+                              return reg;
+                          },
+                          [&](const Expression* e) { return Lower(e, dest); },
+                          [&](const Subscript* element) {
+                              if (const auto index = ConstantIndex(element)) {
+                                  const int32_t reg = Element(element->Ident, *index);
+                                  if (dest && *dest != reg) {
+                                      Emit(Opcode::Move, *dest, reg);
+                                      return *dest;
+                                  }
+                                  return reg;
+                              }
+                              const int32_t index = Lower(element->Index);
+                              Emit(Opcode::CheckIndex, index, 0, element->Decl->Size);
+                              const int32_t reg = dest ? *dest : Temporary();
+                              Emit(Opcode::LoadElement, reg, index, m_Scopes.Lookup(element->Ident).StackOffset);
+                              return reg;
+                          } },
+        primary->Value);
+}
+
+int32_t BytecodeGenerator::Variable(const std::string& name) const {
+    return static_cast<int32_t>(m_Scopes.Lookup(name).StackOffset);
+}
+
+int32_t BytecodeGenerator::Element(const std::string& array, int64_t index) const {
+    return Variable(array) + static_cast<int32_t>(index);
+}
+
+int32_t BytecodeGenerator::Lower(const PostfixExpression* expr, std::optional<int32_t> dest) {
+    if (!expr->Callee) {
+        return Lower(expr->Prim, dest);
+    }
+
+    // the arguments go above every register in use, so the callee's frame clobbers none of them
+    const auto& args = expr->CallList.front();
+    const int32_t first = m_NextRegister;
+    for (size_t i = 0; i < args.size(); ++i) {
+        Temporary();
+    }
+    for (size_t i = 0; i < args.size(); ++i) {
+        const auto reg = first + static_cast<int32_t>(i);
+        const int32_t value = EnsureStack([&] { return Lower(args[i], reg); });
+        if (value != reg) {
+            Emit(Opcode::Move, reg, value);
+        }
+    }
+    const int32_t result = dest ? *dest : Temporary();
+    const size_t call = Emit(Opcode::Call, result, first);
+    const auto count = static_cast<int32_t>(args.size());
+    const int32_t stackArgs = std::max(count - 6, 0);
+    m_Chunk.Code[call].D = (m_Variables + stackArgs + 1) / 2 * 16 - m_Parameters * 8 + 16 + count * 8;
+    m_Calls.emplace_back(call, expr->Callee);
+    return result;
+}
+
+template <typename T>
+int32_t BytecodeGenerator::Lower(const T* expr, std::optional<int32_t> dest) {
+    if (expr->Right.empty()) {
+        return Lower(expr->Left, dest);
+    }
+
+    // only the last operation writes dest: the operands may still read the variable it names
+    int32_t left = Lower(expr->Left);
+    for (size_t i = 0; i < expr->Right.size(); ++i) {
+        const auto& [op, right] = expr->Right[i];
+        left = Protect(left, right);
+        const int32_t result = dest && i + 1 == expr->Right.size() ? *dest
+                               : IsTemporary(left)                  ? left
+                                                                    : Temporary();
+        if (const auto literal = AsLiteral(right)) {
+            Emit(Offset(Opcode::AddI, Index(op)), result, left, *literal);
+        } else {
+            Emit(Offset(Opcode::Add, Index(op)), result, left, Lower(right));
+        }
+        left = result;
+    }
+    return left;
+}
+
+void BytecodeGenerator::Fuse() {
+    std::vector<Instruction>& code = m_Chunk.Code;
+    std::vector<bool> targeted(code.size() + 1);
+    for (const Instruction& inst : code) {
+        if (HasTarget(inst.Op)) {
+            targeted[TargetOf(inst)] = true;
+        }
+    }
+
+    // decrement [print] jnz, with nothing jumping into the middle, becomes one decjnz
+    std::vector<size_t> index(code.size() + 1);
+    std::vector<Instruction> fused;
+    for (size_t i = 0; i < code.size(); ++i) {
+        index[i] = fused.size();
+        const Instruction& dec = code[i];
+        const bool decrement = (dec.Op == Opcode::SubI && dec.C == 1) || (dec.Op == Opcode::AddI && dec.C == -1);
+        if (decrement && dec.A == dec.B) {
+            const bool print = i + 1 < code.size() && code[i + 1].Op == Opcode::Print && code[i + 1].A == dec.A;
+            const size_t test = i + 1 + print;
+            if (test < code.size() && code[test].Op == Opcode::JumpIfNotZero && code[test].A == dec.A &&
+                !targeted[i + 1] && !targeted[test]) {
+                fused.push_back({ Opcode::DecJumpIfNotZero, dec.A, print, code[test].C });
+                for (size_t j = i + 1; j <= test; ++j) {
+                    index[j] = fused.size() - 1;
+                }
+                i = test;
+                continue;
+            }
+        }
+        fused.push_back(dec);
+    }
+    index[code.size()] = fused.size();
+
+    for (Instruction& inst : fused) {
+        if (HasTarget(inst.Op)) {
+            SetTarget(inst, index[TargetOf(inst)]);
+        }
+    }
+    code = std::move(fused);
+}
+
+} // namespace Compiler
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "ast.h"
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Compiler {
+
+class ScopeStack;
+
+// The operations of the register bytecode. A, B and C name registers unless stated otherwise;
+// the I forms take an immediate and the jumps an instruction index.
+enum class Opcode : uint8_t {
+    LoadI, // A = C
+    Move,  // A = B
+    // the arrays' elements are consecutive registers, the first at immediate C
+    LoadElement,  // A = element B of C
+    StoreElement, // element B of C = A
+    CheckIndex,   // trap unless 0 <= A < immediate C
+    // A = B op C
+    Add,
+    Sub,
+    Mul,
+    Div,
+    Mod,
+    Eq,
+    Ne,
+    Lt,
+    Le,
+    Gt,
+    Ge,
+    // A = B op immediate C
+    AddI,
+    SubI,
+    MulI,
+    DivI,
+    ModI,
+    EqI,
+    NeI,
+    LtI,
+    LeI,
+    GtI,
+    GeI,
+    Jump,          // goto C
+    JumpIfZero,    // if A == 0 goto C
+    JumpIfNotZero, // if A != 0 goto C
+    // superinstructions: compare and branch, decrement and test
+    JumpIfEq, // if A op B goto C
+    JumpIfNe,
+    JumpIfLt,
+    JumpIfLe,
+    JumpIfGt,
+    JumpIfGe,
+    JumpIfEqI, // if A op immediate C goto B
+    JumpIfNeI,
+    JumpIfLtI,
+    JumpIfLeI,
+    JumpIfGtI,
+    JumpIfGeI,
+    DecJumpIfNotZero, // A = A - 1, printed if B is set; if A != 0 goto C
+    Call,             // A = the function at C, its registers starting at B, where its arguments are;
+                      // immediate D is the stack the native call takes, see BytecodeGenerator
+    Return,           // return A to the caller
+    Print,            // print A
+    Exit,             // exit with status A
+    Halt,             // exit with status 0
+    Count
+};
+
+struct Instruction {
+    Opcode Op;
+    int32_t A = 0;
+    int32_t B = 0;
+    int64_t C = 0;
+    int32_t D = 0;
+};
+
+struct Chunk {
+    std::vector<Instruction> Code;
+    int32_t RegisterCount = 0;
+};
+
+// A listing of the chunk, one instruction per line.
+std::string ToString(const Chunk& chunk);
+
+// Lowers the program to register bytecode, an alternative to the Generator's assembly run by
+// RunBytecode. Every variable gets a register of its own for the lifetime of its block, an array
+// one per element, and
+// expressions compute into temporaries above the variables' registers, reused by the next
+// statement. Comparisons feeding a branch become a single compare-and-branch, and a decrement
+// followed by a test of the result for zero, as at the bottom of a counting loop, a single
+// decrement-and-branch.
+//
+// Functions follow the main program. A call passes its arguments in consecutive registers above
+// every register in use, which become the first registers of the callee, its parameters. It also
+// records the bytes the native call adds to the stack by the time the callee has stored its
+// parameters: the caller's frame at that point, a slot per parameter, variable in scope and
+// argument passed on the stack rounded up to 16 bytes, less the parameters' slots, charged by the
+// call to it; the return address; the saved frame pointer; and the callee's parameters' slots.
+// Temporaries the native code spills and the stack print takes are not counted, so the depth at
+// which deep recursion faults can differ by a few frames.
+class BytecodeGenerator {
+  public:
+    BytecodeGenerator(Program* prog, ScopeStack& scopes);
+    Chunk Generate();
+
+  private:
+    void GenerateFunction(const FunctionDefinition* function);
+    void GenerateBlock(const Block* block);
+    void GenerateStatement(const Statement* stmt);
+    void GenerateStatementHere(const Statement* stmt); // on the current stack
+    // emits a jump to be patched, taken if cond is nonzero (jumpIf) or zero; returns its index
+    size_t GenerateBranch(const Expression* cond, bool jumpIf);
+    template <typename T>
+    size_t GenerateCompare(BinaryOp op, const T* left, const T* right, bool jumpIf);
+
+    // computes expr into dest, if given, or any register; returns the register
+    int32_t Lower(const Expression* expr, std::optional<int32_t> dest = std::nullopt);
+    int32_t Lower(const AssignmentExpression* expr, std::optional<int32_t> dest = std::nullopt);
+    int32_t Lower(const Primary* primary, std::optional<int32_t> dest = std::nullopt);
+    int32_t Lower(const PostfixExpression* expr, std::optional<int32_t> dest = std::nullopt);
+    template <typename T>
+    int32_t Lower(const T* expr, std::optional<int32_t> dest = std::nullopt);
+    // a register the right operand can't change, left or a copy of it
+    template <typename T>
+    int32_t Protect(int32_t left, const T* right);
+
+    int32_t Variable(const std::string& name) const;                 // its register
+    int32_t Element(const std::string& array, int64_t index) const; // the register of a constant one
+    int32_t Temporary(int32_t count = 1); // the first of count consecutive registers
+    bool IsTemporary(int32_t reg) const { return reg >= m_Variables; }
+    size_t Emit(Opcode op, int32_t a = 0, int32_t b = 0, int64_t c = 0);
+    void Patch(size_t jump, size_t target);
+    void Fuse();
+
+    const Program* m_Program;
+    ScopeStack& m_Scopes;
+    Chunk m_Chunk;
+    int32_t m_Variables = 0; // registers [0, m_Variables) hold the variables in scope
+    int32_t m_NextRegister = 0;
+    bool m_InFunction = false;
+    int32_t m_Parameters = 0; // of the function being lowered
+    std::vector<std::pair<size_t, const FunctionDefinition*>> m_Calls; // patched with the entries
+};
+
+} // namespace Compiler
@@ -0,0 +1,205 @@
+#include "cache.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <unistd.h>
+#include <vector>
+
+namespace Compiler {
+
+namespace {
+
+constexpr uint64_t Prime1 = 0x9E3779B185EBCA87;
+constexpr uint64_t Prime2 = 0xC2B2AE3D27D4EB4F;
+constexpr uint64_t Prime3 = 0x165667B19E3779F9;
+
+// Spreads every bit of h over all the others (MurmurHash3's finalizer).
+uint64_t Avalanche(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCD;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53;
+    h ^= h >> 33;
+    return h;
+}
+
+// Reads the whole file in one go.
+bool ReadFile(const std::filesystem::path& path, std::string& contents) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        return false;
+    }
+    contents.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(contents.data(), static_cast<std::streamsize>(contents.size()));
+    return static_cast<bool>(file);
+}
+
+// True if name is length lowercase hexadecimal digits, as the digests name entries.
+bool IsHex(std::string_view name, size_t length) {
+    return name.size() == length &&
+           std::ranges::all_of(name, [](char c) { return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'); });
+}
+
+// Temporary files older than this were left behind by a compiler that died while writing.
+constexpr auto AbandonedAfter = std::chrono::hours(1);
+
+} // namespace
+
+Digest Digest::Of(std::string_view data) {
+    // two lanes of 64 bits, each mixing in the input a word at a time
+    uint64_t a = Prime1 ^ data.size();
+    uint64_t b = Prime2 + data.size();
+    auto mix = [&](uint64_t word) {
+        a = std::rotl(a ^ word * Prime2, 31) * Prime1;
+        b = std::rotl(b + word * Prime3, 27) * Prime2 + a;
+    };
+
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= data.size(); i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data.data() + i, sizeof(word));
+        mix(word);
+    }
+    // memcpy from the null data() of an empty view is undefined, even for no bytes
+    uint64_t tail = 0;
+    if (i < data.size()) {
+        std::memcpy(&tail, data.data() + i, data.size() - i);
+    }
+    mix(tail);
+
+    return { Avalanche(a + b), Avalanche(b ^ std::rotl(a, 17)) };
+}
+
+std::string Digest::ToHex() const {
+    return std::format("{:016x}{:016x}", High, Low);
+}
+
+const Digest& CompilerIdentity() {
+    static const Digest identity = [] {
+        std::string contents;
+        if (!ReadFile("/proc/self/exe", contents) || contents.empty()) {
+            // no way to read the executable: fall back to when this file was compiled
+            contents = __DATE__ " " __TIME__;
+        }
+        return Digest::Of(contents);
+    }();
+    return identity;
+}
+
+CompileCache::CompileCache(std::filesystem::path directory, uintmax_t budget)
+    : m_Directory(std::move(directory)), m_Budget(budget) {}
+
+std::filesystem::path CompileCache::Path(const Digest& key) const {
+    // fanned out over 256 subdirectories, so none grows too large
+    const std::string name = key.ToHex();
+    return m_Directory / name.substr(0, 2) / name.substr(2);
+}
+
+std::optional<std::string> CompileCache::Load(const Digest& key) const {
+    const std::filesystem::path path = Path(key);
+    std::string contents;
+    if (!ReadFile(path, contents)) {
+        return std::nullopt;
+    }
+
+    // marks the entry as recently used; it may have been evicted since it was opened
+    std::error_code ec;
+    std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+    return contents;
+}
+
+void CompileCache::Store(const Digest& key, std::string_view contents) const {
+    static std::atomic<uint64_t> count = 0;
+
+    const std::filesystem::path path = Path(key);
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+
+    std::filesystem::path temporary = path;
+    temporary += std::format(".{}.{}.tmp", getpid(), count++);
+    std::ofstream file(temporary, std::ios::binary);
+    file.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+    file.close();
+    // another compiler storing the same entry meanwhile wrote the same contents, so whichever
+    // rename comes last wins harmlessly
+    if (!file || (std::filesystem::rename(temporary, path, ec), ec)) {
+        std::filesystem::remove(temporary, ec);
+        return;
+    }
+
+    // the directory is scanned once, on the first store, then only when its size as estimated
+    // from the stores since exceeds the budget; the other processes' stores count at that point
+    std::lock_guard lock(m_Mutex);
+    if (!m_Size) {
+        m_Size = Evict(m_Budget);
+    } else if ((*m_Size += contents.size()) > m_Budget) {
+        // evicting to below the budget leaves room for a while before the next scan
+        m_Size = Evict(m_Budget / 4 * 3);
+    }
+}
+
+uintmax_t CompileCache::Evict(uintmax_t target) const {
+    struct Entry {
+        std::filesystem::path Path;
+        uintmax_t Size;
+        std::filesystem::file_time_type Time;
+    };
+    std::vector<Entry> entries;
+    uintmax_t total = 0;
+
+    const auto now = std::filesystem::file_time_type::clock::now();
+    std::error_code ec;
+    // only the files laid out as Path and Store name them are looked at: the directory may hold
+    // others, which are not the cache's to delete
+    for (auto dir = std::filesystem::directory_iterator(m_Directory, ec);
+         !ec && dir != std::filesystem::directory_iterator(); dir.increment(ec)) {
+        std::error_code dirError;
+        if (!IsHex(dir->path().filename().string(), 2) || !dir->is_directory(dirError)) {
+            continue;
+        }
+        for (auto it = std::filesystem::directory_iterator(dir->path(), dirError);
+             !dirError && it != std::filesystem::directory_iterator(); it.increment(dirError)) {
+            // entries may be evicted by other processes while this one looks at them
+            const std::string name = it->path().filename().string();
+            const bool temporary = name.ends_with(".tmp") && name.size() > 32 && name[30] == '.' &&
+                                   IsHex(std::string_view(name).substr(0, 30), 30);
+            std::error_code entryError;
+            if ((!temporary && !IsHex(name, 30)) || !it->is_regular_file(entryError)) {
+                continue;
+            }
+            const uintmax_t size = it->file_size(entryError);
+            const auto time = it->last_write_time(entryError);
+            if (entryError) {
+                continue;
+            }
+            if (temporary) {
+                if (now - time > AbandonedAfter) {
+                    std::filesystem::remove(it->path(), entryError);
+                }
+                continue;
+            }
+            entries.push_back({ it->path(), size, time });
+            total += size;
+        }
+    }
+    if (total <= target) {
+        return total;
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.Time < b.Time; });
+    for (const Entry& entry : entries) {
+        if (total <= target) {
+            break;
+        }
+        std::filesystem::remove(entry.Path, ec);
+        total -= entry.Size;
+    }
+    return total;
+}
+
+} // namespace Compiler
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace Compiler {
+
+// A 128-bit hash of some bytes. Not cryptographic, but fast and wide enough that distinct inputs
+// don't collide in practice.
+struct Digest {
+    uint64_t High = 0;
+    uint64_t Low = 0;
+
+    static Digest Of(std::string_view data);
+    std::string ToHex() const;
+    bool operator==(const Digest&) const = default;
+};
+
+// Identifies the running compiler: a digest of its executable, so a rebuilt compiler never
+// reuses what an older one cached.
+const Digest& CompilerIdentity();
+
+// Content-addressed store of compiler outputs in a directory, shared by any number of
+// compilers, threads and processes at once. An entry is named by the digest of everything that
+// determines the output (the compiler, the options and the source), so it is never stale and
+// never updated, only added and evicted. Entries are written under a temporary name and renamed
+// into place, so readers see them whole or not at all. Reading an entry touches its
+// modification time, and once the directory outgrows the budget the entries least recently used
+// are evicted. Files in the directory not named as entries are left alone.
+class CompileCache {
+  public:
+    CompileCache(std::filesystem::path directory, uintmax_t budget);
+
+    std::optional<std::string> Load(const Digest& key) const;
+    // failures are ignored: the cache is only an optimization
+    void Store(const Digest& key, std::string_view contents) const;
+
+  private:
+    std::filesystem::path Path(const Digest& key) const;
+    // evicts the least recently used entries until at most target bytes are left; returns the size
+    uintmax_t Evict(uintmax_t target) const;
+
+    std::filesystem::path m_Directory;
+    uintmax_t m_Budget;
+    mutable std::mutex m_Mutex;
+    mutable std::optional<uintmax_t> m_Size; // as last scanned, plus what was stored since
+};
+
+} // namespace Compiler
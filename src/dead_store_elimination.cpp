@@ -0,0 +1,303 @@
+#include "dead_store_elimination.h"
+#include "ast_utils.h"
+#include "remarks.h"
+#include "stack.h"
+#include <algorithm>
+#include <format>
+
+namespace Compiler {
+
+namespace {
+
+// True if expr reads var, or an element of it if it is an array.
+template <typename T>
+bool Reads(const T* expr, const Declaration* var) {
+    if constexpr (std::is_same_v<T, Primary>) {
+        return std::visit(overloaded{ [&](int64_t) { return false; },
+                              [&](const std::string&) { return expr->Decl == var; },
+                              [&](const Expression* e) { return EnsureStack([&] { return Reads(e->Expr, var); }); },
+                              [&](const Subscript* s) {
+                                  return s->Decl == var || EnsureStack([&] { return Reads(s->Index->Expr, var); });
+                              } },
+            expr->Value);
+    } else if constexpr (std::is_same_v<T, PostfixExpression>) {
+        return Reads(expr->Prim, var) || std::ranges::any_of(expr->CallList, [&](const auto& args) {
+            return std::ranges::any_of(args, [&](const AssignmentExpression* arg) { return Reads(arg, var); });
+        });
+    } else if constexpr (std::is_same_v<T, AssignmentExpression>) {
+        return (expr->Element && Reads(expr->Element->Index->Expr, var)) || Reads(expr->Expr, var);
+    } else {
+        return Reads(expr->Left, var) ||
+               std::ranges::any_of(expr->Right, [&](const auto& right) { return Reads(right.second, var); });
+    }
+}
+
+const Declaration* Target(const AssignmentExpression* assign) {
+    return assign->Element ? assign->Element->Decl : assign->Decl;
+}
+
+std::string TargetName(const AssignmentExpression* assign) {
+    return assign->Element ? ToString(assign->Element) : *assign->Ident;
+}
+
+} // namespace
+
+DeadStoreElimination::DeadStoreElimination(Block* body, Remarks& remarks) : m_Body(body), m_Remarks(remarks) {}
+
+void DeadStoreElimination::Run() {
+    // removing a statement may leave unread what its value read, so the stores are found again
+    // until that settles, a bounded number of times; the remarks on the ones kept are of the last
+    constexpr int MaxRounds = 8;
+    for (int round = 0; round < MaxRounds; round++) {
+        m_Reads.clear();
+        m_Stores.clear();
+        m_Kept.clear();
+        VisitBlock(m_Body);
+        if (!Eliminate()) {
+            break;
+        }
+    }
+    for (size_t i = 0; i < m_Kept.size(); i++) {
+        // once for the copies of a statement unrolling made
+        const auto& [loc, message] = m_Kept[i];
+        const auto& [lastLoc, lastMessage] = m_Kept[i ? i - 1 : 0];
+        if (i == 0 || loc.Line != lastLoc.Line || loc.Column != lastLoc.Column || message != lastMessage) {
+            m_Remarks.Missed("dse", loc, message);
+        }
+    }
+}
+
+void DeadStoreElimination::VisitPrimary(Primary* primary) {
+    std::visit(overloaded{ [&](int64_t) {},
+                   [&](std::string&) { CountRead(primary->Decl, nullptr); },
+                   [&](Expression* e) { VisitExpression(e); },
+                   [&](Subscript* s) {
+                       CountRead(s->Decl, s);
+                       VisitExpression(s->Index);
+                   } },
+        primary->Value);
+}
+
+void DeadStoreElimination::CountRead(const Declaration* var, const Subscript* element) {
+    m_Reads[var]++;
+    if (m_Visiting.empty()) {
+        return;
+    }
+    // a value stored back to the variable or element it was read from, noted so that the read can
+    // be discounted if the store is removed with its statement
+    Store& store = m_Stores[m_Visiting.back()];
+    if (Target(store.Assign) != var) {
+        return;
+    }
+    if (element) {
+        const auto index = ConstantIndex(element);
+        if (!index || !store.Assign->Element || ConstantIndex(store.Assign->Element) != index) {
+            return;
+        }
+    }
+    store.SelfReads++;
+}
+
+void DeadStoreElimination::VisitPostfixExpression(PostfixExpression* expr) {
+    VisitPrimary(expr->Prim);
+    for (const auto& args : expr->CallList) {
+        for (auto* arg : args) {
+            VisitAssignmentExpression(arg);
+        }
+    }
+}
+
+template <typename T>
+void DeadStoreElimination::VisitChain(T* expr) {
+    if constexpr (std::is_same_v<T, PostfixExpression>) {
+        VisitPostfixExpression(expr);
+    } else {
+        VisitChain(expr->Left);
+        for (auto& [op, right] : expr->Right) {
+            VisitChain(right);
+        }
+    }
+}
+
+void DeadStoreElimination::VisitAssignmentExpression(AssignmentExpression* expr) {
+    if (!expr->Ident && !expr->Element) {
+        EnsureStack([&] { VisitChain(expr->Expr); });
+        return;
+    }
+
+    Store store{ expr, m_Loc };
+    store.Kept = m_Keep;
+    if (expr == m_Whole) {
+        store.Parent = m_Parent;
+        store.Index = m_Index;
+    }
+    m_Stores.push_back(store);
+
+    if (expr->Element) {
+        EnsureStack([&] { VisitExpression(expr->Element->Index); });
+    }
+    m_Visiting.push_back(m_Stores.size() - 1);
+    EnsureStack([&] { VisitChain(expr->Expr); });
+    m_Visiting.pop_back();
+}
+
+void DeadStoreElimination::VisitExpression(Expression* expr) {
+    VisitAssignmentExpression(expr->Expr);
+}
+
+void DeadStoreElimination::VisitBlock(Block* block) {
+    for (size_t i = 0; i < block->Items.size(); i++) {
+        auto* stmt = std::get_if<Statement*>(&block->Items[i]->Item);
+        if (!stmt) {
+            continue;
+        }
+        if (auto* exprStmt = std::get_if<ExpressionStatement*>(&(*stmt)->Stmt)) {
+            m_Whole = (*exprStmt)->Expr->Expr;
+            m_Parent = block;
+            m_Index = i;
+        }
+        VisitStatement(*stmt);
+    }
+}
+
+void DeadStoreElimination::VisitStatement(Statement* stmt) {
+    EnsureStack([&] { VisitStatementHere(stmt); });
+}
+
+void DeadStoreElimination::VisitStatementHere(Statement* stmt) {
+    std::visit(overloaded{ [&](ExpressionStatement* exprStmt) {
+                              m_Loc = exprStmt->Loc;
+                              VisitExpression(exprStmt->Expr);
+                          },
+                   [&](ReturnStatement* retStmt) {
+                       if (retStmt->Expr) {
+                           m_Loc = retStmt->Loc;
+                           VisitExpression(retStmt->Expr);
+                       }
+                   },
+                   [&](IfStatement* ifStmt) {
+                       m_Loc = ifStmt->Loc;
+                       VisitExpression(ifStmt->Cond);
+                       const char* outer = m_Keep;
+                       if (ifStmt->Select) {
+                           m_Keep = "it is an arm of a select";
+                       }
+                       VisitStatement(ifStmt->Then);
+                       if (ifStmt->Else) {
+                           VisitStatement(ifStmt->Else);
+                       }
+                       m_Keep = outer;
+                   },
+                   [&](WhileStatement* whileStmt) {
+                       const char* outer = m_Keep;
+                       if (whileStmt->Vector) {
+                           m_Keep = "it is in a vectorized loop";
+                       }
+                       m_Loc = whileStmt->Loc;
+                       VisitExpression(whileStmt->Cond);
+                       VisitStatement(whileStmt->Loop);
+                       m_Keep = outer;
+                   },
+                   [&](Block* block) { VisitBlock(block); } },
+        stmt->Stmt);
+}
+
+bool DeadStoreElimination::Eliminate() {
+    std::unordered_set<const BlockItem*> removed;
+    std::vector<Block*> parents;
+    m_Removed.clear();
+    for (const Store& store : m_Stores) {
+        if (store.SelfReads && Removable(store)) {
+            m_Removed[Target(store.Assign)] += store.SelfReads;
+        }
+    }
+    for (const Store& store : m_Stores) {
+        AssignmentExpression* assign = store.Assign;
+        const std::string name = TargetName(assign);
+        if (assign->Ident && !assign->Decl->Synthetic) {
+            if (Unread(assign->Decl)) {
+                m_Kept.emplace_back(
+                    store.Loc, std::format("store to '{}' not removed: assigning it prints the value", name));
+            }
+            continue;
+        }
+        const char* reason = Dead(store);
+        if (!reason) {
+            continue;
+        }
+
+        const char* obstacle = store.Kept;
+        if (!obstacle && assign->Element && !ConstantIndex(assign->Element)) {
+            obstacle = "its index may be out of bounds";
+        }
+        if (obstacle) {
+            m_Kept.emplace_back(store.Loc, std::format("store to '{}' not removed: {}", name, obstacle));
+            continue;
+        }
+
+        if (store.Parent && IsSpeculatable(assign->Expr)) {
+            removed.insert(store.Parent->Items[store.Index]);
+            parents.push_back(store.Parent);
+        } else {
+            // the value is still computed, for its effects or as part of an enclosing expression
+            assign->Ident.reset();
+            assign->Decl = nullptr;
+            assign->Element = nullptr;
+        }
+        m_Remarks.Passed("dse", store.Loc, std::format("removed store to '{}': {}", name, reason));
+    }
+    for (Block* parent : parents) {
+        std::erase_if(parent->Items, [&](const BlockItem* item) { return removed.contains(item); });
+    }
+    return !removed.empty();
+}
+
+const char* DeadStoreElimination::Dead(const Store& store) const {
+    if (Unread(Target(store.Assign))) {
+        return "it is never read";
+    }
+    if (Overwritten(store)) {
+        return "it is overwritten before it is read";
+    }
+    return nullptr;
+}
+
+bool DeadStoreElimination::Unread(const Declaration* var) const {
+    // every read left is in the value of a store removed with its statement once it is found dead
+    const auto reads = m_Reads.find(var);
+    const auto removed = m_Removed.find(var);
+    return reads == m_Reads.end() || (removed != m_Removed.end() && removed->second == reads->second);
+}
+
+bool DeadStoreElimination::Removable(const Store& store) const {
+    const AssignmentExpression* assign = store.Assign;
+    return store.Parent && !store.Kept && IsSpeculatable(assign->Expr) &&
+           (!assign->Element || ConstantIndex(assign->Element));
+}
+
+bool DeadStoreElimination::Overwritten(const Store& store) const {
+    if (!store.Parent || store.Index + 1 == store.Parent->Items.size()) {
+        return false;
+    }
+    auto* stmt = std::get_if<Statement*>(&store.Parent->Items[store.Index + 1]->Item);
+    auto* exprStmt = stmt ? std::get_if<ExpressionStatement*>(&(*stmt)->Stmt) : nullptr;
+    if (!exprStmt) {
+        return false;
+    }
+
+    const AssignmentExpression* first = store.Assign;
+    const AssignmentExpression* second = (*exprStmt)->Expr->Expr;
+    if (Target(second) != Target(first) || (!second->Ident && !second->Element)) {
+        return false;
+    }
+    if (first->Element) {
+        // the same element, the later one stored whatever its index
+        const auto index = ConstantIndex(first->Element);
+        if (!index || !second->Element || ConstantIndex(second->Element) != index) {
+            return false;
+        }
+    }
+    return !Reads(second, Target(first));
+}
+
+} // namespace Compiler
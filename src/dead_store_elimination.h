@@ -0,0 +1,73 @@
+#pragma once
+
+#include "ast.h"
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace Compiler {
+
+class Remarks;
+
+// Dead store elimination. Assigning a variable of the program prints its value, so only the
+// temporaries other passes introduce and array elements, whose stores print nothing, can hold
+// values that are never used. A store to one of them is dead if nothing reads its variable or array,
+// or if the next statement of its block stores to the same variable or element without reading it
+// first. A read in the value of a store of the variable, or of the same element, it stores to is not
+// counted if the whole statement of that store is removed with it.
+//
+// A dead store is removed with its statement if its value is speculatable; otherwise the value is
+// still computed, for its effects. Removing a store to an element must not remove the bounds check
+// of its index, so only stores at a literal index are removed. Stores in the arms of a select and
+// in vectorized loops, which the generator lowers as a whole, are kept.
+class DeadStoreElimination {
+  public:
+    DeadStoreElimination(Block* body, Remarks& remarks);
+    void Run();
+
+  private:
+    // an assignment to a variable or an element
+    struct Store {
+        AssignmentExpression* Assign;
+        SourceLocation Loc;
+        Block* Parent = nullptr; // of an assignment that is a whole statement, the block and its index
+        size_t Index = 0;
+        const char* Kept = nullptr; // why the generator needs it as written, if it does
+        int SelfReads = 0;          // of its variable or element, in its value
+    };
+
+    void VisitPrimary(Primary* primary);
+    void CountRead(const Declaration* var, const Subscript* element); // element null for a variable
+    void VisitPostfixExpression(PostfixExpression* expr);
+    template <typename T>
+    void VisitChain(T* expr);
+    void VisitAssignmentExpression(AssignmentExpression* expr);
+    void VisitExpression(Expression* expr);
+    void VisitBlock(Block* block);
+    void VisitStatement(Statement* stmt);
+    void VisitStatementHere(Statement* stmt); // on the current stack
+
+    // removes the dead stores found by the last visit, returning whether any statement was, and
+    // notes why the others that are dead were kept
+    bool Eliminate();
+    const char* Dead(const Store& store) const; // why the store is dead, or null
+    bool Unread(const Declaration* var) const;
+    bool Removable(const Store& store) const; // with its whole statement, if it is dead
+    bool Overwritten(const Store& store) const;
+
+    Block* m_Body;
+    Remarks& m_Remarks;
+
+    std::unordered_map<const Declaration*, int> m_Reads;   // reads of each variable and array
+    std::unordered_map<const Declaration*, int> m_Removed; // of those, in the values of removable stores
+    std::vector<Store> m_Stores;                         // in the order of the program
+    std::vector<std::pair<SourceLocation, std::string>> m_Kept; // the missed remarks
+    std::vector<size_t> m_Visiting;                      // the stores being visited, innermost last
+    SourceLocation m_Loc;                                // of the statement being visited
+    const AssignmentExpression* m_Whole = nullptr;       // with m_Parent and m_Index, of that statement
+    Block* m_Parent = nullptr;
+    size_t m_Index = 0;
+    const char* m_Keep = nullptr; // within a select or a vectorized loop
+};
+
+} // namespace Compiler
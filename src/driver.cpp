@@ -0,0 +1,320 @@
+#include "driver.h"
+#include "ast_image.h"
+#include "bytecode.h"
+#include "generator.h"
+#include "jit.h"
+#include "lexer.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "semantic_analyzer.h"
+#include "spsc_ring.h"
+#include "vm.h"
+#include <algorithm>
+#include <charconv>
+#include <format>
+#include <fstream>
+#include <thread>
+
+namespace Compiler {
+
+bool ParseCompileOption(std::string_view arg, DriverOptions& options) {
+    static constexpr std::string_view remarkFlags[] = { "-Rpass=", "-Rpass-missed=", "-Rpass-analysis=" };
+
+    if (arg.starts_with("-O")) {
+        int level = -1;
+        std::from_chars(arg.data() + 2, arg.data() + arg.size(), level);
+        if (arg.size() != 3 || level < 0 || level > 3) {
+            throw UsageException(std::format("invalid optimization level '{}'", arg));
+        }
+        options.Optimization = OptimizationOptions::ForLevel(level);
+        return true;
+    } else if (arg == "--emit-bytecode") {
+        options.Emit = Target::Bytecode;
+        return true;
+    } else if (arg == "--emit-ast") {
+        options.Emit = Target::AstImage;
+        return true;
+    } else if (arg == "--pipeline") {
+        options.Pipeline = true;
+        return true;
+    } else if (arg.starts_with("--profile-generate=")) {
+        // absolute, so that the program finds it wherever it is run from
+        std::filesystem::path path = arg.substr(std::string_view("--profile-generate=").size());
+        if (path.empty()) {
+            throw UsageException("missing file name in '--profile-generate='");
+        }
+        options.ProfileOutput = std::filesystem::absolute(path).string();
+        return true;
+    } else if (arg == "--profile-cycles") {
+        options.ProfileCycles = true;
+        return true;
+    } else if (arg == "-mno-avx2") {
+        options.Avx2 = false;
+        return true;
+    } else if (arg == "--stats") {
+        options.Statistics = true;
+        return true;
+    } else if (arg.starts_with("--profile-use=")) {
+        std::string_view path = arg.substr(std::string_view("--profile-use=").size());
+        try {
+            options.UseProfile = std::make_shared<const Profile>(Profile::Load(path));
+        } catch (const CompileError& e) {
+            throw UsageException(std::format("cannot use profile '{}': {}", path, e.what()));
+        }
+        return true;
+    } else if (arg.starts_with("-Rpass")) {
+        auto flag = std::find_if(
+            std::begin(remarkFlags), std::end(remarkFlags), [&](auto f) { return arg.starts_with(f); });
+        if (flag == std::end(remarkFlags)) {
+            throw UsageException(std::format("unknown option '{}'", arg));
+        }
+        try {
+            std::regex pattern(std::string(arg.substr(flag->size())));
+            options.Remarks.Patterns[flag - std::begin(remarkFlags)] = std::move(pattern);
+        } catch (const std::regex_error& e) {
+            throw UsageException(std::format("invalid regex in '{}': {}", arg, e.what()));
+        }
+        return true;
+    }
+    return false;
+}
+
+// Parses source while a second thread lexes it, the tokens passing between them in batches through
+// a ring. The result, or the error, is the same as lexing it all and then parsing: an error from
+// the lexer is reported in preference to one from the parser, which may have read past it.
+static Program* ParsePipelined(std::string_view source, ArenaAllocator& allocator) {
+    constexpr size_t batchSize = 256;
+    SpscRing<Token> ring(16 * batchSize);
+
+    std::exception_ptr lexError;
+    std::thread lexer([&] {
+        try {
+            Lexer(source).Lex(batchSize, [&](std::vector<Token>& batch) { ring.Write(batch); });
+        } catch (...) {
+            lexError = std::current_exception();
+        }
+        ring.Close();
+    });
+
+    Program* program = nullptr;
+    std::exception_ptr parseError;
+    try {
+        Parser parser([&](std::vector<Token>& tokens) { return ring.Read(tokens); }, allocator);
+        program = parser.ParseProgram();
+    } catch (...) {
+        parseError = std::current_exception();
+    }
+
+    // let the lexer run to its end, then wait for it
+    std::vector<Token> rest;
+    while (ring.Read(rest)) {
+        rest.clear();
+    }
+    lexer.join();
+
+    if (lexError) {
+        std::rethrow_exception(lexError);
+    } else if (parseError) {
+        std::rethrow_exception(parseError);
+    }
+    return program;
+}
+
+// The program in input, parsed and analyzed, or loaded from an AST image.
+static Program* Analyze(std::string_view input, const DriverOptions& options, CompilerContext& context) {
+    if (IsAstImage(input)) {
+        return AstImage(input).Load(context.Allocator);
+    }
+
+    std::string source(input);
+    source += '\n';
+
+    Program* program;
+    if (options.Pipeline) {
+        program = ParsePipelined(source, context.Allocator);
+    } else {
+        program = Parser(Lexer(source).Lex(), context.Allocator).ParseProgram();
+    }
+    SemanticAnalyzer analyzer(program, context.Scopes);
+    analyzer.Analyze();
+    return program;
+}
+
+static void Optimize(std::string_view name, Program* program, const DriverOptions& options,
+    CompilerContext& context, std::ostream& diagnostics) {
+    OptimizationOptions optimization = options.Optimization;
+    if (!options.ProfileOutput.empty()) {
+        // every branch is kept as written, so that the counts are those of the source
+        optimization.IfConversion = false;
+        optimization.UnrollFactor = 1;
+        optimization.Vectorize = false;
+    }
+
+    Remarks remarks;
+    Optimizer optimizer(program, optimization, options.UseProfile.get(), remarks, context.Allocator);
+    optimizer.Run();
+    remarks.Print(diagnostics, name, options.Remarks);
+}
+
+// Runs one compilation, reporting its errors against name, and readies the context for the next.
+template <typename Fn>
+static bool Guard(std::string_view name, CompilerContext& context, std::ostream& diagnostics, Fn&& compile) {
+    bool ok = false;
+    try {
+        compile();
+        ok = true;
+    } catch (const CompileError& e) {
+        if (e.Location()) {
+            diagnostics << std::format(
+                "{}:{}:{}: error: {}\n", name, e.Location()->Line, e.Location()->Column, e.what());
+        } else {
+            diagnostics << std::format("{}: error: {}\n", name, e.what());
+        }
+    } catch (const std::exception& e) {
+        diagnostics << std::format("{}: internal compiler error: {}\n", name, e.what());
+    }
+
+    context.Allocator.Reset();
+    context.Scopes.Reset();
+    return ok;
+}
+
+// Everything that determines the output of a compilation.
+static Digest CacheKey(const DriverOptions& options, std::string_view source) {
+    std::string key = std::format("{}\n{}\nemit={} avx2={}\nprofile={} profile-output={} profile-cycles={}\n",
+        CompilerIdentity().ToHex(), options.Optimization.Key(), static_cast<int>(options.Emit), options.Avx2,
+        options.UseProfile ? options.UseProfile->Key().ToHex() : "none", options.ProfileOutput,
+        options.ProfileCycles);
+    key += source;
+    return Digest::Of(key);
+}
+
+static bool Compile(std::string_view name, std::string_view input, const DriverOptions& options,
+    CompilerContext& context, std::string& assembly, std::ostream& diagnostics) {
+    // remarks and statistics are only made by compiling, which a cached output skips
+    std::optional<Digest> key;
+    if (options.Cache && !options.Statistics &&
+        std::ranges::none_of(options.Remarks.Patterns, [](auto& p) { return p.has_value(); })) {
+        key = CacheKey(options, input);
+        if (auto cached = options.Cache->Load(*key)) {
+            assembly = std::move(*cached);
+            return true;
+        }
+    }
+
+    const bool ok = Guard(name, context, diagnostics, [&] {
+        Program* program = Analyze(input, options, context);
+        if (options.Emit == Target::AstImage) {
+            assembly = WriteAstImage(program);
+            return;
+        }
+        Optimize(name, program, options, context, diagnostics);
+        if (options.Emit == Target::Bytecode) {
+            assembly = ToString(BytecodeGenerator(program, context.Scopes).Generate());
+        } else {
+            const GeneratorOptions generation{ options.UseProfile.get(), options.ProfileOutput,
+                options.ProfileCycles, options.Optimization.Schedule, options.Optimization.CodeAlignment,
+                options.Avx2 };
+            Generator generator(program, context.Scopes, generation);
+            assembly = generator.GenerateAsm();
+            if (options.Statistics) {
+                generator.Statistics().Print(diagnostics, name);
+            }
+        }
+    });
+    if (ok && key) {
+        options.Cache->Store(*key, assembly);
+    }
+    return ok;
+}
+
+bool CompileSource(std::string_view name, std::string source, const DriverOptions& options,
+    CompilerContext& context, std::string& assembly, std::ostream& diagnostics) {
+    return Compile(name, source, options, context, assembly, diagnostics);
+}
+
+// Reads the file at input: an AST image is mapped into image, source text read into source.
+// Returns the input's bytes.
+static std::optional<std::string_view> ReadInput(const std::filesystem::path& input, std::string& source,
+    std::optional<AstImage>& image, std::ostream& diagnostics) {
+    std::ifstream inputFile(input, std::ios::in | std::ios::binary);
+    if (!inputFile) {
+        diagnostics << std::format("{}: error: Failed to open file\n", input.string());
+        return std::nullopt;
+    }
+
+    char magic[sizeof(Image::Magic)];
+    inputFile.read(magic, sizeof(magic));
+    if (IsAstImage(std::string_view(magic, static_cast<size_t>(inputFile.gcount())))) {
+        try {
+            image.emplace(AstImage::Open(input));
+            return image->Bytes();
+        } catch (const CompileError& e) {
+            diagnostics << std::format("{}: error: {}\n", input.string(), e.what());
+            return std::nullopt;
+        }
+    }
+
+    inputFile.clear();
+    inputFile.seekg(0);
+    source.assign(std::istreambuf_iterator<char>(inputFile), std::istreambuf_iterator<char>());
+    return source;
+}
+
+bool CompileFile(const std::filesystem::path& input, const std::filesystem::path& output,
+    const DriverOptions& options, CompilerContext& context, std::ostream& diagnostics) {
+    std::string source;
+    std::optional<AstImage> image;
+    std::string assembly;
+    auto bytes = ReadInput(input, source, image, diagnostics);
+    if (!bytes || !Compile(input.string(), *bytes, options, context, assembly, diagnostics)) {
+        return false;
+    }
+
+    std::ofstream outputFile(output, std::ios::out | std::ios::binary);
+    outputFile << assembly;
+    outputFile.close();
+    if (!outputFile) {
+        diagnostics << std::format("{}: error: Failed to write to file\n", output.string());
+        return false;
+    }
+    return true;
+}
+
+std::optional<int> RunFile(const std::filesystem::path& input, Engine engine, const DriverOptions& options,
+    CompilerContext& context, std::ostream& out, std::ostream& diagnostics) {
+    std::string source;
+    std::optional<AstImage> image;
+    auto bytes = ReadInput(input, source, image, diagnostics);
+    if (!bytes) {
+        return std::nullopt;
+    }
+
+    if (engine == Engine::Bytecode) {
+        Chunk chunk;
+        if (!Guard(input.string(), context, diagnostics, [&] {
+                Program* program = Analyze(*bytes, options, context);
+                Optimize(input.string(), program, options, context, diagnostics);
+                chunk = BytecodeGenerator(program, context.Scopes).Generate();
+            })) {
+            return std::nullopt;
+        }
+        return RunBytecode(chunk, out);
+    }
+
+    DriverOptions native = options;
+    native.Emit = Target::Assembly;
+    std::string assembly;
+    if (!Compile(input.string(), *bytes, native, context, assembly, diagnostics)) {
+        return std::nullopt;
+    }
+
+    try {
+        return RunJit(assembly, out);
+    } catch (const CompileError& e) {
+        diagnostics << std::format("{}: error: {}\n", input.string(), e.what());
+        return std::nullopt;
+    }
+}
+
+} // namespace Compiler
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "cache.h"
+#include "options.h"
+#include "profile.h"
+#include "remarks.h"
+#include "symbol_table.h"
+#include "utils.h"
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+
+namespace Compiler {
+
+// What a compilation produces: assembly, a listing of the bytecode the VM would run, or the
+// analyzed program saved as an AST image (see ast_image.h).
+enum class Target { Assembly, Bytecode, AstImage };
+
+// How RunFile executes a program: its machine code in-process, or its bytecode in the VM.
+enum class Engine { Jit, Bytecode };
+
+struct DriverOptions {
+    OptimizationOptions Optimization;
+    RemarkFilter Remarks;
+    Target Emit = Target::Assembly;
+    std::shared_ptr<const CompileCache> Cache; // outputs of earlier compilations, if any
+    bool Pipeline = false;                     // lex on a thread of its own while parsing
+    std::shared_ptr<const Profile> UseProfile; // counts from earlier runs to optimize for, if any
+    std::string ProfileOutput; // if set, instrument the program to write its profile to this file
+    bool ProfileCycles = false; // instrument the program to report the cycles each if and loop took
+    bool Statistics = false;    // report what the assembly is made of with the diagnostics
+    bool Avx2 = true;           // let vectorized loops use AVX2 where the processor has it
+};
+
+// An invalid command-line argument.
+class UsageException : public std::runtime_error {
+  public:
+    using std::runtime_error::runtime_error;
+};
+
+// Applies arg to options if it is one of the options that affect how a unit is compiled
+// (-O<level>, -Rpass=<regex>, --emit-bytecode, --profile-cycles, ...); returns false for other
+// arguments.
+bool ParseCompileOption(std::string_view arg, DriverOptions& options);
+
+// The state reused by the compilations one thread runs, kept warm between them.
+struct CompilerContext {
+    CompilerContext() : Allocator(4 * 1024 * 1024) {} // 4 MB
+
+    ArenaAllocator Allocator;
+    ScopeStack Scopes;
+};
+
+// Compiles source, text or an AST image, into assembly or another target. Diagnostics name the
+// source name and are written to diagnostics rather than to stderr, so that units compiled in
+// parallel are reported whole. With a cache, an output compiled before from the same source with the same options is
+// reused, unless remarks or statistics are asked for. Returns whether it succeeded.
+bool CompileSource(std::string_view name, std::string source, const DriverOptions& options,
+    CompilerContext& context, std::string& assembly, std::ostream& diagnostics);
+
+// Compiles the file at input into assembly at output. An AST image is mapped rather than read.
+bool CompileFile(const std::filesystem::path& input, const std::filesystem::path& output,
+    const DriverOptions& options, CompilerContext& context, std::ostream& diagnostics);
+
+// Compiles the file at input and runs it in-process with engine, its output going to out.
+// Returns the program's exit status, or nothing if it failed to compile.
+std::optional<int> RunFile(const std::filesystem::path& input, Engine engine, const DriverOptions& options,
+    CompilerContext& context, std::ostream& out, std::ostream& diagnostics);
+
+} // namespace Compiler
@@ -0,0 +1,574 @@
+#include "encoder.h"
+#include "utils.h"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <format>
+
+namespace Compiler {
+
+namespace {
+
+struct RegisterInfo {
+    int Code;
+    int Size;
+};
+
+const std::unordered_map<std::string_view, RegisterInfo> registers{ { "rax", { 0, 64 } }, { "rcx", { 1, 64 } },
+    { "rdx", { 2, 64 } }, { "rbx", { 3, 64 } }, { "rsp", { 4, 64 } }, { "rbp", { 5, 64 } }, { "rsi", { 6, 64 } },
+    { "rdi", { 7, 64 } }, { "r8", { 8, 64 } }, { "r9", { 9, 64 } }, { "r10", { 10, 64 } }, { "r11", { 11, 64 } },
+    { "r12", { 12, 64 } }, { "r13", { 13, 64 } }, { "r14", { 14, 64 } }, { "r15", { 15, 64 } },
+    { "eax", { 0, 32 } }, { "ecx", { 1, 32 } }, { "edx", { 2, 32 } }, { "ebx", { 3, 32 } }, { "esp", { 4, 32 } },
+    { "ebp", { 5, 32 } }, { "esi", { 6, 32 } }, { "edi", { 7, 32 } }, { "r8d", { 8, 32 } }, { "r9d", { 9, 32 } },
+    { "r10d", { 10, 32 } }, { "r11d", { 11, 32 } }, { "r12d", { 12, 32 } }, { "r13d", { 13, 32 } },
+    { "r14d", { 14, 32 } }, { "r15d", { 15, 32 } }, { "al", { 0, 8 } }, { "cl", { 1, 8 } }, { "dl", { 2, 8 } },
+    { "bl", { 3, 8 } }, { "spl", { 4, 8 } }, { "bpl", { 5, 8 } }, { "sil", { 6, 8 } }, { "dil", { 7, 8 } },
+    { "r8b", { 8, 8 } }, { "r9b", { 9, 8 } }, { "r10b", { 10, 8 } }, { "r11b", { 11, 8 } }, { "r12b", { 12, 8 } },
+    { "r13b", { 13, 8 } }, { "r14b", { 14, 8 } }, { "r15b", { 15, 8 } }, { "xmm0", { 0, 128 } },
+    { "xmm1", { 1, 128 } }, { "xmm2", { 2, 128 } }, { "xmm3", { 3, 128 } }, { "xmm4", { 4, 128 } },
+    { "xmm5", { 5, 128 } }, { "xmm6", { 6, 128 } }, { "xmm7", { 7, 128 } }, { "xmm8", { 8, 128 } },
+    { "xmm9", { 9, 128 } }, { "xmm10", { 10, 128 } }, { "xmm11", { 11, 128 } }, { "xmm12", { 12, 128 } },
+    { "xmm13", { 13, 128 } }, { "xmm14", { 14, 128 } }, { "xmm15", { 15, 128 } }, { "ymm0", { 0, 256 } },
+    { "ymm1", { 1, 256 } }, { "ymm2", { 2, 256 } }, { "ymm3", { 3, 256 } }, { "ymm4", { 4, 256 } },
+    { "ymm5", { 5, 256 } }, { "ymm6", { 6, 256 } }, { "ymm7", { 7, 256 } }, { "ymm8", { 8, 256 } },
+    { "ymm9", { 9, 256 } }, { "ymm10", { 10, 256 } }, { "ymm11", { 11, 256 } }, { "ymm12", { 12, 256 } },
+    { "ymm13", { 13, 256 } }, { "ymm14", { 14, 256 } }, { "ymm15", { 15, 256 } } };
+
+const std::unordered_map<std::string_view, int> conditionCodes{ { "o", 0x0 }, { "no", 0x1 }, { "b", 0x2 },
+    { "c", 0x2 }, { "nae", 0x2 }, { "ae", 0x3 }, { "nb", 0x3 }, { "nc", 0x3 }, { "e", 0x4 }, { "z", 0x4 },
+    { "ne", 0x5 }, { "nz", 0x5 }, { "be", 0x6 }, { "na", 0x6 }, { "a", 0x7 }, { "nbe", 0x7 }, { "s", 0x8 },
+    { "ns", 0x9 }, { "p", 0xA }, { "pe", 0xA }, { "np", 0xB }, { "po", 0xB }, { "l", 0xC }, { "nge", 0xC },
+    { "ge", 0xD }, { "nl", 0xD }, { "le", 0xE }, { "ng", 0xE }, { "g", 0xF }, { "nle", 0xF } };
+
+// the /digit of the instructions sharing an opcode
+const std::unordered_map<std::string_view, int> arithmetic{ { "add", 0 }, { "or", 1 }, { "adc", 2 }, { "sbb", 3 },
+    { "and", 4 }, { "sub", 5 }, { "xor", 6 }, { "cmp", 7 } };
+const std::unordered_map<std::string_view, int> unary{ { "not", 2 }, { "neg", 3 }, { "mul", 4 }, { "div", 6 },
+    { "idiv", 7 } };
+const std::unordered_map<std::string_view, int> shifts{ { "rol", 0 }, { "ror", 1 }, { "shl", 4 }, { "sal", 4 },
+    { "shr", 5 }, { "sar", 7 } };
+const std::unordered_map<std::string_view, int> laneShifts{ { "psrlq", 2 }, { "psllq", 6 } };
+// 66 0F opcodes of the packed integer operations, the same with VEX
+const std::unordered_map<std::string_view, uint8_t> packed{ { "paddq", 0xD4 }, { "psubq", 0xFB },
+    { "pmuludq", 0xF4 }, { "pxor", 0xEF }, { "punpcklqdq", 0x6C } };
+
+std::string_view Trim(std::string_view s) {
+    while (!s.empty() && std::isspace(static_cast<unsigned char>(s.front()))) {
+        s.remove_prefix(1);
+    }
+    while (!s.empty() && std::isspace(static_cast<unsigned char>(s.back()))) {
+        s.remove_suffix(1);
+    }
+    return s;
+}
+
+bool ParseNumber(std::string_view text, int64_t& value) {
+    bool negative = text.starts_with('-');
+    if (negative) {
+        text.remove_prefix(1);
+    }
+    int base = 10;
+    if (text.starts_with("0x")) {
+        text.remove_prefix(2);
+        base = 16;
+    }
+    uint64_t magnitude;
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), magnitude, base);
+    if (text.empty() || ec != std::errc() || end != text.data() + text.size()) {
+        return false;
+    }
+    value = static_cast<int64_t>(negative ? 0 - magnitude : magnitude);
+    return true;
+}
+
+bool FitsInt8(int64_t value) {
+    return value >= INT8_MIN && value <= INT8_MAX;
+}
+
+bool FitsInt32(int64_t value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+} // namespace
+
+void Encoder::Assemble(std::string_view text) {
+    while (!text.empty()) {
+        size_t end = text.find('\n');
+        Line(text.substr(0, end));
+        text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+    }
+}
+
+std::vector<uint8_t> Encoder::Finish() {
+    for (const auto& [offset, label] : m_Fixups) {
+        int64_t distance = static_cast<int64_t>(Offset(label)) - static_cast<int64_t>(offset + 4);
+        for (int i = 0; i < 4; i++) {
+            m_Code[offset + i] = static_cast<uint8_t>(static_cast<uint64_t>(distance) >> (8 * i));
+        }
+    }
+    m_Fixups.clear();
+    return std::move(m_Code);
+}
+
+size_t Encoder::Offset(std::string_view label) const {
+    auto it = m_Labels.find(std::string(label));
+    if (it == m_Labels.end()) {
+        Error(std::format("Undefined label '{}'", label));
+    }
+    return it->second;
+}
+
+void Encoder::Unsupported() const {
+    Error(std::format("Cannot encode '{}'", m_Line));
+}
+
+void Encoder::Line(std::string_view line) {
+    m_Line = line;
+    line = Trim(line.substr(0, line.find(';')));
+    if (line.empty()) {
+        return;
+    }
+
+    if (line.ends_with(':')) {
+        if (!m_Labels.emplace(std::string(line.substr(0, line.size() - 1)), m_Code.size()).second) {
+            Error(std::format("Redefinition of label '{}'", line));
+        }
+        return;
+    }
+
+    size_t space = line.find_first_of(" \t");
+    std::string_view mnemonic = line.substr(0, space);
+    if (mnemonic == "global" || mnemonic == "extern" || mnemonic == "section") {
+        return;
+    }
+
+    std::vector<Operand> ops;
+    if (space != std::string_view::npos) {
+        std::string_view rest = line.substr(space + 1);
+        while (true) {
+            size_t comma = rest.find(',');
+            ops.push_back(ParseOperand(rest.substr(0, comma)));
+            if (comma == std::string_view::npos) {
+                break;
+            }
+            rest.remove_prefix(comma + 1);
+        }
+    }
+    Instruction(mnemonic, ops);
+}
+
+Encoder::Operand Encoder::ParseOperand(std::string_view text) const {
+    static const std::unordered_map<std::string_view, int> sizes{ { "byte", 8 }, { "dword", 32 }, { "qword", 64 } };
+
+    text = Trim(text);
+    Operand op;
+
+    size_t open = text.find('[');
+    if (open != std::string_view::npos) {
+        op.Type = Operand::Memory;
+        std::string_view size = Trim(text.substr(0, open));
+        if (!size.empty()) {
+            auto it = sizes.find(size);
+            if (it == sizes.end()) {
+                Unsupported();
+            }
+            op.Size = it->second;
+        }
+        if (!text.ends_with(']')) {
+            Unsupported();
+        }
+
+        // terms separated by + and -: registers, register*scale and displacements
+        std::string_view terms = text.substr(open + 1, text.size() - open - 2);
+        while (!terms.empty()) {
+            bool negative = terms.front() == '-';
+            if (terms.front() == '+' || terms.front() == '-') {
+                terms.remove_prefix(1);
+            }
+            size_t end = terms.find_first_of("+-");
+            std::string_view term = Trim(terms.substr(0, end));
+            terms.remove_prefix(end == std::string_view::npos ? terms.size() : end);
+
+            std::string_view reg = term.substr(0, term.find('*'));
+            auto it = registers.find(Trim(reg));
+            int64_t value;
+            if (it != registers.end() && it->second.Size == 64 && !negative) {
+                int64_t scale = 1;
+                if (reg.size() != term.size() && !ParseNumber(Trim(term.substr(reg.size() + 1)), scale)) {
+                    Unsupported();
+                }
+                if (op.Reg < 0 && scale == 1) {
+                    op.Reg = it->second.Code;
+                } else if (op.Index < 0 && (scale == 1 || scale == 2 || scale == 4 || scale == 8)) {
+                    op.Index = it->second.Code;
+                    op.Scale = static_cast<int>(scale);
+                } else {
+                    Unsupported();
+                }
+            } else if (ParseNumber(term, value)) {
+                op.Value += negative ? -value : value;
+            } else {
+                Unsupported();
+            }
+        }
+        return op;
+    }
+
+    if (auto it = registers.find(text); it != registers.end()) {
+        op.Type = Operand::Register;
+        op.Reg = it->second.Code;
+        op.Size = it->second.Size;
+    } else if (!ParseNumber(text, op.Value)) {
+        if (text.empty() || text.find_first_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_.$")
+                != std::string_view::npos) {
+            Unsupported();
+        }
+        op.Type = Operand::Label;
+        op.Name = text;
+    }
+    return op;
+}
+
+void Encoder::Bytes(std::initializer_list<uint8_t> bytes) {
+    m_Code.insert(m_Code.end(), bytes);
+}
+
+void Encoder::Immediate(int64_t value, int size) {
+    for (int i = 0; i < size / 8; i++) {
+        m_Code.push_back(static_cast<uint8_t>(static_cast<uint64_t>(value) >> (8 * i)));
+    }
+}
+
+void Encoder::ModRM(std::initializer_list<uint8_t> opcode, int size, int reg, const Operand& rm) {
+    uint8_t rex = 0x40 | (size == 64) << 3 | (reg >> 3 & 1) << 2 | (rm.Index >= 8) << 1 | (rm.Reg >= 8);
+    // spl, bpl, sil and dil only exist with a REX prefix; without one they mean ah, ch, dh and bh
+    bool byteRegister = rm.Type == Operand::Register && rm.Size == 8 && rm.Reg >= 4 && rm.Reg < 8;
+    if (rex != 0x40 || byteRegister) {
+        m_Code.push_back(rex);
+    }
+    Bytes(opcode);
+    RegisterOrMemory(reg, rm);
+}
+
+void Encoder::Sse(uint8_t prefix, std::initializer_list<uint8_t> opcode, int size, int reg, const Operand& rm) {
+    m_Code.push_back(prefix);
+    ModRM(opcode, size, reg, rm);
+}
+
+void Encoder::Vex(int pp, int map, bool w, int bits, int source, uint8_t opcode, int reg, const Operand& rm) {
+    // R, X, B and vvvv are stored inverted
+    const int r = reg >> 3 & 1;
+    const int x = rm.Index >= 8;
+    const int b = rm.Reg >= 8;
+    const int tail = (~source & 15) << 3 | (bits == 256) << 2 | pp;
+    if (x == 0 && b == 0 && map == 1 && !w) {
+        Bytes({ 0xC5, static_cast<uint8_t>(!r << 7 | tail) });
+    } else {
+        Bytes({ 0xC4, static_cast<uint8_t>(!r << 7 | !x << 6 | !b << 5 | map), static_cast<uint8_t>(w << 7 | tail) });
+    }
+    m_Code.push_back(opcode);
+    RegisterOrMemory(reg, rm);
+}
+
+void Encoder::RegisterOrMemory(int reg, const Operand& rm) {
+    const int base = rm.Reg;
+    const int index = rm.Index;
+    const uint8_t field = static_cast<uint8_t>((reg & 7) << 3);
+    if (rm.Type == Operand::Register) {
+        m_Code.push_back(0xC0 | field | (base & 7));
+        return;
+    }
+
+    static constexpr uint8_t scaleBits[] = { 0, 0, 1, 0, 2, 0, 0, 0, 3 };
+    if (index == 4) {
+        Unsupported(); // rsp can't be an index
+    }
+    const uint8_t sib = static_cast<uint8_t>(scaleBits[rm.Scale] << 6 | (index < 0 ? 4 : index & 7) << 3);
+    if (!FitsInt32(rm.Value)) {
+        Unsupported();
+    }
+
+    if (base < 0) {
+        // no base: a SIB byte with base 101 and mod 00 means a bare 32-bit displacement
+        m_Code.push_back(field | 4);
+        m_Code.push_back(sib | 5);
+        Immediate(rm.Value, 32);
+        return;
+    }
+
+    // rbp and r13 as base have no form without displacement
+    const int mod = rm.Value == 0 && (base & 7) != 5 ? 0 : FitsInt8(rm.Value) ? 1 : 2;
+    if (index >= 0 || (base & 7) == 4) {
+        m_Code.push_back(static_cast<uint8_t>(mod << 6) | field | 4);
+        m_Code.push_back(sib | (base & 7));
+    } else {
+        m_Code.push_back(static_cast<uint8_t>(mod << 6) | field | (base & 7));
+    }
+    if (mod != 0) {
+        Immediate(rm.Value, mod == 1 ? 8 : 32);
+    }
+}
+
+void Encoder::Nops(int64_t count) {
+    // the forms of 1 to 9 bytes the optimization manuals recommend, each decoded as one instruction
+    static constexpr uint8_t forms[9][9] = { { 0x90 }, { 0x66, 0x90 }, { 0x0F, 0x1F, 0x00 }, { 0x0F, 0x1F, 0x40, 0x00 },
+        { 0x0F, 0x1F, 0x44, 0x00, 0x00 }, { 0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00 },
+        { 0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00 }, { 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+        { 0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 } };
+    while (count > 0) {
+        const int64_t size = std::min<int64_t>(count, 9);
+        m_Code.insert(m_Code.end(), forms[size - 1], forms[size - 1] + size);
+        count -= size;
+    }
+}
+
+void Encoder::Relative(std::initializer_list<uint8_t> opcode, const std::string& label) {
+    Bytes(opcode);
+    m_Fixups.emplace_back(m_Code.size(), label);
+    Immediate(0, 32);
+}
+
+void Encoder::Vector(std::string_view mnemonic, const std::string& form, const std::vector<Operand>& ops) {
+    const bool avx = mnemonic.starts_with('v');
+    const std::string_view name = avx ? mnemonic.substr(1) : mnemonic;
+    // the size of the vectors; SSE has only xmm registers
+    const int bits = ops[0].Type == Operand::Register && ops[0].Size >= 128 ? ops[0].Size : ops[1].Size;
+    const bool xmm = bits == 128;
+    auto vector = [&](size_t i) { return ops[i].Type == Operand::Register && ops[i].Size == bits; };
+    auto sse = [&](uint8_t prefix, uint8_t opcode, int reg, const Operand& rm) {
+        if (avx || !xmm) {
+            Unsupported();
+        }
+        Sse(prefix, { 0x0F, opcode }, 0, reg, rm);
+    };
+
+    if ((name == "movdqu" || name == "movdqa") && (form == "RR" || form == "RM" || form == "MR")) {
+        const uint8_t prefix = name == "movdqu" ? 0xF3 : 0x66;
+        const bool store = form == "MR";
+        const int reg = ops[store].Reg;
+        if (!vector(store) || (form == "RR" && !vector(1))) {
+            Unsupported();
+        }
+        if (avx) {
+            Vex(prefix == 0x66 ? 1 : 2, 1, false, bits, 0, store ? 0x7F : 0x6F, reg, ops[!store]);
+        } else {
+            sse(prefix, store ? 0x7F : 0x6F, reg, ops[!store]);
+        }
+    } else if (auto it = packed.find(name); it != packed.end() && !avx && (form == "RR" || form == "RM") &&
+                                            vector(0) && (form == "RM" || vector(1))) {
+        sse(0x66, it->second, ops[0].Reg, ops[1]);
+    } else if (auto it = packed.find(name); it != packed.end() && avx && (form == "RRR" || form == "RRM") &&
+                                            vector(0) && vector(1) && (form == "RRM" || vector(2))) {
+        Vex(1, 1, false, bits, ops[1].Reg, it->second, ops[0].Reg, ops[2]);
+    } else if (auto it = laneShifts.find(name); it != laneShifts.end() && !avx && form == "RI" && vector(0) &&
+                                                ops[1].Value >= 0 && ops[1].Value < 64) {
+        sse(0x66, 0x73, it->second, ops[0]);
+        Immediate(ops[1].Value, 8);
+    } else if (auto it = laneShifts.find(name); it != laneShifts.end() && avx && form == "RRI" && vector(0) &&
+                                                vector(1) && ops[2].Value >= 0 && ops[2].Value < 64) {
+        // the destination is the vvvv register
+        Vex(1, 1, false, bits, ops[0].Reg, 0x73, it->second, ops[1]);
+        Immediate(ops[2].Value, 8);
+    } else if (name == "pshufd" && (form == "RRI" || form == "RMI") && vector(0) &&
+               (form == "RMI" || vector(1)) && ops[2].Value >= 0 && ops[2].Value <= UINT8_MAX) {
+        if (avx) {
+            Vex(1, 1, false, bits, 0, 0x70, ops[0].Reg, ops[1]);
+        } else {
+            sse(0x66, 0x70, ops[0].Reg, ops[1]);
+        }
+        Immediate(ops[2].Value, 8);
+    } else if (name == "movq" && form == "RR" && (ops[0].Size == 64 || ops[1].Size == 64)) {
+        // 66 REX.W 0F 6E loads an xmm register from a general purpose one, and 7E stores it back;
+        // either way the ModRM reg field holds the xmm register
+        const bool load = ops[1].Size == 64;
+        const Operand& xmmOp = ops[load ? 0 : 1];
+        const Operand& gp = ops[load ? 1 : 0];
+        if (xmmOp.Size != 128) {
+            Unsupported();
+        }
+        if (avx) {
+            Vex(1, 1, true, 128, 0, load ? 0x6E : 0x7E, xmmOp.Reg, gp);
+        } else {
+            Sse(0x66, { 0x0F, static_cast<uint8_t>(load ? 0x6E : 0x7E) }, 64, xmmOp.Reg, gp);
+        }
+    } else if (mnemonic == "vpbroadcastq" && (form == "RR" || form == "RM") &&
+               (form == "RM" || ops[1].Size == 128)) {
+        Vex(1, 2, false, bits, 0, 0x59, ops[0].Reg, ops[1]);
+    } else if (mnemonic == "vextracti128" && form == "RRI" && ops[0].Size == 128 && ops[1].Size == 256 &&
+               (ops[2].Value == 0 || ops[2].Value == 1)) {
+        // the ModRM reg field holds the source
+        Vex(1, 3, false, 256, 0, 0x39, ops[1].Reg, ops[0]);
+        Immediate(ops[2].Value, 8);
+    } else {
+        Unsupported();
+    }
+}
+
+void Encoder::Instruction(std::string_view mnemonic, const std::vector<Operand>& ops) {
+    // the kinds of the operands, one letter each: Register, Memory, Immediate or Label
+    std::string form;
+    for (const auto& op : ops) {
+        form += "RMIL"[op.Type];
+    }
+    // the operand size: the first register's, else the memory operand's
+    int size = 0;
+    for (const auto& op : ops) {
+        if (op.Type == Operand::Register || (op.Type == Operand::Memory && size == 0)) {
+            size = op.Size;
+            if (op.Type == Operand::Register) {
+                break;
+            }
+        }
+    }
+    auto condition = [&](std::string_view prefix) {
+        if (!mnemonic.starts_with(prefix)) {
+            return -1;
+        }
+        auto it = conditionCodes.find(mnemonic.substr(prefix.size()));
+        return it != conditionCodes.end() ? it->second : -1;
+    };
+    const bool wide = size == 64 || size == 32;
+
+    if (mnemonic == "cqo" && form.empty()) {
+        Bytes({ 0x48, 0x99 });
+    } else if (mnemonic == "cdq" && form.empty()) {
+        Bytes({ 0x99 });
+    } else if (mnemonic == "ret" && form.empty()) {
+        Bytes({ 0xC3 });
+    } else if (mnemonic == "syscall" && form.empty()) {
+        Bytes({ 0x0F, 0x05 });
+    } else if (mnemonic == "ud2" && form.empty()) {
+        Bytes({ 0x0F, 0x0B });
+    } else if (mnemonic == "nop" && form.empty()) {
+        Bytes({ 0x90 });
+    } else if (mnemonic == "align" && form == "I" && ops[0].Value > 0 && ops[0].Value <= 4096) {
+        const auto alignment = static_cast<size_t>(ops[0].Value);
+        Nops(static_cast<int64_t>((alignment - m_Code.size() % alignment) % alignment));
+    } else if (mnemonic == "rdtsc" && form.empty()) {
+        Bytes({ 0x0F, 0x31 });
+    } else if (mnemonic == "rdtscp" && form.empty()) {
+        Bytes({ 0x0F, 0x01, 0xF9 });
+    } else if (mnemonic == "cpuid" && form.empty()) {
+        Bytes({ 0x0F, 0xA2 });
+    } else if (mnemonic == "xgetbv" && form.empty()) {
+        Bytes({ 0x0F, 0x01, 0xD0 });
+    } else if (mnemonic == "vzeroupper" && form.empty()) {
+        Bytes({ 0xC5, 0xF8, 0x77 });
+    } else if (std::ranges::any_of(
+                   ops, [](const Operand& op) { return op.Type == Operand::Register && op.Size > 64; })) {
+        Vector(mnemonic, form, ops);
+    } else if (auto it = arithmetic.find(mnemonic); it != arithmetic.end() && wide) {
+        const uint8_t base = static_cast<uint8_t>(it->second * 8);
+        if (form == "RR" || form == "MR") {
+            ModRM({ static_cast<uint8_t>(base + 1) }, size, ops[1].Reg, ops[0]);
+        } else if (form == "RM") {
+            ModRM({ static_cast<uint8_t>(base + 3) }, size, ops[0].Reg, ops[1]);
+        } else if ((form == "RI" || form == "MI") && FitsInt8(ops[1].Value)) {
+            ModRM({ 0x83 }, size, it->second, ops[0]);
+            Immediate(ops[1].Value, 8);
+        } else if ((form == "RI" || form == "MI") && FitsInt32(ops[1].Value)) {
+            ModRM({ 0x81 }, size, it->second, ops[0]);
+            Immediate(ops[1].Value, 32);
+        } else {
+            Unsupported();
+        }
+    } else if (mnemonic == "mov" && wide) {
+        if (form == "RR" || form == "MR") {
+            ModRM({ 0x89 }, size, ops[1].Reg, ops[0]);
+        } else if (form == "RM") {
+            ModRM({ 0x8B }, size, ops[0].Reg, ops[1]);
+        } else if ((form == "RI" || form == "MI") && size == 64 && FitsInt32(ops[1].Value)) {
+            ModRM({ 0xC7 }, size, 0, ops[0]); // sign-extended
+            Immediate(ops[1].Value, 32);
+        } else if (form == "RI") {
+            // movabs, or the zero-extending 32-bit form
+            if (ops[0].Reg >= 8 || size == 64) {
+                m_Code.push_back(static_cast<uint8_t>(0x40 | (size == 64) << 3 | ops[0].Reg >> 3));
+            }
+            m_Code.push_back(static_cast<uint8_t>(0xB8 + (ops[0].Reg & 7)));
+            Immediate(ops[1].Value, size);
+        } else if (form == "MI" && FitsInt32(ops[1].Value)) {
+            ModRM({ 0xC7 }, size, 0, ops[0]);
+            Immediate(ops[1].Value, 32);
+        } else {
+            Unsupported();
+        }
+    } else if (mnemonic == "mov" && size == 8) {
+        if ((form == "MR" || form == "RR") && (ops[1].Reg < 4 || ops[1].Reg >= 8)) {
+            ModRM({ 0x88 }, size, ops[1].Reg, ops[0]);
+        } else if (form == "MI" && ops[1].Value >= INT8_MIN && ops[1].Value <= UINT8_MAX) {
+            ModRM({ 0xC6 }, size, 0, ops[0]);
+            Immediate(ops[1].Value, 8);
+        } else {
+            Unsupported();
+        }
+    } else if (mnemonic == "test" && wide) {
+        if (form == "RR" || form == "MR") {
+            ModRM({ 0x85 }, size, ops[1].Reg, ops[0]);
+        } else if ((form == "RI" || form == "MI") && FitsInt32(ops[1].Value)) {
+            ModRM({ 0xF7 }, size, 0, ops[0]);
+            Immediate(ops[1].Value, 32);
+        } else {
+            Unsupported();
+        }
+    } else if (mnemonic == "imul" && wide) {
+        if (form == "RR" || form == "RM") {
+            ModRM({ 0x0F, 0xAF }, size, ops[0].Reg, ops[1]);
+        } else if ((form == "RRI" || form == "RMI") && FitsInt8(ops[2].Value)) {
+            ModRM({ 0x6B }, size, ops[0].Reg, ops[1]);
+            Immediate(ops[2].Value, 8);
+        } else if ((form == "RRI" || form == "RMI") && FitsInt32(ops[2].Value)) {
+            ModRM({ 0x69 }, size, ops[0].Reg, ops[1]);
+            Immediate(ops[2].Value, 32);
+        } else if (form == "R" || form == "M") {
+            ModRM({ 0xF7 }, size, 5, ops[0]);
+        } else {
+            Unsupported();
+        }
+    } else if (auto it = unary.find(mnemonic); it != unary.end() && wide && (form == "R" || form == "M")) {
+        ModRM({ 0xF7 }, size, it->second, ops[0]);
+    } else if ((mnemonic == "inc" || mnemonic == "dec") && wide && (form == "R" || form == "M")) {
+        ModRM({ 0xFF }, size, mnemonic == "dec", ops[0]);
+    } else if (auto it = shifts.find(mnemonic); it != shifts.end() && wide) {
+        if ((form == "RI" || form == "MI") && ops[1].Value == 1) {
+            ModRM({ 0xD1 }, size, it->second, ops[0]);
+        } else if ((form == "RI" || form == "MI") && ops[1].Value >= 0 && ops[1].Value < size) {
+            ModRM({ 0xC1 }, size, it->second, ops[0]);
+            Immediate(ops[1].Value, 8);
+        } else if ((form == "RR" || form == "MR") && ops[1].Reg == 1 && ops[1].Size == 8) {
+            ModRM({ 0xD3 }, size, it->second, ops[0]);
+        } else {
+            Unsupported();
+        }
+    } else if (mnemonic == "lea" && form == "RM" && wide) {
+        ModRM({ 0x8D }, size, ops[0].Reg, ops[1]);
+    } else if ((mnemonic == "movzx" || mnemonic == "movsx") && (form == "RR" || form == "RM") && wide &&
+               ops[1].Size == 8) {
+        ModRM({ 0x0F, static_cast<uint8_t>(mnemonic == "movzx" ? 0xB6 : 0xBE) }, size, ops[0].Reg, ops[1]);
+    } else if (int cc = condition("set"); cc >= 0 && (form == "R" || form == "M") && size == 8) {
+        ModRM({ 0x0F, static_cast<uint8_t>(0x90 + cc) }, 8, 0, ops[0]);
+    } else if (int cc = condition("cmov"); cc >= 0 && (form == "RR" || form == "RM") && wide) {
+        ModRM({ 0x0F, static_cast<uint8_t>(0x40 + cc) }, size, ops[0].Reg, ops[1]);
+    } else if (int cc = condition("j"); cc >= 0 && form == "L") {
+        Relative({ 0x0F, static_cast<uint8_t>(0x80 + cc) }, ops[0].Name);
+    } else if ((mnemonic == "jmp" || mnemonic == "call") && form == "L") {
+        Relative({ static_cast<uint8_t>(mnemonic == "jmp" ? 0xE9 : 0xE8) }, ops[0].Name);
+    } else if ((mnemonic == "jmp" || mnemonic == "call") && (form == "R" || form == "M") && size != 32) {
+        // 64-bit by default, no REX.W
+        ModRM({ 0xFF }, 0, mnemonic == "jmp" ? 4 : 2, ops[0]);
+    } else if ((mnemonic == "push" || mnemonic == "pop") && form == "R" && size == 64) {
+        if (ops[0].Reg >= 8) {
+            m_Code.push_back(0x41);
+        }
+        m_Code.push_back(static_cast<uint8_t>((mnemonic == "push" ? 0x50 : 0x58) + (ops[0].Reg & 7)));
+    } else if ((mnemonic == "push" || mnemonic == "pop") && form == "M" && (size == 64 || size == 0)) {
+        ModRM({ static_cast<uint8_t>(mnemonic == "push" ? 0xFF : 0x8F) }, 0, mnemonic == "push" ? 6 : 0, ops[0]);
+    } else if (mnemonic == "push" && form == "I" && FitsInt32(ops[0].Value)) {
+        m_Code.push_back(0x68);
+        Immediate(ops[0].Value, 32);
+    } else {
+        Unsupported();
+    }
+}
+
+} // namespace Compiler
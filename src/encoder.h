@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Compiler {
+
+// Assembles the subset of NASM syntax the generator emits into x86-64 machine code: the general
+// purpose instructions on 64-, 32- and 8-bit registers and memory operands addressed by base,
+// scaled index and displacement, jumps and calls to labels, and the SSE2 and AVX2 integer
+// instructions of vectorized loops on xmm and ymm registers. Jumps always take 32-bit
+// displacements, so every instruction's size is known when it is encoded and labels only need
+// patching once the text is complete. Directives (global, extern, section) are ignored, but for
+// align, which pads with long nops to a multiple from the start of the code. The code refers to
+// nothing outside itself, so it runs wherever it is copied, aligned as if copied to a page.
+class Encoder {
+  public:
+    // encodes text after the code encoded so far; labels may be used before they are defined
+    void Assemble(std::string_view text);
+    // resolves the uses of labels and returns the code
+    std::vector<uint8_t> Finish();
+
+    size_t Offset(std::string_view label) const;
+
+  private:
+    struct Operand {
+        enum Kind { Register, Memory, Immediate, Label } Type = Immediate;
+        int Size = 0;   // Register and Memory: in bits, 0 for a memory operand of unstated size
+        int Reg = -1;   // Register: the register; Memory: the base register, -1 for none
+        int Index = -1; // Memory: the index register, -1 for none
+        int Scale = 1;
+        int64_t Value = 0; // Immediate: the value; Memory: the displacement
+        std::string Name;  // Label
+    };
+
+    void Line(std::string_view line);
+    void Instruction(std::string_view mnemonic, const std::vector<Operand>& ops);
+    void Vector(std::string_view mnemonic, const std::string& form, const std::vector<Operand>& ops);
+    Operand ParseOperand(std::string_view text) const;
+    [[noreturn]] void Unsupported() const;
+
+    void Bytes(std::initializer_list<uint8_t> bytes);
+    void Immediate(int64_t value, int size);
+    void Nops(int64_t count);
+    // [REX] opcode ModRM [SIB] [displacement]; reg is a register or an opcode extension
+    void ModRM(std::initializer_list<uint8_t> opcode, int size, int reg, const Operand& rm);
+    // ModRM [SIB] [displacement]
+    void RegisterOrMemory(int reg, const Operand& rm);
+    // the SSE form: the mandatory prefix (0x66 or 0xF3) comes before any REX prefix
+    void Sse(uint8_t prefix, std::initializer_list<uint8_t> opcode, int size, int reg, const Operand& rm);
+    // VEX opcode ModRM [SIB] [displacement]; pp selects the implied prefix (1 for 0x66, 2 for 0xF3)
+    // and map the opcode map (1 for 0F, 2 for 0F38, 3 for 0F3A); source is the vvvv register
+    void Vex(int pp, int map, bool w, int bits, int source, uint8_t opcode, int reg, const Operand& rm);
+    void Relative(std::initializer_list<uint8_t> opcode, const std::string& label);
+
+    std::vector<uint8_t> m_Code;
+    std::unordered_map<std::string, size_t> m_Labels;
+    std::vector<std::pair<size_t, std::string>> m_Fixups; // rel32 fields and the labels they reach
+    std::string_view m_Line;                               // for diagnostics
+};
+
+} // namespace Compiler
@@ -1,257 +1,1021 @@
-#include "generator.h"
-#include "symbol_table.h"
-#include "utils.h"
-#include <format>
-
-namespace Compiler {
-
-Generator::Generator(Program* prog, ScopeStack& scopes) : m_Program(prog), m_Scopes(scopes) {}
-
-std::string Generator::GenerateAsm() {
-    m_StackSize = 0;
-
-    m_Output += "global _start\nsection .text\nextern print\n_start:\n";
-    GenerateBlock(m_Program->GlobalBlock);
-    m_Output += "mov rax, 60\nxor rdi, rdi\nsyscall\n";
-
-    return m_Output;
-}
-
-void Generator::Push(const std::string& reg) {
-    m_Output += "push " + reg + "\n";
-    m_StackSize++;
-}
-
-void Generator::Pop(const std::string& reg) {
-    if (m_StackSize <= 0) {
-        Error("Stack underflow");
-    }
-    m_Output += "pop " + reg + "\n";
-    m_StackSize--;
-}
-
-std::string Generator::CreateLabel() {
-    return "label" + std::to_string(m_LabelCount++);
-}
-
-void Generator::DebugPrint(const std::string& reg) {
-    m_Output += "mov rdi, " + reg + "\n";
-    m_Output += "call print\n";
-}
-
-void Generator::GeneratePrimary(const Primary* primary) {
-    std::visit(overloaded{ [&](int64_t i) {
-                              m_Output += "mov rax, " + std::to_string(i) + "\n";
-                              Push("rax");
-                          },
-                   [&](const std::string& s) {
-                       auto& v = m_Scopes.Lookup(s);
-                       Push("QWORD [rsp + " + std::to_string((m_StackSize - v.StackOffset - 1) * 8) + "]");
-                   },
-                   [&](const Expression* expr) { GenerateExpression(expr); } },
-        primary->Value);
-}
-
-void Generator::GeneratePostfixExpression(const PostfixExpression* expr) {
-    GeneratePrimary(expr->Prim);
-}
-
-void Generator::GenerateMultiplicativeExpression(const MultiplicativeExpression* expr) {
-    GeneratePostfixExpression(expr->Left);
-    for (const auto& [op, right] : expr->Right) {
-        GeneratePostfixExpression(right);
-        Pop("rcx");
-        Pop("rax");
-
-        if (op == BinaryOp::Mul) {
-            m_Output += "imul rax, rcx\n";
-            Push("rax");
-        } else if (op == BinaryOp::Div || op == BinaryOp::Mod) {
-            m_Output += "cqo\n";
-            m_Output += "idiv rcx\n";
-            if (op == BinaryOp::Div) {
-                Push("rax");
-            } else {
-                Push("rdx");
-            }
-        } else {
-            Error("Unknown operator");
-        }
-    }
-}
-
-void Generator::GenerateAdditiveExpression(const AdditiveExpression* expr) {
-    GenerateMultiplicativeExpression(expr->Left);
-    for (const auto& [op, right] : expr->Right) {
-        GenerateMultiplicativeExpression(right);
-        Pop("rax");
-        Pop("rbx");
-
-        if (op == BinaryOp::Add) {
-            m_Output += "add rbx, rax\n";
-            Push("rbx");
-        } else if (op == BinaryOp::Sub) {
-            m_Output += "sub rbx, rax\n";
-            Push("rbx");
-        } else {
-            Error("Unknown operator");
-        }
-    }
-}
-
-void Generator::GenerateRelationalExpression(const RelationalExpression* expr) {
-    GenerateAdditiveExpression(expr->Left);
-    for (const auto& [op, right] : expr->Right) {
-        GenerateAdditiveExpression(right);
-        Pop("rax");
-        Pop("rbx");
-
-        m_Output += "cmp rbx, rax\n";
-        if (op == BinaryOp::Gt) {
-            m_Output += "setg al\n";
-        } else if (op == BinaryOp::Ge) {
-            m_Output += "setge al\n";
-        } else if (op == BinaryOp::Lt) {
-            m_Output += "setl al\n";
-        } else if (op == BinaryOp::Le) {
-            m_Output += "setle al\n";
-        } else {
-            Error("Unknown operator");
-        }
-        m_Output += "movzx rax, al\n";
-        Push("rax");
-    }
-}
-
-void Generator::GenerateEqualityExpression(const EqualityExpression* expr) {
-    GenerateRelationalExpression(expr->Left);
-    for (const auto& [op, right] : expr->Right) {
-        GenerateRelationalExpression(right);
-        Pop("rax");
-        Pop("rbx");
-
-        m_Output += "cmp rbx, rax\n";
-        if (op == BinaryOp::Eq) {
-            m_Output += "sete al\n";
-        } else if (op == BinaryOp::Ne) {
-            m_Output += "setne al\n";
-        } else {
-            Error("Unknown operator");
-        }
-        m_Output += "movzx rax, al\n";
-        Push("rax");
-    }
-}
-
-void Generator::GenerateExpression(const Expression* expr) {
-    if (expr->Expr->Ident) { // assignment
-        auto& v = m_Scopes.Lookup(*expr->Expr->Ident);
-
-        GenerateEqualityExpression(expr->Expr->Expr);
-        Pop("rax");
-
-        m_Output += "mov [rsp + " + std::to_string((m_StackSize - v.StackOffset - 1) * 8) + "], rax\n";
-        DebugPrint("rax");
-    } else {
-        GenerateEqualityExpression(expr->Expr->Expr);
-        Pop("rax");
-    }
-}
-
-void Generator::GenerateBlock(const Block* scope) {
-    m_Scopes.EnterScope();
-
-    for (const auto& item : scope->Items) {
-        std::visit(overloaded{ [&](const Statement* stmt) { GenerateStatement(stmt); },
-                       [&](const Declaration* decl) {
-                           m_Scopes.Insert(decl->Ident, { VARIABLE, m_StackSize - 1 });
-
-                           m_Output += "sub rsp, 8\n";
-                           m_StackSize++;
-                       } },
-            item->Item);
-    }
-
-    size_t popCount = m_Scopes.ExitScope();
-    if (popCount != 0) {
-        m_Output += "add rsp, " + std::to_string(popCount * 8) + "\n";
-    }
-    m_StackSize -= popCount;
-}
-
-void Generator::GenerateStatement(const Statement* stmt) {
-    std::visit(overloaded{ [&](const ExpressionStatement* exprStmt) { GenerateExpression(exprStmt->Expr); },
-                   [&](const ReturnStatement* retStmt) {
-                       if (retStmt->Expr) {
-                           GenerateExpression(retStmt->Expr);
-                           Pop("rdi");
-                       } else {
-                           m_Output += "xor rdi, rdi\n";
-                       }
-                       m_Output += "mov rax, 60\n";
-                       m_Output += "syscall\n";
-                   },
-                   [&](const IfStatement* ifStmt) {
-                       GenerateExpression(ifStmt->Cond);
-                       Pop("rax");
-
-                       const std::string elseLabel = CreateLabel();
-                       const std::string endLabel = CreateLabel();
-
-                       m_Output += "test rax, rax\n";
-                       m_Output += "jz " + elseLabel + "\n";
-
-                       const int64_t stackBefore = m_StackSize;
-
-                       // then-branch
-                       GenerateStatement(ifStmt->Then);
-                       const int64_t thenStack = m_StackSize;
-
-                       m_Output += "jmp " + endLabel + "\n";
-
-                       // else-branch
-                       m_Output += elseLabel + ":\n";
-                       m_StackSize = stackBefore;
-                       if (ifStmt->Else) {
-                           GenerateStatement(ifStmt->Else);
-                       }
-
-                       const int64_t elseStack = m_StackSize;
-
-                       // enforce stack agreement
-                       if (thenStack != elseStack) {
-                           Error("Stack height mismatch between if branches");
-                       }
-
-                       // merged stack height
-                       m_StackSize = thenStack;
-
-                       // end
-                       m_Output += endLabel + ":\n";
-                   },
-                   [&](const WhileStatement* whilStmt) {
-                       const std::string startLabel = CreateLabel();
-                       const std::string endLabel = CreateLabel();
-
-                       m_Output += startLabel + ":\n";
-
-                       GenerateExpression(whilStmt->Cond);
-                       Pop("rax");
-
-                       m_Output += "test rax, rax\n";
-                       m_Output += "jz " + endLabel + "\n";
-
-                       const int64_t stackBefore = m_StackSize;
-
-                       GenerateStatement(whilStmt->Loop);
-
-                       m_Output += "jmp " + startLabel + "\n";
-                       m_Output += endLabel + ":\n";
-
-                       m_StackSize = stackBefore;
-                   },
-                   [&](const Block* scope) { GenerateBlock(scope); } },
-        stmt->Stmt);
-}
-
+#include "generator.h"
+#include "ast_utils.h"
+#include "instruction_scheduler.h"
+#include "stack.h"
+#include "symbol_table.h"
+#include "utils.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <format>
+
+namespace Compiler {
+
+namespace {
+
+constexpr int64_t PageSize = 4096;
+
+// The timer of a region, in the program built with ProfileCycles.
+struct RegionTimer {
+    uint64_t Site; // see ProfileFormat::SiteOf
+    uint64_t Loop;
+    uint64_t Runs;
+    uint64_t Iterations;
+    uint64_t Cycles;
+    uint64_t Start; // the time stamp counter when the current run began
+};
+
+size_t CountBranches(const Block* block);
+
+// The number of if and while statements in stmt.
+size_t CountBranches(const Statement* stmt) {
+    return EnsureStack([&] {
+        return std::visit(
+            overloaded{ [&](const IfStatement* ifStmt) {
+                           const size_t count = 1 + CountBranches(ifStmt->Then);
+                           return ifStmt->Else ? count + CountBranches(ifStmt->Else) : count;
+                       },
+                [&](const WhileStatement* whileStmt) { return 1 + CountBranches(whileStmt->Loop); },
+                [&](const Block* block) { return CountBranches(block); },
+                [&](const auto*) -> size_t { return 0; } },
+            stmt->Stmt);
+    });
+}
+
+size_t CountBranches(const Block* block) {
+    size_t count = 0;
+    for (const auto& item : block->Items) {
+        if (auto* stmt = std::get_if<Statement*>(&item->Item)) {
+            count += CountBranches(*stmt);
+        }
+    }
+    return count;
+}
+
+bool HasVectorLoop(const Block* block);
+
+// Whether stmt holds a loop with a SIMD form.
+bool HasVectorLoop(const Statement* stmt) {
+    return EnsureStack([&] {
+        return std::visit(
+            overloaded{ [&](const IfStatement* ifStmt) {
+                           return HasVectorLoop(ifStmt->Then) || (ifStmt->Else && HasVectorLoop(ifStmt->Else));
+                       },
+                [&](const WhileStatement* whileStmt) {
+                    return whileStmt->Vector != nullptr || HasVectorLoop(whileStmt->Loop);
+                },
+                [&](const Block* block) { return HasVectorLoop(block); },
+                [&](const auto*) { return false; } },
+            stmt->Stmt);
+    });
+}
+
+bool HasVectorLoop(const Block* block) {
+    return std::ranges::any_of(block->Items, [](const BlockItem* item) {
+        auto* stmt = std::get_if<Statement*>(&item->Item);
+        return stmt && HasVectorLoop(*stmt);
+    });
+}
+
+std::string VectorRegister(int reg, bool avx) {
+    return std::format("{}mm{}", avx ? 'y' : 'x', reg);
+}
+
+// [base + displacement]
+std::string Address(std::string_view base, int64_t displacement) {
+    if (displacement == 0) {
+        return std::format("[{}]", base);
+    }
+    return std::format("[{} {} {}]", base, displacement < 0 ? '-' : '+', displacement < 0 ? -displacement : displacement);
+}
+
+} // namespace
+
+Generator::Generator(Program* prog, ScopeStack& scopes, GeneratorOptions options)
+    : m_Program(prog), m_Selector(scopes, m_Asm), m_Options(std::move(options)), m_Scopes(scopes) {}
+
+std::string Generator::GenerateAsm() {
+    m_Asm = Assembly();
+    m_Counters.clear();
+    m_Regions.clear();
+    m_RegionOfSite.clear();
+
+    // the counters come first, as they are written to the profile file as they lie; each if and
+    // loop has two of them
+    const bool instrumented = !m_Options.ProfileOutput.empty() || m_Options.ProfileCycles;
+    m_RegionBase = 0;
+    if (!m_Options.ProfileOutput.empty()) {
+        size_t branches = CountBranches(m_Program->GlobalBlock);
+        for (const FunctionDefinition* function : m_Program->Functions) {
+            branches += CountBranches(function->Body);
+        }
+        m_RegionBase = sizeof(ProfileFormat::Header) + 2 * branches * sizeof(ProfileFormat::Record);
+    }
+
+    m_Asm.Emit("global _start\nsection .text\nextern print\n_start:");
+    if (instrumented) {
+        m_Asm.Emit("jmp __runtime_init\n__runtime_start:");
+    }
+    m_Asm.Emit("mov rbp, rsp");
+    if (instrumented) {
+        // the base of the counters and timers in every frame
+        m_Asm.Emit("mov r15, rbp");
+    }
+    const bool vectorized = HasVectorLoop(m_Program->GlobalBlock) ||
+                            std::ranges::any_of(m_Program->Functions,
+                                [](const FunctionDefinition* function) { return HasVectorLoop(function->Body); });
+    const bool checksAvx2 = vectorized && m_Options.Avx2;
+    if (checksAvx2) {
+        m_Asm.Emit("call __cpu_features");
+    }
+    m_Function = nullptr;
+    GenerateBlock(m_Program->GlobalBlock);
+    m_Asm.Emit("xor rdi, rdi");
+    GenerateExit();
+
+    for (const FunctionDefinition* function : m_Program->Functions) {
+        GenerateFunction(function);
+    }
+    if (m_Selector.ChecksBounds()) {
+        // an index out of bounds traps, as a division by zero does
+        m_Asm.Label(InstructionSelector::BoundsError);
+        m_Asm.Emit("ud2");
+    }
+    if (checksAvx2) {
+        GenerateCpuFeatures();
+    }
+
+    if (instrumented) {
+        GenerateRuntimeInit();
+    }
+    if (!m_Options.ProfileOutput.empty()) {
+        GenerateProfileWrite();
+    }
+    if (m_Options.ProfileCycles) {
+        GenerateRegionReport();
+    }
+    return m_Options.Schedule ? InstructionScheduler().Run(m_Asm.Text()) : m_Asm.Text();
+}
+
+std::string Generator::CreateLabel() {
+    return "label" + std::to_string(m_LabelCount++);
+}
+
+void Generator::GenerateBlock(const Block* scope) {
+    m_Scopes.EnterScope();
+    const int64_t stackBefore = m_Asm.StackSize();
+
+    for (const auto& item : scope->Items) {
+        std::visit(overloaded{ [&](const Statement* stmt) { GenerateStatement(stmt); },
+                       [&](const Declaration* decl) {
+                           m_Scopes.Insert(decl->Ident, { VARIABLE, Allocate(decl), decl });
+                       } },
+            item->Item);
+    }
+
+    m_Scopes.ExitScope();
+    m_Asm.Release(m_Asm.StackSize() - stackBefore);
+}
+
+int64_t Generator::Allocate(const Declaration* decl) {
+    if (decl->Size * 8 <= PageSize) {
+        return m_Asm.Allocate(std::max<int64_t>(decl->Size, 1));
+    }
+    // a large array is probed a page at a time from the top, so that one too large for the stack
+    // faults on the guard page below it instead of reaching past it
+    const int64_t slot = m_Asm.Allocate(decl->Size);
+    const std::string probe = CreateLabel();
+    m_Asm.Emit("mov rax, rsp");
+    m_Asm.Emit("add rax, {}", decl->Size * 8);
+    m_Asm.Label(probe);
+    m_Asm.Emit("sub rax, {}", PageSize);
+    m_Asm.Emit("mov qword [rax], 0");
+    m_Asm.Emit("cmp rax, rsp");
+    m_Asm.Emit("ja {}", probe);
+    return slot;
+}
+
+void Generator::GenerateFunction(const FunctionDefinition* function) {
+    static constexpr std::string_view Registers[] = { "rdi", "rsi", "rdx", "rcx", "r8", "r9" };
+
+    m_Function = function;
+    if (m_Options.CodeAlignment > 0) {
+        // only ever called, so the padding never runs
+        m_Asm.Align(m_Options.CodeAlignment);
+    }
+    m_Asm.Label("fn_" + function->Name);
+    m_Asm.Emit("push rbp");
+    m_Asm.Emit("mov rbp, rsp");
+    m_Asm.SetStackSize(0);
+
+    // the parameters get slots below the frame pointer like other variables, the ones passed on the
+    // stack copied from above the return address
+    m_Scopes.EnterScope();
+    for (size_t i = 0; i < function->Params.size(); i++) {
+        const Declaration* param = function->Params[i];
+        if (i < std::size(Registers)) {
+            m_Asm.Push(Registers[i]);
+        } else {
+            m_Asm.Push(std::format("qword [rbp + {}]", 16 + (i - std::size(Registers)) * 8));
+        }
+        m_Scopes.Insert(param->Ident, { VARIABLE, m_Asm.StackSize() - 1, param });
+    }
+    GenerateBlock(function->Body);
+    m_Scopes.ExitScope();
+
+    // falling off the end returns 0
+    m_Asm.Emit("xor rax, rax");
+    GenerateReturn();
+    m_Asm.SetStackSize(0);
+}
+
+void Generator::GenerateReturn() {
+    m_Asm.Emit("mov rsp, rbp");
+    m_Asm.Emit("pop rbp");
+    m_Asm.Emit("ret");
+}
+
+void Generator::GenerateBranch(const Expression* cond, bool jumpIf, const std::string& label) {
+    std::string_view cc = m_Selector.Condition(cond);
+    m_Asm.Emit("j{} {}", jumpIf ? cc : InstructionSelector::Negate(cc), label);
+}
+
+void Generator::GenerateExit() {
+    if (!m_Options.ProfileOutput.empty()) {
+        m_Asm.Emit("call __profile_write");
+    }
+    if (m_Options.ProfileCycles) {
+        m_Asm.Emit("call __regions_report");
+    }
+    m_Asm.Emit("mov rax, 60");
+    m_Asm.Emit("syscall");
+}
+
+void Generator::Count(SourceLocation loc, ProfileFormat::Counter kind) {
+    if (m_Options.ProfileOutput.empty()) {
+        return;
+    }
+    // the records follow the header at the frame pointer; see GenerateRuntimeInit
+    const size_t offset = sizeof(ProfileFormat::Header) + m_Counters.size() * sizeof(ProfileFormat::Record) +
+                          offsetof(ProfileFormat::Record, Count);
+    m_Counters.push_back({ ProfileFormat::SiteOf(loc), kind, 0 });
+    m_Asm.Emit("inc qword [r15 + {}]", offset);
+}
+
+std::optional<size_t> Generator::BeginRegion(const Statement* stmt) {
+    if (!m_Options.ProfileCycles) {
+        return std::nullopt;
+    }
+    SourceLocation loc;
+    bool loop = false;
+    if (auto* ifStmt = std::get_if<IfStatement*>(&stmt->Stmt)) {
+        loc = (*ifStmt)->Loc;
+    } else if (auto* whileStmt = std::get_if<WhileStatement*>(&stmt->Stmt)) {
+        loc = (*whileStmt)->Loc;
+        loop = true;
+    } else {
+        return std::nullopt;
+    }
+
+    // the copies of a statement made by the optimizer share its timer, and never nest in each other
+    const uint64_t site = ProfileFormat::SiteOf(loc);
+    auto [it, inserted] = m_RegionOfSite.try_emplace(site, m_Regions.size());
+    if (inserted) {
+        m_Regions.emplace_back(site, loop);
+    }
+    const size_t region = it->second;
+
+    m_Asm.Emit("rdtsc");
+    m_Asm.Emit("shl rdx, 32");
+    m_Asm.Emit("or rax, rdx");
+    m_Asm.Emit("mov qword [r15 + {}], rax", RegionOffset(region, offsetof(RegionTimer, Start)));
+    m_Asm.Emit("inc qword [r15 + {}]", RegionOffset(region, offsetof(RegionTimer, Runs)));
+    return region;
+}
+
+void Generator::EndRegion(size_t region) {
+    // rdtscp waits for the region's instructions to execute
+    m_Asm.Emit("rdtscp");
+    m_Asm.Emit("shl rdx, 32");
+    m_Asm.Emit("or rax, rdx");
+    m_Asm.Emit("sub rax, qword [r15 + {}]", RegionOffset(region, offsetof(RegionTimer, Start)));
+    m_Asm.Emit("add qword [r15 + {}], rax", RegionOffset(region, offsetof(RegionTimer, Cycles)));
+}
+
+// The timers follow the time stamp counter at the start of the program.
+size_t Generator::RegionOffset(size_t region, size_t field) const {
+    return m_RegionBase + sizeof(uint64_t) + region * sizeof(RegionTimer) + field;
+}
+
+void Generator::GenerateStatement(const Statement* stmt) {
+    EnsureStack([&] { GenerateStatementHere(stmt); });
+}
+
+void Generator::GenerateStatementHere(const Statement* stmt) {
+    // a region left by a return is not timed: the program exits there, or the function returns
+    const std::optional<size_t> region = BeginRegion(stmt);
+    std::visit(overloaded{ [&](const ExpressionStatement* exprStmt) { m_Selector.Execute(exprStmt->Expr); },
+                   [&](const ReturnStatement* retStmt) {
+                       if (retStmt->Expr) {
+                           m_Selector.Evaluate(retStmt->Expr);
+                       } else {
+                           m_Asm.Emit("xor rax, rax");
+                       }
+                       if (m_Function) {
+                           GenerateReturn();
+                       } else {
+                           m_Asm.Emit("mov rdi, rax");
+                           GenerateExit();
+                       }
+                   },
+                   [&](const IfStatement* ifStmt) {
+                       if (ifStmt->Select) {
+                           GenerateSelect(ifStmt);
+                           return;
+                       }
+                       const Profile::IfCounts* counts =
+                           m_Options.UseProfile ? m_Options.UseProfile->If(ifStmt->Loc) : nullptr;
+                       if (counts && counts->Then != counts->Else) {
+                           // a missing else-arm has no code to move
+                           const bool coldThen = counts->Then < counts->Else;
+                           if (coldThen || ifStmt->Else) {
+                               GenerateIfOutOfLine(ifStmt, coldThen);
+                               return;
+                           }
+                       }
+
+                       const std::string elseLabel = CreateLabel();
+                       const std::string endLabel = CreateLabel();
+
+                       GenerateBranch(ifStmt->Cond, false, elseLabel);
+
+                       const int64_t stackBefore = m_Asm.StackSize();
+
+                       // then-branch
+                       Count(ifStmt->Loc, ProfileFormat::Counter::IfThen);
+                       GenerateStatement(ifStmt->Then);
+                       const int64_t thenStack = m_Asm.StackSize();
+
+                       m_Asm.Emit("jmp " + endLabel);
+
+                       // else-branch
+                       m_Asm.Label(elseLabel);
+                       m_Asm.SetStackSize(stackBefore);
+                       Count(ifStmt->Loc, ProfileFormat::Counter::IfElse);
+                       if (ifStmt->Else) {
+                           GenerateStatement(ifStmt->Else);
+                       }
+
+                       const int64_t elseStack = m_Asm.StackSize();
+
+                       // enforce stack agreement
+                       if (thenStack != elseStack) {
+                           Error("Stack height mismatch between if branches");
+                       }
+
+                       // merged stack height
+                       m_Asm.SetStackSize(thenStack);
+
+                       // end
+                       m_Asm.Label(endLabel);
+                   },
+                   [&](const WhileStatement* whilStmt) {
+                       auto CountIteration = [&] {
+                           if (region) {
+                               m_Asm.Emit("inc qword [r15 + {}]",
+                                   RegionOffset(*region, offsetof(RegionTimer, Iterations)));
+                           }
+                       };
+                       if (whilStmt->Vector) {
+                           GenerateVectorLoop(*whilStmt->Vector, region);
+                       }
+                       const std::string startLabel = CreateLabel();
+                       const std::string endLabel = CreateLabel();
+
+                       Count(whilStmt->Loc, ProfileFormat::Counter::LoopEntry);
+                       if (whilStmt->Rotated) {
+                           // guard, then a do-while whose only branch per iteration is the back edge
+                           GenerateBranch(whilStmt->Cond, false, endLabel);
+
+                           const int64_t stackBefore = m_Asm.StackSize();
+
+                           AlignLoop(whilStmt->Loc);
+                           m_Asm.Label(startLabel);
+                           Count(whilStmt->Loc, ProfileFormat::Counter::LoopBody);
+                           CountIteration();
+                           GenerateStatement(whilStmt->Loop);
+
+                           GenerateBranch(whilStmt->Cond, true, startLabel);
+                           m_Asm.Label(endLabel);
+
+                           m_Asm.SetStackSize(stackBefore);
+                           return;
+                       }
+
+                       AlignLoop(whilStmt->Loc);
+                       m_Asm.Label(startLabel);
+
+                       GenerateBranch(whilStmt->Cond, false, endLabel);
+
+                       const int64_t stackBefore = m_Asm.StackSize();
+
+                       Count(whilStmt->Loc, ProfileFormat::Counter::LoopBody);
+                       CountIteration();
+                       GenerateStatement(whilStmt->Loop);
+
+                       m_Asm.Emit("jmp " + startLabel);
+                       m_Asm.Label(endLabel);
+
+                       m_Asm.SetStackSize(stackBefore);
+                   },
+                   [&](const Block* scope) { GenerateBlock(scope); } },
+        stmt->Stmt);
+    if (region) {
+        EndRegion(*region);
+    }
+}
+
+void Generator::AlignLoop(SourceLocation loc) {
+    const Profile::LoopCounts* counts = m_Options.UseProfile ? m_Options.UseProfile->Loop(loc) : nullptr;
+    if (m_Options.CodeAlignment > 0 && !(counts && counts->Iterations <= counts->Entries)) {
+        m_Asm.Align(m_Options.CodeAlignment);
+    }
+}
+
+void Generator::GenerateIfOutOfLine(const IfStatement* ifStmt, bool coldThen) {
+    const Statement* hot = coldThen ? ifStmt->Else : ifStmt->Then;
+    const Statement* cold = coldThen ? ifStmt->Then : ifStmt->Else;
+    const auto hotCounter = coldThen ? ProfileFormat::Counter::IfElse : ProfileFormat::Counter::IfThen;
+    const auto coldCounter = coldThen ? ProfileFormat::Counter::IfThen : ProfileFormat::Counter::IfElse;
+
+    const std::string coldLabel = CreateLabel();
+    const std::string endLabel = CreateLabel();
+
+    // the hot arm falls through from the branch into the code after the if, with no jump taken
+    GenerateBranch(ifStmt->Cond, coldThen, coldLabel);
+    const int64_t stackBefore = m_Asm.StackSize();
+
+    Count(ifStmt->Loc, hotCounter);
+    if (hot) {
+        GenerateStatement(hot);
+    }
+    m_Asm.Label(endLabel);
+    const int64_t hotStack = m_Asm.StackSize();
+
+    m_Asm.BeginCold();
+    m_Asm.Label(coldLabel);
+    m_Asm.SetStackSize(stackBefore);
+    Count(ifStmt->Loc, coldCounter);
+    GenerateStatement(cold);
+    if (m_Asm.StackSize() != hotStack) {
+        Error("Stack height mismatch between if branches");
+    }
+    m_Asm.Emit("jmp " + endLabel);
+    m_Asm.EndCold();
+
+    m_Asm.SetStackSize(hotStack);
+}
+
+void Generator::GenerateSelect(const IfStatement* ifStmt) {
+    const AssignmentExpression* then = AsSingleAssignment(ifStmt->Then);
+    const AssignmentExpression* other = ifStmt->Else ? AsSingleAssignment(ifStmt->Else) : nullptr;
+    const std::string slot = Assembly::Slot(m_Scopes.Lookup(*then->Ident).StackOffset);
+    const bool trace = !then->Decl->Synthetic;
+
+    // the values may read what the condition assigns, so such a condition is evaluated first;
+    // otherwise it is evaluated last, straight into the flags the cmov tests
+    const AssignmentExpression* cond = ifStmt->Cond->Expr;
+    const bool condFirst = cond->Ident || cond->Element || !IsSpeculatable(cond->Expr);
+    if (condFirst) {
+        m_Selector.Evaluate(ifStmt->Cond);
+        m_Asm.Spill("rax");
+    }
+
+    m_Selector.Evaluate(then->Expr);
+    m_Asm.Spill("rax");
+    if (other) {
+        m_Selector.Evaluate(other->Expr);
+        m_Asm.Spill("rax");
+    }
+
+    std::string_view cc;
+    if (condFirst) {
+        if (other) {
+            m_Asm.Pop("rdx");
+        }
+        m_Asm.Pop("rcx");
+        m_Asm.Pop("rax");
+        m_Asm.Emit("test rax, rax");
+        cc = "nz";
+    } else {
+        cc = m_Selector.Condition(ifStmt->Cond);
+        if (other) {
+            m_Asm.Pop("rdx");
+        }
+        m_Asm.Pop("rcx");
+    }
+
+    // neither mov nor pop changes the flags
+    m_Asm.Emit("mov rax, {}", other ? "rdx" : slot);
+    m_Asm.Emit("cmov{} rax, rcx", cc);
+
+    m_Asm.Emit("mov {}, rax", slot);
+    if (trace) {
+        m_Asm.Emit("mov rdi, rax");
+        m_Asm.Emit("call print");
+    }
+}
+
+void Generator::GenerateVectorLoop(const VectorLoop& plan, std::optional<size_t> region) {
+    const std::string sse = CreateLabel();
+    const std::string done = CreateLabel();
+    const std::string scalar = CreateLabel();
+
+    if (m_Options.Avx2) {
+        m_Asm.Emit("test r14, r14");
+        m_Asm.Emit("jz {}", sse);
+        GenerateVectorLanes(plan, true, scalar);
+        m_Asm.Emit("jmp {}", done);
+    }
+    m_Asm.Label(sse);
+    GenerateVectorLanes(plan, false, scalar);
+    m_Asm.Label(done);
+
+    // the counter stopped at rax; the iterations run print its values now, as nothing else they do prints
+    const std::string counter = Assembly::Slot(m_Scopes.Lookup(plan.Counter->Ident).StackOffset);
+    if (region) {
+        m_Asm.Emit("mov rdx, rax");
+        m_Asm.Emit("sub rdx, {}", counter);
+        m_Asm.Emit("add qword [r15 + {}], rdx", RegionOffset(*region, offsetof(RegionTimer, Iterations)));
+    }
+    if (plan.Counter->Synthetic) {
+        m_Asm.Emit("mov {}, rax", counter);
+    } else {
+        const std::string replay = CreateLabel();
+        m_Asm.Label(replay);
+        m_Asm.Emit("mov rdi, {}", counter);
+        m_Asm.Emit("inc rdi");
+        m_Asm.Emit("mov {}, rdi", counter);
+        m_Asm.Emit("call print");
+        m_Asm.Emit("cmp rdi, rax");
+        m_Asm.Emit("jne {}", replay);
+    }
+    m_Asm.Label(scalar);
+}
+
+void Generator::GenerateVectorLanes(const VectorLoop& plan, bool avx, const std::string& scalar) {
+    using Kind = VectorLoop::Node::Kind;
+    const int width = avx ? 4 : 2;
+    auto reg = [&](int r) { return VectorRegister(r, avx); };
+    auto slot = [&](const Declaration* decl) { return m_Scopes.Lookup(decl->Ident).StackOffset; };
+    auto broadcast = [&](int r) { // rdx to every lane
+        if (avx) {
+            m_Asm.Emit("vmovq {}, rdx", VectorRegister(r, false));
+            m_Asm.Emit("vpbroadcastq {}, {}", reg(r), VectorRegister(r, false));
+        } else {
+            m_Asm.Emit("movq {}, rdx", reg(r));
+            m_Asm.Emit("punpcklqdq {}, {}", reg(r), reg(r));
+        }
+    };
+
+    // the iterations filling whole vectors run the counter from rax up to rcx
+    m_Asm.Emit("mov rax, {}", Assembly::Slot(slot(plan.Counter)));
+    if (plan.Limit) {
+        m_Asm.Emit("mov rcx, {}", Assembly::Slot(slot(plan.Limit)));
+    } else {
+        m_Asm.Emit("mov rcx, {}", plan.Bound);
+    }
+    m_Asm.Emit("cmp rax, rcx");
+    m_Asm.Emit("jge {}", scalar);
+    m_Asm.Emit("sub rcx, rax");
+    m_Asm.Emit("and rcx, {}", -width);
+    m_Asm.Emit("jz {}", scalar);
+    m_Asm.Emit("add rcx, rax");
+
+    // if any of them would index out of bounds, the scalar loop runs them all and traps at it
+    for (const auto& [array, offset] : plan.Accesses) {
+        m_Asm.Emit("lea rdx, {}", Address("rax", offset));
+        m_Asm.Emit("cmp rdx, {}", array->Size);
+        m_Asm.Emit("jae {}", scalar);
+        m_Asm.Emit("lea rdx, {}", Address("rcx", offset - 1));
+        m_Asm.Emit("cmp rdx, {}", array->Size);
+        m_Asm.Emit("jae {}", scalar);
+    }
+
+    for (const VectorLoop::Node& node : plan.Nodes) {
+        if (node.Op == Kind::Broadcast) {
+            if (node.Var) {
+                m_Asm.Emit("mov rdx, {}", Assembly::Slot(slot(node.Var)));
+            } else {
+                m_Asm.Emit("mov rdx, {}", node.Value);
+            }
+            broadcast(node.Reg);
+        } else if (node.Op == Kind::Counter) {
+            // the counter of each lane, lane 0 lowest
+            for (int lane = width - 1; lane > 0; lane--) {
+                m_Asm.Emit("lea rdx, {}", Address("rax", lane));
+                m_Asm.Push("rdx");
+            }
+            m_Asm.Push("rax");
+            m_Asm.Emit("{} {}, [rsp]", avx ? "vmovdqu" : "movdqu", reg(node.Reg));
+            m_Asm.Release(width);
+        } else if (node.Reg >= 0) {
+            const int value = ComputeLanes(plan, node, plan.FirstTemporary, avx);
+            m_Asm.Emit("{} {}, {}", avx ? "vmovdqa" : "movdqa", reg(node.Reg), reg(value));
+        }
+    }
+    if (plan.Step >= 0) {
+        m_Asm.Emit("mov rdx, {}", width);
+        broadcast(plan.Step);
+    }
+    for (const VectorLoop::Store& store : plan.Stores) {
+        if (store.Reduction) {
+            const std::string acc = reg(store.Accumulator);
+            m_Asm.Emit(avx ? std::format("vpxor {0}, {0}, {0}", acc) : std::format("pxor {0}, {0}", acc));
+        }
+    }
+
+    const std::string loop = CreateLabel();
+    if (m_Options.CodeAlignment > 0) {
+        m_Asm.Align(m_Options.CodeAlignment);
+    }
+    m_Asm.Label(loop);
+    for (const VectorLoop::Store& store : plan.Stores) {
+        const int value = EvaluateLanes(plan, store.Value, plan.FirstTemporary, avx);
+        if (store.Reduction) {
+            const std::string acc = reg(store.Accumulator);
+            m_Asm.Emit(avx ? std::format("vpaddq {0}, {0}, {1}", acc, reg(value))
+                           : std::format("paddq {}, {}", acc, reg(value)));
+        } else {
+            // lane 0 of element counter + Offset, whose element 0 is at the slot
+            const std::string address = Address("rbp + rax*8", (store.Offset - slot(store.Array) - 1) * 8);
+            m_Asm.Emit("{} {}, {}", avx ? "vmovdqu" : "movdqu", address, reg(value));
+        }
+    }
+    for (const VectorLoop::Node& node : plan.Nodes) {
+        if (node.Op == Kind::Counter) {
+            m_Asm.Emit(avx ? std::format("vpaddq {0}, {0}, {1}", reg(node.Reg), reg(plan.Step))
+                           : std::format("paddq {}, {}", reg(node.Reg), reg(plan.Step)));
+        }
+    }
+    m_Asm.Emit("add rax, {}", width);
+    m_Asm.Emit("cmp rax, rcx");
+    m_Asm.Emit("jne {}", loop);
+
+    // the lanes of each reduction summed into its element
+    const std::string temp = VectorRegister(plan.FirstTemporary, false);
+    for (const VectorLoop::Store& store : plan.Stores) {
+        if (!store.Reduction) {
+            continue;
+        }
+        const std::string acc = VectorRegister(store.Accumulator, false);
+        if (avx) {
+            m_Asm.Emit("vextracti128 {}, {}, 1", temp, reg(store.Accumulator));
+            m_Asm.Emit("vpaddq {0}, {0}, {1}", acc, temp);
+            m_Asm.Emit("vpshufd {}, {}, 0xEE", temp, acc);
+            m_Asm.Emit("vpaddq {0}, {0}, {1}", acc, temp);
+            m_Asm.Emit("vmovq rdx, {}", acc);
+        } else {
+            m_Asm.Emit("pshufd {}, {}, 0xEE", temp, acc);
+            m_Asm.Emit("paddq {}, {}", acc, temp);
+            m_Asm.Emit("movq rdx, {}", acc);
+        }
+        m_Asm.Emit("{} {}, rdx", store.Subtract ? "sub" : "add", Assembly::Slot(slot(store.Array) - store.Offset));
+    }
+    if (avx) {
+        // leaves the upper halves clean, so that SSE code after it does not stall
+        m_Asm.Emit("vzeroupper");
+    }
+}
+
+int Generator::EvaluateLanes(const VectorLoop& plan, int node, int dst, bool avx) {
+    const VectorLoop::Node& n = plan.Nodes[node];
+    return n.Reg >= 0 ? n.Reg : ComputeLanes(plan, n, dst, avx);
+}
+
+int Generator::ComputeLanes(const VectorLoop& plan, const VectorLoop::Node& n, int dst, bool avx) {
+    using Kind = VectorLoop::Node::Kind;
+    auto reg = [&](int r) { return VectorRegister(r, avx); };
+    // dst = left op right
+    auto binary = [&](std::string_view op, int to, int left, int right) {
+        if (avx) {
+            m_Asm.Emit("v{} {}, {}, {}", op, reg(to), reg(left), reg(right));
+            return;
+        }
+        if (left != to) {
+            m_Asm.Emit("movdqa {}, {}", reg(to), reg(left));
+        }
+        m_Asm.Emit("{} {}, {}", op, reg(to), reg(right));
+    };
+    // to = from shifted by 32 bits
+    auto shift = [&](std::string_view op, int to, int from) {
+        if (avx) {
+            m_Asm.Emit("v{} {}, {}, 32", op, reg(to), reg(from));
+            return;
+        }
+        if (from != to) {
+            m_Asm.Emit("movdqa {}, {}", reg(to), reg(from));
+        }
+        m_Asm.Emit("{} {}, 32", op, reg(to));
+    };
+
+    switch (n.Op) {
+    case Kind::Broadcast:
+    case Kind::Counter: return n.Reg; // computed before the loop
+    case Kind::Load: {
+        const int64_t slot = m_Scopes.Lookup(n.Var->Ident).StackOffset;
+        const std::string address = Address("rbp + rax*8", (n.Value - slot - 1) * 8);
+        m_Asm.Emit("{} {}, {}", avx ? "vmovdqu" : "movdqu", reg(dst), address);
+        return dst;
+    }
+    case Kind::Add:
+    case Kind::Sub:
+    case Kind::Mul: break;
+    }
+
+    const int left = EnsureStack([&] { return EvaluateLanes(plan, n.Left, dst, avx); });
+    const int right = EvaluateLanes(plan, n.Right, dst + 1, avx);
+    if (n.Op != Kind::Mul) {
+        binary(n.Op == Kind::Add ? "paddq" : "psubq", dst, left, right);
+        return dst;
+    }
+
+    // there is no 64-bit lane multiply before AVX-512: with each operand in 32-bit halves,
+    // lo(a * b) = lo(a) * lo(b) + ((hi(a) * lo(b) + lo(a) * hi(b)) << 32)
+    const int high = right == dst + 1 ? dst + 2 : dst + 1;
+    const int cross = high + 1;
+    shift("psrlq", high, left);
+    binary("pmuludq", high, high, right);
+    shift("psrlq", cross, right);
+    binary("pmuludq", cross, cross, left);
+    binary("paddq", high, high, cross);
+    shift("psllq", high, high);
+    binary("pmuludq", dst, left, right);
+    binary("paddq", dst, dst, high);
+    return dst;
+}
+
+void Generator::GenerateCpuFeatures() {
+    // sets r14 to 1 if the processor has AVX2 and the operating system saves the ymm registers,
+    // and to 0 otherwise; cpuid overwrites rbx
+    const std::string done = "__cpu_features_done";
+    m_Asm.Label("__cpu_features");
+    m_Asm.Emit("push rbx");
+    m_Asm.Emit("xor r14, r14");
+    m_Asm.Emit("xor rax, rax");
+    m_Asm.Emit("cpuid");
+    m_Asm.Emit("cmp rax, 7");
+    m_Asm.Emit("jb {}", done);
+    m_Asm.Emit("mov rax, 1");
+    m_Asm.Emit("cpuid");
+    m_Asm.Emit("and rcx, 0x18000000"); // OSXSAVE and AVX
+    m_Asm.Emit("cmp rcx, 0x18000000");
+    m_Asm.Emit("jne {}", done);
+    m_Asm.Emit("xor rcx, rcx");
+    m_Asm.Emit("xgetbv");
+    m_Asm.Emit("and rax, 6"); // the xmm and ymm state
+    m_Asm.Emit("cmp rax, 6");
+    m_Asm.Emit("jne {}", done);
+    m_Asm.Emit("mov rax, 7");
+    m_Asm.Emit("xor rcx, rcx");
+    m_Asm.Emit("cpuid");
+    m_Asm.Emit("test rbx, 32"); // AVX2
+    m_Asm.Emit("jz {}", done);
+    m_Asm.Emit("mov r14, 1");
+    m_Asm.Label(done);
+    m_Asm.Emit("pop rbx");
+    m_Asm.Emit("ret");
+}
+
+void Generator::GenerateRuntimeInit() {
+    using ProfileFormat::Header;
+    using ProfileFormat::Record;
+    const size_t size = m_Options.ProfileCycles ? RegionOffset(m_Regions.size(), 0) : m_RegionBase;
+
+    // the counters and the timers, at zero, are laid out above the frame pointer
+    m_Asm.Label("__runtime_init");
+    m_Asm.Emit("sub rsp, {}", (size + 15) / 16 * 16);
+    if (!m_Options.ProfileOutput.empty()) {
+        m_Asm.Emit("mov rax, 0x{:x}", ProfileFormat::Magic);
+        m_Asm.Emit("mov qword [rsp + {}], rax", offsetof(Header, Magic));
+        m_Asm.Emit("mov qword [rsp + {}], {}", offsetof(Header, Records), m_Counters.size());
+        for (size_t i = 0; i < m_Counters.size(); i++) {
+            const size_t record = sizeof(Header) + i * sizeof(Record);
+            m_Asm.Emit("mov rax, {}", m_Counters[i].Site);
+            m_Asm.Emit("mov qword [rsp + {}], rax", record + offsetof(Record, Site));
+            m_Asm.Emit("mov qword [rsp + {}], {}", record + offsetof(Record, Kind),
+                static_cast<uint64_t>(m_Counters[i].Kind));
+            m_Asm.Emit("mov qword [rsp + {}], 0", record + offsetof(Record, Count));
+        }
+    }
+    if (m_Options.ProfileCycles) {
+        for (size_t i = 0; i < m_Regions.size(); i++) {
+            m_Asm.Emit("mov rax, {}", m_Regions[i].first);
+            m_Asm.Emit("mov qword [rsp + {}], rax", RegionOffset(i, offsetof(RegionTimer, Site)));
+            m_Asm.Emit("mov qword [rsp + {}], {}", RegionOffset(i, offsetof(RegionTimer, Loop)),
+                m_Regions[i].second ? 1 : 0);
+            for (size_t field : { offsetof(RegionTimer, Runs), offsetof(RegionTimer, Iterations),
+                     offsetof(RegionTimer, Cycles) }) {
+                m_Asm.Emit("mov qword [rsp + {}], 0", RegionOffset(i, field));
+            }
+        }
+        m_Asm.Emit("rdtsc");
+        m_Asm.Emit("shl rdx, 32");
+        m_Asm.Emit("or rax, rdx");
+        m_Asm.Emit("mov qword [rsp + {}], rax", m_RegionBase);
+    }
+    m_Asm.Emit("jmp __runtime_start");
+}
+
+void Generator::GenerateProfileWrite() {
+    using ProfileFormat::Header;
+    using ProfileFormat::Record;
+    const size_t size = sizeof(Header) + m_Counters.size() * sizeof(Record);
+
+    // called on exit, writes them to the profile file; keeps rdi, the exit status
+    m_Asm.Label("__profile_write");
+    m_Asm.Emit("push rdi");
+    std::string path = m_Options.ProfileOutput;
+    path.resize((path.size() / 8 + 1) * 8, '\0');
+    for (size_t chunk = path.size(); chunk > 0; chunk -= 8) {
+        uint64_t word;
+        std::memcpy(&word, path.data() + chunk - 8, sizeof(word));
+        m_Asm.Emit("mov rax, 0x{:x}", word);
+        m_Asm.Emit("push rax");
+    }
+    m_Asm.Emit("mov rax, 2"); // open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)
+    m_Asm.Emit("mov rdi, rsp");
+    m_Asm.Emit("mov rsi, {}", O_WRONLY | O_CREAT | O_TRUNC);
+    m_Asm.Emit("mov rdx, {}", 0644);
+    m_Asm.Emit("syscall");
+    m_Asm.Emit("add rsp, {}", path.size());
+    m_Asm.Emit("test rax, rax");
+    m_Asm.Emit("js __profile_done");
+    m_Asm.Emit("push rax");
+    m_Asm.Emit("mov rdi, rax"); // write(fd, rbp, size)
+    m_Asm.Emit("mov rax, 1");
+    m_Asm.Emit("mov rsi, rbp");
+    m_Asm.Emit("mov rdx, {}", size);
+    m_Asm.Emit("syscall");
+    m_Asm.Emit("pop rdi"); // close(fd)
+    m_Asm.Emit("mov rax, 3");
+    m_Asm.Emit("syscall");
+    m_Asm.Label("__profile_done");
+    m_Asm.Emit("pop rdi");
+    m_Asm.Emit("ret");
+}
+
+// Called on exit, prints the timers that ran, the most cycles first, to stderr; keeps rdi, the exit
+// status. The cycles of a region include those of the regions nested in it.
+void Generator::GenerateRegionReport() {
+    const size_t first = RegionOffset(0, 0);
+    const size_t last = RegionOffset(m_Regions.size(), 0);
+    const size_t cycles = offsetof(RegionTimer, Cycles);
+
+    // append to the line at rdi
+    auto text = [&](std::string_view chunk) {
+        for (size_t i = 0; i < chunk.size(); i += 8) {
+            uint64_t word = 0;
+            const size_t n = std::min<size_t>(8, chunk.size() - i);
+            std::memcpy(&word, chunk.data() + i, n);
+            m_Asm.Emit("mov rax, 0x{:x}", word);
+            m_Asm.Emit("mov qword [rdi], rax");
+            m_Asm.Emit("add rdi, {}", n);
+        }
+    };
+    auto number = [&](std::string_view value) {
+        m_Asm.Emit("mov rax, {}", value);
+        m_Asm.Emit("call __regions_number");
+    };
+    auto character = [&](char c) {
+        m_Asm.Emit("mov byte [rdi], {}", static_cast<int>(c));
+        m_Asm.Emit("inc rdi");
+    };
+    // write(2, r13, rdi - r13)
+    auto flush = [&] {
+        m_Asm.Emit("mov rax, 1");
+        m_Asm.Emit("mov rsi, r13");
+        m_Asm.Emit("mov rdx, rdi");
+        m_Asm.Emit("sub rdx, r13");
+        m_Asm.Emit("mov rdi, 2");
+        m_Asm.Emit("syscall");
+    };
+
+    m_Asm.Label("__regions_report");
+    m_Asm.Emit("push rdi");
+    // the cycles of the whole run, which the percentages are of, at least 1 as it is divided by
+    m_Asm.Emit("rdtscp");
+    m_Asm.Emit("shl rdx, 32");
+    m_Asm.Emit("or rax, rdx");
+    m_Asm.Emit("sub rax, qword [rbp + {}]", m_RegionBase);
+    m_Asm.Emit("cmp rax, 1");
+    m_Asm.Emit("adc rax, 0");
+    m_Asm.Emit("mov rbx, rax");
+
+    // selection sort, r8 the first unsorted timer and r9 the one with the most cycles after it
+    m_Asm.Emit("lea r8, [rbp + {}]", first);
+    m_Asm.Label("__regions_sort");
+    m_Asm.Emit("lea r11, [rbp + {}]", last);
+    m_Asm.Emit("cmp r8, r11");
+    m_Asm.Emit("jae __regions_sorted");
+    m_Asm.Emit("mov r9, r8");
+    m_Asm.Emit("lea r10, [r8 + {}]", sizeof(RegionTimer));
+    m_Asm.Label("__regions_max");
+    m_Asm.Emit("cmp r10, r11");
+    m_Asm.Emit("jae __regions_swap");
+    m_Asm.Emit("mov rax, qword [r10 + {}]", cycles);
+    m_Asm.Emit("cmp rax, qword [r9 + {}]", cycles);
+    m_Asm.Emit("jbe __regions_less");
+    m_Asm.Emit("mov r9, r10");
+    m_Asm.Label("__regions_less");
+    m_Asm.Emit("add r10, {}", sizeof(RegionTimer));
+    m_Asm.Emit("jmp __regions_max");
+    m_Asm.Label("__regions_swap");
+    for (size_t field = 0; field < sizeof(RegionTimer); field += sizeof(uint64_t)) {
+        m_Asm.Emit("mov rax, qword [r8 + {}]", field);
+        m_Asm.Emit("mov rcx, qword [r9 + {}]", field);
+        m_Asm.Emit("mov qword [r8 + {}], rcx", field);
+        m_Asm.Emit("mov qword [r9 + {}], rax", field);
+    }
+    m_Asm.Emit("add r8, {}", sizeof(RegionTimer));
+    m_Asm.Emit("jmp __regions_sort");
+    m_Asm.Label("__regions_sorted");
+
+    // one line per timer that ran, built at r13 on the stack
+    m_Asm.Emit("sub rsp, 256");
+    m_Asm.Emit("mov r13, rsp");
+    m_Asm.Emit("mov rdi, r13");
+    text("cycles\t%\truns\titerations\tregion\n");
+    flush();
+    m_Asm.Emit("lea r12, [rbp + {}]", first);
+    m_Asm.Label("__regions_line");
+    m_Asm.Emit("lea rax, [rbp + {}]", last);
+    m_Asm.Emit("cmp r12, rax");
+    m_Asm.Emit("jae __regions_done");
+    m_Asm.Emit("cmp qword [r12 + {}], 0", offsetof(RegionTimer, Runs));
+    m_Asm.Emit("je __regions_next");
+    m_Asm.Emit("mov rdi, r13");
+    number(std::format("qword [r12 + {}]", cycles));
+    character('\t');
+    m_Asm.Emit("mov rax, qword [r12 + {}]", cycles);
+    m_Asm.Emit("mov rcx, 100");
+    m_Asm.Emit("mul rcx");
+    m_Asm.Emit("div rbx");
+    m_Asm.Emit("call __regions_number");
+    character('\t');
+    number(std::format("qword [r12 + {}]", offsetof(RegionTimer, Runs)));
+    character('\t');
+    m_Asm.Emit("cmp qword [r12 + {}], 0", offsetof(RegionTimer, Loop));
+    m_Asm.Emit("je __regions_no_iterations");
+    number(std::format("qword [r12 + {}]", offsetof(RegionTimer, Iterations)));
+    m_Asm.Emit("jmp __regions_site");
+    m_Asm.Label("__regions_no_iterations");
+    character('-');
+    m_Asm.Label("__regions_site");
+    character('\t');
+    m_Asm.Emit("mov rax, qword [r12 + {}]", offsetof(RegionTimer, Site));
+    m_Asm.Emit("shr rax, 32");
+    m_Asm.Emit("call __regions_number");
+    character(':');
+    m_Asm.Emit("mov rax, qword [r12 + {}]", offsetof(RegionTimer, Site));
+    m_Asm.Emit("mov eax, eax");
+    m_Asm.Emit("call __regions_number");
+    m_Asm.Emit("cmp qword [r12 + {}], 0", offsetof(RegionTimer, Loop));
+    m_Asm.Emit("je __regions_if");
+    text(" while\n");
+    m_Asm.Emit("jmp __regions_write");
+    m_Asm.Label("__regions_if");
+    text(" if\n");
+    m_Asm.Label("__regions_write");
+    flush();
+    m_Asm.Label("__regions_next");
+    m_Asm.Emit("add r12, {}", sizeof(RegionTimer));
+    m_Asm.Emit("jmp __regions_line");
+    m_Asm.Label("__regions_done");
+    m_Asm.Emit("add rsp, 256");
+    m_Asm.Emit("pop rdi");
+    m_Asm.Emit("ret");
+
+    // writes rax in decimal at rdi, and moves rdi past it; the digits are pushed lowest first
+    m_Asm.Label("__regions_number");
+    m_Asm.Emit("mov rcx, 10");
+    m_Asm.Emit("xor rsi, rsi");
+    m_Asm.Label("__regions_digit");
+    m_Asm.Emit("xor rdx, rdx");
+    m_Asm.Emit("div rcx");
+    m_Asm.Emit("add rdx, {}", static_cast<int>('0'));
+    m_Asm.Emit("push rdx");
+    m_Asm.Emit("inc rsi");
+    m_Asm.Emit("test rax, rax");
+    m_Asm.Emit("jnz __regions_digit");
+    m_Asm.Label("__regions_digits");
+    m_Asm.Emit("pop rax");
+    m_Asm.Emit("mov byte [rdi], al");
+    m_Asm.Emit("inc rdi");
+    m_Asm.Emit("dec rsi");
+    m_Asm.Emit("jnz __regions_digits");
+    m_Asm.Emit("ret");
+}
+
 } // namespace Compiler
\ No newline at end of file
@@ -1,42 +1,95 @@
 #pragma once
 
+#include "assembly.h"
 #include "ast.h"
+#include "instruction_selector.h"
+#include "loop_vectorizer.h"
+#include "profile.h"
 #include "utils.h"
+#include <optional>
 #include <unordered_map>
 
 namespace Compiler {
 
 class ScopeStack;
 
+// See the options of the same names in DriverOptions and OptimizationOptions.
+struct GeneratorOptions {
+    const Profile* UseProfile = nullptr;
+    std::string ProfileOutput;
+    bool ProfileCycles = false;
+    bool Schedule = false;
+    int CodeAlignment = 0;
+    bool Avx2 = true;
+};
+
+// Lowers a program to assembly. With a profile, the arm of an if that ran less often is moved out
+// of line. With a profile output, the program is instrumented: it counts how often the arms of
+// each if and the body of each loop run, and writes the counts there when it exits (see
+// ProfileFormat). With ProfileCycles, it times each if and loop with the time stamp counter and
+// prints the regions that took the most cycles to stderr when it exits. The counts and timers
+// live above main's frame pointer, below the program's own stack, and are addressed through r15 so
+// that functions reach them too. A region re-entered by a recursive call restarts its timer, so
+// the cycles of such regions are undercounted.
+//
+// Functions follow main, each labelled fn_<name>, with a frame of their own: rbp is pushed and
+// the parameters are copied into slots below it, so they are addressed like any other variable.
+//
+// Loop headers and functions start on a multiple of CodeAlignment bytes, so that a short loop
+// body is fetched and decoded in as few blocks as it fits in; with a profile, loops that ran at
+// most once each time they were entered are left unaligned. With Schedule, the instructions of
+// each basic block are then reordered for their latencies (see InstructionScheduler).
+//
+// A loop with a SIMD form (see LoopVectorizer) runs it first, with AVX2 when the processor and the
+// operating system support it and with SSE2, which every x86-64 processor has, otherwise. The
+// program checks for AVX2 once when it starts and keeps the answer in r14. Without Avx2, vector
+// loops only have their SSE2 form and nothing is checked.
 class Generator {
   public:
-    explicit Generator(Program* prog, ScopeStack& scopes);
+    Generator(Program* prog, ScopeStack& scopes, GeneratorOptions options = {});
     std::string GenerateAsm();
+    CodeStatistics Statistics() const { return m_Asm.Statistics(); }
 
   private:
-
-    void Push(const std::string& reg);
-    void Pop(const std::string& reg);
-
     std::string CreateLabel();
 
-    void DebugPrint(const std::string& reg);
-
-    void GeneratePrimary(const Primary* primary);
-    void GeneratePostfixExpression(const PostfixExpression* expr);
-    void GenerateMultiplicativeExpression(const MultiplicativeExpression* expr);
-    void GenerateAdditiveExpression(const AdditiveExpression* expr);
-    void GenerateRelationalExpression(const RelationalExpression* expr);
-    void GenerateEqualityExpression(const EqualityExpression* expr);
-    void GenerateExpression(const Expression* expr);
+    void GenerateFunction(const FunctionDefinition* function);
+    void GenerateReturn(); // with the value in rax
     void GenerateBlock(const Block* expr);
+    int64_t Allocate(const Declaration* decl); // the slot of the variable, or of an array's element 0
     void GenerateStatement(const Statement* stmt);
+    void GenerateStatementHere(const Statement* stmt); // on the current stack
+    void GenerateBranch(const Expression* cond, bool jumpIf, const std::string& label);
+    void AlignLoop(SourceLocation loc); // pads the code before the header of the loop at loc
+    void GenerateIfOutOfLine(const IfStatement* ifStmt, bool coldThen);
+    void GenerateSelect(const IfStatement* ifStmt);
+    void GenerateExit(); // with the status in rdi
+    void GenerateVectorLoop(const VectorLoop& plan, std::optional<size_t> region);
+    void GenerateVectorLanes(const VectorLoop& plan, bool avx, const std::string& scalar);
+    int EvaluateLanes(const VectorLoop& plan, int node, int dst, bool avx); // the register holding the value
+    int ComputeLanes(const VectorLoop& plan, const VectorLoop::Node& node, int dst, bool avx);
+    void GenerateCpuFeatures();
+
+    void Count(SourceLocation loc, ProfileFormat::Counter kind);
+    std::optional<size_t> BeginRegion(const Statement* stmt);
+    void EndRegion(size_t region);
+    size_t RegionOffset(size_t region, size_t field) const;
+    void GenerateRuntimeInit();
+    void GenerateProfileWrite();
+    void GenerateRegionReport();
 
     const Program* m_Program;
-    std::string m_Output;
-    int64_t m_StackSize = 0;
+    Assembly m_Asm;
+    InstructionSelector m_Selector;
 
     int m_LabelCount = 0;
+    const FunctionDefinition* m_Function = nullptr; // being generated, null in the main block
+
+    GeneratorOptions m_Options;
+    std::vector<ProfileFormat::Record> m_Counters;
+    size_t m_RegionBase = 0; // the offset of the timers, after room for every counter
+    std::vector<std::pair<uint64_t, bool>> m_Regions; // the site of each timer, and if it is a loop's
+    std::unordered_map<uint64_t, size_t> m_RegionOfSite;
 
     ScopeStack& m_Scopes;
 };
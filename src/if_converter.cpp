@@ -0,0 +1,102 @@
+#include "if_converter.h"
+#include "ast_utils.h"
+#include "profile.h"
+#include "remarks.h"
+#include "stack.h"
+#include <algorithm>
+#include <format>
+
+namespace Compiler {
+
+IfConverter::IfConverter(
+    Block* body, const OptimizationOptions& options, const Profile* profile, Remarks& remarks)
+    : m_Body(body), m_Options(options), m_Profile(profile), m_Remarks(remarks) {}
+
+void IfConverter::Run() {
+    for (auto* item : m_Body->Items) {
+        if (auto* stmt = std::get_if<Statement*>(&item->Item)) {
+            VisitStatement(*stmt);
+        }
+    }
+}
+
+void IfConverter::VisitStatement(Statement* stmt) {
+    EnsureStack([&] { VisitStatementHere(stmt); });
+}
+
+void IfConverter::VisitStatementHere(Statement* stmt) {
+    std::visit(overloaded{ [&](ExpressionStatement*) {}, [&](ReturnStatement*) {},
+                   [&](IfStatement* ifStmt) {
+                       TryConvert(ifStmt);
+                       if (!ifStmt->Select) {
+                           VisitStatement(ifStmt->Then);
+                           if (ifStmt->Else) {
+                               VisitStatement(ifStmt->Else);
+                           }
+                       }
+                   },
+                   [&](WhileStatement* whileStmt) { VisitStatement(whileStmt->Loop); },
+                   [&](Block* block) {
+                       for (auto* item : block->Items) {
+                           if (auto* s = std::get_if<Statement*>(&item->Item)) {
+                               VisitStatement(*s);
+                           }
+                       }
+                   } },
+        stmt->Stmt);
+}
+
+void IfConverter::TryConvert(IfStatement* ifStmt) {
+    const SourceLocation loc = ifStmt->Loc;
+
+    const AssignmentExpression* then = AsSingleAssignment(ifStmt->Then);
+    const AssignmentExpression* other = ifStmt->Else ? AsSingleAssignment(ifStmt->Else) : nullptr;
+    if (!then || (ifStmt->Else && !other)) {
+        m_Remarks.Missed("if-conversion", loc, "if not converted: an arm is not a single assignment");
+        return;
+    }
+    if (other && other->Decl != then->Decl) {
+        m_Remarks.Missed("if-conversion", loc, "if not converted: the arms assign different variables");
+        return;
+    }
+    if (!other && !then->Decl->Synthetic) {
+        // x = c ? v : x would trace x on the path that did not assign it
+        m_Remarks.Missed("if-conversion", loc, "if not converted: the assignment is traced on one path only");
+        return;
+    }
+    if (!IsSpeculatable(then->Expr) || (other && !IsSpeculatable(other->Expr))) {
+        m_Remarks.Missed("if-conversion", loc, "if not converted: an arm may trap or have side effects");
+        return;
+    }
+
+    // both values are always computed; a branch costs nothing extra when it predicts well, so
+    // only cheap arms are worth trading for a possible misprediction
+    int budget = m_Options.IfConversionBudget;
+    const Profile::IfCounts* counts = m_Profile ? m_Profile->If(loc) : nullptr;
+    if (counts && counts->Then + counts->Else > 0) {
+        // one way at least 9 times out of 10 predicts well; otherwise mispredictions are frequent
+        const uint64_t total = counts->Then + counts->Else;
+        const uint64_t majority = std::max(counts->Then, counts->Else);
+        if (majority * 10 >= total * 9) {
+            m_Remarks.Missed("if-conversion", loc,
+                std::format("if not converted: its branch went the same way {}% of the time in the profile",
+                    majority * 100 / total));
+            return;
+        }
+        budget *= 2;
+    }
+
+    const int cost = EstimateCost(then->Expr) + (other ? EstimateCost(other->Expr) : 1);
+    if (cost > budget) {
+        m_Remarks.Missed("if-conversion", loc,
+            std::format("if not converted: arms cost {} exceeds the budget of {}", cost, budget));
+        return;
+    }
+
+    ifStmt->Select = true;
+    m_Remarks.Passed("if-conversion", loc,
+        std::format("converted if into a conditional move of '{}' (arms cost {}, budget {})", *then->Ident, cost,
+            budget));
+}
+
+} // namespace Compiler
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "ast.h"
+#include "options.h"
+
+namespace Compiler {
+
+class Profile;
+class Remarks;
+
+// If-conversion: an if/else whose arms each assign one value to the same variable becomes a
+// select, lowered by the generator as a compare and a conditional move instead of branches.
+// Both values are computed up front, so they must be speculatable and cheap. With a profile, an if
+// whose branch nearly always went the same way is left alone, as it predicts well.
+class IfConverter {
+  public:
+    IfConverter(Block* body, const OptimizationOptions& options, const Profile* profile, Remarks& remarks);
+    void Run();
+
+  private:
+    void VisitStatement(Statement* stmt);
+    void VisitStatementHere(Statement* stmt); // on the current stack
+    void TryConvert(IfStatement* ifStmt);
+
+    Block* m_Body;
+    const OptimizationOptions& m_Options;
+    const Profile* m_Profile;
+    Remarks& m_Remarks;
+};
+
+} // namespace Compiler
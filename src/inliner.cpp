@@ -0,0 +1,341 @@
+#include "inliner.h"
+#include "ast_utils.h"
+#include "remarks.h"
+#include "stack.h"
+#include <algorithm>
+#include <format>
+
+namespace Compiler {
+
+namespace {
+
+// The functions an expression calls, in the order of their first call, and the variables it
+// assigns.
+struct Effects {
+    std::vector<const FunctionDefinition*> Calls;
+    std::unordered_set<const Declaration*> Assigned;
+};
+
+template <typename T>
+void Collect(const T* expr, Effects& effects) {
+    if constexpr (std::is_same_v<T, AssignmentExpression>) {
+        if (expr->Ident) {
+            effects.Assigned.insert(expr->Decl);
+        } else if (expr->Element) {
+            Collect(expr->Element->Index->Expr, effects);
+        }
+        EnsureStack([&] { Collect(expr->Expr, effects); });
+    } else if constexpr (std::is_same_v<T, Primary>) {
+        if (const auto* e = std::get_if<Expression*>(&expr->Value)) {
+            Collect((*e)->Expr, effects);
+        } else if (const auto* element = std::get_if<Subscript*>(&expr->Value)) {
+            Collect((*element)->Index->Expr, effects);
+        }
+    } else if constexpr (std::is_same_v<T, PostfixExpression>) {
+        Collect(expr->Prim, effects);
+        if (expr->Callee && std::ranges::find(effects.Calls, expr->Callee) == effects.Calls.end()) {
+            effects.Calls.push_back(expr->Callee);
+        }
+        for (const auto& args : expr->CallList) {
+            for (const auto* arg : args) {
+                Collect(arg, effects);
+            }
+        }
+    } else {
+        Collect(expr->Left, effects);
+        for (const auto& [op, right] : expr->Right) {
+            Collect(right, effects);
+        }
+    }
+}
+
+Effects EffectsOf(const Block* block) {
+    Effects effects;
+    for (auto* item : block->Items) {
+        if (auto* stmt = std::get_if<Statement*>(&item->Item)) {
+            ForEachExpression(*stmt, [&](Expression* expr) { Collect(expr->Expr, effects); });
+        }
+    }
+    return effects;
+}
+
+size_t CountReturns(const Block* block);
+
+size_t CountReturns(const Statement* stmt) {
+    return EnsureStack([&] {
+        return std::visit(
+            overloaded{ [&](const ReturnStatement*) -> size_t { return 1; },
+                [&](const IfStatement* ifStmt) {
+                    const size_t count = CountReturns(ifStmt->Then);
+                    return ifStmt->Else ? count + CountReturns(ifStmt->Else) : count;
+                },
+                [&](const WhileStatement* whileStmt) { return CountReturns(whileStmt->Loop); },
+                [&](const Block* block) { return CountReturns(block); },
+                [&](const ExpressionStatement*) -> size_t { return 0; } },
+            stmt->Stmt);
+    });
+}
+
+size_t CountReturns(const Block* block) {
+    size_t count = 0;
+    for (const auto* item : block->Items) {
+        if (auto* stmt = std::get_if<Statement*>(&item->Item)) {
+            count += CountReturns(*stmt);
+        }
+    }
+    return count;
+}
+
+// The return that ends block, directly or as the end of a block ending it, if there is one; path
+// gets the blocks from block to the one holding it.
+ReturnStatement* FinalReturn(Block* block, std::vector<Block*>& path) {
+    path.push_back(block);
+    if (block->Items.empty()) {
+        return nullptr;
+    }
+    auto* last = std::get_if<Statement*>(&block->Items.back()->Item);
+    if (!last) {
+        return nullptr;
+    }
+    if (auto* ret = std::get_if<ReturnStatement*>(&(*last)->Stmt)) {
+        return *ret;
+    }
+    if (auto* inner = std::get_if<Block*>(&(*last)->Stmt)) {
+        return EnsureStack([&] { return FinalReturn(*inner, path); });
+    }
+    return nullptr;
+}
+
+int BodyCost(const Block* block) {
+    int cost = 0;
+    for (auto* item : block->Items) {
+        if (auto* stmt = std::get_if<Statement*>(&item->Item)) {
+            cost += EstimateCost(*stmt);
+        }
+    }
+    return cost;
+}
+
+// The call a value consists of, if it is one.
+template <typename T>
+PostfixExpression* AsCall(T* expr) {
+    if constexpr (std::is_same_v<T, PostfixExpression>) {
+        return expr->Callee ? expr : nullptr;
+    } else {
+        return expr->Right.empty() ? AsCall(expr->Left) : nullptr;
+    }
+}
+
+} // namespace
+
+Inliner::Inliner(Program* prog, AstBuilder& builder, const OptimizationOptions& options, Remarks& remarks)
+    : m_Program(prog), m_Builder(builder), m_Options(options), m_Remarks(remarks) {}
+
+void Inliner::Run() {
+    for (const FunctionDefinition* function : m_Program->Functions) {
+        Effects effects = EffectsOf(function->Body);
+        m_Callees[function] = std::move(effects.Calls);
+        m_Assigned[function] = std::move(effects.Assigned);
+    }
+
+    for (const FunctionDefinition* function : m_Program->Functions) {
+        Visit(function);
+    }
+    VisitBlock(m_Program->GlobalBlock);
+    DropUncalled();
+}
+
+void Inliner::Visit(const FunctionDefinition* function) {
+    if (!m_Visited.insert(function).second) {
+        return;
+    }
+    EnsureStack([&] {
+        for (const FunctionDefinition* callee : m_Callees[function]) {
+            Visit(callee);
+        }
+    });
+    VisitBlock(function->Body);
+}
+
+void Inliner::VisitBlock(Block* block) {
+    for (auto* item : block->Items) {
+        if (auto* stmt = std::get_if<Statement*>(&item->Item)) {
+            VisitStatement(*stmt);
+        }
+    }
+}
+
+void Inliner::VisitStatement(Statement* stmt) {
+    EnsureStack([&] { VisitStatementHere(stmt); });
+}
+
+void Inliner::VisitStatementHere(Statement* stmt) {
+    std::visit(overloaded{ [&](ExpressionStatement*) { TryInline(stmt); },
+                   [&](ReturnStatement*) { TryInline(stmt); },
+                   [&](IfStatement* ifStmt) {
+                       VisitStatement(ifStmt->Then);
+                       if (ifStmt->Else) {
+                           VisitStatement(ifStmt->Else);
+                       }
+                   },
+                   [&](WhileStatement* whileStmt) { VisitStatement(whileStmt->Loop); },
+                   [&](Block* block) { VisitBlock(block); } },
+        stmt->Stmt);
+}
+
+void Inliner::TryInline(Statement* stmt) {
+    // x = f(...);, f(...); or return f(...); but not a[i] = f(...);
+    AssignmentExpression* assign;
+    SourceLocation loc;
+    bool returns = false;
+    if (auto* exprStmt = std::get_if<ExpressionStatement*>(&stmt->Stmt)) {
+        assign = (*exprStmt)->Expr->Expr;
+        loc = (*exprStmt)->Loc;
+    } else {
+        ReturnStatement* retStmt = std::get<ReturnStatement*>(stmt->Stmt);
+        if (!retStmt->Expr) {
+            return;
+        }
+        assign = retStmt->Expr->Expr;
+        loc = retStmt->Loc;
+        returns = true;
+    }
+    PostfixExpression* call = AsCall(assign->Expr);
+    if (!call || assign->Element || (returns && assign->Ident)) {
+        return;
+    }
+    const FunctionDefinition* callee = call->Callee;
+    if (auto obstacle = Obstacle(callee)) {
+        m_Remarks.Missed("inline", loc, std::format("'{}' not inlined: {}", callee->Name, *obstacle));
+        return;
+    }
+
+    Block* block = m_Builder.Make<Block>();
+    auto statement = [&](Expression* expr) {
+        Statement* s = m_Builder.ExpressionStmt(expr);
+        std::get<ExpressionStatement*>(s->Stmt)->Loc = loc;
+        return m_Builder.Item(s);
+    };
+    // the value of an argument or of the returned expression, to be assigned to another variable
+    auto value = [&](AssignmentExpression* expr) {
+        if (!expr->Ident && !expr->Element) {
+            return expr->Expr;
+        }
+        return m_Builder.Wrap<EqualityExpression>(m_Builder.Make<Primary>(m_Builder.Make<Expression>(expr)));
+    };
+
+    // the arguments are evaluated in order, before the body, into the variables standing for the
+    // parameters
+    AstBuilder::DeclarationMap renames;
+    const auto& args = call->CallList.front();
+    for (size_t i = 0; i < args.size(); ++i) {
+        Declaration* param = m_Builder.CreateTemporary("arg");
+        renames[callee->Params[i]] = param;
+        block->Items.push_back(m_Builder.Item(param));
+        block->Items.push_back(statement(m_Builder.Assign(param, value(args[i]))));
+    }
+    Block* body = m_Builder.CloneRenaming(callee->Body, std::move(renames));
+    block->Items.push_back(m_Builder.Item(m_Builder.Make<Statement>(body)));
+
+    // the final return stays a return for return f(...); otherwise it becomes an assignment of its
+    // value, or a statement evaluating it if that has effects
+    std::vector<Block*> path;
+    ReturnStatement* ret = FinalReturn(body, path);
+    if (!returns) {
+        AssignmentExpression* result = ret && ret->Expr ? ret->Expr->Expr : nullptr;
+        if (ret) {
+            path.back()->Items.pop_back();
+        }
+        if (assign->Ident) {
+            // the returned value is computed where the callee's names are in scope, which may hide x
+            const bool hidden = std::ranges::any_of(path, [&](const Block* b) {
+                return std::ranges::any_of(b->Items, [&](const BlockItem* item) {
+                    auto* decl = std::get_if<Declaration*>(&item->Item);
+                    return decl && (*decl)->Ident == *assign->Ident;
+                });
+            });
+            const Declaration* target = assign->Decl;
+            if (hidden) {
+                Declaration* temp = m_Builder.CreateTemporary("ret");
+                block->Items.insert(block->Items.end() - 1, m_Builder.Item(temp));
+                target = temp;
+            }
+            EqualityExpression* returned =
+                result ? value(result) : m_Builder.Wrap<EqualityExpression>(m_Builder.Literal(0));
+            path.back()->Items.push_back(statement(m_Builder.Assign(target, returned)));
+            if (hidden) {
+                auto* copy = m_Builder.Wrap<EqualityExpression>(m_Builder.Var(target));
+                block->Items.push_back(statement(m_Builder.Assign(assign->Decl, copy)));
+            }
+        } else if (result && (result->Ident || result->Element || !IsSpeculatable(result->Expr))) {
+            path.back()->Items.push_back(statement(m_Builder.Make<Expression>(result)));
+        }
+    } else if (!ret) {
+        // a function without a return returns 0
+        auto* zero = m_Builder.Make<ReturnStatement>(
+            m_Builder.Value(m_Builder.Wrap<EqualityExpression>(m_Builder.Literal(0))));
+        zero->Loc = loc;
+        block->Items.push_back(m_Builder.Item(m_Builder.Make<Statement>(zero)));
+    }
+
+    stmt->Stmt = block;
+    m_Remarks.Passed("inline", loc,
+        std::format("inlined '{}' (cost {}, budget {})", callee->Name, BodyCost(callee->Body),
+            m_Options.InlineBudget));
+}
+
+std::optional<std::string> Inliner::Obstacle(const FunctionDefinition* function) {
+    auto [it, inserted] = m_Obstacles.try_emplace(function);
+    std::optional<std::string>& obstacle = it->second;
+    if (!inserted) {
+        return obstacle;
+    }
+
+    // recursive if it is reachable from its callees
+    std::vector<const FunctionDefinition*> work = m_Callees[function];
+    std::unordered_set<const FunctionDefinition*> seen(work.begin(), work.end());
+    bool recursive = false;
+    while (!work.empty() && !recursive) {
+        const FunctionDefinition* next = work.back();
+        work.pop_back();
+        recursive = next == function;
+        for (const FunctionDefinition* callee : m_Callees[next]) {
+            if (seen.insert(callee).second) {
+                work.push_back(callee);
+            }
+        }
+    }
+
+    const auto& assigned = m_Assigned[function];
+    auto param = std::ranges::find_if(function->Params, [&](auto* p) { return assigned.contains(p); });
+    std::vector<Block*> path;
+    const size_t returns = CountReturns(function->Body);
+    const int cost = BodyCost(function->Body);
+    if (recursive) {
+        obstacle = "it is recursive";
+    } else if (param != function->Params.end()) {
+        obstacle = std::format("it assigns its parameter '{}'", (*param)->Ident);
+    } else if (returns > (FinalReturn(function->Body, path) ? 1 : 0)) {
+        obstacle = "it returns before its end";
+    } else if (cost > m_Options.InlineBudget) {
+        obstacle = std::format("its cost {} exceeds the budget of {}", cost, m_Options.InlineBudget);
+    }
+    return obstacle;
+}
+
+void Inliner::DropUncalled() {
+    std::vector<const FunctionDefinition*> work = EffectsOf(m_Program->GlobalBlock).Calls;
+    std::unordered_set<const FunctionDefinition*> called(work.begin(), work.end());
+    while (!work.empty()) {
+        const FunctionDefinition* function = work.back();
+        work.pop_back();
+        for (const FunctionDefinition* callee : EffectsOf(function->Body).Calls) {
+            if (called.insert(callee).second) {
+                work.push_back(callee);
+            }
+        }
+    }
+    std::erase_if(m_Program->Functions, [&](const FunctionDefinition* f) { return !called.contains(f); });
+}
+
+} // namespace Compiler
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "ast.h"
+#include "options.h"
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace Compiler {
+
+class AstBuilder;
+class Remarks;
+
+// Inlines calls to small functions. A statement `x = f(a, b);` becomes
+//
+//     { int arg.0; arg.0 = a; int arg.1; arg.1 = b; { body } }
+//
+// where the body is a copy of f's with its parameters renamed to the synthetic arg.N variables,
+// and its final `return e;` turned into `x = e;`, into `e;` for a call statement, or kept for
+// `return f(a, b);`. The language has no goto, so only functions whose one return ends their body
+// are inlined, and only if they are not recursive, cost no more than the budget and never assign a
+// parameter: that assignment would be traced in the call but not in the copy. Functions are
+// inlined into before their callers, so chains of small helpers collapse into the caller, and
+// functions no longer called from the main program are dropped.
+class Inliner {
+  public:
+    Inliner(Program* prog, AstBuilder& builder, const OptimizationOptions& options, Remarks& remarks);
+    void Run();
+
+  private:
+    void Visit(const FunctionDefinition* function);
+    void VisitBlock(Block* block);
+    void VisitStatement(Statement* stmt);
+    void VisitStatementHere(Statement* stmt); // on the current stack
+    void TryInline(Statement* stmt);
+    // why calls to function can't be inlined, if they can't
+    std::optional<std::string> Obstacle(const FunctionDefinition* function);
+    void DropUncalled();
+
+    Program* m_Program;
+    AstBuilder& m_Builder;
+    const OptimizationOptions& m_Options;
+    Remarks& m_Remarks;
+
+    std::unordered_map<const FunctionDefinition*, std::vector<const FunctionDefinition*>> m_Callees;
+    std::unordered_map<const FunctionDefinition*, std::unordered_set<const Declaration*>> m_Assigned;
+    std::unordered_map<const FunctionDefinition*, std::optional<std::string>> m_Obstacles;
+    std::unordered_set<const FunctionDefinition*> m_Visited;
+};
+
+} // namespace Compiler
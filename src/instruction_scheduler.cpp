@@ -0,0 +1,437 @@
+#include "instruction_scheduler.h"
+#include <algorithm>
+#include <charconv>
+#include <initializer_list>
+#include <limits>
+#include <optional>
+#include <tuple>
+
+namespace Compiler {
+
+namespace {
+
+// bits 0-15 of the masks are the general purpose registers, 16-31 the vector registers
+constexpr int Rax = 0;
+constexpr int Rdx = 2;
+constexpr int Rsp = 4;
+constexpr int Rbp = 5;
+constexpr int Flags = 32;
+
+constexpr int LoadLatency = 5;     // of a hit in the L1 cache
+constexpr int ForwardLatency = 5;  // from a store to a load of what it stored
+constexpr int MultiplyLatency = 3;
+constexpr int DivideLatency = 40;  // of a 64-bit division, which takes longer for large quotients
+
+constexpr uint64_t Bit(int index) {
+    return uint64_t(1) << index;
+}
+
+struct Operand {
+    enum Kind { Register, Memory, Immediate } Type = Immediate;
+    int Reg = -1;         // Register: the bit of the register
+    int Size = 0;         // Register: in bits; Memory: in bytes, 0 when not stated
+    uint64_t Address = 0; // Memory: the registers it is addressed by
+    bool Known = false;   // Memory: at Offset from rbp, with a stated size
+    int64_t Offset = 0;
+    int64_t Value = 0; // Immediate
+};
+
+std::string_view Trim(std::string_view s) {
+    const size_t begin = s.find_first_not_of(' ');
+    if (begin == std::string_view::npos) {
+        return {};
+    }
+    return s.substr(begin, s.find_last_not_of(' ') - begin + 1);
+}
+
+bool ParseNumber(std::string_view text, int64_t& value) {
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    return !text.empty() && ec == std::errc() && end == text.data() + text.size();
+}
+
+// the bit and size of a register: rax-r15 and their 32- and 8-bit parts, xmm0-15 and ymm0-15
+std::optional<std::pair<int, int>> ParseRegister(std::string_view name) {
+    static constexpr std::string_view legacy[] = { "ax", "cx", "dx", "bx", "sp", "bp", "si", "di" };
+    static constexpr std::string_view low[] = { "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil" };
+    for (int i = 0; i < 8; i++) {
+        if (name.size() == 3 && (name[0] == 'r' || name[0] == 'e') && name.substr(1) == legacy[i]) {
+            return std::pair{ i, name[0] == 'r' ? 64 : 32 };
+        }
+        if (name == low[i]) {
+            return std::pair{ i, 8 };
+        }
+    }
+
+    int first = 0;
+    int size = 64;
+    if (name.starts_with("xmm") || name.starts_with("ymm")) {
+        first = 16;
+        size = name[0] == 'x' ? 128 : 256;
+        name.remove_prefix(3);
+    } else if (name.starts_with('r')) {
+        name.remove_prefix(1);
+        if (name.ends_with('d') || name.ends_with('b')) {
+            size = name.ends_with('d') ? 32 : 8;
+            name.remove_suffix(1);
+        }
+    } else {
+        return std::nullopt;
+    }
+    int64_t number;
+    if (!ParseNumber(name, number) || number < (first ? 0 : 8) || number > 15) {
+        return std::nullopt;
+    }
+    return std::pair{ first + static_cast<int>(number), size };
+}
+
+std::optional<Operand> ParseOperand(std::string_view text) {
+    static constexpr std::pair<std::string_view, int> sizes[] = { { "byte", 1 }, { "word", 2 }, { "dword", 4 },
+        { "qword", 8 } };
+
+    Operand op;
+    const size_t open = text.find('[');
+    if (open == std::string_view::npos) {
+        if (auto reg = ParseRegister(text)) {
+            op.Type = Operand::Register;
+            std::tie(op.Reg, op.Size) = *reg;
+        } else if (!ParseNumber(text, op.Value)) {
+            return std::nullopt; // a label
+        }
+        return op;
+    }
+
+    op.Type = Operand::Memory;
+    const std::string_view size = Trim(text.substr(0, open));
+    if (!size.empty()) {
+        auto it = std::ranges::find(sizes, size, &std::pair<std::string_view, int>::first);
+        if (it == std::end(sizes)) {
+            return std::nullopt;
+        }
+        op.Size = it->second;
+    }
+    if (!text.ends_with(']')) {
+        return std::nullopt;
+    }
+
+    // terms separated by + and -: registers, register*scale and displacements
+    std::string_view terms = text.substr(open + 1, text.size() - open - 2);
+    int registers = 0;
+    bool scaled = false;
+    while (!terms.empty()) {
+        const bool negative = terms.front() == '-';
+        if (terms.front() == '+' || terms.front() == '-') {
+            terms.remove_prefix(1);
+        }
+        const size_t end = terms.find_first_of("+-");
+        const std::string_view term = Trim(terms.substr(0, end));
+        terms.remove_prefix(end == std::string_view::npos ? terms.size() : end);
+
+        const std::string_view name = Trim(term.substr(0, term.find('*')));
+        int64_t value;
+        if (auto reg = ParseRegister(name); reg && reg->second == 64 && !negative) {
+            op.Address |= Bit(reg->first);
+            registers++;
+            scaled |= name.size() != term.size();
+        } else if (ParseNumber(term, value)) {
+            op.Offset += negative ? -value : value;
+        } else {
+            return std::nullopt;
+        }
+    }
+    op.Known = op.Address == Bit(Rbp) && registers == 1 && !scaled && op.Size > 0;
+    return op;
+}
+
+} // namespace
+
+std::string InstructionScheduler::Run(std::string_view text) {
+    m_Out.clear();
+    m_Out.reserve(text.size());
+    while (!text.empty()) {
+        const size_t end = text.find('\n');
+        const std::string_view line = text.substr(0, end);
+        text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+
+        Node node;
+        if (Parse(line, node)) {
+            m_Block.push_back(std::move(node));
+            if (m_Block.size() == MaxBlock) {
+                Schedule();
+            }
+        } else {
+            Schedule();
+            m_Out += line;
+            m_Out += '\n';
+        }
+    }
+    Schedule();
+    return std::move(m_Out);
+}
+
+bool InstructionScheduler::Parse(std::string_view line, Node& node) const {
+    if (line.empty() || line.ends_with(':') || line.find(';') != std::string_view::npos) {
+        return false;
+    }
+    const size_t space = line.find(' ');
+    const std::string_view mnemonic = line.substr(0, space);
+    std::vector<Operand> ops;
+    if (space != std::string_view::npos) {
+        std::string_view rest = line.substr(space + 1);
+        while (true) {
+            const size_t comma = rest.find(',');
+            auto op = ParseOperand(Trim(rest.substr(0, comma)));
+            if (!op) {
+                return false;
+            }
+            ops.push_back(*op);
+            if (comma == std::string_view::npos) {
+                break;
+            }
+            rest.remove_prefix(comma + 1);
+        }
+    }
+    node.Line = line;
+
+    auto read = [&](const Operand& op) {
+        if (op.Type == Operand::Register) {
+            node.Reads |= Bit(op.Reg);
+        } else if (op.Type == Operand::Memory) {
+            node.Reads |= op.Address;
+            node.Memory.push_back({ false, op.Known, op.Offset, op.Size });
+        }
+    };
+    auto write = [&](const Operand& op) {
+        if (op.Type == Operand::Register) {
+            node.Writes |= Bit(op.Reg);
+            if (op.Size == 8) {
+                node.Reads |= Bit(op.Reg); // the rest of the register is kept
+            }
+        } else if (op.Type == Operand::Memory) {
+            node.Reads |= op.Address;
+            node.Memory.push_back({ true, op.Known, op.Offset, op.Size });
+        }
+    };
+    auto update = [&](const Operand& op) {
+        read(op);
+        write(op);
+    };
+    auto is = [&](std::initializer_list<std::string_view> names, size_t operands) {
+        return ops.size() == operands && std::ranges::find(names, mnemonic) != names.end();
+    };
+
+    auto vector = [](const Operand& op) { return op.Type == Operand::Register && op.Reg >= 16; };
+    if (std::ranges::any_of(ops, vector)) {
+        // SSE2 forms update their first operand, VEX forms and the moves only write it
+        static constexpr std::string_view moves[] = { "movdqa", "movdqu", "movq", "pshufd" };
+        static constexpr std::string_view others[] = { "paddq", "psubq", "pmuludq", "pxor", "punpcklqdq",
+            "psrlq", "psllq", "pbroadcastq", "extracti128" };
+        const bool avx = mnemonic.starts_with('v');
+        const std::string_view name = avx ? mnemonic.substr(1) : mnemonic;
+        const bool move = std::ranges::find(moves, name) != std::end(moves);
+        if (ops.size() < 2 || (!move && std::ranges::find(others, name) == std::end(others))) {
+            return false;
+        }
+        if (avx || move) {
+            write(ops[0]);
+        } else {
+            update(ops[0]);
+        }
+        std::ranges::for_each(ops.begin() + 1, ops.end(), read);
+        node.Latency = name == "pmuludq"                                  ? 5
+                       : name == "pbroadcastq" || name == "extracti128" ? 3
+                       : name == "movq"                                 ? 2
+                                                                        : 1;
+    } else if (is({ "mov", "movzx", "movsx" }, 2)) {
+        write(ops[0]);
+        read(ops[1]);
+    } else if (is({ "lea" }, 2) && ops[1].Type == Operand::Memory) {
+        write(ops[0]);
+        node.Reads |= ops[1].Address; // no access
+    } else if (is({ "add", "sub", "and", "or", "xor", "adc", "sbb" }, 2)) {
+        update(ops[0]);
+        read(ops[1]);
+        node.Writes |= Bit(Flags);
+        if (mnemonic == "adc" || mnemonic == "sbb") {
+            node.Reads |= Bit(Flags);
+        }
+    } else if (is({ "cmp", "test" }, 2)) {
+        read(ops[0]);
+        read(ops[1]);
+        node.Writes |= Bit(Flags);
+    } else if (is({ "imul" }, 2) || is({ "imul" }, 3)) {
+        if (ops.size() == 2) {
+            update(ops[0]);
+        } else {
+            write(ops[0]);
+        }
+        read(ops[1]);
+        node.Writes |= Bit(Flags);
+        node.Latency = MultiplyLatency;
+    } else if (is({ "imul", "mul", "idiv", "div" }, 1)) {
+        // rdx:rax = rax * operand, or rax and rdx = rdx:rax / operand
+        read(ops[0]);
+        node.Reads |= Bit(Rax) | Bit(Rdx);
+        node.Writes |= Bit(Rax) | Bit(Rdx) | Bit(Flags);
+        const bool divide = mnemonic.ends_with("div");
+        if (divide) {
+            node.Memory.push_back({ true, false }); // may trap
+        }
+        node.Latency = divide ? DivideLatency : MultiplyLatency;
+    } else if (is({ "neg", "inc", "dec" }, 1)) {
+        update(ops[0]);
+        node.Writes |= Bit(Flags);
+    } else if (is({ "not" }, 1)) {
+        update(ops[0]);
+    } else if (is({ "shl", "sal", "shr", "sar" }, 2)) {
+        update(ops[0]);
+        read(ops[1]);
+        node.Writes |= Bit(Flags);
+        if (ops[1].Type != Operand::Immediate || ops[1].Value == 0) {
+            node.Reads |= Bit(Flags); // shifting by zero leaves them as they were
+        }
+    } else if (mnemonic.starts_with("set") && ops.size() == 1) {
+        write(ops[0]);
+        node.Reads |= Bit(Flags);
+    } else if (mnemonic.starts_with("cmov") && ops.size() == 2) {
+        update(ops[0]); // kept when the condition is false
+        read(ops[1]);
+        node.Reads |= Bit(Flags);
+    } else if (is({ "cqo" }, 0)) {
+        node.Reads |= Bit(Rax);
+        node.Writes |= Bit(Rdx);
+    } else if (is({ "push" }, 1)) {
+        read(ops[0]);
+        node.Reads |= Bit(Rsp);
+        node.Writes |= Bit(Rsp);
+    } else if (is({ "pop" }, 1) && ops[0].Type == Operand::Register) {
+        write(ops[0]);
+        node.Reads |= Bit(Rsp);
+        node.Writes |= Bit(Rsp);
+        node.Memory.push_back({ false, false });
+    } else {
+        return false;
+    }
+
+    if (node.Writes & Bit(Rsp)) {
+        node.Memory.push_back({ true, false }); // pushes, and whatever lies below the old rsp
+    }
+    if (std::ranges::any_of(node.Memory, [](const Access& access) { return !access.Write; })) {
+        node.Latency += LoadLatency;
+    }
+    return true;
+}
+
+void InstructionScheduler::Depend(size_t from, size_t to, int latency) {
+    m_Block[from].Successors.emplace_back(to, latency);
+    m_Block[to].Predecessors++;
+}
+
+void InstructionScheduler::Schedule() {
+    const size_t n = m_Block.size();
+
+    // The flags are written by most instructions and read by few, so only the writes that are read
+    // are ordered against the other writes: those read in the block, and the last, which may be
+    // read after it. The flags a reader reads are those of the last write before it.
+    std::vector<bool> read(n);
+    std::optional<size_t> lastWrite;
+    for (size_t j = 0; j < n; j++) {
+        if ((m_Block[j].Reads & Bit(Flags)) && lastWrite) {
+            read[*lastWrite] = true;
+        }
+        if (m_Block[j].Writes & Bit(Flags)) {
+            lastWrite = j;
+        }
+    }
+    if (lastWrite) {
+        read[*lastWrite] = true;
+    }
+
+    lastWrite.reset();
+    const uint64_t registers = ~Bit(Flags);
+    for (size_t j = 0; j < n; j++) {
+        const Node& b = m_Block[j];
+        for (size_t i = 0; i < j; i++) {
+            const Node& a = m_Block[i];
+            int latency = -1;
+            if (a.Writes & b.Reads & registers) {
+                latency = a.Latency;
+            } else if (((a.Reads | a.Writes) & b.Writes & registers) ||
+                       ((a.Reads & Bit(Flags)) && (b.Writes & Bit(Flags))) ||
+                       ((a.Writes & Bit(Flags)) && (b.Writes & Bit(Flags)) && read[j])) {
+                latency = 0;
+            }
+            if (i == lastWrite && (b.Reads & Bit(Flags))) {
+                latency = std::max(latency, a.Latency);
+            }
+            for (const Access& x : a.Memory) {
+                for (const Access& y : b.Memory) {
+                    const bool overlap = !x.Known || !y.Known ||
+                                         (x.Offset < y.Offset + y.Size && y.Offset < x.Offset + x.Size);
+                    if ((x.Write || y.Write) && overlap) {
+                        latency = std::max(latency, x.Write && !y.Write ? ForwardLatency : 0);
+                    }
+                }
+            }
+            if (latency >= 0) {
+                Depend(i, j, latency);
+            }
+        }
+        if (b.Writes & Bit(Flags)) {
+            lastWrite = j;
+        }
+    }
+
+    for (size_t i = n; i-- > 0;) {
+        Node& node = m_Block[i];
+        node.Height = node.Latency;
+        for (const auto& [next, latency] : node.Successors) {
+            node.Height = std::max(node.Height, latency + m_Block[next].Height);
+        }
+    }
+
+    std::vector<size_t> ready; // every predecessor issued
+    for (size_t i = 0; i < n; i++) {
+        if (m_Block[i].Predecessors == 0) {
+            ready.push_back(i);
+        }
+    }
+    int cycle = 0;
+    int issued = 0;
+    while (!ready.empty()) {
+        auto best = ready.end();
+        for (auto it = ready.begin(); it != ready.end(); ++it) {
+            const Node& node = m_Block[*it];
+            if (node.Ready <= cycle &&
+                (best == ready.end() || node.Height > m_Block[*best].Height ||
+                    (node.Height == m_Block[*best].Height && *it < *best))) {
+                best = it;
+            }
+        }
+        if (best == ready.end() || issued == IssueWidth) {
+            // on to the next cycle in which something can issue
+            int next = std::numeric_limits<int>::max();
+            for (size_t i : ready) {
+                next = std::min(next, m_Block[i].Ready);
+            }
+            cycle = std::max(next, cycle + 1);
+            issued = 0;
+            continue;
+        }
+
+        const size_t i = *best;
+        ready.erase(best);
+        issued++;
+        m_Out += m_Block[i].Line;
+        m_Out += '\n';
+        for (const auto& [next, latency] : m_Block[i].Successors) {
+            Node& successor = m_Block[next];
+            successor.Ready = std::max(successor.Ready, cycle + latency);
+            if (--successor.Predecessors == 0) {
+                ready.push_back(next);
+            }
+        }
+    }
+    m_Block.clear();
+}
+
+} // namespace Compiler
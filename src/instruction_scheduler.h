@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace Compiler {
+
+// Reorders the instructions of assembly text within its basic blocks, so that an instruction
+// waiting on a load, a multiplication or a division comes after independent instructions that can
+// run in the meantime, instead of right after the instruction it waits on. Blocks end at labels,
+// jumps, calls and every instruction or directive the scheduler has no model of, which stay where
+// they are.
+//
+// An instruction follows those before it that write what it reads, read what it writes or write
+// what it writes: registers, the flags and memory. Accesses at constant offsets from rbp are told
+// apart by their extent; any other two accesses of which one writes stay in order. Divisions stay
+// in order with every access, so that a program that traps does so with the same signal, and so
+// do instructions that move rsp, so that nothing is written below the stack pointer.
+//
+// Each cycle, up to IssueWidth of the instructions whose operands are ready issue, the one with
+// the longest chain of latencies after it first, in their original order when equal. The
+// latencies are those of Skylake and the cores after it.
+class InstructionScheduler {
+  public:
+    static constexpr size_t MaxBlock = 128; // longer blocks are scheduled in pieces
+    static constexpr int IssueWidth = 4;
+
+    // returns the text with each block's instructions reordered
+    std::string Run(std::string_view text);
+
+  private:
+    // a memory access
+    struct Access {
+        bool Write = false;
+        bool Known = false; // at Offset from rbp, with Size bytes
+        int64_t Offset = 0;
+        int Size = 0;
+    };
+
+    struct Node {
+        std::string_view Line;
+        uint64_t Reads = 0; // registers, and the flags
+        uint64_t Writes = 0;
+        std::vector<Access> Memory;
+        int Latency = 1; // until what it writes can be read
+
+        std::vector<std::pair<size_t, int>> Successors; // and the cycles each waits for this
+        int Predecessors = 0;                            // not yet issued
+        int Height = 0; // the longest chain of latencies from its issue to the end of the block
+        int Ready = 0;  // the earliest cycle it can issue
+    };
+
+    bool Parse(std::string_view line, Node& node) const; // false for a line that ends a block
+    void Depend(size_t from, size_t to, int latency);
+    void Schedule(); // appends the block to m_Out and starts the next
+
+    std::vector<Node> m_Block;
+    std::string m_Out;
+};
+
+} // namespace Compiler
@@ -0,0 +1,798 @@
+#include "instruction_selector.h"
+#include "assembly.h"
+#include "ast_utils.h"
+#include "stack.h"
+#include "symbol_table.h"
+#include "utils.h"
+#include <algorithm>
+#include <bit>
+#include <format>
+
+namespace Compiler {
+
+namespace {
+
+constexpr std::array<std::string_view, static_cast<size_t>(IrOp::Count)> OpNames = { "Const", "Local", "Assign",
+    "Call", "Element", "StoreElement", "Add", "Sub", "Mul", "Div", "Mod", "Gt", "Ge", "Lt", "Le", "Eq", "Ne" };
+
+constexpr std::array<std::string_view, static_cast<size_t>(Nonterminal::Count)> NonterminalNames = { "Stmt", "Reg",
+    "Cc", "Mem", "Imm", "Scale", "Shift" };
+
+constexpr size_t Index(Nonterminal nt) {
+    return static_cast<size_t>(nt);
+}
+
+constexpr size_t Arity(IrOp op) {
+    switch (op) {
+    case IrOp::Const:
+    case IrOp::Local:
+    case IrOp::Call:
+        return 0;
+    case IrOp::Assign:
+    case IrOp::Element:
+        return 1;
+    default:
+        return 2;
+    }
+}
+
+// One symbol of a pattern in prefix order: an operator, followed by the patterns of its
+// operands, or a nonterminal leaf.
+struct Term {
+    bool IsOp = false;
+    uint8_t Value = 0;
+};
+
+// A tree pattern such as "Add(Reg, Mul(Mem, Scale))", parsed when the compiler is compiled:
+// a malformed pattern fails the build.
+struct Pattern {
+    std::array<Term, 8> Terms{};
+    size_t Size = 0;
+
+    consteval Pattern(const char* text) {
+        const std::string_view src(text);
+        size_t pos = 0;
+        Parse(src, pos);
+        if (pos != src.size()) {
+            throw "trailing characters in pattern";
+        }
+    }
+
+    consteval void Parse(std::string_view src, size_t& pos) {
+        Skip(src, pos);
+        const size_t start = pos;
+        while (pos < src.size() && ((src[pos] >= 'A' && src[pos] <= 'Z') || (src[pos] >= 'a' && src[pos] <= 'z'))) {
+            pos++;
+        }
+        const std::string_view name = src.substr(start, pos - start);
+        if (Size == Terms.size()) {
+            throw "pattern too large";
+        }
+
+        for (size_t nt = 0; nt < NonterminalNames.size(); nt++) {
+            if (NonterminalNames[nt] == name) {
+                Terms[Size++] = { false, static_cast<uint8_t>(nt) };
+                return;
+            }
+        }
+        for (size_t op = 0; op < OpNames.size(); op++) {
+            if (OpNames[op] != name) {
+                continue;
+            }
+            Terms[Size++] = { true, static_cast<uint8_t>(op) };
+            const size_t arity = Arity(static_cast<IrOp>(op));
+            if (arity > 0) {
+                Expect(src, pos, '(');
+                for (size_t i = 0; i < arity; i++) {
+                    if (i > 0) {
+                        Expect(src, pos, ',');
+                    }
+                    Parse(src, pos);
+                }
+                Expect(src, pos, ')');
+            }
+            return;
+        }
+        throw "unknown name in pattern";
+    }
+
+    static consteval void Skip(std::string_view src, size_t& pos) {
+        while (pos < src.size() && src[pos] == ' ') {
+            pos++;
+        }
+    }
+
+    static consteval void Expect(std::string_view src, size_t& pos, char c) {
+        Skip(src, pos);
+        if (pos >= src.size() || src[pos] != c) {
+            throw "malformed pattern";
+        }
+        pos++;
+    }
+};
+
+bool FitsImm(const IrNode* node) {
+    return node->Value >= INT32_MIN && node->Value <= INT32_MAX;
+}
+
+bool IsScale(const IrNode* node) {
+    return node->Value == 2 || node->Value == 4 || node->Value == 8;
+}
+
+bool IsShift(const IrNode* node) {
+    return node->Value > 1 && std::has_single_bit(static_cast<uint64_t>(node->Value));
+}
+
+// x * 3, x * 5 and x * 9 are x + x * scale
+bool IsLeaMultiplier(int64_t value) {
+    return value == 3 || value == 5 || value == 9;
+}
+
+std::string_view Mnemonic(IrOp op) {
+    switch (op) {
+    case IrOp::Add:
+        return "add";
+    case IrOp::Sub:
+        return "sub";
+    case IrOp::Mul:
+        return "imul";
+    default:
+        Error("Unknown operator");
+    }
+}
+
+std::string_view ConditionCode(IrOp op) {
+    switch (op) {
+    case IrOp::Gt:
+        return "g";
+    case IrOp::Ge:
+        return "ge";
+    case IrOp::Lt:
+        return "l";
+    case IrOp::Le:
+        return "le";
+    case IrOp::Eq:
+        return "e";
+    case IrOp::Ne:
+        return "ne";
+    default:
+        Error("Unknown operator");
+    }
+}
+
+std::string Displacement(int64_t value) {
+    return value < 0 ? std::format(" - {}", -value) : std::format(" + {}", value);
+}
+
+using Leaves = std::array<const IrNode*, 4>; // the nodes matched by a pattern's nonterminals, in order
+
+} // namespace
+
+// The code each rule emits, given the node its pattern is rooted at and the leaves it matched.
+struct RuleEmitters {
+    static void Nothing(InstructionSelector&, const IrNode*, const Leaves&) {}
+
+    static void Discard(InstructionSelector& s, const IrNode*, const Leaves& l) { s.Reduce(l[0], Nonterminal::Reg); }
+
+    static void LoadConst(InstructionSelector& s, const IrNode* node, const Leaves&) {
+        s.m_Asm.Emit("mov rax, {}", node->Value);
+    }
+
+    static void LoadMem(InstructionSelector& s, const IrNode*, const Leaves& l) {
+        s.m_Asm.Emit("mov rax, {}", s.Operand(l[0]));
+    }
+
+    static void SetCc(InstructionSelector& s, const IrNode*, const Leaves& l) {
+        s.Reduce(l[0], Nonterminal::Cc);
+        s.m_Asm.Emit("set{} al", s.m_Condition);
+        s.m_Asm.Emit("movzx rax, al");
+    }
+
+    static void TestReg(InstructionSelector& s, const IrNode*, const Leaves& l) {
+        s.Reduce(l[0], Nonterminal::Reg);
+        s.m_Asm.Emit("test rax, rax");
+        s.m_Condition = "nz";
+    }
+
+    static void TestMem(InstructionSelector& s, const IrNode*, const Leaves& l) {
+        s.m_Asm.Emit("cmp {}, 0", s.Operand(l[0]));
+        s.m_Condition = "ne";
+    }
+
+    // op rax, imm | op rax, [mem]
+    static void RegOperand(InstructionSelector& s, const IrNode* node, const Leaves& l) {
+        s.Reduce(l[0], Nonterminal::Reg);
+        s.m_Asm.Emit("{} rax, {}", Mnemonic(node->Op), s.Operand(l[1]));
+    }
+
+    static void RegReg(InstructionSelector& s, const IrNode* node, const Leaves& l) {
+        s.Operands(l[0], l[1]);
+        s.m_Asm.Emit("{} rax, rcx", Mnemonic(node->Op));
+    }
+
+    // constants too wide for an immediate go through rcx
+    static void RegConst(InstructionSelector& s, const IrNode* node, const Leaves& l) {
+        s.Reduce(l[0], Nonterminal::Reg);
+        s.m_Asm.Emit("mov rcx, {}", node->Kids[1]->Value);
+        s.m_Asm.Emit("{} rax, rcx", Mnemonic(node->Op));
+    }
+
+    static void Negate(InstructionSelector& s, const IrNode*, const Leaves& l) {
+        s.Reduce(l[0], Nonterminal::Reg);
+        s.m_Asm.Emit("neg rax");
+    }
+
+    static void MulImm(InstructionSelector& s, const IrNode*, const Leaves& l) {
+        s.Reduce(l[0], Nonterminal::Reg);
+        s.m_Asm.Emit("imul rax, rax, {}", s.Operand(l[1]));
+    }
+
+    static void MulMemImm(InstructionSelector& s, const IrNode*, const Leaves& l) {
+        s.m_Asm.Emit("imul rax, {}, {}", s.Operand(l[0]), s.Operand(l[1]));
+    }
+
+    static void ShiftLeft(InstructionSelector& s, const IrNode*, const Leaves& l) {
+        s.Reduce(l[0], Nonterminal::Reg);
+        s.m_Asm.Emit("shl rax, {}", std::countr_zero(static_cast<uint64_t>(l[1]->Value)));
+    }
+
+    static void MulLea(InstructionSelector& s, const IrNode* node, const Leaves& l) {
+        s.Reduce(l[0], Nonterminal::Reg);
+        s.m_Asm.Emit("lea rax, [rax + rax*{}]", node->Kids[1]->Value - 1);
+    }
+
+    static void LeaIndex(InstructionSelector& s, const IrNode*, const Leaves& l) {
+        s.Reduce(l[0], Nonterminal::Reg);
+        s.m_Asm.Emit("mov rcx, {}", s.Operand(l[1]));
+        s.m_Asm.Emit("lea rax, [rax + rcx*{}]", l[2]->Value);
+    }
+
+    static void LeaScaled(InstructionSelector& s, const IrNode*, const Leaves& l) {
+        s.Reduce(l[0], Nonterminal::Reg);
+        s.m_Asm.Emit("lea rax, [rax*{}{}]", l[1]->Value, Displacement(l[2]->Value));
+    }
+
+    static void LeaScaledBase(InstructionSelector& s, const IrNode* node, const Leaves& l) {
+        s.Reduce(l[0], Nonterminal::Reg);
+        s.m_Asm.Emit("lea rax, [rax + rax*{}{}]", node->Kids[0]->Kids[1]->Value - 1, Displacement(l[1]->Value));
+    }
+
+    static void Divide(InstructionSelector& s, const IrNode* node, std::string_view divisor) {
+        s.m_Asm.Emit("cqo");
+        s.m_Asm.Emit("idiv {}", divisor);
+        if (node->Op == IrOp::Mod) {
+            s.m_Asm.Emit("mov rax, rdx");
+        }
+    }
+
+    static void DivMem(InstructionSelector& s, const IrNode* node, const Leaves& l) {
+        s.Reduce(l[0], Nonterminal::Reg);
+        Divide(s, node, s.Operand(l[1]));
+    }
+
+    static void DivImm(InstructionSelector& s, const IrNode* node, const Leaves& l) {
+        s.Reduce(l[0], Nonterminal::Reg);
+        s.m_Asm.Emit("mov rcx, {}", s.Operand(l[1]));
+        Divide(s, node, "rcx");
+    }
+
+    static void DivReg(InstructionSelector& s, const IrNode* node, const Leaves& l) {
+        s.Operands(l[0], l[1]);
+        Divide(s, node, "rcx");
+    }
+
+    static void CmpOperand(InstructionSelector& s, const IrNode* node, const Leaves& l) {
+        s.Reduce(l[0], Nonterminal::Reg);
+        s.m_Asm.Emit("cmp rax, {}", s.Operand(l[1]));
+        s.m_Condition = ConditionCode(node->Op);
+    }
+
+    static void CmpMemImm(InstructionSelector& s, const IrNode* node, const Leaves& l) {
+        s.m_Asm.Emit("cmp {}, {}", s.Operand(l[0]), s.Operand(l[1]));
+        s.m_Condition = ConditionCode(node->Op);
+    }
+
+    static void CmpReg(InstructionSelector& s, const IrNode* node, const Leaves& l) {
+        s.Operands(l[0], l[1]);
+        s.m_Asm.Emit("cmp rax, rcx");
+        s.m_Condition = ConditionCode(node->Op);
+    }
+
+    static void Store(InstructionSelector& s, const IrNode* node, const Leaves& l) {
+        s.Reduce(l[0], Nonterminal::Reg);
+        s.Store(node, "rax");
+    }
+
+    static void StoreImm(InstructionSelector& s, const IrNode* node, const Leaves& l) {
+        s.Store(node, s.Operand(l[0]));
+    }
+
+    // x = x + imm as a single read-modify-write instruction
+    static void Update(InstructionSelector& s, const IrNode* node, const Leaves& l) {
+        s.m_Asm.Emit("{} {}, {}", Mnemonic(node->Kids[0]->Op), s.Operand(l[0]), s.Operand(l[1]));
+        if (node->Trace) {
+            s.m_Asm.Emit("mov rdi, {}", s.Operand(l[0]));
+            s.m_Asm.Emit("call print");
+        }
+    }
+
+    static void LoadElement(InstructionSelector& s, const IrNode* node, const Leaves& l) {
+        s.Reduce(l[0], Nonterminal::Reg);
+        s.CheckBounds(node, "rax");
+        s.m_Asm.Emit("mov rax, {}", Assembly::Element(node->Value, "rax"));
+    }
+
+    // the index in rax and the value in rcx, which is also the result
+    static void StoreElement(InstructionSelector& s, const IrNode* node, const Leaves& l) {
+        s.Operands(l[0], l[1]);
+        s.CheckBounds(node, "rax");
+        s.m_Asm.Emit("mov {}, rcx", Assembly::Element(node->Value, "rax"));
+        s.m_Asm.Emit("mov rax, rcx");
+    }
+
+    static void StoreElementImm(InstructionSelector& s, const IrNode* node, const Leaves& l) {
+        s.Reduce(l[0], Nonterminal::Reg);
+        s.CheckBounds(node, "rax");
+        s.m_Asm.Emit("mov {}, {}", Assembly::Element(node->Value, "rax"), s.Operand(l[1]));
+    }
+
+    static void CallFunction(InstructionSelector& s, const IrNode* node, const Leaves&) {
+        s.Call(s.m_Calls[node->Value]);
+    }
+};
+
+namespace {
+
+bool MulLeaMultiplier(const IrNode* node) {
+    return IsLeaMultiplier(node->Kids[1]->Value);
+}
+
+bool AddLeaMultiplier(const IrNode* node) {
+    return IsLeaMultiplier(node->Kids[0]->Kids[1]->Value);
+}
+
+bool ZeroMinuend(const IrNode* node) {
+    return node->Kids[0]->Value == 0;
+}
+
+bool SameSlot(const IrNode* node) {
+    const IrNode* target = node->Kids[0]->Kids[0];
+    return target->Op == IrOp::Local && target->Value == node->Value;
+}
+
+struct Rule {
+    Nonterminal Lhs;
+    Pattern Rhs;
+    int Cost;
+    void (*Emit)(InstructionSelector&, const IrNode*, const Leaves&);
+    bool (*Predicate)(const IrNode*) = nullptr; // checked on the root once the pattern matched
+};
+
+// The rules; among equally cheap ones the first wins. A rule whose pattern is a single
+// nonterminal is a chain rule, converting between forms of the same node.
+struct RuleTable : RuleEmitters {
+    // clang-format off
+    static constexpr Rule Rules[] = {
+        // leaves
+        { Nonterminal::Mem,   "Local", 0, Nothing },
+        { Nonterminal::Imm,   "Const", 0, Nothing, FitsImm },
+        { Nonterminal::Scale, "Const", 0, Nothing, IsScale },
+        { Nonterminal::Shift, "Const", 0, Nothing, IsShift },
+
+        // conversions
+        { Nonterminal::Reg,  "Const", 1, LoadConst },
+        { Nonterminal::Reg,  "Mem",   1, LoadMem },
+        { Nonterminal::Reg,  "Cc",    2, SetCc },
+        { Nonterminal::Reg,  "Call", 10, CallFunction },
+        { Nonterminal::Cc,   "Mem",   1, TestMem },
+        { Nonterminal::Cc,   "Reg",   1, TestReg },
+        { Nonterminal::Stmt, "Reg",   0, Discard },
+
+        // arithmetic
+        { Nonterminal::Reg, "Add(Reg, Imm)", 1, RegOperand },
+        { Nonterminal::Reg, "Add(Reg, Mem)", 1, RegOperand },
+        { Nonterminal::Reg, "Add(Reg, Const)", 2, RegConst },
+        { Nonterminal::Reg, "Add(Reg, Reg)", 4, RegReg },
+        { Nonterminal::Reg, "Sub(Const, Reg)", 1, Negate, ZeroMinuend },
+        { Nonterminal::Reg, "Sub(Reg, Imm)", 1, RegOperand },
+        { Nonterminal::Reg, "Sub(Reg, Mem)", 1, RegOperand },
+        { Nonterminal::Reg, "Sub(Reg, Const)", 2, RegConst },
+        { Nonterminal::Reg, "Sub(Reg, Reg)", 4, RegReg },
+        { Nonterminal::Reg, "Mul(Reg, Shift)", 1, ShiftLeft },
+        { Nonterminal::Reg, "Mul(Reg, Const)", 1, MulLea, MulLeaMultiplier },
+        { Nonterminal::Reg, "Mul(Reg, Imm)", 3, MulImm },
+        { Nonterminal::Reg, "Mul(Mem, Imm)", 3, MulMemImm },
+        { Nonterminal::Reg, "Mul(Reg, Mem)", 3, RegOperand },
+        { Nonterminal::Reg, "Mul(Reg, Const)", 4, RegConst },
+        { Nonterminal::Reg, "Mul(Reg, Reg)", 6, RegReg },
+
+        // address arithmetic
+        { Nonterminal::Reg, "Add(Reg, Mul(Mem, Scale))", 2, LeaIndex },
+        { Nonterminal::Reg, "Add(Mul(Reg, Scale), Imm)", 1, LeaScaled },
+        { Nonterminal::Reg, "Add(Mul(Reg, Const), Imm)", 1, LeaScaledBase, AddLeaMultiplier },
+
+        // division
+        { Nonterminal::Reg, "Div(Reg, Mem)", 20, DivMem },
+        { Nonterminal::Reg, "Div(Reg, Imm)", 21, DivImm },
+        { Nonterminal::Reg, "Div(Reg, Reg)", 23, DivReg },
+        { Nonterminal::Reg, "Mod(Reg, Mem)", 21, DivMem },
+        { Nonterminal::Reg, "Mod(Reg, Imm)", 22, DivImm },
+        { Nonterminal::Reg, "Mod(Reg, Reg)", 24, DivReg },
+
+        // comparisons
+        { Nonterminal::Cc, "Gt(Mem, Imm)", 1, CmpMemImm },
+        { Nonterminal::Cc, "Gt(Reg, Imm)", 1, CmpOperand },
+        { Nonterminal::Cc, "Gt(Reg, Mem)", 1, CmpOperand },
+        { Nonterminal::Cc, "Gt(Reg, Reg)", 4, CmpReg },
+        { Nonterminal::Cc, "Ge(Mem, Imm)", 1, CmpMemImm },
+        { Nonterminal::Cc, "Ge(Reg, Imm)", 1, CmpOperand },
+        { Nonterminal::Cc, "Ge(Reg, Mem)", 1, CmpOperand },
+        { Nonterminal::Cc, "Ge(Reg, Reg)", 4, CmpReg },
+        { Nonterminal::Cc, "Lt(Mem, Imm)", 1, CmpMemImm },
+        { Nonterminal::Cc, "Lt(Reg, Imm)", 1, CmpOperand },
+        { Nonterminal::Cc, "Lt(Reg, Mem)", 1, CmpOperand },
+        { Nonterminal::Cc, "Lt(Reg, Reg)", 4, CmpReg },
+        { Nonterminal::Cc, "Le(Mem, Imm)", 1, CmpMemImm },
+        { Nonterminal::Cc, "Le(Reg, Imm)", 1, CmpOperand },
+        { Nonterminal::Cc, "Le(Reg, Mem)", 1, CmpOperand },
+        { Nonterminal::Cc, "Le(Reg, Reg)", 4, CmpReg },
+        { Nonterminal::Cc, "Eq(Mem, Imm)", 1, CmpMemImm },
+        { Nonterminal::Cc, "Eq(Reg, Imm)", 1, CmpOperand },
+        { Nonterminal::Cc, "Eq(Reg, Mem)", 1, CmpOperand },
+        { Nonterminal::Cc, "Eq(Reg, Reg)", 4, CmpReg },
+        { Nonterminal::Cc, "Ne(Mem, Imm)", 1, CmpMemImm },
+        { Nonterminal::Cc, "Ne(Reg, Imm)", 1, CmpOperand },
+        { Nonterminal::Cc, "Ne(Reg, Mem)", 1, CmpOperand },
+        { Nonterminal::Cc, "Ne(Reg, Reg)", 4, CmpReg },
+
+        // stores
+        { Nonterminal::Stmt, "Assign(Imm)", 1, StoreImm },
+        { Nonterminal::Stmt, "Assign(Add(Mem, Imm))", 1, Update, SameSlot },
+        { Nonterminal::Stmt, "Assign(Sub(Mem, Imm))", 1, Update, SameSlot },
+        { Nonterminal::Reg,  "Assign(Reg)", 1, Store },
+
+        // array elements
+        { Nonterminal::Reg,  "Element(Reg)", 3, LoadElement },
+        { Nonterminal::Stmt, "StoreElement(Reg, Imm)", 3, StoreElementImm },
+        { Nonterminal::Reg,  "StoreElement(Reg, Reg)", 7, StoreElement },
+    };
+    // clang-format on
+
+};
+
+constexpr size_t RuleCount = std::size(RuleTable::Rules);
+static_assert(RuleCount <= UINT8_MAX, "rule indices are stored in a byte");
+
+// rules rooted at each operator, and chain rules, so labelling only tries rules that can match
+struct RuleIndex {
+    std::array<std::array<uint8_t, RuleCount>, static_cast<size_t>(IrOp::Count)> ByOp{};
+    std::array<uint8_t, static_cast<size_t>(IrOp::Count)> OpCount{};
+    std::array<uint8_t, RuleCount> Chain{};
+    uint8_t ChainCount = 0;
+};
+
+constexpr RuleIndex BuildIndex() {
+    RuleIndex index;
+    for (size_t i = 0; i < RuleCount; i++) {
+        const Term& root = RuleTable::Rules[i].Rhs.Terms[0];
+        if (root.IsOp) {
+            index.ByOp[root.Value][index.OpCount[root.Value]++] = static_cast<uint8_t>(i);
+        } else {
+            index.Chain[index.ChainCount++] = static_cast<uint8_t>(i);
+        }
+    }
+    return index;
+}
+
+constexpr RuleIndex Indexed = BuildIndex();
+
+bool Match(const Pattern& pattern, size_t& term, const IrNode* node, int& cost) {
+    const Term& t = pattern.Terms[term++];
+    if (!t.IsOp) {
+        cost += node->Cost[t.Value];
+        return node->Cost[t.Value] < INT_MAX / 2;
+    }
+    if (node->Op != static_cast<IrOp>(t.Value)) {
+        return false;
+    }
+    for (size_t i = 0; i < Arity(node->Op); i++) {
+        if (!Match(pattern, term, node->Kids[i], cost)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void CollectLeaves(const Pattern& pattern, size_t& term, const IrNode* node, Leaves& leaves, size_t& count) {
+    const Term& t = pattern.Terms[term++];
+    if (!t.IsOp) {
+        leaves[count++] = node;
+        return;
+    }
+    for (size_t i = 0; i < Arity(node->Op); i++) {
+        CollectLeaves(pattern, term, node->Kids[i], leaves, count);
+    }
+}
+
+} // namespace
+
+InstructionSelector::InstructionSelector(ScopeStack& scopes, Assembly& assembly)
+    : m_Scopes(scopes), m_Asm(assembly) {}
+
+void InstructionSelector::Execute(const Expression* expr) {
+    m_Nodes.clear();
+    m_Calls.clear();
+    Select(Build(expr), Nonterminal::Stmt);
+}
+
+void InstructionSelector::Evaluate(const Expression* expr) {
+    m_Nodes.clear();
+    m_Calls.clear();
+    Select(Build(expr), Nonterminal::Reg);
+}
+
+void InstructionSelector::Evaluate(const EqualityExpression* expr) {
+    m_Nodes.clear();
+    m_Calls.clear();
+    Select(Build(expr), Nonterminal::Reg);
+}
+
+std::string_view InstructionSelector::Condition(const Expression* expr) {
+    m_Nodes.clear();
+    m_Calls.clear();
+    Select(Build(expr), Nonterminal::Cc);
+    return m_Condition;
+}
+
+std::string_view InstructionSelector::Negate(std::string_view cc) {
+    static constexpr std::pair<std::string_view, std::string_view> Inverse[] = { { "e", "ne" }, { "ne", "e" },
+        { "g", "le" }, { "le", "g" }, { "l", "ge" }, { "ge", "l" }, { "nz", "z" }, { "z", "nz" } };
+    for (const auto& [code, inverse] : Inverse) {
+        if (code == cc) {
+            return inverse;
+        }
+    }
+    Error("Unknown condition code");
+}
+
+IrNode* InstructionSelector::Node(IrOp op, int64_t value) {
+    IrNode& node = m_Nodes.emplace_back();
+    node.Op = op;
+    node.Value = value;
+    return &node;
+}
+
+IrNode* InstructionSelector::Build(const Expression* expr) {
+    return EnsureStack([&] { return Build(expr->Expr); });
+}
+
+IrNode* InstructionSelector::Build(const AssignmentExpression* expr) {
+    if (expr->Element) {
+        IrNode* element = Build(expr->Element);
+        IrNode* node;
+        if (element->Op == IrOp::Local) {
+            node = Node(IrOp::Assign, element->Value);
+            node->Kids[0] = Build(expr->Expr);
+        } else {
+            node = Node(IrOp::StoreElement, element->Value);
+            node->Size = element->Size;
+            node->Kids = { element->Kids[0], Build(expr->Expr) };
+        }
+        node->Pure = false;
+        return node;
+    }
+    if (!expr->Ident) {
+        return Build(expr->Expr);
+    }
+
+    const TableEntry& v = m_Scopes.Lookup(*expr->Ident);
+    IrNode* node = Node(IrOp::Assign, v.StackOffset);
+    node->Kids[0] = Build(expr->Expr);
+    node->Trace = !v.Decl || !v.Decl->Synthetic;
+    node->Pure = false;
+    return node;
+}
+
+IrNode* InstructionSelector::Build(const Primary* primary) {
+    return std::visit(overloaded{ [&](int64_t i) { return Node(IrOp::Const, i); },
+                          [&](const std::string& s) { return Node(IrOp::Local, m_Scopes.Lookup(s).StackOffset); },
+                          [&](const Expression* e) { return Build(e); },
+                          [&](const Subscript* element) { return Build(element); } },
+        primary->Value);
+}
+
+IrNode* InstructionSelector::Build(const Subscript* element) {
+    const int64_t base = m_Scopes.Lookup(element->Ident).StackOffset;
+    const int64_t size = element->Decl->Size;
+    if (const auto index = ConstantIndex(element)) {
+        return Node(IrOp::Local, base - *index);
+    }
+    IrNode* node = Node(IrOp::Element, base);
+    node->Size = size;
+    node->Kids[0] = Build(element->Index);
+    node->Pure = node->Kids[0]->Pure;
+    return node;
+}
+
+IrNode* InstructionSelector::Build(const PostfixExpression* expr) {
+    if (!expr->Callee) {
+        return Build(expr->Prim);
+    }
+    CallSite call{ expr->Callee, {} };
+    for (const AssignmentExpression* arg : expr->CallList.front()) {
+        call.Args.push_back(EnsureStack([&] { return Build(arg); }));
+    }
+    IrNode* node = Node(IrOp::Call, static_cast<int64_t>(m_Calls.size()));
+    m_Calls.push_back(std::move(call));
+    node->Pure = false;
+    return node;
+}
+
+template <typename T>
+IrNode* InstructionSelector::Build(const T* expr) {
+    IrNode* node = Build(expr->Left);
+    for (const auto& [op, right] : expr->Right) {
+        node = Binary(op, node, Build(right));
+    }
+    return node;
+}
+
+IrNode* InstructionSelector::Binary(BinaryOp op, IrNode* left, IrNode* right) {
+    IrOp irOp;
+    IrOp mirrored; // the operator with its operands swapped, or Count if there is none
+    switch (op) {
+    case BinaryOp::Add: irOp = mirrored = IrOp::Add; break;
+    case BinaryOp::Sub: irOp = IrOp::Sub; mirrored = IrOp::Count; break;
+    case BinaryOp::Mul: irOp = mirrored = IrOp::Mul; break;
+    case BinaryOp::Div: irOp = IrOp::Div; mirrored = IrOp::Count; break;
+    case BinaryOp::Mod: irOp = IrOp::Mod; mirrored = IrOp::Count; break;
+    case BinaryOp::Gt: irOp = IrOp::Gt; mirrored = IrOp::Lt; break;
+    case BinaryOp::Ge: irOp = IrOp::Ge; mirrored = IrOp::Le; break;
+    case BinaryOp::Lt: irOp = IrOp::Lt; mirrored = IrOp::Gt; break;
+    case BinaryOp::Le: irOp = IrOp::Le; mirrored = IrOp::Ge; break;
+    case BinaryOp::Eq: irOp = mirrored = IrOp::Eq; break;
+    case BinaryOp::Ne: irOp = mirrored = IrOp::Ne; break;
+    default: Error("Unknown operator");
+    }
+
+    // instructions take an immediate or memory operand only on the right. Swapping delays the
+    // read of the left leaf past the right operand, which is fine as long as that assigns nothing.
+    auto isLeaf = [](const IrNode* node) { return node->Op == IrOp::Const || node->Op == IrOp::Local; };
+    if (mirrored != IrOp::Count && isLeaf(left) && right->Pure &&
+        (!isLeaf(right) || (left->Op == IrOp::Const && right->Op == IrOp::Local))) {
+        std::swap(left, right);
+        irOp = mirrored;
+    }
+
+    IrNode* node = Node(irOp);
+    node->Kids = { left, right };
+    node->Pure = left->Pure && right->Pure;
+    return node;
+}
+
+void InstructionSelector::Label(IrNode* node) {
+    EnsureStack([&] {
+        for (size_t i = 0; i < Arity(node->Op); i++) {
+            Label(node->Kids[i]);
+        }
+        if (node->Op == IrOp::Call) {
+            for (IrNode* arg : m_Calls[node->Value].Args) {
+                Label(arg);
+            }
+        }
+    });
+
+    node->Cost.fill(Infinite);
+    auto improve = [&](const Rule& rule, int cost, uint8_t index) {
+        if (cost < node->Cost[Index(rule.Lhs)]) {
+            node->Cost[Index(rule.Lhs)] = cost;
+            node->Rule[Index(rule.Lhs)] = index;
+            return true;
+        }
+        return false;
+    };
+
+    const auto op = static_cast<size_t>(node->Op);
+    for (size_t i = 0; i < Indexed.OpCount[op]; i++) {
+        const uint8_t index = Indexed.ByOp[op][i];
+        const Rule& rule = RuleTable::Rules[index];
+        int cost = rule.Cost;
+        size_t term = 0;
+        if (Match(rule.Rhs, term, node, cost) && (!rule.Predicate || rule.Predicate(node))) {
+            improve(rule, cost, index);
+        }
+    }
+
+    // close over the chain rules
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t i = 0; i < Indexed.ChainCount; i++) {
+            const uint8_t index = Indexed.Chain[i];
+            const Rule& rule = RuleTable::Rules[index];
+            const int from = node->Cost[rule.Rhs.Terms[0].Value];
+            if (from < Infinite && improve(rule, from + rule.Cost, index)) {
+                changed = true;
+            }
+        }
+    }
+}
+
+void InstructionSelector::Reduce(const IrNode* node, Nonterminal goal) {
+    const Rule& rule = RuleTable::Rules[node->Rule[Index(goal)]];
+    Leaves leaves{};
+    size_t term = 0;
+    size_t count = 0;
+    CollectLeaves(rule.Rhs, term, node, leaves, count);
+    EnsureStack([&] { rule.Emit(*this, node, leaves); });
+}
+
+void InstructionSelector::Select(IrNode* root, Nonterminal goal) {
+    Label(root);
+    if (root->Cost[Index(goal)] >= Infinite) {
+        Error("No instruction pattern covers the expression");
+    }
+    Reduce(root, goal);
+}
+
+std::string InstructionSelector::Operand(const IrNode* leaf) const {
+    if (leaf->Op == IrOp::Local) {
+        return Assembly::Slot(leaf->Value);
+    }
+    return std::to_string(leaf->Value);
+}
+
+void InstructionSelector::Operands(const IrNode* left, const IrNode* right) {
+    Reduce(left, Nonterminal::Reg);
+    m_Asm.Spill("rax");
+    Reduce(right, Nonterminal::Reg);
+    m_Asm.Emit("mov rcx, rax");
+    m_Asm.Pop("rax");
+}
+
+void InstructionSelector::Call(const CallSite& call) {
+    static constexpr std::string_view Registers[] = { "rdi", "rsi", "rdx", "rcx", "r8", "r9" };
+    constexpr size_t InRegisters = std::size(Registers);
+    const size_t count = call.Args.size();
+    const size_t registerArgs = std::min(count, InRegisters);
+
+    // room for the stack arguments, and a qword of padding if it would leave rsp misaligned; the
+    // frame pointer is 16-byte aligned
+    const int64_t stackArgs = static_cast<int64_t>(count - registerArgs);
+    const int64_t reserved = stackArgs + (m_Asm.StackSize() + stackArgs) % 2;
+    if (reserved > 0) {
+        m_Asm.Emit("sub rsp, {}", reserved * 8);
+        m_Asm.SetStackSize(m_Asm.StackSize() + reserved);
+    }
+
+    // in order, the register arguments pushed until the others are computed, the others stored
+    // above them
+    for (size_t i = 0; i < count; i++) {
+        Reduce(call.Args[i], Nonterminal::Reg);
+        if (i < InRegisters) {
+            m_Asm.Spill("rax");
+        } else {
+            m_Asm.Emit("mov qword [rsp + {}], rax", i * 8);
+        }
+    }
+    for (size_t i = registerArgs; i > 0; i--) {
+        m_Asm.Pop(Registers[i - 1]);
+    }
+    m_Asm.Emit("call fn_{}", call.Callee->Name);
+    m_Asm.Release(reserved);
+}
+
+void InstructionSelector::CheckBounds(const IrNode* element, std::string_view index) {
+    m_Asm.Emit("cmp {}, {}", index, element->Size);
+    m_Asm.Emit("jae {}", BoundsError);
+    m_ChecksBounds = true;
+}
+
+void InstructionSelector::Store(const IrNode* assign, std::string_view value) {
+    m_Asm.Emit("mov {}, {}", Assembly::Slot(assign->Value), value);
+    if (assign->Trace) {
+        m_Asm.Emit("mov rdi, {}", value);
+        m_Asm.Emit("call print");
+    }
+}
+
+} // namespace Compiler
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "ast.h"
+#include <array>
+#include <climits>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Compiler {
+
+class Assembly;
+class ScopeStack;
+
+// Operators of the expression trees instructions are selected for.
+enum class IrOp : uint8_t {
+    Const,
+    Local,
+    Assign,
+    Call,
+    Element,
+    StoreElement,
+    Add,
+    Sub,
+    Mul,
+    Div,
+    Mod,
+    Gt,
+    Ge,
+    Lt,
+    Le,
+    Eq,
+    Ne,
+    Count
+};
+
+// The forms in which a pattern can deliver a value to the pattern that uses it.
+enum class Nonterminal : uint8_t {
+    Stmt,  // nothing, evaluated for its effects
+    Reg,   // in rax
+    Cc,    // in the flags, tested by the condition code the rule leaves behind
+    Mem,   // a variable's stack slot, usable as a memory operand
+    Imm,   // a constant that fits a sign-extended 32-bit immediate
+    Scale, // a constant usable as an index scale: 2, 4 or 8
+    Shift, // a constant power of two
+    Count
+};
+
+struct IrNode {
+    IrOp Op;
+    int64_t Value = 0;  // Const: the constant; Local and Assign: the variable's slot; Call: the call site;
+                        // Element and StoreElement: the slot of the array's element 0
+    int64_t Size = 0;   // Element and StoreElement: the length of the array, to check the index against
+    bool Trace = false; // Assign: the assigned value is printed
+    bool Pure = true;   // evaluating the tree assigns nothing
+    std::array<IrNode*, 2> Kids{};
+
+    // set by labelling: the cheapest cost of delivering the node in each form and the rule doing it
+    std::array<int, static_cast<size_t>(Nonterminal::Count)> Cost;
+    std::array<uint8_t, static_cast<size_t>(Nonterminal::Count)> Rule;
+};
+
+// Instruction selection by bottom-up tree rewriting (BURS).
+//
+// An expression is turned into a tree of IrNodes, labelled bottom-up with the cheapest rule
+// for delivering every node in every form, then reduced top-down from the form its user
+// needs, each rule emitting its instructions. The rules map tree patterns to x86-64 forms:
+// memory and immediate operands, three-operand imul, lea for scaled adds, read-modify-write
+// stores and compares that feed branches directly. The rule table is indexed by operator at
+// compile time, so labelling a node only tries the rules rooted at its operator.
+//
+// Values in registers are always computed into rax. When both operands need a register, the
+// left one is pushed while the right one is computed and then lives in rcx.
+//
+// An array element at a constant index is a variable of its own. Other indexes are checked
+// against the array's length, unsigned so that negative ones fail too, and an index out of bounds
+// jumps to BoundsError, which the generator places once, on a ud2.
+//
+// A call is a leaf whose arguments are trees of their own, selected when it is reduced. It follows
+// the System V ABI: the first six arguments go in rdi, rsi, rdx, rcx, r8 and r9 and the rest on
+// the stack, and rsp is 16-byte aligned at the call.
+class InstructionSelector {
+  public:
+    InstructionSelector(ScopeStack& scopes, Assembly& assembly);
+
+    // evaluates expr for its effects only
+    void Execute(const Expression* expr);
+    // evaluates expr into rax
+    void Evaluate(const Expression* expr);
+    void Evaluate(const EqualityExpression* expr);
+    // sets the flags from expr; returns the condition code that holds when expr is nonzero
+    std::string_view Condition(const Expression* expr);
+
+    static std::string_view Negate(std::string_view cc);
+
+    static constexpr std::string_view BoundsError = "__bounds_error";
+    // whether an index was checked, so that BoundsError is needed
+    bool ChecksBounds() const { return m_ChecksBounds; }
+
+  private:
+    friend struct RuleEmitters;
+    static constexpr int Infinite = INT_MAX / 2;
+
+    struct CallSite {
+        const FunctionDefinition* Callee;
+        std::vector<IrNode*> Args;
+    };
+
+    IrNode* Build(const Expression* expr);
+    IrNode* Build(const AssignmentExpression* expr);
+    IrNode* Build(const Primary* primary);
+    IrNode* Build(const Subscript* element);
+    IrNode* Build(const PostfixExpression* expr);
+    template <typename T>
+    IrNode* Build(const T* expr);
+    IrNode* Binary(BinaryOp op, IrNode* left, IrNode* right);
+    IrNode* Node(IrOp op, int64_t value = 0);
+
+    void Label(IrNode* node);
+    void Reduce(const IrNode* node, Nonterminal goal);
+    void Select(IrNode* root, Nonterminal goal);
+
+    // emission helpers for the rules
+    std::string Operand(const IrNode* leaf) const;
+    void Operands(const IrNode* left, const IrNode* right); // left in rax, right in rcx
+    void Store(const IrNode* assign, std::string_view value);
+    void CheckBounds(const IrNode* element, std::string_view index);
+    void Call(const CallSite& call); // the result in rax
+
+    ScopeStack& m_Scopes;
+    Assembly& m_Asm;
+    std::deque<IrNode> m_Nodes;
+    std::vector<CallSite> m_Calls; // of the Call nodes among them
+    std::string_view m_Condition;
+    bool m_ChecksBounds = false;
+};
+
+} // namespace Compiler
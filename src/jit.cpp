@@ -0,0 +1,255 @@
+#include "jit.h"
+#include "encoder.h"
+#include "utils.h"
+#include <cerrno>
+#include <csetjmp>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <format>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace Compiler {
+
+namespace {
+
+constexpr size_t StackSize = 8 * 1024 * 1024; // 8 MB, the usual limit of a process' main stack
+constexpr int FaultSignals[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL };
+
+// Shared by the runtime and RunJit. The runtime finds it at the address formatted into its text
+// and reads the fields at fixed offsets.
+struct State {
+    uint64_t HostStack = 0;    // [+0]  rsp of the caller, restored on exit
+    uint64_t ProgramStack = 0; // [+8]  top of the program's stack
+    std::ostream* Out = nullptr;
+};
+
+// Entered from RunJit, saves the callee-saved registers and switches to the program's stack.
+// The program's syscall instructions call __jit_syscall instead. For exit, it switches back and
+// returns rdi, the exit status; any other system call is made by SystemCall, keeping every register
+// but rax as the kernel would. print keeps the contract of the print routine in test/print.asm,
+// saving every register, around a call to Print under the C calling convention.
+constexpr std::string_view Runtime = R"(__jit_enter:
+push rbx
+push rbp
+push r12
+push r13
+push r14
+push r15
+mov rax, {0}
+mov qword [rax], rsp
+mov rsp, qword [rax + 8]
+jmp _start
+__jit_syscall:
+cmp rax, 60
+jne __jit_service
+mov rcx, {0}
+mov rsp, qword [rcx]
+mov rax, rdi
+pop r15
+pop r14
+pop r13
+pop r12
+pop rbp
+pop rbx
+ret
+__jit_service:
+push rcx
+push rdx
+push rsi
+push rdi
+push r8
+push r9
+push r10
+push r11
+push rbp
+mov rbp, rsp
+and rsp, -16
+mov rcx, rdx
+mov rdx, rsi
+mov rsi, rdi
+mov rdi, rax
+mov rax, {2}
+call rax
+mov rsp, rbp
+pop rbp
+pop r11
+pop r10
+pop r9
+pop r8
+pop rdi
+pop rsi
+pop rdx
+pop rcx
+ret
+print:
+push rax
+push rcx
+push rdx
+push rsi
+push rdi
+push r8
+push r9
+push r10
+push r11
+push rbp
+mov rbp, rsp
+and rsp, -16
+mov rsi, {0}
+mov rax, {1}
+call rax
+mov rsp, rbp
+pop rbp
+pop r11
+pop r10
+pop r9
+pop r8
+pop rdi
+pop rsi
+pop rdx
+pop rcx
+pop rax
+ret
+)";
+
+thread_local sigjmp_buf* t_Recovery = nullptr;
+thread_local volatile std::sig_atomic_t t_Signal = 0;
+
+void Print(int64_t value, State* state) {
+    *state->Out << value << '\n';
+}
+
+// The system calls besides exit that generated code makes: those a program built with
+// --profile-generate writes its profile with. Returns what the kernel would, -errno on failure.
+int64_t SystemCall(int64_t number, int64_t a, int64_t b, int64_t c) {
+    int64_t result;
+    switch (number) {
+    case SYS_write:
+        result = ::write(static_cast<int>(a), reinterpret_cast<const void*>(b), static_cast<size_t>(c));
+        break;
+    case SYS_open:
+        result = ::open(reinterpret_cast<const char*>(a), static_cast<int>(b), static_cast<mode_t>(c));
+        break;
+    case SYS_close:
+        result = ::close(static_cast<int>(a));
+        break;
+    default:
+        return -ENOSYS;
+    }
+    return result < 0 ? -errno : result;
+}
+
+void OnFault(int signal) {
+    if (t_Recovery) {
+        t_Signal = signal;
+        siglongjmp(*t_Recovery, 1);
+    }
+    // not raised by a program being run
+    std::signal(signal, SIG_DFL);
+    std::raise(signal);
+}
+
+// Anonymous memory, unmapped when it goes out of scope.
+class Mapping {
+  public:
+    explicit Mapping(size_t size) : m_Size(size) {
+        m_Data =
+            mmap(nullptr, m_Size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (m_Data == MAP_FAILED) {
+            Error(std::format("Failed to map memory: {}", std::strerror(errno)));
+        }
+    }
+    ~Mapping() { munmap(m_Data, m_Size); }
+
+    Mapping(const Mapping&) = delete;
+    Mapping& operator=(const Mapping&) = delete;
+
+    std::byte* Data() const { return static_cast<std::byte*>(m_Data); }
+    size_t Size() const { return m_Size; }
+
+    void Protect(size_t offset, size_t size, int protection) const {
+        if (mprotect(Data() + offset, size, protection) != 0) {
+            Error(std::format("Failed to protect memory: {}", std::strerror(errno)));
+        }
+    }
+
+  private:
+    void* m_Data;
+    size_t m_Size;
+};
+
+size_t RoundUp(size_t size, size_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+} // namespace
+
+int RunJit(std::string_view assembly, std::ostream& out) {
+    State state;
+    state.Out = &out;
+
+    Encoder encoder;
+    encoder.Assemble(
+        std::format(Runtime, reinterpret_cast<uint64_t>(&state), reinterpret_cast<uint64_t>(&Print),
+            reinterpret_cast<uint64_t>(&SystemCall)));
+    std::string program;
+    for (size_t start = 0; start < assembly.size();) {
+        size_t end = std::min(assembly.find('\n', start), assembly.size());
+        std::string_view line = assembly.substr(start, end - start);
+        program += line == "syscall" ? "call __jit_syscall" : line;
+        program += '\n';
+        start = end + 1;
+    }
+    encoder.Assemble(program);
+    const std::vector<uint8_t> code = encoder.Finish();
+
+    // the code is written, then made executable but no longer writable
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    Mapping text(RoundUp(code.size(), page));
+    std::memcpy(text.Data(), code.data(), code.size());
+    text.Protect(0, text.Size(), PROT_READ | PROT_EXEC);
+
+    // the lowest page is left inaccessible, so overflowing the stack faults
+    Mapping stack(StackSize + page);
+    stack.Protect(0, page, PROT_NONE);
+    state.ProgramStack = reinterpret_cast<uint64_t>(stack.Data() + stack.Size());
+
+    // faults are turned into an exit status; their handler runs on a stack of its own, as the
+    // program's may be the cause
+    static std::once_flag installed;
+    std::call_once(installed, [] {
+        struct sigaction action {};
+        action.sa_handler = OnFault;
+        action.sa_flags = SA_ONSTACK;
+        sigemptyset(&action.sa_mask);
+        for (int signal : FaultSignals) {
+            sigaction(signal, &action, nullptr);
+        }
+    });
+    Mapping signalStack(RoundUp(64 * 1024, page));
+    stack_t alternate{}, previous{};
+    alternate.ss_sp = signalStack.Data();
+    alternate.ss_size = signalStack.Size();
+    sigaltstack(&alternate, &previous);
+
+    auto enter = reinterpret_cast<int64_t (*)()>(text.Data() + encoder.Offset("__jit_enter"));
+    sigjmp_buf recovery;
+    volatile int64_t result = 0; // assigned between sigsetjmp and a possible siglongjmp
+    t_Signal = 0;
+    if (sigsetjmp(recovery, 1) == 0) {
+        t_Recovery = &recovery;
+        result = enter();
+    }
+    t_Recovery = nullptr;
+    sigaltstack(&previous, nullptr);
+
+    if (t_Signal != 0) {
+        return 128 + t_Signal;
+    }
+    return static_cast<int>(result & 0xFF);
+}
+
+} // namespace Compiler
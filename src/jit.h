@@ -0,0 +1,14 @@
+#pragma once
+
+#include <ostream>
+#include <string_view>
+
+namespace Compiler {
+
+// Runs a generated program in-process. Its assembly is encoded into an executable buffer after a
+// small runtime standing in for the print routine and the system calls, then called on a
+// stack of its own. What it prints goes to out. Returns its exit status, or 128 plus the signal
+// number if it faulted (a division by zero, a stack overflow), as a shell would report it.
+int RunJit(std::string_view assembly, std::ostream& out);
+
+} // namespace Compiler
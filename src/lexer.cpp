@@ -11,11 +11,22 @@ static const std::unordered_map<std::string_view, TokenType> keywords{ { "return
 Lexer::Lexer(std::string_view src) : m_Src(src), m_Size(src.size()) {}
 
 std::vector<Token> Lexer::Lex() {
+    std::vector<Token> tokens;
+    Lex(SIZE_MAX, [&](std::vector<Token>& batch) { tokens = std::move(batch); });
+    return tokens;
+}
+
+void Lexer::Lex(size_t batchSize, const std::function<void(std::vector<Token>&)>& publish) {
     m_Index = 0;
+    m_Loc = SourceLocation();
 
     std::vector<Token> tokens;
 
     while (m_Index < m_Size) {
+        if (tokens.size() >= batchSize) {
+            publish(tokens);
+        }
+
         const char c = m_Src[m_Index];
 
         if (IsSpace(c)) {
@@ -78,6 +89,8 @@ std::vector<Token> Lexer::Lex() {
             case ')': tokens.emplace_back(RPAREN, startLoc); break;
             case '{': tokens.emplace_back(LBRACE, startLoc); break;
             case '}': tokens.emplace_back(RBRACE, startLoc); break;
+            case '[': tokens.emplace_back(LBRACKET, startLoc); break;
+            case ']': tokens.emplace_back(RBRACKET, startLoc); break;
             case ';': tokens.emplace_back(SEMICOLON, startLoc); break;
             case ',': tokens.emplace_back(COMMA, startLoc); break;
 
@@ -88,8 +101,7 @@ std::vector<Token> Lexer::Lex() {
     }
 
     tokens.emplace_back(END_OF_FILE, m_Loc);
-
-    return tokens;
+    publish(tokens);
 }
 
 bool Lexer::IsAlpha(char c) {
@@ -2,6 +2,7 @@
 
 #include <array>
 #include <cstdint>
+#include <functional>
 #include <optional>
 #include <string>
 #include <string_view>
@@ -23,6 +24,8 @@ enum TokenType {
     RPAREN,
     LBRACE,
     RBRACE,
+    LBRACKET,
+    RBRACKET,
     SEMICOLON,
     COMMA,
 
@@ -50,14 +53,15 @@ struct SourceLocation {
 };
 
 constexpr std::array<std::string_view, TOKEN_TYPE_NB> TokenNames = { "identifier", "literal", "return", "int",
-    "if", "else", "while", "(", ")", "{", "}", ";", ",", "+", "-", "*", "/", "%", ">", ">=", "<",
-    "<=", "==", "!=", "=", "eof" };
+    "if", "else", "while", "(", ")", "{", "}", "[", "]", ";", ",", "+", "-", "*", "/", "%", ">", ">=",
+    "<", "<=", "==", "!=", "=", "eof" };
 
 constexpr std::string_view TokenToStr(TokenType type) {
     return TokenNames.at(type);
 }
 
 struct Token {
+    Token() : Type(END_OF_FILE) {}
     Token(TokenType type, SourceLocation loc) : Type(type), Location(loc) {}
     Token(TokenType type, SourceLocation loc, std::string_view v) : Type(type), Location(loc), Value(v) {}
 
@@ -70,6 +74,9 @@ class Lexer {
   public:
     Lexer(std::string_view src);
     std::vector<Token> Lex();
+    // Lexes in batches of batchSize tokens, handing each to publish, which takes the tokens out of
+    // the vector; the last batch, which may be shorter, ends with END_OF_FILE.
+    void Lex(size_t batchSize, const std::function<void(std::vector<Token>&)>& publish);
 
   private:
     static bool IsAlpha(char c);
@@ -0,0 +1,167 @@
+#include "loop_analysis.h"
+#include "ast_utils.h"
+#include "stack.h"
+#include "utils.h"
+
+namespace Compiler {
+
+LoopAnalysis::LoopAnalysis(Block* body) {
+    VisitBlock(body);
+    for (auto& loop : m_Loops) {
+        FindInductionVariables(*loop);
+    }
+}
+
+void LoopAnalysis::VisitPrimary(Primary* primary) {
+    if (auto* expr = std::get_if<Expression*>(&primary->Value)) {
+        VisitExpression(*expr);
+    } else if (auto* element = std::get_if<Subscript*>(&primary->Value)) {
+        VisitExpression((*element)->Index);
+    }
+}
+
+void LoopAnalysis::VisitPostfixExpression(PostfixExpression* expr) {
+    VisitPrimary(expr->Prim);
+    for (const auto& args : expr->CallList) {
+        for (auto* arg : args) {
+            VisitAssignmentExpression(arg);
+        }
+    }
+}
+
+template <typename T>
+void LoopAnalysis::VisitChain(T* expr) {
+    if constexpr (std::is_same_v<T, PostfixExpression>) {
+        VisitPostfixExpression(expr);
+    } else {
+        VisitChain(expr->Left);
+        for (auto& [op, right] : expr->Right) {
+            VisitChain(right);
+        }
+    }
+}
+
+void LoopAnalysis::VisitAssignmentExpression(AssignmentExpression* expr) {
+    if (expr->Element) {
+        EnsureStack([&] { VisitExpression(expr->Element->Index); });
+    }
+    EnsureStack([&] { VisitChain(expr->Expr); });
+    if (expr->Ident) {
+        for (Loop* loop : m_Active) {
+            loop->Defs[expr->Decl]++;
+        }
+    }
+}
+
+void LoopAnalysis::VisitExpression(Expression* expr) {
+    VisitAssignmentExpression(expr->Expr);
+}
+
+void LoopAnalysis::VisitBlock(Block* block) {
+    for (auto* item : block->Items) {
+        std::visit(overloaded{ [&](Statement* stmt) { VisitStatement(stmt); },
+                       [&](Declaration* decl) {
+                           for (Loop* loop : m_Active) {
+                               loop->Locals.insert(decl);
+                           }
+                       } },
+            item->Item);
+    }
+}
+
+void LoopAnalysis::VisitStatement(Statement* stmt) {
+    EnsureStack([&] { VisitStatementHere(stmt); });
+}
+
+void LoopAnalysis::VisitStatementHere(Statement* stmt) {
+    std::visit(overloaded{ [&](ExpressionStatement* exprStmt) { VisitExpression(exprStmt->Expr); },
+                   [&](ReturnStatement* retStmt) {
+                       if (retStmt->Expr) {
+                           VisitExpression(retStmt->Expr);
+                       }
+                   },
+                   [&](IfStatement* ifStmt) {
+                       VisitExpression(ifStmt->Cond);
+                       VisitStatement(ifStmt->Then);
+                       if (ifStmt->Else) {
+                           VisitStatement(ifStmt->Else);
+                       }
+                   },
+                   [&](WhileStatement* whileStmt) {
+                       if (m_Untracked > 0 || static_cast<int>(m_Active.size()) == MaxLoopDepth) {
+                           if (m_Untracked++ == 0) {
+                               m_TooDeep.push_back(whileStmt);
+                           }
+                           VisitExpression(whileStmt->Cond);
+                           VisitStatement(whileStmt->Loop);
+                           m_Untracked--;
+                           return;
+                       }
+
+                       auto& loop = m_Loops.emplace_back(std::make_unique<Loop>(stmt, whileStmt));
+                       if (m_Active.empty()) {
+                           m_TopLevel.push_back(loop.get());
+                       } else {
+                           loop->Parent = m_Active.back();
+                           loop->Depth = loop->Parent->Depth + 1;
+                           loop->Parent->Children.push_back(loop.get());
+                       }
+
+                       m_Active.push_back(loop.get());
+                       VisitExpression(whileStmt->Cond);
+                       VisitStatement(whileStmt->Loop);
+                       m_Active.pop_back();
+                   },
+                   [&](Block* block) { VisitBlock(block); } },
+        stmt->Stmt);
+}
+
+void LoopAnalysis::FindInductionVariables(Loop& loop) {
+    auto* body = std::get_if<Block*>(&loop.While->Loop->Stmt);
+    if (!body) {
+        return;
+    }
+
+    for (auto* item : (*body)->Items) {
+        auto* stmt = std::get_if<Statement*>(&item->Item);
+        if (!stmt) {
+            continue;
+        }
+        auto* exprStmt = std::get_if<ExpressionStatement*>(&(*stmt)->Stmt);
+        if (!exprStmt) {
+            continue;
+        }
+
+        const AssignmentExpression* assign = (*exprStmt)->Expr->Expr;
+        if (!assign->Ident || loop.Locals.contains(assign->Decl) || loop.Defs.at(assign->Decl) != 1) {
+            continue;
+        }
+
+        // i = i + c | i = i - c | i = c + i
+        const EqualityExpression* eq = assign->Expr;
+        if (!eq->Right.empty() || !eq->Left->Right.empty()) {
+            continue;
+        }
+        const AdditiveExpression* add = eq->Left->Left;
+        if (add->Right.size() != 1) {
+            continue;
+        }
+        const auto& [op, right] = add->Right.front();
+
+        std::optional<int64_t> step;
+        if (AsVariable(add->Left) == assign->Decl) {
+            step = AsLiteral(right);
+            if (step && op == BinaryOp::Sub) {
+                step = static_cast<int64_t>(0ULL - static_cast<uint64_t>(*step));
+            }
+        } else if (op == BinaryOp::Add && AsVariable(right) == assign->Decl) {
+            step = AsLiteral(add->Left);
+        }
+
+        if (step) {
+            loop.InductionVariables.push_back({ assign->Decl, *step, item });
+        }
+    }
+}
+
+} // namespace Compiler
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "ast.h"
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace Compiler {
+
+// A variable stepped by a constant exactly once per iteration: `i = i + c` or `i = i - c` as a
+// direct item of the loop body, with no other assignment to `i` anywhere in the loop.
+struct InductionVariable {
+    const Declaration* Var;
+    int64_t Step;
+    BlockItem* Update;
+};
+
+// The source language has no goto, so every cycle in the control flow graph comes from a
+// `while`: the condition is the loop header, the end of the body is the only latch and the
+// statement before the loop is the only entry. Loops are therefore found on the AST, with the
+// block nesting giving the loop nest.
+struct Loop {
+    Statement* Stmt; // statement holding the WhileStatement, replaced by the preheader block
+    WhileStatement* While;
+    Loop* Parent = nullptr;
+    std::vector<Loop*> Children;
+    int Depth = 1;
+
+    std::unordered_map<const Declaration*, int> Defs; // assignment count per variable
+    std::unordered_set<const Declaration*> Locals;    // variables declared inside the loop
+    std::vector<InductionVariable> InductionVariables;
+
+    bool IsInvariant(const Declaration* decl) const { return !Defs.contains(decl) && !Locals.contains(decl); }
+};
+
+// Every variable assigned in a loop is recorded for each of the loops enclosing the assignment, and
+// the optimizer walks the body of each loop, so deep loop nests would cost time quadratic in their
+// depth. Loops nested more than MaxLoopDepth deep are therefore not analyzed: their statements count
+// as part of the enclosing loops, and TooDeep lists the outermost of them.
+class LoopAnalysis {
+  public:
+    static constexpr int MaxLoopDepth = 64;
+
+    explicit LoopAnalysis(Block* body);
+
+    const std::vector<Loop*>& TopLevelLoops() const { return m_TopLevel; }
+    const std::vector<std::unique_ptr<Loop>>& Loops() const { return m_Loops; }
+    const std::vector<const WhileStatement*>& TooDeep() const { return m_TooDeep; }
+
+  private:
+    void VisitPrimary(Primary* primary);
+    void VisitPostfixExpression(PostfixExpression* expr);
+    template <typename T>
+    void VisitChain(T* expr);
+    void VisitAssignmentExpression(AssignmentExpression* expr);
+    void VisitExpression(Expression* expr);
+    void VisitBlock(Block* block);
+    void VisitStatement(Statement* stmt);
+    void VisitStatementHere(Statement* stmt); // on the current stack
+
+    void FindInductionVariables(Loop& loop);
+
+    std::vector<std::unique_ptr<Loop>> m_Loops;
+    std::vector<Loop*> m_TopLevel;
+    std::vector<Loop*> m_Active; // loops enclosing the node being visited
+    std::vector<const WhileStatement*> m_TooDeep;
+    int m_Untracked = 0; // depth of the node being visited within loops too deep to analyze
+};
+
+} // namespace Compiler
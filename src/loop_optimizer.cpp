@@ -0,0 +1,257 @@
+#include "loop_optimizer.h"
+#include "ast_utils.h"
+#include "loop_analysis.h"
+#include "remarks.h"
+#include "stack.h"
+#include <algorithm>
+#include <format>
+
+namespace Compiler {
+
+LoopOptimizer::LoopOptimizer(
+    Block* body, AstBuilder& builder, const OptimizationOptions& options, Remarks& remarks)
+    : m_Body(body), m_Builder(builder), m_Options(options), m_Remarks(remarks) {}
+
+void LoopOptimizer::Run() {
+    LoopAnalysis analysis(m_Body);
+    for (Loop* loop : analysis.TopLevelLoops()) {
+        OptimizeLoop(*loop);
+    }
+    for (const WhileStatement* whileStmt : analysis.TooDeep()) {
+        m_Remarks.Missed("licm", whileStmt->Loc, std::format("loop not optimized: it is nested more than {} loops deep",
+                                                     LoopAnalysis::MaxLoopDepth));
+    }
+}
+
+void LoopOptimizer::OptimizeLoop(Loop& loop) {
+    m_Loop = &loop;
+
+    if (m_Options.LoopInvariantCodeMotion) {
+        auto hoist = [&](Expression* expr) { Hoist(expr->Expr); };
+        hoist(loop.While->Cond);
+        ForEachExpression(loop.While->Loop, hoist);
+    }
+
+    // the vector loop of a vectorized loop advances the counter but no reduced expression of it
+    if (m_Options.StrengthReduction && !loop.While->Vector) {
+        for (const auto& iv : loop.InductionVariables) {
+            ReduceInductionVariable(iv);
+        }
+    }
+
+    InsertPreheader(loop);
+
+    for (Loop* child : loop.Children) {
+        EnsureStack([&] { OptimizeLoop(*child); });
+    }
+}
+
+void LoopOptimizer::InsertPreheader(Loop& loop) {
+    if (m_PreheaderInits.empty()) {
+        return;
+    }
+
+    // { int licm.0; ...; licm.0 = <invariant>; ...; while (...) ... }
+    Block* preheader = m_Builder.Make<Block>();
+    preheader->Items = std::move(m_PreheaderDecls);
+    preheader->Items.insert(preheader->Items.end(), m_PreheaderInits.begin(), m_PreheaderInits.end());
+
+    Statement* whileStmt = m_Builder.Make<Statement>(loop.While);
+    preheader->Items.push_back(m_Builder.Item(whileStmt));
+
+    loop.Stmt->Stmt = preheader;
+    loop.Stmt = whileStmt;
+
+    m_PreheaderDecls.clear();
+    m_PreheaderInits.clear();
+}
+
+template <typename T>
+LoopOptimizer::ExprInfo LoopOptimizer::Classify(const T* expr) const {
+    if constexpr (std::is_same_v<T, Primary>) {
+        return std::visit(overloaded{ [&](int64_t) { return ExprInfo{}; },
+                              [&](const std::string&) { return ExprInfo{ m_Loop->IsInvariant(expr->Decl) }; },
+                              [&](const Expression* e) {
+                                  if (e->Expr->Ident || e->Expr->Element) {
+                                      return ExprInfo{ false, true };
+                                  }
+                                  return EnsureStack([&] { return Classify(e->Expr->Expr); });
+                              },
+                              // the loop may store to the element, and a hoisted load could trap
+                              [&](const Subscript*) { return ExprInfo{ false, true }; } },
+            expr->Value);
+    } else if constexpr (std::is_same_v<T, PostfixExpression>) {
+        if (!expr->CallList.empty()) {
+            return { false, true };
+        }
+        return Classify(expr->Prim);
+    } else {
+        ExprInfo info = Classify(expr->Left);
+        for (const auto& [op, right] : expr->Right) {
+            info.Invariant = info.Invariant && CanSpeculate(op, right) && Classify(right).Invariant;
+            info.HasOperator = true;
+        }
+        return info;
+    }
+}
+
+template <typename T>
+void LoopOptimizer::Hoist(T* expr) {
+    if constexpr (std::is_same_v<T, Primary>) {
+        if (auto* e = std::get_if<Expression*>(&expr->Value)) {
+            EnsureStack([&] { Hoist((*e)->Expr); });
+        } else if (auto* element = std::get_if<Subscript*>(&expr->Value)) {
+            EnsureStack([&] { Hoist((*element)->Index->Expr); });
+        }
+    } else if constexpr (std::is_same_v<T, PostfixExpression>) {
+        const ExprInfo info = Classify(expr);
+        if (info.Invariant && info.HasOperator) {
+            expr->Prim = m_Builder.Var(HoistValue(m_Builder.Wrap<EqualityExpression>(expr->Prim)));
+            return;
+        }
+        Hoist(expr->Prim);
+        for (const auto& args : expr->CallList) {
+            for (auto* arg : args) {
+                Hoist(arg);
+            }
+        }
+    } else {
+        using Operand = OperandOf_t<T>;
+
+        // operators are left associative, so only a prefix of the chain forms a subexpression
+        size_t prefix = 0;
+        if (Classify(expr->Left).Invariant) {
+            for (const auto& [op, right] : expr->Right) {
+                if (!CanSpeculate(op, right) || !Classify(right).Invariant) {
+                    break;
+                }
+                ++prefix;
+            }
+        }
+
+        if (prefix > 0) {
+            T* hoisted = m_Builder.Make<T>(expr->Left);
+            hoisted->Right.assign(expr->Right.begin(), expr->Right.begin() + prefix);
+            const Declaration* temp = HoistValue(m_Builder.Wrap<EqualityExpression>(hoisted));
+
+            expr->Left = m_Builder.Wrap<Operand>(m_Builder.Var(temp));
+            expr->Right.erase(expr->Right.begin(), expr->Right.begin() + prefix);
+        } else {
+            Hoist(expr->Left);
+        }
+
+        for (auto& [op, right] : expr->Right) {
+            Hoist(right);
+        }
+    }
+}
+
+void LoopOptimizer::Hoist(AssignmentExpression* expr) {
+    if (expr->Element) {
+        EnsureStack([&] { Hoist(expr->Element->Index->Expr); });
+    }
+    Hoist(expr->Expr);
+}
+
+const Declaration* LoopOptimizer::HoistValue(EqualityExpression* value) {
+    m_Remarks.Passed("licm", m_Loop->While->Loc, std::format("hoisted '{}' out of the loop", ToString(value)));
+    Declaration* temp = m_Builder.CreateTemporary("licm");
+    m_PreheaderDecls.push_back(m_Builder.Item(temp));
+    m_PreheaderInits.push_back(m_Builder.Item(m_Builder.ExpressionStmt(m_Builder.Assign(temp, value))));
+    return temp;
+}
+
+void LoopOptimizer::ReduceInductionVariable(const InductionVariable& iv) {
+    std::map<int64_t, const Declaration*> temps;
+    auto reduce = [&](Expression* expr) { Reduce(expr->Expr, iv, temps); };
+    reduce(m_Loop->While->Cond);
+    ForEachExpression(m_Loop->While->Loop, reduce);
+
+    if (temps.empty()) {
+        return;
+    }
+
+    auto& items = std::get<Block*>(m_Loop->While->Loop->Stmt)->Items;
+    auto pos = std::find(items.begin(), items.end(), iv.Update) + 1;
+
+    for (const auto& [factor, temp] : temps) {
+        // preheader: sr.N = i * factor
+        auto* init = m_Builder.Wrap<MultiplicativeExpression>(m_Builder.Var(iv.Var));
+        init->Right.emplace_back(BinaryOp::Mul, m_Builder.Wrap<PostfixExpression>(m_Builder.Literal(factor)));
+        m_PreheaderInits.push_back(
+            m_Builder.Item(m_Builder.ExpressionStmt(m_Builder.Assign(temp, m_Builder.Wrap<EqualityExpression>(init)))));
+
+        // after the update of i: sr.N = sr.N + step * factor, wrapping like the multiply would
+        int64_t delta = static_cast<int64_t>(static_cast<uint64_t>(iv.Step) * static_cast<uint64_t>(factor));
+        BinaryOp op = BinaryOp::Add;
+        if (delta < 0 && delta != INT64_MIN) {
+            op = BinaryOp::Sub;
+            delta = -delta;
+        }
+        m_Remarks.Passed("loop-reduce", m_Loop->While->Loc,
+            std::format("replaced '{} * {}' with a variable stepped by {}", iv.Var->Ident, factor,
+                static_cast<int64_t>(static_cast<uint64_t>(iv.Step) * static_cast<uint64_t>(factor))));
+        auto* update = m_Builder.Wrap<AdditiveExpression>(m_Builder.Var(temp));
+        update->Right.emplace_back(op, m_Builder.Wrap<MultiplicativeExpression>(m_Builder.Literal(delta)));
+
+        Statement* stmt = m_Builder.ExpressionStmt(m_Builder.Assign(temp, m_Builder.Wrap<EqualityExpression>(update)));
+        pos = items.insert(pos, m_Builder.Item(stmt)) + 1;
+    }
+}
+
+template <typename T>
+void LoopOptimizer::Reduce(T* expr, const InductionVariable& iv, std::map<int64_t, const Declaration*>& temps) {
+    if constexpr (std::is_same_v<T, Primary>) {
+        if (auto* e = std::get_if<Expression*>(&expr->Value)) {
+            EnsureStack([&] { Reduce((*e)->Expr, iv, temps); });
+        } else if (auto* element = std::get_if<Subscript*>(&expr->Value)) {
+            EnsureStack([&] { Reduce((*element)->Index->Expr, iv, temps); });
+        }
+    } else if constexpr (std::is_same_v<T, PostfixExpression>) {
+        Reduce(expr->Prim, iv, temps);
+        for (const auto& args : expr->CallList) {
+            for (auto* arg : args) {
+                Reduce(arg, iv, temps);
+            }
+        }
+    } else {
+        if constexpr (std::is_same_v<T, MultiplicativeExpression>) {
+            // i * c | c * i at the head of the chain
+            if (!expr->Right.empty() && expr->Right.front().first == BinaryOp::Mul) {
+                PostfixExpression* right = expr->Right.front().second;
+                std::optional<int64_t> factor;
+                if (AsVariable(expr->Left) == iv.Var) {
+                    factor = AsLiteral(right);
+                } else if (AsVariable(right) == iv.Var) {
+                    factor = AsLiteral(expr->Left);
+                }
+
+                if (factor) {
+                    const Declaration*& temp = temps[*factor];
+                    if (!temp) {
+                        Declaration* decl = m_Builder.CreateTemporary("sr");
+                        m_PreheaderDecls.push_back(m_Builder.Item(decl));
+                        temp = decl;
+                    }
+                    expr->Left = m_Builder.Wrap<PostfixExpression>(m_Builder.Var(temp));
+                    expr->Right.erase(expr->Right.begin());
+                }
+            }
+        }
+
+        Reduce(expr->Left, iv, temps);
+        for (auto& [op, right] : expr->Right) {
+            Reduce(right, iv, temps);
+        }
+    }
+}
+
+void LoopOptimizer::Reduce(
+    AssignmentExpression* expr, const InductionVariable& iv, std::map<int64_t, const Declaration*>& temps) {
+    if (expr->Element) {
+        EnsureStack([&] { Reduce(expr->Element->Index->Expr, iv, temps); });
+    }
+    Reduce(expr->Expr, iv, temps);
+}
+
+} // namespace Compiler
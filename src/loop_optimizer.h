@@ -0,0 +1,55 @@
+#pragma once
+
+#include "ast.h"
+#include "options.h"
+#include <map>
+
+namespace Compiler {
+
+class AstBuilder;
+class Remarks;
+struct Loop;
+struct InductionVariable;
+
+// Loop-invariant code motion and induction-variable strength reduction.
+//
+// Loops are visited outermost first, so an expression is hoisted out of every loop it is
+// invariant in. Hoisted values and the initial values of reduced induction expressions are
+// stored in synthetic variables declared in a preheader block that wraps the loop.
+class LoopOptimizer {
+  public:
+    LoopOptimizer(Block* body, AstBuilder& builder, const OptimizationOptions& options, Remarks& remarks);
+    void Run();
+
+  private:
+    struct ExprInfo {
+        bool Invariant = true;
+        bool HasOperator = false;
+    };
+
+    void OptimizeLoop(Loop& loop);
+    void InsertPreheader(Loop& loop);
+
+    template <typename T>
+    ExprInfo Classify(const T* expr) const;
+    void Hoist(AssignmentExpression* expr);
+    template <typename T>
+    void Hoist(T* expr);
+    const Declaration* HoistValue(EqualityExpression* value);
+
+    void ReduceInductionVariable(const InductionVariable& iv);
+    void Reduce(AssignmentExpression* expr, const InductionVariable& iv, std::map<int64_t, const Declaration*>& temps);
+    template <typename T>
+    void Reduce(T* expr, const InductionVariable& iv, std::map<int64_t, const Declaration*>& temps);
+
+    Block* m_Body;
+    AstBuilder& m_Builder;
+    const OptimizationOptions& m_Options;
+    Remarks& m_Remarks;
+
+    const Loop* m_Loop = nullptr;
+    std::vector<BlockItem*> m_PreheaderDecls;
+    std::vector<BlockItem*> m_PreheaderInits;
+};
+
+} // namespace Compiler
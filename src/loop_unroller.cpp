@@ -0,0 +1,185 @@
+#include "loop_unroller.h"
+#include "ast_utils.h"
+#include "loop_analysis.h"
+#include "profile.h"
+#include "remarks.h"
+#include <format>
+
+namespace Compiler {
+
+LoopUnroller::LoopUnroller(Block* body, AstBuilder& builder, const OptimizationOptions& options,
+    const Profile* profile, Remarks& remarks)
+    : m_Body(body), m_Builder(builder), m_Options(options), m_Profile(profile), m_Remarks(remarks) {}
+
+void LoopUnroller::Run() {
+    LoopAnalysis analysis(m_Body);
+    for (const auto& loop : analysis.Loops()) {
+        WhileStatement* unrolled = m_Options.UnrollFactor != 1 ? TryUnroll(*loop) : nullptr;
+        Rotate(loop->While, unrolled);
+    }
+}
+
+WhileStatement* LoopUnroller::TryUnroll(Loop& loop) {
+    const SourceLocation loc = loop.While->Loc;
+
+    if (!loop.Children.empty()) {
+        m_Remarks.Missed("loop-unroll", loc, "loop not unrolled: it contains another loop");
+        return nullptr;
+    }
+    if (loop.While->Vector) {
+        // the loop itself only runs what is left over from the vector loop
+        m_Remarks.Missed("loop-unroll", loc, "loop not unrolled: it is vectorized");
+        return nullptr;
+    }
+
+    std::optional<TripTest> test = MatchTripTest(loop);
+    if (!test) {
+        m_Remarks.Missed("loop-unroll", loc, "loop not unrolled: its condition is not a counted test");
+        return nullptr;
+    }
+
+    const int cost = EstimateCost(loop.While->Loop);
+    int factor = ChooseFactor(cost);
+    if (factor < 2) {
+        m_Remarks.Missed("loop-unroll", loc,
+            std::format("loop not unrolled: body cost {} does not fit the budget of {}", cost, m_Options.UnrollBudget));
+        return nullptr;
+    }
+
+    // copies of the body beyond the iterations the loop usually runs would only ever be skipped
+    const Profile::LoopCounts* counts = m_Profile ? m_Profile->Loop(loc) : nullptr;
+    if (counts && m_Options.UnrollFactor == 0) {
+        if (counts->Entries == 0) {
+            m_Remarks.Missed("loop-unroll", loc, "loop not unrolled: it never ran in the profile");
+            return nullptr;
+        }
+        const uint64_t trips = counts->Iterations / counts->Entries;
+        while (factor >= 2 && static_cast<uint64_t>(factor) > trips) {
+            factor /= 2;
+        }
+        if (factor < 2) {
+            m_Remarks.Missed("loop-unroll", loc,
+                std::format("loop not unrolled: it ran {} iterations on average in the profile", trips));
+            return nullptr;
+        }
+    }
+
+    Expression* cond = UnrolledCondition(*test, factor);
+    if (!cond) {
+        m_Remarks.Missed("loop-unroll", loc, "loop not unrolled: the adjusted bound would overflow");
+        return nullptr;
+    }
+
+    Block* body = m_Builder.Make<Block>();
+    for (int i = 0; i < factor; i++) {
+        body->Items.push_back(m_Builder.Item(m_Builder.Clone(loop.While->Loop)));
+    }
+
+    WhileStatement* unrolled = m_Builder.Make<WhileStatement>(cond, m_Builder.Make<Statement>(body));
+    unrolled->Loc = loc;
+
+    Statement* remainder = m_Builder.Make<Statement>(loop.While);
+    Block* replacement = m_Builder.Make<Block>();
+    replacement->Items.push_back(m_Builder.Item(m_Builder.Make<Statement>(unrolled)));
+    replacement->Items.push_back(m_Builder.Item(remainder));
+    loop.Stmt->Stmt = replacement;
+    loop.Stmt = remainder;
+
+    m_Remarks.Passed("loop-unroll", loc,
+        std::format("unrolled loop by a factor of {} with a remainder loop (body cost {}, budget {})", factor, cost,
+            m_Options.UnrollBudget));
+    return unrolled;
+}
+
+std::optional<LoopUnroller::TripTest> LoopUnroller::MatchTripTest(const Loop& loop) const {
+    const AssignmentExpression* cond = loop.While->Cond->Expr;
+    if (cond->Ident || cond->Element) {
+        return std::nullopt;
+    }
+
+    const Declaration* var = AsVariable(cond->Expr);
+    BinaryOp op = BinaryOp::Ne;
+    int64_t bound = 0;
+
+    if (!var) {
+        // i < N, i <= N, i > N, i >= N, i != N
+        const EqualityExpression* eq = cond->Expr;
+        const RelationalExpression* rel = eq->Left;
+        std::optional<int64_t> literal;
+        if (eq->Right.size() == 1 && eq->Right.front().first == BinaryOp::Ne) {
+            var = AsVariable(rel);
+            literal = AsLiteral(eq->Right.front().second);
+        } else if (eq->Right.empty() && rel->Right.size() == 1) {
+            var = AsVariable(rel->Left);
+            literal = AsLiteral(rel->Right.front().second);
+            op = rel->Right.front().first;
+        }
+
+        if (!var || !literal) {
+            return std::nullopt;
+        }
+        bound = *literal;
+    }
+
+    for (const auto& iv : loop.InductionVariables) {
+        if (iv.Var != var || iv.Step == 0) {
+            continue;
+        }
+
+        if (op == BinaryOp::Ne) {
+            op = iv.Step < 0 ? BinaryOp::Gt : BinaryOp::Lt;
+        }
+        const bool up = op == BinaryOp::Lt || op == BinaryOp::Le;
+        const bool down = op == BinaryOp::Gt || op == BinaryOp::Ge;
+        if ((up && iv.Step > 0) || (down && iv.Step < 0)) {
+            return TripTest{ &iv, op, bound };
+        }
+        return std::nullopt;
+    }
+    return std::nullopt;
+}
+
+Expression* LoopUnroller::UnrolledCondition(const TripTest& test, int factor) const {
+    // the next `factor` tests all pass iff the last one does: i + (factor - 1) * step Op Bound,
+    // evaluated as i Op Bound - (factor - 1) * step so that i itself cannot overflow
+    int64_t distance;
+    int64_t bound;
+    if (__builtin_mul_overflow(static_cast<int64_t>(factor - 1), test.IV->Step, &distance) ||
+        __builtin_sub_overflow(test.Bound, distance, &bound)) {
+        return nullptr;
+    }
+
+    auto* rel = m_Builder.Wrap<RelationalExpression>(m_Builder.Var(test.IV->Var));
+    rel->Right.emplace_back(test.Op, m_Builder.Wrap<AdditiveExpression>(m_Builder.Literal(bound)));
+    return m_Builder.Value(m_Builder.Wrap<EqualityExpression>(rel));
+}
+
+int LoopUnroller::ChooseFactor(int cost) const {
+    if (m_Options.UnrollFactor > 1) {
+        return m_Options.UnrollFactor;
+    }
+
+    // largest power of two that keeps the unrolled body within budget
+    int factor = 1;
+    while (factor * 2 <= m_Options.MaxUnrollFactor && factor * 2 * cost <= m_Options.UnrollBudget) {
+        factor *= 2;
+    }
+    return factor;
+}
+
+void LoopUnroller::Rotate(WhileStatement* whileStmt, WhileStatement* unrolled) {
+    if (!m_Options.LoopRotation) {
+        return;
+    }
+    whileStmt->Rotated = true;
+    if (!unrolled) {
+        m_Remarks.Passed("loop-rotate", whileStmt->Loc, "rotated loop into a guarded do-while");
+        return;
+    }
+    // one remark for the source loop, which both copies share the location of
+    unrolled->Rotated = true;
+    m_Remarks.Passed(
+        "loop-rotate", whileStmt->Loc, "rotated the unrolled loop and its remainder into guarded do-whiles");
+}
+
+} // namespace Compiler
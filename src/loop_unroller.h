@@ -0,0 +1,50 @@
+#pragma once
+
+#include "ast.h"
+#include "options.h"
+
+namespace Compiler {
+
+class AstBuilder;
+class Profile;
+class Remarks;
+struct InductionVariable;
+struct Loop;
+
+// Unrolls counted loops and rotates every loop into a guarded do-while.
+//
+// A counted loop tests one induction variable against a literal bound (or against zero) and
+// changes it nowhere but in its update. Such a loop is rewritten as
+//
+//     { while (<U iterations left>) { body; body; ... } while (cond) body; }
+//
+// where the second loop is the original one and runs the remaining iterations. With a profile, U is
+// also at most the number of iterations the loop ran on average.
+class LoopUnroller {
+  public:
+    LoopUnroller(Block* body, AstBuilder& builder, const OptimizationOptions& options, const Profile* profile,
+        Remarks& remarks);
+    void Run();
+
+  private:
+    // The loop test in the form `IV Op Bound`; a bare `i` is `i != 0`.
+    struct TripTest {
+        const InductionVariable* IV;
+        BinaryOp Op;
+        int64_t Bound;
+    };
+
+    WhileStatement* TryUnroll(Loop& loop); // the unrolled copy, if it was unrolled
+    std::optional<TripTest> MatchTripTest(const Loop& loop) const;
+    Expression* UnrolledCondition(const TripTest& test, int factor) const;
+    int ChooseFactor(int cost) const;
+    void Rotate(WhileStatement* whileStmt, WhileStatement* unrolled);
+
+    Block* m_Body;
+    AstBuilder& m_Builder;
+    const OptimizationOptions& m_Options;
+    const Profile* m_Profile;
+    Remarks& m_Remarks;
+};
+
+} // namespace Compiler
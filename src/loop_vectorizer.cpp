@@ -0,0 +1,341 @@
+#include "loop_vectorizer.h"
+#include "ast_utils.h"
+#include "loop_analysis.h"
+#include "remarks.h"
+#include "stack.h"
+#include <algorithm>
+#include <format>
+
+namespace Compiler {
+
+using Kind = VectorLoop::Node::Kind;
+
+LoopVectorizer::LoopVectorizer(Block* body, AstBuilder& builder, Remarks& remarks)
+    : m_Body(body), m_Builder(builder), m_Remarks(remarks) {}
+
+void LoopVectorizer::Run() {
+    LoopAnalysis analysis(m_Body);
+    for (const auto& loop : analysis.Loops()) {
+        TryVectorize(*loop);
+    }
+}
+
+void LoopVectorizer::TryVectorize(Loop& loop) {
+    const SourceLocation loc = loop.While->Loc;
+    auto missed = [&](std::string_view reason) {
+        m_Remarks.Missed("vectorize", loc, std::format("loop not vectorized: {}", reason));
+    };
+
+    if (!loop.Children.empty()) {
+        missed("it contains another loop");
+        return;
+    }
+    Block* const* body = std::get_if<Block*>(&loop.While->Loop->Stmt);
+    if (!body) {
+        missed("its body is not a block");
+        return;
+    }
+
+    // counter < bound
+    const AssignmentExpression* cond = loop.While->Cond->Expr;
+    const RelationalExpression* rel = cond->Expr->Left;
+    if (cond->Ident || cond->Element || !cond->Expr->Right.empty() || rel->Right.size() != 1 ||
+        rel->Right.front().first != BinaryOp::Lt) {
+        missed("its condition is not a counter below a bound");
+        return;
+    }
+    m_Plan = {};
+    m_Plan.Counter = AsVariable(rel->Left);
+    m_Arrays.clear();
+    m_Plan.Limit = AsVariable(rel->Right.front().second);
+    const std::optional<int64_t> bound = AsLiteral(rel->Right.front().second);
+    if (!m_Plan.Counter || (!m_Plan.Limit && !bound)) {
+        missed("its condition is not a counter below a bound");
+        return;
+    }
+    if (m_Plan.Limit && !loop.IsInvariant(m_Plan.Limit)) {
+        missed("its bound changes in the loop");
+        return;
+    }
+    m_Plan.Bound = bound.value_or(0);
+
+    const auto iv = std::ranges::find(loop.InductionVariables, m_Plan.Counter, &InductionVariable::Var);
+    if (iv == loop.InductionVariables.end() || iv->Step != 1 || iv->Update != (*body)->Items.back()) {
+        missed("its counter is not stepped by one at the end of the body");
+        return;
+    }
+
+    for (size_t i = 0; i + 1 < (*body)->Items.size(); i++) {
+        Statement* const* stmt = std::get_if<Statement*>(&(*body)->Items[i]->Item);
+        ExpressionStatement* const* exprStmt = stmt ? std::get_if<ExpressionStatement*>(&(*stmt)->Stmt) : nullptr;
+        if (!exprStmt) {
+            missed("its body holds more than expression statements");
+            return;
+        }
+        const AssignmentExpression* store = (*exprStmt)->Expr->Expr;
+        if (store->Ident) {
+            missed(std::format("it assigns '{}'", *store->Ident));
+            return;
+        }
+        if (!store->Element) {
+            missed("a statement is not an element store");
+            return;
+        }
+        if (!AddStore(loop, store)) {
+            missed(m_Reason);
+            return;
+        }
+    }
+    if (m_Plan.Stores.empty()) {
+        missed("it stores no element");
+        return;
+    }
+    if (const char* reason = CheckArrays()) {
+        missed(reason);
+        return;
+    }
+    if (!AllocateRegisters()) {
+        missed(std::format("it needs more than {} vector registers", Registers));
+        return;
+    }
+
+    const size_t stores = m_Plan.Stores.size();
+    loop.While->Vector = m_Builder.Make<VectorLoop>(std::move(m_Plan));
+    m_Remarks.Passed("vectorize", loc,
+        std::format("vectorized loop with {} element store{}, 4 iterations at a time with AVX2 and 2 with SSE2",
+            stores, stores == 1 ? "" : "s"));
+}
+
+bool LoopVectorizer::AddStore(const Loop& loop, const AssignmentExpression* store) {
+    const Subscript* element = store->Element;
+    if (const std::optional<int64_t> offset = MatchOffset(element->Index)) {
+        const std::optional<int> value = Add(loop, store->Expr);
+        if (!value) {
+            return false;
+        }
+        ArrayUse& use = Use(element->Decl);
+        use.Stored = true;
+        if (std::ranges::find(use.Offsets, *offset) == use.Offsets.end()) {
+            use.Offsets.push_back(*offset);
+        }
+        m_Plan.Stores.push_back({ element->Decl, *offset, *value });
+        return true;
+    }
+
+    // a[k] = a[k] + e or a[k] = a[k] - e, or more terms, which a[k] - e1 + e2 sums as a[k] - (e1 - e2)
+    const std::optional<int64_t> index = ConstantIndex(element);
+    const EqualityExpression* eq = store->Expr;
+    const AdditiveExpression* sum = eq->Left->Left;
+    const Primary* first = eq->Right.empty() && eq->Left->Right.empty() ? AsPrimary(sum->Left) : nullptr;
+    Subscript* const* same = first ? std::get_if<Subscript*>(&first->Value) : nullptr;
+    if (!index || !same || (*same)->Decl != element->Decl || ConstantIndex(*same) != index || sum->Right.empty()) {
+        m_Reason = "a store is neither to the counter plus a literal nor a reduction";
+        return false;
+    }
+    const bool subtract = sum->Right.front().first == BinaryOp::Sub;
+    std::optional<int> value = Add(loop, sum->Right.front().second);
+    for (size_t i = 1; value && i < sum->Right.size(); i++) {
+        const auto& [op, term] = sum->Right[i];
+        const std::optional<int> right = Add(loop, term);
+        if (!right) {
+            return false;
+        }
+        value = Binary(subtract == (op == BinaryOp::Add) ? BinaryOp::Sub : BinaryOp::Add, *value, *right);
+    }
+    if (!value) {
+        return false;
+    }
+    Use(element->Decl).Reduced = true;
+    m_Plan.Stores.push_back({ element->Decl, *index, *value, true, subtract });
+    return true;
+}
+
+template <typename T>
+std::optional<int> LoopVectorizer::Add(const Loop& loop, const T* expr) {
+    if constexpr (std::is_same_v<T, PostfixExpression>) {
+        if (!expr->CallList.empty()) {
+            m_Reason = "it calls a function";
+            return std::nullopt;
+        }
+        return Add(loop, expr->Prim);
+    } else {
+        std::optional<int> left = Add(loop, expr->Left);
+        for (const auto& [op, operand] : expr->Right) {
+            if (!left) {
+                break;
+            }
+            const std::optional<int> right = Add(loop, operand);
+            left = right ? Binary(op, *left, *right) : std::nullopt;
+        }
+        return left;
+    }
+}
+
+std::optional<int> LoopVectorizer::Add(const Loop& loop, const Primary* primary) {
+    return std::visit(
+        overloaded{ [&](int64_t value) -> std::optional<int> { return Leaf(Kind::Broadcast, nullptr, value); },
+            [&](const std::string&) -> std::optional<int> {
+                if (primary->Decl == m_Plan.Counter) {
+                    return Leaf(Kind::Counter, nullptr, 0);
+                }
+                if (!loop.IsInvariant(primary->Decl)) {
+                    m_Reason = "it reads a variable the loop assigns";
+                    return std::nullopt;
+                }
+                return Leaf(Kind::Broadcast, primary->Decl, 0);
+            },
+            [&](const Expression* e) -> std::optional<int> {
+                if (e->Expr->Ident || e->Expr->Element) {
+                    m_Reason = "it assigns inside an expression";
+                    return std::nullopt;
+                }
+                return EnsureStack([&] { return Add(loop, e->Expr->Expr); });
+            },
+            [&](const Subscript* element) -> std::optional<int> {
+                const std::optional<int64_t> offset = MatchOffset(element->Index);
+                if (!offset) {
+                    m_Reason = "an index is not the counter plus a literal";
+                    return std::nullopt;
+                }
+                ArrayUse& use = Use(element->Decl);
+                if (std::ranges::find(use.Offsets, *offset) == use.Offsets.end()) {
+                    use.Offsets.push_back(*offset);
+                }
+                return Leaf(Kind::Load, element->Decl, *offset);
+            } },
+        primary->Value);
+}
+
+std::optional<int> LoopVectorizer::Binary(BinaryOp op, int left, int right) {
+    Kind kind;
+    switch (op) {
+    case BinaryOp::Add: kind = Kind::Add; break;
+    case BinaryOp::Sub: kind = Kind::Sub; break;
+    case BinaryOp::Mul: kind = Kind::Mul; break;
+    case BinaryOp::Div:
+    case BinaryOp::Mod: m_Reason = "it divides, which SIMD integer instructions cannot"; return std::nullopt;
+    default: m_Reason = "it compares"; return std::nullopt;
+    }
+    auto invariant = [&](int node) {
+        return m_Plan.Nodes[node].Op == Kind::Broadcast || m_Plan.Nodes[node].Invariant;
+    };
+    m_Plan.Nodes.push_back({ kind, nullptr, 0, left, right, invariant(left) && invariant(right) });
+    return static_cast<int>(m_Plan.Nodes.size() - 1);
+}
+
+int LoopVectorizer::Leaf(Kind kind, const Declaration* var, int64_t value) {
+    // the counter and each invariant are kept in one register for the whole loop
+    if (kind != Kind::Load) {
+        auto same = [&](const VectorLoop::Node& node) {
+            return node.Op == kind && node.Var == var && node.Value == value;
+        };
+        if (auto found = std::ranges::find_if(m_Plan.Nodes, same); found != m_Plan.Nodes.end()) {
+            return static_cast<int>(found - m_Plan.Nodes.begin());
+        }
+    }
+    m_Plan.Nodes.push_back({ kind, var, value });
+    return static_cast<int>(m_Plan.Nodes.size() - 1);
+}
+
+std::optional<int64_t> LoopVectorizer::MatchOffset(const Expression* index) const {
+    // i, i + c, i - c or c + i
+    const AssignmentExpression* assign = index->Expr;
+    if (assign->Ident || assign->Element || !assign->Expr->Right.empty() || !assign->Expr->Left->Right.empty()) {
+        return std::nullopt;
+    }
+    const AdditiveExpression* sum = assign->Expr->Left->Left;
+    std::optional<int64_t> offset;
+    if (sum->Right.empty()) {
+        offset = AsVariable(sum) == m_Plan.Counter ? std::optional<int64_t>(0) : std::nullopt;
+    } else if (sum->Right.size() == 1) {
+        const auto& [op, right] = sum->Right.front();
+        if (AsVariable(sum->Left) == m_Plan.Counter) {
+            offset = AsLiteral(right);
+            if (offset && op == BinaryOp::Sub) {
+                offset = -*offset;
+            }
+        } else if (op == BinaryOp::Add && AsVariable(right) == m_Plan.Counter) {
+            offset = AsLiteral(sum->Left);
+        }
+    }
+    return offset && *offset >= -MaxOffset && *offset <= MaxOffset ? offset : std::nullopt;
+}
+
+LoopVectorizer::ArrayUse& LoopVectorizer::Use(const Declaration* array) {
+    auto found = std::ranges::find(m_Arrays, array, &ArrayUse::Array);
+    return found != m_Arrays.end() ? *found : m_Arrays.emplace_back(ArrayUse{ array, {} });
+}
+
+const char* LoopVectorizer::CheckArrays() {
+    for (const ArrayUse& use : m_Arrays) {
+        if (use.Reduced && (use.Stored || !use.Offsets.empty())) {
+            return "it reduces into an array it also accesses otherwise";
+        }
+        if (use.Stored && use.Offsets.size() > 1) {
+            return "it stores to an array it accesses at more than one offset";
+        }
+        for (const int64_t offset : use.Offsets) {
+            m_Plan.Accesses.emplace_back(use.Array, offset);
+        }
+    }
+    return nullptr;
+}
+
+bool LoopVectorizer::AllocateRegisters() {
+    // the invariant operations computed before the loop
+    std::vector<bool> hoisted(m_Plan.Nodes.size());
+    for (const VectorLoop::Node& node : m_Plan.Nodes) {
+        if (node.Left >= 0 && !node.Invariant) {
+            hoisted[node.Left] = m_Plan.Nodes[node.Left].Invariant;
+            hoisted[node.Right] = m_Plan.Nodes[node.Right].Invariant;
+        }
+    }
+    for (const VectorLoop::Store& store : m_Plan.Stores) {
+        hoisted[store.Value] = m_Plan.Nodes[store.Value].Invariant;
+    }
+
+    int next = 0;
+    bool counter = false;
+    for (size_t i = 0; i < m_Plan.Nodes.size(); i++) {
+        VectorLoop::Node& node = m_Plan.Nodes[i];
+        if (node.Op == Kind::Broadcast || node.Op == Kind::Counter || hoisted[i]) {
+            node.Reg = next++;
+            counter |= node.Op == Kind::Counter;
+        }
+    }
+    if (counter) {
+        m_Plan.Step = next++;
+    }
+    for (VectorLoop::Store& store : m_Plan.Stores) {
+        if (store.Reduction) {
+            store.Accumulator = next++;
+        }
+    }
+    m_Plan.FirstTemporary = next;
+
+    // the registers each node needs from the one it is evaluated into up; see the class comment
+    std::vector<int> needs(m_Plan.Nodes.size());
+    for (size_t i = 0; i < needs.size(); i++) {
+        const VectorLoop::Node& node = m_Plan.Nodes[i];
+        switch (node.Op) {
+        case Kind::Broadcast:
+        case Kind::Counter: needs[i] = 0; break;
+        case Kind::Load: needs[i] = 1; break;
+        case Kind::Add:
+        case Kind::Sub: needs[i] = std::max({ 1, needs[node.Left], 1 + needs[node.Right] }); break;
+        case Kind::Mul:
+            needs[i] = std::max({ needs[node.Left], 1 + needs[node.Right], needs[node.Right] > 0 ? 4 : 3 });
+            break;
+        }
+        if (hoisted[i]) {
+            if (next + needs[i] > Registers) {
+                return false;
+            }
+            needs[i] = 0;
+        }
+    }
+    return std::ranges::all_of(
+        m_Plan.Stores, [&](const VectorLoop::Store& store) { return next + needs[store.Value] <= Registers; });
+}
+
+} // namespace Compiler
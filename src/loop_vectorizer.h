@@ -0,0 +1,110 @@
+#pragma once
+
+#include "ast.h"
+#include <optional>
+#include <vector>
+
+namespace Compiler {
+
+class AstBuilder;
+class Remarks;
+struct Loop;
+
+// The SIMD form of a loop, which the generator emits ahead of the loop itself: it runs as many
+// iterations as fill whole vectors, and the loop runs the rest. The operations are copied out of
+// the loop's body, so that later passes may rewrite the body freely.
+struct VectorLoop {
+    // An operation on every lane; its operands come before it in Nodes.
+    struct Node {
+        enum class Kind : uint8_t { Load, Broadcast, Counter, Add, Sub, Mul } Op;
+        const Declaration* Var = nullptr; // Load: the array; Broadcast: an invariant variable, or none
+        int64_t Value = 0;                // Load: the offset from the counter; Broadcast without Var: a literal
+        int Left = -1;                    // Add, Sub and Mul: the operands
+        int Right = -1;
+        bool Invariant = false; // Add, Sub and Mul: of broadcasts only
+        // the register holding the value for the whole loop: every Broadcast, the Counter, and the
+        // invariant operations that are operands of others that are not, computed before the loop
+        int Reg = -1;
+    };
+
+    // An element store a[counter + Offset] = Value, or a reduction a[Offset] = a[Offset] + Value (or
+    // - Value), summed over the lanes and stored once the vector loop is done.
+    struct Store {
+        const Declaration* Array;
+        int64_t Offset;
+        int Value;
+        bool Reduction = false;
+        bool Subtract = false;
+        int Accumulator = -1; // Reduction: the register the lanes are summed in
+    };
+
+    const Declaration* Counter = nullptr; // stepped by one, after the stores
+    const Declaration* Limit = nullptr;   // the loop runs while Counter < Limit, or
+    int64_t Bound = 0;                    // while Counter < Bound when there is no Limit
+    std::vector<Node> Nodes;
+    std::vector<Store> Stores; // in the order of the body
+    // every array and offset from the counter accessed, checked against the bounds before the vector loop
+    std::vector<std::pair<const Declaration*, int64_t>> Accesses;
+    int Step = -1;          // the register holding the vector width in every lane, when Counter is read
+    int FirstTemporary = 0; // the registers from here up hold intermediate values
+};
+
+// Vectorizes innermost loops over arrays, such as
+//
+//     while (i < n) { c[i] = a[i] * b[i] + k; s[0] = s[0] + a[i]; i = i + 1; }
+//
+// A candidate counts up by one to a literal or an invariant bound, its body being element stores
+// and the step last. The stores must index with the counter plus a literal, and an array stored to
+// must be accessed at that one offset only, so that no iteration reads what another writes; or be
+// a reduction into an element at a literal index the loop touches nowhere else, as wrapping sums
+// can be reassociated. The values may add, subtract and multiply elements, invariant variables,
+// literals and the counter.
+//
+// Element stores print nothing, so the iterations of the counter's trace are the only output and
+// are printed after the vector loop.
+//
+// Intermediate values are computed into registers from FirstTemporary up: a node evaluated into r
+// leaves its value in r, or in its own register if it has one, and may use the registers above r
+// while it is computed. The right operand of an operation is evaluated into r + 1, and a
+// multiplication needs two more registers above its operands for the halves of the product.
+class LoopVectorizer {
+  public:
+    static constexpr int Registers = 16;        // xmm0-15 or ymm0-15
+    static constexpr int64_t MaxOffset = 1 << 20; // keeps the displacements of the accesses within 32 bits
+
+    LoopVectorizer(Block* body, AstBuilder& builder, Remarks& remarks);
+    void Run();
+
+  private:
+    // how a loop accesses an array
+    struct ArrayUse {
+        const Declaration* Array;
+        std::vector<int64_t> Offsets; // from the counter
+        bool Stored = false;          // at one of the offsets
+        bool Reduced = false;
+    };
+
+    void TryVectorize(Loop& loop);
+    bool AddStore(const Loop& loop, const AssignmentExpression* store);
+    // appends the nodes computing expr and returns the last, or fails with m_Reason
+    template <typename T>
+    std::optional<int> Add(const Loop& loop, const T* expr);
+    std::optional<int> Add(const Loop& loop, const Primary* primary);
+    std::optional<int> Binary(BinaryOp op, int left, int right);
+    int Leaf(VectorLoop::Node::Kind kind, const Declaration* var, int64_t value);
+    std::optional<int64_t> MatchOffset(const Expression* index) const;
+    ArrayUse& Use(const Declaration* array);
+    const char* CheckArrays();
+    bool AllocateRegisters();
+
+    Block* m_Body;
+    AstBuilder& m_Builder;
+    Remarks& m_Remarks;
+
+    // the loop being vectorized
+    VectorLoop m_Plan;
+    std::vector<ArrayUse> m_Arrays; // in the order first accessed
+    const char* m_Reason = nullptr;
+};
+
+} // namespace Compiler
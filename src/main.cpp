@@ -1,41 +1,237 @@
-#include "generator.h"
-#include "lexer.h"
-#include "parser.h"
-#include "semantic_analyzer.h"
-#include "symbol_table.h"
+#include "driver.h"
+#include "protocol.h"
+#include "server.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
 #include <filesystem>
 #include <format>
 #include <fstream>
 #include <iostream>
+#include <mutex>
+#include <sstream>
 
-int main() {
-    std::filesystem::path inputFilePath = "test/main.c";
-    std::filesystem::path outputFilePath = "test/main.asm";
+using Compiler::ExitCode;
+using Compiler::UsageException;
 
-    std::ifstream inputFile(inputFilePath, std::ios::in);
-    if (!inputFile) {
-        Compiler::Error("Failed to open file: " + inputFilePath.string());
+namespace {
+
+constexpr std::string_view Usage = R"(Usage: Compiler [options] <input>...
+       Compiler --run | --vm [options] <input>
+       Compiler --serve <socket> [options]
+
+Compiles each input to NASM assembly, next to it with the extension .asm unless -o is given.
+With --run, runs the program in-process instead and exits with its exit status; --vm does the
+same in the bytecode interpreter, the reference for the generated code. With --serve, compiles
+the sources sent by CompilerClient over the Unix socket <socket>.
+
+Options:
+  -o <file>               write the assembly to <file> (a single input only)
+  -O<level>               optimization level 0-3, 2 by default
+  -j <jobs>               compile up to <jobs> inputs or requests in parallel, 0 for one per
+                          hardware thread; 1 by default, 0 with --serve
+  -Rpass=<regex>          print the optimizations done by the passes matching <regex>
+  -Rpass-missed=<regex>   print the optimizations the passes matching <regex> chose not to do
+  -Rpass-analysis=<regex> print the analysis results of the passes matching <regex>
+  --stats                 print the instructions of the assembly by kind, its pushes, pops,
+                          spills, branches and calls, and how deep its frames get
+  --emit-bytecode         write a listing of the bytecode instead, with the extension .bc
+  --emit-ast              write the analyzed program as an AST image instead, with the extension
+                          .ast; an image may be given as input in place of source
+  --pipeline              lex on a second thread while parsing, for large inputs
+  -mno-avx2               run vectorized loops with SSE2 even where the processor has AVX2
+  --profile-generate=<file>
+                          instrument the program to write how often its branches ran to <file>
+                          when it exits
+  --profile-use=<file>    optimize for the branch counts in <file>, written by a program built
+                          with --profile-generate
+  --profile-cycles        instrument the program to print the cycles each if and loop took to
+                          stderr when it exits
+  --cache <dir>           reuse the outputs of earlier compilations kept in <dir>, by default
+                          $COMPILER_CACHE if set
+  --cache-size <MB>, --cache-size=<MB>
+                          evict the least recently used outputs beyond <MB>, 256 by default
+  --run                   run the program instead of writing its assembly
+  --vm                    run the program's bytecode instead of writing its assembly
+  --serve <socket>        run as a compile server listening on <socket>
+  @<file>                 read more arguments from <file>, one per line
+  -h, --help              print this message
+)";
+
+struct CommandLine {
+    std::vector<std::filesystem::path> Inputs;
+    std::optional<std::filesystem::path> Output;
+    std::optional<std::filesystem::path> Socket;
+    Compiler::DriverOptions Options = {
+        Compiler::OptimizationOptions::ForLevel(2), {}, {}, {}, false, {}, {}, false
+    };
+    std::optional<size_t> Jobs;
+    std::optional<std::filesystem::path> Cache;
+    uintmax_t CacheSize = 256; // MB
+    std::optional<Compiler::Engine> Run;
+    bool Help = false;
+};
+
+size_t ParseCount(std::string_view text, std::string_view option) {
+    size_t value;
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (text.empty() || ec != std::errc() || end != text.data() + text.size()) {
+        throw UsageException(std::format("invalid argument '{}' to {}", text, option));
+    }
+    return value;
+}
+
+void ParseArguments(std::vector<std::string> args, CommandLine& cmd) {
+    for (size_t i = 0; i < args.size(); i++) {
+        std::string_view arg = args[i];
+        auto value = [&](std::string_view option) -> std::string_view {
+            if (arg.size() > option.size()) {
+                return arg.substr(option.size());
+            }
+            if (i + 1 == args.size()) {
+                throw UsageException(std::format("missing argument to {}", option));
+            }
+            return args[++i];
+        };
+
+        if (arg == "-h" || arg == "--help") {
+            cmd.Help = true;
+        } else if (arg.starts_with("@")) {
+            std::ifstream file{ std::string(arg.substr(1)) };
+            if (!file) {
+                throw UsageException(std::format("cannot open response file '{}'", arg.substr(1)));
+            }
+            std::vector<std::string> lines;
+            for (std::string line; std::getline(file, line);) {
+                if (!line.empty() && line.back() == '\r') {
+                    line.pop_back();
+                }
+                if (!line.empty()) {
+                    lines.push_back(std::move(line));
+                }
+            }
+            ParseArguments(std::move(lines), cmd);
+        } else if (arg == "--run") {
+            cmd.Run = Compiler::Engine::Jit;
+        } else if (arg == "--vm") {
+            cmd.Run = Compiler::Engine::Bytecode;
+        } else if (arg == "--cache-size") {
+            cmd.CacheSize = ParseCount(value("--cache-size"), "--cache-size");
+        } else if (arg.starts_with("--cache-size=")) {
+            cmd.CacheSize = ParseCount(arg.substr(std::string_view("--cache-size=").size()), "--cache-size");
+        } else if (arg == "--cache") {
+            cmd.Cache = value("--cache");
+        } else if (arg == "--serve") {
+            cmd.Socket = value("--serve");
+        } else if (arg.starts_with("-o")) {
+            cmd.Output = value("-o");
+        } else if (arg.starts_with("-j")) {
+            cmd.Jobs = ParseCount(value("-j"), "-j");
+        } else if (Compiler::ParseCompileOption(arg, cmd.Options)) {
+            continue;
+        } else if (arg.size() > 1 && arg.starts_with("-")) {
+            throw UsageException(std::format("unknown option '{}'", arg));
+        } else {
+            cmd.Inputs.emplace_back(arg);
+        }
+    }
+}
+
+size_t Workers(size_t jobs) {
+    return jobs == 0 ? std::max(1u, std::thread::hardware_concurrency()) : jobs;
+}
+
+ExitCode CompileAll(const CommandLine& cmd) {
+    size_t jobs = std::min(Workers(cmd.Jobs.value_or(1)), cmd.Inputs.size());
+
+    // every worker reuses one context for all the units it compiles
+    std::vector<std::unique_ptr<Compiler::CompilerContext>> contexts;
+    for (size_t i = 0; i < jobs; i++) {
+        contexts.push_back(std::make_unique<Compiler::CompilerContext>());
     }
 
-    std::string sourceCode((std::istreambuf_iterator<char>(inputFile)), std::istreambuf_iterator<char>());
-    sourceCode += '\n';
-    inputFile.close();
+    // diagnostics are printed in input order, each unit's as soon as it and all before it are done
+    std::vector<std::string> diagnostics(cmd.Inputs.size());
+    std::vector<bool> done(cmd.Inputs.size());
+    size_t printed = 0;
+    size_t failed = 0;
+    std::mutex mutex;
 
-    Compiler::Lexer lexer(sourceCode);
-    Compiler::Parser parser(lexer.Lex());
-    auto program = parser.ParseProgram();
-    Compiler::ScopeStack scopes;
-    Compiler::SemanticAnalyzer analyzer(program, scopes);
-    analyzer.Analyze();
-    Compiler::Generator generator(program, scopes);
+    Compiler::ThreadPool pool(jobs);
+    for (size_t i = 0; i < cmd.Inputs.size(); i++) {
+        pool.Submit([&, i](size_t worker) {
+            const auto& input = cmd.Inputs[i];
+            const char* extension = cmd.Options.Emit == Compiler::Target::Bytecode ? ".bc"
+                                    : cmd.Options.Emit == Compiler::Target::AstImage ? ".ast"
+                                                                                      : ".asm";
+            auto output = cmd.Output.value_or(std::filesystem::path(input).replace_extension(extension));
+            std::ostringstream out;
+            bool ok = Compiler::CompileFile(input, output, cmd.Options, *contexts[worker], out);
 
-    std::ofstream outputFile(outputFilePath);
-    if (!outputFile) {
-        Compiler::Error("Failed to write to file: " + outputFilePath.string());
+            std::lock_guard lock(mutex);
+            diagnostics[i] = std::move(out).str();
+            done[i] = true;
+            failed += !ok;
+            for (; printed < done.size() && done[printed]; printed++) {
+                std::cerr << diagnostics[printed];
+                diagnostics[printed].clear();
+            }
+        });
     }
-    outputFile << generator.GenerateAsm();
-    outputFile.close();
+    pool.Wait();
 
-    std::cout << "Output written to " << outputFilePath << "\n";
-    return 0;
+    if (failed != 0 && cmd.Inputs.size() > 1) {
+        std::cerr << std::format("Compiler: {} of {} inputs failed to compile\n", failed, cmd.Inputs.size());
+    }
+    return failed == 0 ? ExitCode::Success : ExitCode::CompileFailed;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    CommandLine cmd;
+    try {
+        ParseArguments(std::vector<std::string>(argv + 1, argv + argc), cmd);
+        if (cmd.Help) {
+            std::cout << Usage;
+            return static_cast<int>(ExitCode::Success);
+        }
+        if (cmd.Socket && !cmd.Inputs.empty()) {
+            throw UsageException("--serve takes no input files");
+        }
+        if (!cmd.Socket && cmd.Inputs.empty()) {
+            throw UsageException("no input files");
+        }
+        if (cmd.Output && cmd.Inputs.size() > 1) {
+            throw UsageException("-o cannot be used with multiple inputs");
+        }
+        if (cmd.Run && (cmd.Inputs.size() != 1 || cmd.Output || cmd.Socket)) {
+            throw UsageException("--run and --vm take a single input and no -o or --serve");
+        }
+    } catch (const UsageException& e) {
+        std::cerr << std::format("Compiler: error: {}\nRun 'Compiler --help' for usage.\n", e.what());
+        return static_cast<int>(ExitCode::UsageError);
+    }
+
+    if (!cmd.Cache) {
+        if (const char* env = std::getenv("COMPILER_CACHE"); env && *env) {
+            cmd.Cache = env;
+        }
+    }
+    if (cmd.Cache) {
+        cmd.Options.Cache = std::make_shared<Compiler::CompileCache>(*cmd.Cache, cmd.CacheSize * 1024 * 1024);
+    }
+
+    if (cmd.Run) {
+        Compiler::CompilerContext context;
+        auto status =
+            Compiler::RunFile(cmd.Inputs.front(), *cmd.Run, cmd.Options, context, std::cout, std::cerr);
+        std::cout.flush();
+        return status ? *status : static_cast<int>(ExitCode::CompileFailed);
+    }
+    if (cmd.Socket) {
+        return Compiler::Serve(*cmd.Socket, cmd.Options, Workers(cmd.Jobs.value_or(0)));
+    }
+    return static_cast<int>(CompileAll(cmd));
 }
@@ -0,0 +1,50 @@
+#include "optimizer.h"
+#include "dead_store_elimination.h"
+#include "if_converter.h"
+#include "inliner.h"
+#include "loop_optimizer.h"
+#include "loop_unroller.h"
+#include "loop_vectorizer.h"
+#include "value_numbering.h"
+
+namespace Compiler {
+
+Optimizer::Optimizer(Program* prog, const OptimizationOptions& options, const Profile* profile, Remarks& remarks,
+    ArenaAllocator& allocator)
+    : m_Program(prog), m_Options(options), m_Profile(profile), m_Remarks(remarks), m_Builder(allocator) {}
+
+void Optimizer::Run() {
+    if (m_Options.InlineBudget > 0) {
+        Inliner(m_Program, m_Builder, m_Options, m_Remarks).Run();
+    }
+    for (FunctionDefinition* function : m_Program->Functions) {
+        Optimize(function->Body);
+    }
+    Optimize(m_Program->GlobalBlock);
+}
+
+void Optimizer::Optimize(Block* body) {
+    // first, while the loops are as written: the other loop passes add assignments to their bodies
+    if (m_Options.Vectorize) {
+        LoopVectorizer(body, m_Builder, m_Remarks).Run();
+    }
+    if (m_Options.LoopInvariantCodeMotion || m_Options.StrengthReduction) {
+        LoopOptimizer(body, m_Builder, m_Options, m_Remarks).Run();
+    }
+    if (m_Options.IfConversion) {
+        IfConverter(body, m_Options, m_Profile, m_Remarks).Run();
+    }
+    if (m_Options.UnrollFactor != 1 || m_Options.LoopRotation) {
+        LoopUnroller(body, m_Builder, m_Options, m_Profile, m_Remarks).Run();
+    }
+    // last, so it also sees the copies made by unrolling
+    if (m_Options.ValueNumbering != ValueNumberingScope::None) {
+        ValueNumbering(body, m_Builder, m_Options, m_Remarks).Run();
+    }
+    // after every pass that introduces temporaries
+    if (m_Options.DeadStoreElimination) {
+        DeadStoreElimination(body, m_Remarks).Run();
+    }
+}
+
+} // namespace Compiler
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "ast.h"
+#include "ast_utils.h"
+#include "options.h"
+#include "utils.h"
+
+namespace Compiler {
+
+class Profile;
+class Remarks;
+
+// Runs the AST-level optimization passes enabled in the options, after semantic analysis and
+// before code generation. Nodes created by the passes are allocated in the given arena, the one
+// the program was parsed into. A profile, if any, guides the choices of the passes that trade
+// code size or branches for speed. Calls are inlined first; the other passes then run over each
+// function body and the main block in turn.
+class Optimizer {
+  public:
+    Optimizer(Program* prog, const OptimizationOptions& options, const Profile* profile, Remarks& remarks,
+        ArenaAllocator& allocator);
+    void Run();
+
+  private:
+    void Optimize(Block* body);
+
+    Program* m_Program;
+    const OptimizationOptions m_Options;
+    const Profile* m_Profile;
+    Remarks& m_Remarks;
+    AstBuilder m_Builder;
+};
+
+} // namespace Compiler
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <format>
+#include <string>
+
+namespace Compiler {
+
+enum class ValueNumberingScope {
+    None,
+    Local,  // within straight-line code
+    Global, // along the dominator tree
+};
+
+struct OptimizationOptions {
+    bool LoopInvariantCodeMotion = true;
+    bool StrengthReduction = true;
+    bool LoopRotation = true;
+    bool IfConversion = true;
+    bool Vectorize = true;
+    bool DeadStoreElimination = true;
+    bool Schedule = true; // reorder the instructions of each basic block for their latencies
+    ValueNumberingScope ValueNumbering = ValueNumberingScope::Global;
+
+    int UnrollFactor = 0; // 0 lets the cost model choose, 1 disables unrolling
+    int MaxUnrollFactor = 8;
+    int UnrollBudget = 128; // estimated instructions an unrolled body may grow to
+    int IfConversionBudget = 16; // estimated instructions for computing both arms of a select
+    int InlineBudget = 24; // estimated instructions a function inlined at its calls may have, 0 for none
+    int CodeAlignment = 16; // the boundary loop headers and functions start on, 0 for none
+
+    // every field, telling apart the outputs of compilations with different options (see
+    // CompileCache); a field missing here lets the cache return code compiled without it
+    std::string Key() const {
+        return std::format(
+            "licm={} sr={} rotate={} ifconv={} vec={} dse={} sched={} vn={} unroll={} maxunroll={} budget={} "
+            "ifbudget={} inline={} align={}",
+            LoopInvariantCodeMotion, StrengthReduction, LoopRotation, IfConversion, Vectorize, DeadStoreElimination,
+            Schedule, static_cast<int>(ValueNumbering), UnrollFactor, MaxUnrollFactor, UnrollBudget,
+            IfConversionBudget, InlineBudget, CodeAlignment);
+    }
+
+    // the options behind -O<level>: 0 runs no pass, 1 the ones that never grow the code, 2 (the
+    // default) all of them and 3 also doubles the size budgets
+    static OptimizationOptions ForLevel(int level) {
+        OptimizationOptions options;
+        if (level <= 1) {
+            options.UnrollFactor = 1;
+            options.Vectorize = false;
+            options.ValueNumbering = ValueNumberingScope::Local;
+            options.InlineBudget = 8; // no larger than the call
+            options.CodeAlignment = 0;
+        }
+        if (level <= 0) {
+            options.LoopInvariantCodeMotion = false;
+            options.StrengthReduction = false;
+            options.LoopRotation = false;
+            options.IfConversion = false;
+            options.DeadStoreElimination = false;
+            options.Schedule = false;
+            options.ValueNumbering = ValueNumberingScope::None;
+            options.InlineBudget = 0;
+        }
+        if (level >= 3) {
+            options.MaxUnrollFactor *= 2;
+            options.UnrollBudget *= 2;
+            options.IfConversionBudget *= 2;
+            options.InlineBudget *= 2;
+            options.CodeAlignment = 32; // a whole fetch block of the decoded instruction cache
+        }
+        return options;
+    }
+};
+
+} // namespace Compiler
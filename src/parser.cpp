@@ -1,23 +1,64 @@
 #include "parser.h"
+#include "stack.h"
+#include <charconv>
 #include <format>
 
 namespace Compiler {
 
-Parser::Parser(const std::vector<Token>& tokens)
-    : m_Tokens(tokens), m_Index(0), m_Allocator(4 * 1024 * 1024) {} // 4 MB
+namespace {
 
-Program* Parser::ParseProgram() {
+// The element an expression is, if it is nothing but one, unparenthesized: what may be stored to.
+template <typename T>
+Subscript* AsElement(const T* expr) {
+    if constexpr (std::is_same_v<T, PostfixExpression>) {
+        auto* const* element = std::get_if<Subscript*>(&expr->Prim->Value);
+        return element && expr->CallList.empty() ? *element : nullptr;
+    } else {
+        return expr->Right.empty() ? AsElement(expr->Left) : nullptr;
+    }
+}
+
+} // namespace
+
+void TokenStream::Fill() {
+    m_Tokens.erase(m_Tokens.begin(), m_Tokens.begin() + m_Index);
     m_Index = 0;
-    return m_Allocator.alloc<Program>(ParseBlock());
+    if (!m_Refill || !m_Refill(m_Tokens)) {
+        // the stream ended early, because the lexer failed: pad it out to the end
+        m_Tokens.emplace_back(END_OF_FILE, m_Tokens.empty() ? SourceLocation() : m_Tokens.back().Location);
+    }
+}
+
+Parser::Parser(std::vector<Token> tokens, ArenaAllocator& allocator)
+    : m_Tokens(std::move(tokens)), m_Allocator(allocator) {}
+
+Parser::Parser(TokenStream::Refill refill, ArenaAllocator& allocator)
+    : m_Tokens(std::move(refill)), m_Allocator(allocator) {}
+
+Program* Parser::ParseProgram() {
+    std::vector<FunctionDefinition*> functions;
+    while (Match(INT)) {
+        functions.push_back(ParseFunctionDefinition());
+    }
+    Program* program = m_Allocator.alloc<Program>(ParseBlock());
+    program->Functions = std::move(functions);
+    return program;
 }
 
 Primary* Parser::ParsePrimary() {
     if (Match(END_OF_FILE)) {
-        Error(m_Tokens.back().Location, "Expected primary");
+        Error(m_Tokens.Peek().Location, "Expected primary");
     } else if (Match(LITERAL)) {
-        return m_Allocator.alloc<Primary>(std::stoll(*Consume().Value));
+        return m_Allocator.alloc<Primary>(ParseLiteral());
     } else if (Match(IDENTIFIER)) {
-        return m_Allocator.alloc<Primary>(*Consume().Value);
+        std::string name = *Consume().Value;
+        if (Match(LBRACKET)) {
+            Consume();
+            Expression* index = ParseExpression();
+            Expect(RBRACKET);
+            return m_Allocator.alloc<Primary>(m_Allocator.alloc<Subscript>(name, index));
+        }
+        return m_Allocator.alloc<Primary>(name);
     } else if (Match(LPAREN)) {
         Consume();
         Expression* expr = ParseExpression();
@@ -25,7 +66,7 @@ Primary* Parser::ParsePrimary() {
         return m_Allocator.alloc<Primary>(expr);
     }
 
-    Error("Unexpected token in primary");
+    Error(m_Tokens.Peek().Location, "Unexpected token in primary");
     return nullptr; // never reached
 }
 
@@ -107,17 +148,22 @@ EqualityExpression* Parser::ParseEqualityExpression() {
 }
 
 AssignmentExpression* Parser::ParseAssignmentExpression() {
-    AssignmentExpression* expr;
-
-    if (Match(IDENTIFIER) && m_Tokens[m_Index + 1].Type == EQUAL) {
-        std::string_view name = *Consume().Value;
-        Consume(); // '='
-        expr = m_Allocator.alloc<AssignmentExpression>(name, ParseEqualityExpression());
-    } else {
-        expr = m_Allocator.alloc<AssignmentExpression>(ParseEqualityExpression());
-    }
-
-    return expr;
+    return EnsureStack([&] {
+        if (Match(IDENTIFIER) && m_Tokens.Peek(1).Type == EQUAL) {
+            std::string name = *Consume().Value;
+            Consume(); // '='
+            return m_Allocator.alloc<AssignmentExpression>(name, ParseEqualityExpression());
+        }
+        // an element to store to is only known as such when the '=' after its index is reached
+        EqualityExpression* expr = ParseEqualityExpression();
+        if (Match(EQUAL)) {
+            if (Subscript* element = AsElement(expr)) {
+                Consume();
+                return m_Allocator.alloc<AssignmentExpression>(element, ParseEqualityExpression());
+            }
+        }
+        return m_Allocator.alloc<AssignmentExpression>(expr);
+    });
 }
 
 Expression* Parser::ParseExpression() {
@@ -125,40 +171,49 @@ Expression* Parser::ParseExpression() {
 }
 
 Statement* Parser::ParseStatement() {
+    return EnsureStack([&] { return ParseStatementHere(); });
+}
+
+Statement* Parser::ParseStatementHere() {
     if (Match(RETURN)) {
-        Consume();
+        SourceLocation loc = Consume().Location;
         Expression* expr = ParseExpression();
         Expect(SEMICOLON);
         ReturnStatement* stmt = m_Allocator.alloc<ReturnStatement>(expr);
+        stmt->Loc = loc;
         return m_Allocator.alloc<Statement>(stmt);
     } else if (Match(IF)) {
-        Consume();
+        SourceLocation loc = Consume().Location;
         Expect(LPAREN);
         Expression* expr = ParseExpression();
         Expect(RPAREN);
 
         IfStatement* stmt = m_Allocator.alloc<IfStatement>(expr, ParseStatement());
+        stmt->Loc = loc;
         if (Match(ELSE)) {
             Consume();
             stmt->Else = ParseStatement();
         }
         return m_Allocator.alloc<Statement>(stmt);
     } else if (Match(WHILE)) {
-        Consume();
+        SourceLocation loc = Consume().Location;
         Expect(LPAREN);
         Expression* expr = ParseExpression();
         Expect(RPAREN);
 
         WhileStatement* stmt = m_Allocator.alloc<WhileStatement>(expr, ParseStatement());
+        stmt->Loc = loc;
         return m_Allocator.alloc<Statement>(stmt);
     } else if (Match(LBRACE)) {
         return m_Allocator.alloc<Statement>(ParseBlock());
     }
 
+    SourceLocation loc = m_Tokens.Peek().Location;
     Expression* expr = ParseExpression();
     Expect(SEMICOLON);
 
     ExpressionStatement* stmt = m_Allocator.alloc<ExpressionStatement>(expr);
+    stmt->Loc = loc;
     return m_Allocator.alloc<Statement>(stmt);
 }
 
@@ -170,8 +225,17 @@ Block* Parser::ParseBlock() {
         if (Match(INT)) {
             Consume();
             std::string name = *Expect(IDENTIFIER).Value;
-            Expect(SEMICOLON);
             Declaration* decl = m_Allocator.alloc<Declaration>(name);
+            if (Match(LBRACKET)) {
+                Consume();
+                const SourceLocation loc = m_Tokens.Peek().Location;
+                decl->Size = Match(LITERAL) ? ParseLiteral() : 0;
+                if (decl->Size <= 0 || decl->Size > Declaration::MaxSize) {
+                    Error(loc, std::format("Array size must be a literal between 1 and {}", Declaration::MaxSize));
+                }
+                Expect(RBRACKET);
+            }
+            Expect(SEMICOLON);
 
             item = m_Allocator.alloc<BlockItem>(decl);
         } else {
@@ -183,9 +247,43 @@ Block* Parser::ParseBlock() {
     return block;
 }
 
+FunctionDefinition* Parser::ParseFunctionDefinition() {
+    Expect(INT);
+    const Token name = Expect(IDENTIFIER);
+    Expect(LPAREN);
+    std::vector<Declaration*> params;
+    auto parameter = [&] {
+        Expect(INT);
+        params.push_back(m_Allocator.alloc<Declaration>(*Expect(IDENTIFIER).Value));
+    };
+    if (!Match(RPAREN)) {
+        parameter();
+        while (Match(COMMA)) {
+            Consume();
+            parameter();
+        }
+    }
+    Expect(RPAREN);
+
+    FunctionDefinition* function =
+        m_Allocator.alloc<FunctionDefinition>(*name.Value, std::move(params), ParseBlock());
+    function->Loc = name.Location;
+    return function;
+}
+
+int64_t Parser::ParseLiteral() {
+    const Token token = Expect(LITERAL);
+    int64_t value;
+    const std::string& digits = *token.Value;
+    if (std::from_chars(digits.data(), digits.data() + digits.size(), value).ec != std::errc()) {
+        Error(token.Location, std::format("Integer literal '{}' is out of range", digits));
+    }
+    return value;
+}
+
 Token Parser::Expect(TokenType type) {
-    if (m_Tokens[m_Index].Type != type) {
-        Error(m_Tokens[m_Index].Location, std::format("Expected '{}'", TokenToStr(type)));
+    if (m_Tokens.Peek().Type != type) {
+        Error(m_Tokens.Peek().Location, std::format("Expected '{}'", TokenToStr(type)));
     }
     return Consume();
 }
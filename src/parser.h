@@ -2,15 +2,53 @@
 
 #include "ast.h"
 #include "utils.h"
+#include <functional>
+#include <vector>
 
 namespace Compiler {
 
+// The tokens a parser reads: all of them from the start, or a window that is refilled as the
+// parser advances, from a lexer running alongside it. References to tokens are invalidated by
+// the next Peek or Consume.
+class TokenStream {
+  public:
+    // appends more tokens to the vector; returns false once there are no more
+    using Refill = std::function<bool(std::vector<Token>&)>;
+
+    explicit TokenStream(std::vector<Token> tokens) : m_Tokens(std::move(tokens)) {}
+    explicit TokenStream(Refill refill) : m_Refill(std::move(refill)) {}
+
+    // the token ahead places after the next one
+    const Token& Peek(size_t ahead = 0) {
+        while (m_Index + ahead >= m_Tokens.size()) {
+            Fill();
+        }
+        return m_Tokens[m_Index + ahead];
+    }
+
+    const Token& Consume() {
+        const Token& token = Peek();
+        ++m_Index;
+        return token;
+    }
+
+  private:
+    void Fill();
+
+    std::vector<Token> m_Tokens;
+    size_t m_Index = 0;
+    Refill m_Refill;
+};
+
 class Parser {
   public:
-    explicit Parser(const std::vector<Token>& tokens);
+    // nodes are allocated in allocator, which must outlive the program
+    Parser(std::vector<Token> tokens, ArenaAllocator& allocator);
+    Parser(TokenStream::Refill refill, ArenaAllocator& allocator);
     Program* ParseProgram();
 
   private:
+    int64_t ParseLiteral();
     Primary* ParsePrimary();
     PostfixExpression* ParsePostfixExpression();
     MultiplicativeExpression* ParseMultiplicativeExpression();
@@ -20,13 +58,16 @@ class Parser {
     AssignmentExpression* ParseAssignmentExpression();
     Expression* ParseExpression();
     Statement* ParseStatement();
+    Statement* ParseStatementHere(); // on the current stack
     Block* ParseBlock();
+    FunctionDefinition* ParseFunctionDefinition();
 
-    const Token& Consume() { return m_Tokens[m_Index++]; }
+    const Token& Consume() { return m_Tokens.Consume(); }
 
     template <typename... Args>
     bool Match(TokenType first, Args... rest) {
-        if (((m_Tokens[m_Index].Type == first) || ... || (m_Tokens[m_Index].Type == rest))) {
+        const TokenType type = m_Tokens.Peek().Type;
+        if (((type == first) || ... || (type == rest))) {
             return true;
         }
         return false;
@@ -34,9 +75,8 @@ class Parser {
 
     Token Expect(TokenType type);
 
-    const std::vector<Token> m_Tokens;
-    size_t m_Index = 0;
-    ArenaAllocator m_Allocator;
+    TokenStream m_Tokens;
+    ArenaAllocator& m_Allocator;
 };
 
 } // namespace Compiler
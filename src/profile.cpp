@@ -0,0 +1,63 @@
+#include "profile.h"
+#include "utils.h"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+namespace Compiler {
+
+Profile Profile::Load(const std::filesystem::path& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        Error("Failed to open the profile");
+    }
+    const std::string contents{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+
+    ProfileFormat::Header header;
+    if (contents.size() < sizeof(header)) {
+        Error("Not a profile");
+    }
+    std::memcpy(&header, contents.data(), sizeof(header));
+    if (header.Magic != ProfileFormat::Magic) {
+        Error("Not a profile");
+    }
+    if (header.Records > (contents.size() - sizeof(header)) / sizeof(ProfileFormat::Record)) {
+        Error("Truncated profile");
+    }
+
+    Profile profile;
+    for (uint64_t i = 0; i < header.Records; i++) {
+        ProfileFormat::Record record;
+        std::memcpy(&record, contents.data() + sizeof(header) + i * sizeof(record), sizeof(record));
+        switch (record.Kind) {
+        case ProfileFormat::Counter::IfThen:
+            profile.m_Ifs[record.Site].Then += record.Count;
+            break;
+        case ProfileFormat::Counter::IfElse:
+            profile.m_Ifs[record.Site].Else += record.Count;
+            break;
+        case ProfileFormat::Counter::LoopEntry:
+            profile.m_Loops[record.Site].Entries += record.Count;
+            break;
+        case ProfileFormat::Counter::LoopBody:
+            profile.m_Loops[record.Site].Iterations += record.Count;
+            break;
+        default:
+            Error("Corrupt profile");
+        }
+    }
+    profile.m_Key = Digest::Of(contents);
+    return profile;
+}
+
+const Profile::IfCounts* Profile::If(SourceLocation loc) const {
+    auto it = m_Ifs.find(ProfileFormat::SiteOf(loc));
+    return it != m_Ifs.end() ? &it->second : nullptr;
+}
+
+const Profile::LoopCounts* Profile::Loop(SourceLocation loc) const {
+    auto it = m_Loops.find(ProfileFormat::SiteOf(loc));
+    return it != m_Loops.end() ? &it->second : nullptr;
+}
+
+} // namespace Compiler
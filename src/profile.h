@@ -0,0 +1,73 @@
+#pragma once
+
+#include "cache.h"
+#include "lexer.h"
+#include <cstdint>
+#include <filesystem>
+#include <unordered_map>
+
+namespace Compiler {
+
+// The file a program built with --profile-generate writes when it exits: a header, then one
+// record per counter, all in little-endian qwords.
+namespace ProfileFormat {
+
+constexpr uint64_t Magic = 0x31464F5250434343; // "CCCPROF1"
+
+// where a counter is
+enum class Counter : uint64_t {
+    IfThen,    // the start of an if's then-arm
+    IfElse,    // the start of its else-arm, or the statement after it if it has none
+    LoopEntry, // the statement before a loop
+    LoopBody,  // the start of its body
+};
+
+struct Header {
+    uint64_t Magic;
+    uint64_t Records;
+};
+
+struct Record {
+    uint64_t Site; // the location of the if or while statement, see SiteOf
+    Counter Kind;
+    uint64_t Count;
+};
+
+inline uint64_t SiteOf(SourceLocation loc) {
+    return static_cast<uint64_t>(loc.Line) << 32 | loc.Column;
+}
+
+} // namespace ProfileFormat
+
+// How often the branches of a program went each way in the runs profiled, for --profile-use. The
+// counts are keyed by the location of the statements in the source, so they keep applying to it
+// across compilations with other options, and the counts of the copies of a statement add up.
+// Statements added to the source since the profile was written have no counts.
+class Profile {
+  public:
+    struct IfCounts {
+        uint64_t Then = 0;
+        uint64_t Else = 0;
+    };
+
+    struct LoopCounts {
+        uint64_t Entries = 0;
+        uint64_t Iterations = 0;
+    };
+
+    // reads the file at path; throws CompileError if it is not a profile
+    static Profile Load(const std::filesystem::path& path);
+
+    const IfCounts* If(SourceLocation loc) const;
+    const LoopCounts* Loop(SourceLocation loc) const;
+
+    // of the file's contents, telling apart compilations with different profiles
+    const Digest& Key() const { return m_Key; }
+
+  private:
+    std::unordered_map<uint64_t, IfCounts> m_Ifs;
+    std::unordered_map<uint64_t, LoopCounts> m_Loops;
+    Digest m_Key;
+};
+
+} // namespace Compiler
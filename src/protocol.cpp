@@ -0,0 +1,108 @@
+#include "protocol.h"
+#include <cerrno>
+#include <string_view>
+#include <sys/socket.h>
+
+namespace Compiler {
+
+static constexpr uint32_t MaxFrameSize = 64 * 1024 * 1024; // 64 MB
+
+static void AppendFrame(std::string& message, std::string_view frame) {
+    uint32_t size = static_cast<uint32_t>(frame.size());
+    for (int i = 0; i < 4; i++) {
+        message += static_cast<char>(size >> (8 * i));
+    }
+    message += frame;
+}
+
+// the whole message goes out in one write, so a small request costs a single system call
+static bool SendMessage(int fd, std::string_view message) {
+    while (!message.empty()) {
+        ssize_t sent = send(fd, message.data(), message.size(), MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        } else if (sent <= 0) {
+            return false;
+        }
+        message.remove_prefix(static_cast<size_t>(sent));
+    }
+    return true;
+}
+
+static bool ReceiveBytes(int fd, char* data, size_t size) {
+    while (size > 0) {
+        ssize_t received = recv(fd, data, size, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        } else if (received <= 0) {
+            return false;
+        }
+        data += received;
+        size -= static_cast<size_t>(received);
+    }
+    return true;
+}
+
+static bool ReceiveFrame(int fd, std::string& frame) {
+    unsigned char header[4];
+    if (!ReceiveBytes(fd, reinterpret_cast<char*>(header), sizeof(header))) {
+        return false;
+    }
+    uint32_t size = header[0] | header[1] << 8 | header[2] << 16 | static_cast<uint32_t>(header[3]) << 24;
+    if (size > MaxFrameSize) {
+        return false;
+    }
+    frame.resize(size);
+    return ReceiveBytes(fd, frame.data(), size);
+}
+
+bool Send(int fd, const CompileRequest& request) {
+    std::string arguments;
+    for (const auto& arg : request.Arguments) {
+        arguments += arg;
+        arguments += '\0';
+    }
+
+    std::string message;
+    AppendFrame(message, arguments);
+    AppendFrame(message, request.Name);
+    AppendFrame(message, request.Source);
+    return SendMessage(fd, message);
+}
+
+bool Send(int fd, const CompileResponse& response) {
+    std::string message;
+    AppendFrame(message, std::string(1, static_cast<char>(response.Code)));
+    AppendFrame(message, response.Assembly);
+    AppendFrame(message, response.Diagnostics);
+    return SendMessage(fd, message);
+}
+
+bool Receive(int fd, CompileRequest& request) {
+    std::string arguments;
+    if (!ReceiveFrame(fd, arguments) || !ReceiveFrame(fd, request.Name) || !ReceiveFrame(fd, request.Source)) {
+        return false;
+    }
+
+    request.Arguments.clear();
+    for (size_t start = 0; start < arguments.size();) {
+        size_t end = arguments.find('\0', start);
+        if (end == std::string::npos) {
+            return false;
+        }
+        request.Arguments.push_back(arguments.substr(start, end - start));
+        start = end + 1;
+    }
+    return true;
+}
+
+bool Receive(int fd, CompileResponse& response) {
+    std::string code;
+    if (!ReceiveFrame(fd, code) || code.size() != 1) {
+        return false;
+    }
+    response.Code = static_cast<ExitCode>(code[0]);
+    return ReceiveFrame(fd, response.Assembly) && ReceiveFrame(fd, response.Diagnostics);
+}
+
+} // namespace Compiler
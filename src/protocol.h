@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Compiler {
+
+// Exit codes of the compiler, also carried by the compile server's responses.
+enum class ExitCode : uint8_t {
+    Success = 0,
+    CompileFailed = 1, // some input had errors
+    UsageError = 2,    // invalid arguments
+    ServerUnavailable = 3,
+};
+
+// The messages exchanged over the compile server's socket. A message is a sequence of frames,
+// each a 32-bit little-endian byte count followed by that many bytes:
+//   request:  arguments (separated by NULs), source name, source
+//   response: exit code (a single byte), assembly, diagnostics
+// A connection may carry any number of requests, each answered before the next is read.
+struct CompileRequest {
+    std::vector<std::string> Arguments;
+    std::string Name; // the path diagnostics refer to
+    std::string Source;
+};
+
+struct CompileResponse {
+    ExitCode Code = ExitCode::Success;
+    std::string Assembly;
+    std::string Diagnostics;
+};
+
+// Receive returns false when the peer closed the connection or sent a malformed message, Send
+// when the peer is gone
+bool Send(int fd, const CompileRequest& request);
+bool Send(int fd, const CompileResponse& response);
+bool Receive(int fd, CompileRequest& request);
+bool Receive(int fd, CompileResponse& response);
+
+} // namespace Compiler
@@ -0,0 +1,34 @@
+#include "remarks.h"
+#include <format>
+
+namespace Compiler {
+
+void Remarks::Passed(std::string_view pass, SourceLocation loc, std::string message) {
+    m_Remarks.push_back({ RemarkKind::Passed, std::string(pass), loc, std::move(message) });
+}
+
+void Remarks::Missed(std::string_view pass, SourceLocation loc, std::string message) {
+    m_Remarks.push_back({ RemarkKind::Missed, std::string(pass), loc, std::move(message) });
+}
+
+void Remarks::Analysis(std::string_view pass, SourceLocation loc, std::string message) {
+    m_Remarks.push_back({ RemarkKind::Analysis, std::string(pass), loc, std::move(message) });
+}
+
+bool RemarkFilter::Matches(const Remark& remark) const {
+    const auto& pattern = Patterns[static_cast<int>(remark.Kind)];
+    return pattern && std::regex_search(remark.Pass, *pattern);
+}
+
+void Remarks::Print(std::ostream& out, std::string_view file, const RemarkFilter& filter) const {
+    static constexpr std::string_view flags[] = { "-Rpass", "-Rpass-missed", "-Rpass-analysis" };
+    for (const auto& r : m_Remarks) {
+        if (!filter.Matches(r)) {
+            continue;
+        }
+        out << std::format("{}:{}:{}: remark: {} [{}={}]\n", file, r.Loc.Line, r.Loc.Column, r.Message,
+            flags[static_cast<int>(r.Kind)], r.Pass);
+    }
+}
+
+} // namespace Compiler
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "lexer.h"
+#include <array>
+#include <optional>
+#include <ostream>
+#include <regex>
+
+namespace Compiler {
+
+enum class RemarkKind { Passed, Missed, Analysis };
+
+// An optimization remark, in the spirit of clang's -Rpass: what a pass did (or did not do) to
+// the construct at Loc.
+struct Remark {
+    RemarkKind Kind;
+    std::string Pass;
+    SourceLocation Loc;
+    std::string Message;
+};
+
+// Selects the remarks to print: those whose pass matches the pattern given for their kind, as
+// with -Rpass=<regex>, -Rpass-missed=<regex> and -Rpass-analysis=<regex>. Nothing is printed by
+// default.
+struct RemarkFilter {
+    std::array<std::optional<std::regex>, 3> Patterns;
+
+    bool Matches(const Remark& remark) const;
+};
+
+class Remarks {
+  public:
+    void Passed(std::string_view pass, SourceLocation loc, std::string message);
+    void Missed(std::string_view pass, SourceLocation loc, std::string message);
+    void Analysis(std::string_view pass, SourceLocation loc, std::string message);
+
+    const std::vector<Remark>& All() const { return m_Remarks; }
+    void Print(std::ostream& out, std::string_view file, const RemarkFilter& filter) const;
+
+  private:
+    std::vector<Remark> m_Remarks;
+};
+
+} // namespace Compiler
@@ -0,0 +1,176 @@
+#include "semantic_analyzer.h"
+#include "ast_utils.h"
+#include "stack.h"
+#include "symbol_table.h"
+#include "utils.h"
+#include <format>
+
+namespace Compiler {
+
+SemanticAnalyzer::SemanticAnalyzer(Program* prog, ScopeStack& scopes) : m_Program(prog), m_Scopes(scopes) {}
+
+void SemanticAnalyzer::Analyze() {
+    // functions are visible everywhere, so they may call each other and themselves; their bodies
+    // see nothing else, as they are analyzed before the main block is entered
+    m_Scopes.EnterScope();
+    for (FunctionDefinition* function : m_Program->Functions) {
+        m_Scopes.Insert(function->Name, { FUNCTION, 0, nullptr, function });
+    }
+    for (FunctionDefinition* function : m_Program->Functions) {
+        AnalyzeFunction(function);
+    }
+    AnalyzeBlock(m_Program->GlobalBlock);
+    m_Scopes.ExitScope();
+}
+
+void SemanticAnalyzer::AnalyzeFunction(FunctionDefinition* function) {
+    m_Scopes.EnterScope();
+    for (Declaration* param : function->Params) {
+        m_Scopes.Insert(param->Ident, { VARIABLE, 0, param });
+    }
+    AnalyzeBlock(function->Body);
+    m_Scopes.ExitScope();
+}
+
+void SemanticAnalyzer::AnalyzePrimary(Primary* primary) {
+    std::visit(overloaded{ [&](int64_t) {},
+                   [&](const std::string& s) {
+                       const TableEntry& entry = m_Scopes.Lookup(s);
+                       if (entry.Type != VARIABLE) {
+                           Error(std::format("Function '{}' used as a value", s));
+                       }
+                       if (entry.Decl->Size) {
+                           Error(std::format("Array '{}' used as a value", s));
+                       }
+                       primary->Decl = entry.Decl;
+                   },
+                   [&](Expression* expr) { AnalyzeExpression(expr); },
+                   [&](Subscript* element) { AnalyzeSubscript(element); } },
+        primary->Value);
+}
+
+void SemanticAnalyzer::AnalyzeSubscript(Subscript* element) {
+    const TableEntry& entry = m_Scopes.Lookup(element->Ident);
+    if (entry.Type != VARIABLE || !entry.Decl->Size) {
+        Error(std::format("Subscripted object '{}' is not an array", element->Ident));
+    }
+    element->Decl = entry.Decl;
+    const auto index = AsLiteral(element->Index);
+    if (index && *index >= entry.Decl->Size) {
+        Error(std::format("Index {} is out of bounds of '{}', which has {} elements", *index, element->Ident,
+            entry.Decl->Size));
+    }
+    EnsureStack([&] { AnalyzeExpression(element->Index); });
+}
+
+void SemanticAnalyzer::AnalyzePostfixExpression(PostfixExpression* expr) {
+    if (expr->CallList.empty()) {
+        AnalyzePrimary(expr->Prim);
+        return;
+    }
+
+    const auto* name = std::get_if<std::string>(&expr->Prim->Value);
+    const TableEntry* entry = name ? &m_Scopes.Lookup(*name) : nullptr;
+    if (!entry || entry->Type != FUNCTION) {
+        Error("Called object is not a function");
+    }
+    if (expr->CallList.size() > 1) {
+        Error(std::format("The result of '{}' is not a function", *name));
+    }
+    const FunctionDefinition* function = entry->Function;
+    const auto& args = expr->CallList.front();
+    if (args.size() != function->Params.size()) {
+        Error(std::format(
+            "'{}' takes {} arguments, {} given", function->Name, function->Params.size(), args.size()));
+    }
+    expr->Callee = function;
+    for (auto* arg : args) {
+        AnalyzeAssignmentExpression(arg);
+    }
+}
+
+void SemanticAnalyzer::AnalyzeMultiplicativeExpression(MultiplicativeExpression* expr) {
+    AnalyzePostfixExpression(expr->Left);
+    for (auto& [op, right] : expr->Right) {
+        AnalyzePostfixExpression(right);
+    }
+}
+
+void SemanticAnalyzer::AnalyzeAdditiveExpression(AdditiveExpression* expr) {
+    AnalyzeMultiplicativeExpression(expr->Left);
+    for (auto& [op, right] : expr->Right) {
+        AnalyzeMultiplicativeExpression(right);
+    }
+}
+
+void SemanticAnalyzer::AnalyzeRelationalExpression(RelationalExpression* expr) {
+    AnalyzeAdditiveExpression(expr->Left);
+    for (auto& [op, right] : expr->Right) {
+        AnalyzeAdditiveExpression(right);
+    }
+}
+
+void SemanticAnalyzer::AnalyzeEqualityExpression(EqualityExpression* expr) {
+    AnalyzeRelationalExpression(expr->Left);
+    for (auto& [op, right] : expr->Right) {
+        AnalyzeRelationalExpression(right);
+    }
+}
+
+void SemanticAnalyzer::AnalyzeAssignmentExpression(AssignmentExpression* expr) {
+    if (expr->Element) { // the index is evaluated before the value
+        AnalyzeSubscript(expr->Element);
+    }
+    EnsureStack([&] { AnalyzeEqualityExpression(expr->Expr); });
+    if (expr->Ident) {
+        const auto& entry = m_Scopes.Lookup(*expr->Ident);
+        if (entry.Type != VARIABLE || entry.Decl->Size) {
+            Error("Cannot assign to '" + *expr->Ident + "'");
+        }
+        expr->Decl = entry.Decl;
+    }
+}
+
+void SemanticAnalyzer::AnalyzeExpression(Expression* expr) {
+    AnalyzeAssignmentExpression(expr->Expr);
+}
+
+void SemanticAnalyzer::AnalyzeBlock(Block* block) {
+    m_Scopes.EnterScope();
+
+    for (auto* item : block->Items) {
+        std::visit(overloaded{ [&](Statement* stmt) { AnalyzeStatement(stmt); },
+                       [&](Declaration* decl) { m_Scopes.Insert(decl->Ident, { VARIABLE, 0, decl }); } },
+            item->Item);
+    }
+
+    m_Scopes.ExitScope();
+}
+
+void SemanticAnalyzer::AnalyzeStatement(Statement* stmt) {
+    EnsureStack([&] { AnalyzeStatementHere(stmt); });
+}
+
+void SemanticAnalyzer::AnalyzeStatementHere(Statement* stmt) {
+    std::visit(overloaded{ [&](ExpressionStatement* exprStmt) { AnalyzeExpression(exprStmt->Expr); },
+                   [&](ReturnStatement* retStmt) {
+                       if (retStmt->Expr) {
+                           AnalyzeExpression(retStmt->Expr);
+                       }
+                   },
+                   [&](IfStatement* ifStmt) {
+                       AnalyzeExpression(ifStmt->Cond);
+                       AnalyzeStatement(ifStmt->Then);
+                       if (ifStmt->Else) {
+                           AnalyzeStatement(ifStmt->Else);
+                       }
+                   },
+                   [&](WhileStatement* whileStmt) {
+                       AnalyzeExpression(whileStmt->Cond);
+                       AnalyzeStatement(whileStmt->Loop);
+                   },
+                   [&](Block* block) { AnalyzeBlock(block); } },
+        stmt->Stmt);
+}
+
+} // namespace Compiler
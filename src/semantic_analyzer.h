@@ -0,0 +1,33 @@
+#pragma once
+
+#include "ast.h"
+
+namespace Compiler {
+
+class ScopeStack;
+
+class SemanticAnalyzer {
+  public:
+    SemanticAnalyzer(Program* prog, ScopeStack& scopes);
+    void Analyze();
+
+  private:
+    void AnalyzePrimary(Primary* primary);
+    void AnalyzeSubscript(Subscript* element);
+    void AnalyzePostfixExpression(PostfixExpression* expr);
+    void AnalyzeMultiplicativeExpression(MultiplicativeExpression* expr);
+    void AnalyzeAdditiveExpression(AdditiveExpression* expr);
+    void AnalyzeRelationalExpression(RelationalExpression* expr);
+    void AnalyzeEqualityExpression(EqualityExpression* expr);
+    void AnalyzeAssignmentExpression(AssignmentExpression* expr);
+    void AnalyzeExpression(Expression* expr);
+    void AnalyzeBlock(Block* block);
+    void AnalyzeStatement(Statement* stmt);
+    void AnalyzeStatementHere(Statement* stmt); // on the current stack
+    void AnalyzeFunction(FunctionDefinition* function);
+
+    Program* m_Program;
+    ScopeStack& m_Scopes;
+};
+
+} // namespace Compiler
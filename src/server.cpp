@@ -0,0 +1,209 @@
+#include "server.h"
+#include "protocol.h"
+#include "thread_pool.h"
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <pthread.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <unordered_set>
+#include <vector>
+
+namespace Compiler {
+
+static volatile std::sig_atomic_t s_Stopping = 0;
+
+static CompileResponse Handle(
+    const CompileRequest& request, const DriverOptions& defaults, CompilerContext& context) {
+    CompileResponse response;
+    DriverOptions options = defaults;
+    try {
+        for (const auto& arg : request.Arguments) {
+            if (!ParseCompileOption(arg, options)) {
+                throw UsageException(std::format("unknown option '{}'", arg));
+            }
+        }
+    } catch (const UsageException& e) {
+        response.Code = ExitCode::UsageError;
+        response.Diagnostics = std::format("Compiler: error: {}\n", e.what());
+        return response;
+    }
+
+    std::ostringstream diagnostics;
+    bool ok = CompileSource(request.Name, request.Source, options, context, response.Assembly, diagnostics);
+    response.Code = ok ? ExitCode::Success : ExitCode::CompileFailed;
+    response.Diagnostics = std::move(diagnostics).str();
+    return response;
+}
+
+static int Listen(const std::filesystem::path& socketPath) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::string path = socketPath.string();
+    if (path.size() >= sizeof(address.sun_path)) {
+        std::cerr << std::format("Compiler: error: socket path too long: {}\n", path);
+        return -1;
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        std::cerr << std::format("Compiler: error: socket: {}\n", std::strerror(errno));
+        return -1;
+    }
+
+    // a socket left behind by a server that died is replaced, a live server's is not
+    std::error_code ec;
+    if (std::filesystem::is_socket(socketPath, ec)) {
+        if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0) {
+            std::cerr << std::format("Compiler: error: a server is already listening on {}\n", path);
+            close(fd);
+            return -1;
+        }
+        std::filesystem::remove(socketPath, ec);
+    }
+
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        std::cerr << std::format("Compiler: error: cannot listen on {}: {}\n", path, std::strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int Serve(const std::filesystem::path& socketPath, const DriverOptions& defaults, size_t workers) {
+    int listener = Listen(socketPath);
+    if (listener < 0) {
+        return static_cast<int>(ExitCode::UsageError);
+    }
+    int wake[2];
+    if (pipe2(wake, O_CLOEXEC | O_NONBLOCK) < 0) {
+        std::cerr << std::format("Compiler: error: pipe: {}\n", std::strerror(errno));
+        close(listener);
+        return static_cast<int>(ExitCode::ServerUnavailable);
+    }
+    // a client that connects and goes away before it is accepted must not block accept
+    fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK);
+
+    // SIGINT and SIGTERM stop the server instead of killing the process, so the socket is
+    // removed. They stay blocked but while this thread waits in ppoll, so one arriving before the
+    // wait still interrupts it, and the workers never see them.
+    struct sigaction action {};
+    action.sa_handler = [](int) { s_Stopping = 1; };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    sigset_t signals, waiting;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &waiting);
+    sigdelset(&waiting, SIGINT);
+    sigdelset(&waiting, SIGTERM);
+
+    std::vector<std::unique_ptr<CompilerContext>> contexts;
+    for (size_t i = 0; i < workers; i++) {
+        contexts.push_back(std::make_unique<CompilerContext>());
+    }
+    ThreadPool pool(workers);
+
+    // Connections waiting for their next request are idle, and polled by this thread; a worker
+    // takes a connection for one request only, then hands it back through the wake pipe, so
+    // clients that stay connected between requests hold no worker.
+    std::mutex mutex;
+    std::vector<int> idle;
+    std::unordered_set<int> busy; // shut down when stopping, so that their workers return
+    bool closing = false;
+    auto serve = [&](int fd, CompilerContext& context) {
+        CompileRequest request;
+        const bool open = Receive(fd, request) && Send(fd, Handle(request, defaults, context));
+        std::lock_guard lock(mutex);
+        busy.erase(fd);
+        if (!open || closing) {
+            close(fd);
+            return;
+        }
+        idle.push_back(fd);
+        // a full pipe has already woken the poll
+        [[maybe_unused]] ssize_t written = write(wake[1], "", 1);
+    };
+
+    std::vector<pollfd> polled;
+    bool failed = false;
+    while (!s_Stopping && !failed) {
+        polled.assign({ { listener, POLLIN, 0 }, { wake[0], POLLIN, 0 } });
+        {
+            std::lock_guard lock(mutex);
+            for (int fd : idle) {
+                polled.push_back({ fd, POLLIN, 0 });
+            }
+        }
+        if (ppoll(polled.data(), polled.size(), nullptr, &waiting) < 0) {
+            if (errno != EINTR) {
+                std::cerr << std::format("Compiler: error: poll: {}\n", std::strerror(errno));
+                failed = true;
+            }
+            continue;
+        }
+
+        if (polled[1].revents) {
+            char drained[64];
+            while (read(wake[0], drained, sizeof(drained)) > 0) {
+            }
+        }
+        for (size_t i = 2; i < polled.size(); i++) {
+            if (!polled[i].revents) {
+                continue;
+            }
+            // a request, or the client hanging up, which the worker's Receive finds out
+            const int fd = polled[i].fd;
+            {
+                std::lock_guard lock(mutex);
+                std::erase(idle, fd);
+                busy.insert(fd);
+            }
+            pool.Submit([&, fd](size_t worker) { serve(fd, *contexts[worker]); });
+        }
+        if (polled[0].revents) {
+            int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd >= 0) {
+                std::lock_guard lock(mutex);
+                idle.push_back(fd);
+            } else if (errno != EINTR && errno != ECONNABORTED && errno != EAGAIN) {
+                std::cerr << std::format("Compiler: error: accept: {}\n", std::strerror(errno));
+                failed = true;
+            }
+        }
+    }
+
+    close(listener);
+    std::error_code ec;
+    std::filesystem::remove(socketPath, ec);
+    {
+        std::lock_guard lock(mutex);
+        closing = true;
+        for (int fd : idle) {
+            close(fd);
+        }
+        idle.clear();
+        for (int fd : busy) {
+            shutdown(fd, SHUT_RDWR);
+        }
+    }
+    pool.Wait();
+    close(wake[0]);
+    close(wake[1]);
+    pthread_sigmask(SIG_UNBLOCK, &signals, nullptr);
+    return static_cast<int>(s_Stopping ? ExitCode::Success : ExitCode::ServerUnavailable);
+}
+
+} // namespace Compiler
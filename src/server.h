@@ -0,0 +1,16 @@
+#pragma once
+
+#include "driver.h"
+#include <filesystem>
+
+namespace Compiler {
+
+// Compile-server mode: accepts connections on a Unix domain socket and answers the compile
+// requests sent over them (see protocol.h) until interrupted. Requests are served by a pool of
+// workers, each keeping its CompilerContext warm across requests, so a small program costs
+// neither process startup nor allocating the arena; a connection only holds a worker while one
+// of its requests is being answered. Requests may override the default options with their own
+// -O and -Rpass arguments. Returns the exit code.
+int Serve(const std::filesystem::path& socketPath, const DriverOptions& defaults, size_t workers);
+
+} // namespace Compiler
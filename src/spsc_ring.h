@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <vector>
+
+namespace Compiler {
+
+// A bounded queue between exactly one producer thread and one consumer thread, with no lock: the
+// producer alone advances the tail and the consumer alone the head, each reading the other's with
+// acquire ordering. Items move in and out in batches, so the indices are published, and a blocked
+// side woken, once per batch rather than once per item. Close ends the stream; the consumer still
+// receives everything written before it.
+template <typename T>
+class SpscRing {
+  public:
+    // capacity is rounded up to a power of two; T must be default-constructible and movable
+    explicit SpscRing(size_t capacity)
+        : m_Slots(std::bit_ceil(capacity < 2 ? size_t(2) : capacity)), m_Mask(m_Slots.size() - 1) {}
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // Producer: moves all of items into the ring and clears items, blocking while the ring is full.
+    void Write(std::vector<T>& items) {
+        size_t tail = m_Tail.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < items.size();) {
+            size_t head = m_Head.load(std::memory_order_acquire);
+            while (tail - head == m_Slots.size()) {
+                m_Head.wait(head, std::memory_order_acquire);
+                head = m_Head.load(std::memory_order_acquire);
+            }
+            for (const size_t end = head + m_Slots.size(); tail != end && i < items.size(); ++tail, ++i) {
+                m_Slots[tail & m_Mask] = std::move(items[i]);
+            }
+            m_Tail.store(tail, std::memory_order_release);
+            m_Tail.notify_one();
+        }
+        items.clear();
+    }
+
+    // Producer: no more items will be written.
+    void Close() {
+        m_Tail.fetch_or(Closed, std::memory_order_release);
+        m_Tail.notify_one();
+    }
+
+    // Consumer: moves every item available to the end of out, blocking while there is none.
+    // Returns false, having moved nothing, once the ring is closed and empty.
+    bool Read(std::vector<T>& out) {
+        const size_t head = m_Head.load(std::memory_order_relaxed);
+        size_t tail = m_Tail.load(std::memory_order_acquire);
+        while (head == (tail & ~Closed)) {
+            if (tail & Closed) {
+                return false;
+            }
+            m_Tail.wait(tail, std::memory_order_acquire);
+            tail = m_Tail.load(std::memory_order_acquire);
+        }
+        tail &= ~Closed;
+        for (size_t i = head; i != tail; ++i) {
+            out.push_back(std::move(m_Slots[i & m_Mask]));
+        }
+        m_Head.store(tail, std::memory_order_release);
+        m_Head.notify_one();
+        return true;
+    }
+
+  private:
+    // set in the tail by Close: it changes the value a waiting consumer compares against
+    static constexpr size_t Closed = size_t(1) << (sizeof(size_t) * 8 - 1);
+    static constexpr size_t CacheLine = 64;
+
+    std::vector<T> m_Slots;
+    const size_t m_Mask;
+    // kept on separate cache lines so that the two threads don't contend for one
+    alignas(CacheLine) std::atomic<size_t> m_Head = 0;
+    alignas(CacheLine) std::atomic<size_t> m_Tail = 0;
+};
+
+} // namespace Compiler
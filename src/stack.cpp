@@ -0,0 +1,113 @@
+#include "stack.h"
+#include <exception>
+#include <new>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <vector>
+
+namespace Compiler::Stack {
+
+namespace {
+
+// The lowest usable address of the stack the thread is running on.
+thread_local const char* t_Limit = nullptr;
+
+const char* ThreadStackLimit() {
+    pthread_attr_t attr;
+    void* base = nullptr;
+    size_t size = 0;
+    if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+        pthread_attr_getstack(&attr, &base, &size);
+        pthread_attr_destroy(&attr);
+    }
+    // the first pages are guard pages, or, for the main thread, not yet mapped: stay clear of them
+    return static_cast<const char*>(base) + 64 * 1024;
+}
+
+// A few segments no longer in use, kept for the next deep walk of the thread.
+struct SegmentPool {
+    static constexpr size_t Capacity = 4;
+
+    ~SegmentPool() {
+        for (void* segment : Free) {
+            munmap(segment, SegmentSize);
+        }
+    }
+
+    std::vector<void*> Free;
+};
+
+thread_local SegmentPool t_Pool;
+
+struct Switch {
+    Callback Fn;
+    ucontext_t Caller;
+    std::exception_ptr Exception;
+};
+
+thread_local Switch* t_Switch = nullptr;
+
+void Enter() {
+    Switch* s = t_Switch;
+    try {
+        s->Fn();
+    } catch (...) {
+        s->Exception = std::current_exception();
+    }
+    // returning resumes s->Caller, through uc_link
+}
+
+} // namespace
+
+bool HasRoom() {
+    if (!t_Limit) {
+        t_Limit = ThreadStackLimit();
+    }
+    char probe;
+    return &probe - t_Limit > static_cast<ptrdiff_t>(RedZone);
+}
+
+void RunOnNewSegment(Callback fn) {
+    void* segment;
+    if (!t_Pool.Free.empty()) {
+        segment = t_Pool.Free.back();
+        t_Pool.Free.pop_back();
+    } else {
+        segment = mmap(nullptr, SegmentSize, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+        if (segment == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        // a guard page, so that running off the segment faults rather than corrupts
+        mprotect(segment, static_cast<size_t>(sysconf(_SC_PAGESIZE)), PROT_NONE);
+    }
+
+    Switch s{ fn, {}, nullptr };
+    ucontext_t callee;
+    getcontext(&callee);
+    callee.uc_stack.ss_sp = segment;
+    callee.uc_stack.ss_size = SegmentSize;
+    callee.uc_link = &s.Caller;
+    makecontext(&callee, Enter, 0);
+
+    Switch* outer = t_Switch;
+    const char* limit = t_Limit;
+    t_Switch = &s;
+    t_Limit = static_cast<const char*>(segment) + 64 * 1024;
+    swapcontext(&s.Caller, &callee);
+    t_Switch = outer;
+    t_Limit = limit;
+
+    if (t_Pool.Free.size() < SegmentPool::Capacity) {
+        t_Pool.Free.push_back(segment);
+    } else {
+        munmap(segment, SegmentSize);
+    }
+    if (s.Exception) {
+        std::rethrow_exception(s.Exception);
+    }
+}
+
+} // namespace Compiler::Stack
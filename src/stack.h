@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+namespace Compiler {
+
+// The passes walk the AST recursively, so the depth of the input they can handle would be bounded
+// by the size of the thread's stack. Instead, each recursive walk calls EnsureStack where it
+// descends into a nested expression or statement. While more than RedZone bytes of the current
+// stack are left, that just calls fn. Otherwise fn runs on a new stack segment, mapped on demand
+// and released when fn returns, and exceptions thrown by fn are carried back to the caller. Depth
+// is thus limited only by memory, which grows linearly with it.
+namespace Stack {
+
+constexpr size_t RedZone = 256 * 1024;
+constexpr size_t SegmentSize = 16 * 1024 * 1024;
+
+// Whether the current stack has more than RedZone bytes left.
+bool HasRoom();
+
+class Callback {
+  public:
+    template <typename Fn>
+    Callback(Fn& fn) : m_Fn(&fn), m_Call([](void* f) { (*static_cast<Fn*>(f))(); }) {}
+
+    void operator()() const { m_Call(m_Fn); }
+
+  private:
+    void* m_Fn;
+    void (*m_Call)(void*);
+};
+
+// Runs fn on a new segment.
+void RunOnNewSegment(Callback fn);
+
+} // namespace Stack
+
+template <typename Fn>
+auto EnsureStack(Fn&& fn) -> std::invoke_result_t<Fn&> {
+    using Result = std::invoke_result_t<Fn&>;
+    if (Stack::HasRoom()) {
+        return fn();
+    }
+
+    if constexpr (std::is_void_v<Result>) {
+        auto call = [&] { fn(); };
+        Stack::RunOnNewSegment(call);
+    } else {
+        std::optional<Result> result;
+        auto call = [&] { result.emplace(fn()); };
+        Stack::RunOnNewSegment(call);
+        return std::move(*result);
+    }
+}
+
+} // namespace Compiler
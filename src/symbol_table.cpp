@@ -5,40 +5,60 @@
 namespace Compiler {
     
 void ScopeStack::EnterScope() {
-    m_Scopes.emplace_back();
+    if (m_Depth == m_Scopes.size()) {
+        m_Scopes.emplace_back();
+    }
+    m_Depth++;
 }
 
 size_t ScopeStack::ExitScope() {
-    if (m_Scopes.empty()) {
+    if (m_Depth == 0) {
         Error("Attempted to exit scope with empty scope stack");
     }
-    size_t popCount = m_Scopes.back().size();
-    m_Scopes.pop_back();
+    auto& scope = m_Scopes[--m_Depth];
+    size_t popCount = scope.size();
+    for (auto* declarations : scope) {
+        declarations->pop_back();
+    }
+    scope.clear();
     return popCount;
 }
 
+void ScopeStack::Reset() {
+    while (m_Depth > 0) {
+        ExitScope();
+    }
+    // the names stay for the next compilation, unless there are too many to be worth keeping
+    if (m_Names.size() > 4096) {
+        m_Names.clear();
+    }
+}
+
 void ScopeStack::Insert(const std::string& name, const TableEntry& entry) {
-    if (m_Scopes.empty()) {
+    if (m_Depth == 0) {
         Error("No active scope");
-    } else if (!m_Scopes.back().emplace(name, entry).second) {
+    }
+    auto& declarations = m_Names[name];
+    if (!declarations.empty() && declarations.back().Depth == m_Depth) {
         Error("Redefinition of identifier: " + name);
     }
+    declarations.push_back({ m_Depth, entry });
+    m_Scopes[m_Depth - 1].push_back(&declarations);
 }
 
 const TableEntry& ScopeStack::Lookup(const std::string& name) const {
-    for (auto it = m_Scopes.rbegin(); it != m_Scopes.rend(); ++it) {
-        auto found = it->find(name);
-        if (found != it->end()) {
-            return found->second;
-        }
+    auto found = m_Names.find(name);
+    if (found == m_Names.end() || found->second.empty()) {
+        Error("Undeclared identifier: " + name);
     }
-    Error("Undeclared identifier: " + name);
+    return found->second.back().Entry;
 }
 
 void ScopeStack::Print() const {
-    for (const auto& scope : m_Scopes) {
-        for (const auto& [key, value] : scope) {
-            std::cout << key << ":  type: " << value.Type << ", stackOffset: " << value.StackOffset << "\n";
+    for (const auto& [name, declarations] : m_Names) {
+        for (const auto& [depth, value] : declarations) {
+            std::cout << name << ":  depth: " << depth << ", type: " << value.Type
+                      << ", stackOffset: " << value.StackOffset << "\n";
         }
     }
 }
@@ -7,24 +7,43 @@
 
 namespace Compiler {
 
+struct Declaration;
+struct FunctionDefinition;
+
 enum IdentifierType { VARIABLE, FUNCTION };
 
 struct TableEntry {
     IdentifierType Type;
     int64_t StackOffset = 0;
+    const Declaration* Decl = nullptr;
+    const FunctionDefinition* Function = nullptr;
 };
 
+// The scopes currently open, innermost last. Each name maps to the stack of its declarations in
+// scope, so a lookup costs the same however deeply scopes are nested. The tables of closed scopes
+// are kept and reused by the next scopes opened, so a stack reused across compilations stops
+// allocating once warm.
 class ScopeStack {
   public:
     void Insert(const std::string& name, const TableEntry& entry);
+    // the entry is valid until the name is declared again
     const TableEntry& Lookup(const std::string& name) const;
     void Print() const;
 
     void EnterScope();
     size_t ExitScope();
+    // closes every scope, e.g. the ones left open by a compilation that failed
+    void Reset();
 
   private:
-    std::vector<std::unordered_map<std::string, TableEntry>> m_Scopes;
+    struct Visible {
+        size_t Depth; // of the scope declaring it
+        TableEntry Entry;
+    };
+
+    std::unordered_map<std::string, std::vector<Visible>> m_Names; // innermost declaration last
+    std::vector<std::vector<std::vector<Visible>*>> m_Scopes;      // the names each scope declares
+    size_t m_Depth = 0;
 };
 
 } // namespace Compiler
\ No newline at end of file
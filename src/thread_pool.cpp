@@ -0,0 +1,103 @@
+#include "thread_pool.h"
+#include <algorithm>
+#include <utility>
+
+namespace Compiler {
+
+ThreadPool::ThreadPool(size_t workers) {
+    for (size_t i = 0; i < std::max<size_t>(workers, 1); i++) {
+        m_Workers.push_back(std::make_unique<Worker>());
+    }
+    for (size_t i = 0; i < m_Workers.size(); i++) {
+        m_Threads.emplace_back(&ThreadPool::Run, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock(m_Mutex);
+        m_Stopping = true;
+    }
+    m_Available.notify_all();
+    for (auto& thread : m_Threads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::Submit(Task task) {
+    Worker& worker = *m_Workers[m_NextWorker];
+    m_NextWorker = (m_NextWorker + 1) % m_Workers.size();
+    {
+        std::lock_guard lock(m_Mutex);
+        m_Unfinished++;
+    }
+    {
+        std::lock_guard lock(worker.Mutex);
+        worker.Tasks.push_back(std::move(task));
+    }
+    {
+        // a worker may already have taken the task, leaving the count briefly negative
+        std::lock_guard lock(m_Mutex);
+        m_Queued++;
+    }
+    m_Available.notify_one();
+}
+
+void ThreadPool::Wait() {
+    std::unique_lock lock(m_Mutex);
+    m_Finished.wait(lock, [this] { return m_Unfinished == 0; });
+    if (m_Exception) {
+        std::rethrow_exception(std::exchange(m_Exception, nullptr));
+    }
+}
+
+bool ThreadPool::TryTake(size_t index, Task& task) {
+    for (size_t i = 0; i < m_Workers.size(); i++) {
+        Worker& worker = *m_Workers[(index + i) % m_Workers.size()];
+        std::lock_guard lock(worker.Mutex);
+        if (worker.Tasks.empty()) {
+            continue;
+        }
+        if (i == 0) {
+            task = std::move(worker.Tasks.back());
+            worker.Tasks.pop_back();
+        } else {
+            task = std::move(worker.Tasks.front());
+            worker.Tasks.pop_front();
+        }
+        m_Queued--;
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::Run(size_t index) {
+    while (true) {
+        Task task;
+        if (!TryTake(index, task)) {
+            std::unique_lock lock(m_Mutex);
+            m_Available.wait(lock, [this] { return m_Stopping || m_Queued > 0; });
+            if (m_Stopping && m_Queued == 0) {
+                return;
+            }
+            continue;
+        }
+
+        std::exception_ptr exception;
+        try {
+            task(index);
+        } catch (...) {
+            exception = std::current_exception();
+        }
+
+        std::lock_guard lock(m_Mutex);
+        if (exception && !m_Exception) {
+            m_Exception = exception;
+        }
+        if (--m_Unfinished == 0) {
+            m_Finished.notify_all();
+        }
+    }
+}
+
+} // namespace Compiler
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Compiler {
+
+// A fixed set of worker threads, each with its own deque of tasks. Submitted tasks are dealt to
+// the deques in turn; a worker takes tasks from the back of its own deque and, once that is
+// empty, steals from the front of the others', so that a few long tasks don't leave the other
+// workers idle. Tasks are given the index of the worker running them, for per-worker state.
+class ThreadPool {
+  public:
+    using Task = std::function<void(size_t worker)>;
+
+    explicit ThreadPool(size_t workers);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t Size() const { return m_Workers.size(); }
+
+    void Submit(Task task);
+    // blocks until every submitted task has finished; rethrows the first exception a task threw
+    void Wait();
+
+  private:
+    struct Worker {
+        std::mutex Mutex;
+        std::deque<Task> Tasks;
+    };
+
+    void Run(size_t index);
+    bool TryTake(size_t index, Task& task);
+
+    std::vector<std::unique_ptr<Worker>> m_Workers;
+    std::vector<std::thread> m_Threads;
+    size_t m_NextWorker = 0;
+
+    std::mutex m_Mutex;
+    std::condition_variable m_Available;
+    std::condition_variable m_Finished;
+    std::atomic<ptrdiff_t> m_Queued = 0; // tasks in the deques
+    size_t m_Unfinished = 0;
+    bool m_Stopping = false;
+    std::exception_ptr m_Exception;
+};
+
+} // namespace Compiler
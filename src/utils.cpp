@@ -1,29 +1,53 @@
 #include "utils.h"
 #include "lexer.h"
-#include <format>
-#include <iostream>
+#include <algorithm>
+#include <cstdint>
 
 namespace Compiler {
-    
-ArenaAllocator::ArenaAllocator(size_t chunkSize) : m_Size(chunkSize) {
-    m_Buffer = new std::byte[m_Size];
-    m_Offset = m_Buffer;
+
+ArenaAllocator::ArenaAllocator(size_t chunkSize) : m_ChunkSize(chunkSize) {
+    AddChunk(m_ChunkSize);
 }
 
 ArenaAllocator::~ArenaAllocator() {
-    delete[] m_Buffer;
+    Reset();
+}
+
+void ArenaAllocator::Reset() {
+    for (auto it = m_Destructors.rbegin(); it != m_Destructors.rend(); ++it) {
+        it->Destroy(it->Object);
+    }
+    m_Destructors.clear();
+
+    m_Chunks.resize(1);
+    m_Offset = m_Chunks.front().get();
+    m_End = m_Offset + m_ChunkSize;
+}
+
+void* ArenaAllocator::Allocate(size_t size, size_t alignment) {
+    size_t padding = -reinterpret_cast<uintptr_t>(m_Offset) & (alignment - 1);
+    if (size + padding > static_cast<size_t>(m_End - m_Offset)) {
+        AddChunk(std::max(m_ChunkSize, size + alignment));
+        padding = -reinterpret_cast<uintptr_t>(m_Offset) & (alignment - 1);
+    }
+
+    std::byte* start = m_Offset + padding;
+    m_Offset = start + size;
+    return start;
+}
+
+void ArenaAllocator::AddChunk(size_t size) {
+    m_Chunks.push_back(std::make_unique<std::byte[]>(size));
+    m_Offset = m_Chunks.back().get();
+    m_End = m_Offset + size;
 }
 
 [[noreturn]] void Error(SourceLocation loc, const std::string& msg) {
-    std::cerr << std::format("{} [Ln {}, Col {}]\n", msg, loc.Line, loc.Column);
-    std::cin.get();
-    std::exit(1);
+    throw CompileError(loc, msg);
 }
 
 [[noreturn]] void Error(const std::string& msg) {
-    std::cerr << msg << "\n";
-    std::cin.get();
-    std::exit(1);
+    throw CompileError(std::nullopt, msg);
 }
 
 } // namespace Compiler
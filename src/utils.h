@@ -2,10 +2,18 @@
 
 #include "lexer.h"
 #include <cstddef>
+#include <memory>
 #include <new>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
 
 namespace Compiler {
 
+// Bump allocator for AST nodes. Memory comes from chunks of chunkSize bytes, a new chunk being
+// added whenever the current one is full. Objects with non-trivial destructors are destroyed when
+// the arena is reset or destroyed.
 class ArenaAllocator {
   public:
     explicit ArenaAllocator(size_t chunkSize);
@@ -16,20 +24,31 @@ class ArenaAllocator {
 
     template <typename T, typename... Args>
     T* alloc(Args&&... args) {
-        if (m_Offset + sizeof(T) > m_Buffer + m_Size) {
-            throw std::bad_alloc();
+        T* object = new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        if constexpr (!std::is_trivially_destructible_v<T>) {
+            m_Destructors.push_back({ object, [](void* p) { static_cast<T*>(p)->~T(); } });
         }
-
-        std::byte* start = m_Offset;
-        m_Offset += sizeof(T);
-        return new (start) T(std::forward<Args>(args)...);
+        return object;
     }
 
+    // destroys every object allocated so far and keeps the first chunk for reuse
+    void Reset();
+
   private:
-    const size_t m_Size;
+    struct Destructor {
+        void* Object;
+        void (*Destroy)(void*);
+    };
+
+    void* Allocate(size_t size, size_t alignment);
+    void AddChunk(size_t size);
 
-    std::byte* m_Buffer;
-    std::byte* m_Offset;
+    const size_t m_ChunkSize;
+
+    std::vector<std::unique_ptr<std::byte[]>> m_Chunks;
+    std::byte* m_Offset = nullptr;
+    std::byte* m_End = nullptr;
+    std::vector<Destructor> m_Destructors;
 };
 
 template <typename... Ts>
@@ -40,6 +59,19 @@ struct overloaded : Ts... {
 template <typename... Ts>
 overloaded(Ts...) -> overloaded<Ts...>;
 
+// Thrown by Error to abandon the translation unit being compiled. The driver reports it and goes
+// on with the next unit.
+class CompileError : public std::runtime_error {
+  public:
+    CompileError(std::optional<SourceLocation> loc, const std::string& msg)
+        : std::runtime_error(msg), m_Location(loc) {}
+
+    const std::optional<SourceLocation>& Location() const { return m_Location; }
+
+  private:
+    std::optional<SourceLocation> m_Location;
+};
+
 [[noreturn]] void Error(SourceLocation loc, const std::string& msg);
 [[noreturn]] void Error(const std::string& msg);
 
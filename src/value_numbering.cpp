@@ -0,0 +1,412 @@
+#include "value_numbering.h"
+#include "ast_utils.h"
+#include "loop_analysis.h"
+#include "remarks.h"
+#include "stack.h"
+#include <format>
+#include <utility>
+
+namespace Compiler {
+
+ValueNumbering::ValueNumbering(
+    Block* body, AstBuilder& builder, const OptimizationOptions& options, Remarks& remarks)
+    : m_Body(body), m_Builder(builder), m_Options(options), m_Remarks(remarks) {}
+
+void ValueNumbering::Run() {
+    LoopAnalysis analysis(m_Body);
+    for (const auto& loop : analysis.Loops()) {
+        m_Loops[loop->While] = loop.get();
+    }
+
+    PushScope();
+    VisitBlock(m_Body);
+    PopScope();
+
+    if (m_Hits.empty()) {
+        return;
+    }
+
+    auto& items = m_Body->Items;
+    for (auto* item : items) {
+        if (auto* stmt = std::get_if<Statement*>(&item->Item)) {
+            ForEachExpression(*stmt, [&](Expression* expr) { Rewrite(expr->Expr); });
+        }
+    }
+    // the temporaries are used across scopes, so they live for the whole body
+    items.insert(items.begin(), m_TempDecls.begin(), m_TempDecls.end());
+}
+
+void ValueNumbering::VisitBlock(Block* block) {
+    std::vector<const Declaration*> decls;
+    for (auto* item : block->Items) {
+        std::visit(overloaded{ [&](Statement* stmt) { VisitStatement(stmt); },
+                       [&](Declaration* decl) {
+                           m_Visible[decl->Ident].push_back(decl);
+                           decls.push_back(decl);
+                           NewVersion(decl);
+                       } },
+            item->Item);
+    }
+    for (const Declaration* decl : decls) {
+        m_Visible[decl->Ident].pop_back();
+    }
+}
+
+void ValueNumbering::VisitStatement(Statement* stmt) {
+    EnsureStack([&] { VisitStatementHere(stmt); });
+}
+
+void ValueNumbering::VisitStatementHere(Statement* stmt) {
+    std::visit(overloaded{ [&](ExpressionStatement* exprStmt) {
+                              m_Loc = exprStmt->Loc;
+                              VisitExpression(exprStmt->Expr);
+                          },
+                   [&](ReturnStatement* retStmt) {
+                       m_Loc = retStmt->Loc;
+                       if (retStmt->Expr) {
+                           VisitExpression(retStmt->Expr);
+                       }
+                   },
+                   [&](IfStatement* ifStmt) { VisitIf(ifStmt); }, [&](WhileStatement* whileStmt) { VisitWhile(whileStmt); },
+                   [&](Block* block) { VisitBlock(block); } },
+        stmt->Stmt);
+}
+
+void ValueNumbering::VisitIf(IfStatement* ifStmt) {
+    m_Loc = ifStmt->Loc;
+    VisitExpression(ifStmt->Cond);
+
+    // each arm starts from the versions after the condition
+    const auto before = m_Versions;
+    ++m_Region;
+    PushScope();
+    VisitStatement(ifStmt->Then);
+    PopScope();
+
+    const auto afterThen = std::exchange(m_Versions, before);
+    if (ifStmt->Else) {
+        ++m_Region;
+        PushScope();
+        VisitStatement(ifStmt->Else);
+        PopScope();
+    }
+
+    // a variable assigned in either arm has a merged value after the if
+    std::vector<const Declaration*> merged;
+    auto collect = [&](const auto& versions) {
+        for (const auto& [decl, version] : versions) {
+            auto it = before.find(decl);
+            if (it == before.end() || it->second != version) {
+                merged.push_back(decl);
+            }
+        }
+    };
+    collect(afterThen);
+    collect(m_Versions);
+    for (const Declaration* decl : merged) {
+        NewVersion(decl);
+    }
+    ++m_Region;
+}
+
+void ValueNumbering::VisitWhile(WhileStatement* whileStmt) {
+    m_Loc = whileStmt->Loc;
+
+    // the back edge may change every variable assigned in the loop before the condition runs again
+    // (a loop nested too deep to be analyzed assigns no variable the innermost analyzed one doesn't)
+    const Loop* outer = m_Loop;
+    if (auto found = m_Loops.find(whileStmt); found != m_Loops.end()) {
+        m_Loop = found->second;
+    }
+    ++m_Region;
+    for (const auto& [decl, count] : m_Loop->Defs) {
+        NewVersion(decl);
+    }
+    VisitExpression(whileStmt->Cond);
+
+    // the loop exits right after the condition, so values computed there stay available
+    const auto exit = m_Versions;
+    ++m_Region;
+    PushScope();
+    VisitStatement(whileStmt->Loop);
+    PopScope();
+
+    m_Versions = exit;
+    m_Loop = outer;
+    ++m_Region;
+}
+
+int ValueNumbering::VisitExpression(Expression* expr) {
+    return VisitAssignment(expr->Expr);
+}
+
+int ValueNumbering::VisitAssignment(AssignmentExpression* expr) {
+    // elements are not numbered: a store to one makes no value available
+    if (expr->Element) {
+        VisitExpression(expr->Element->Index);
+    }
+    const int number = EnsureStack([&] { return VisitChain(expr->Expr); });
+    if (expr->Ident) {
+        NewVersion(expr->Decl);
+        const int version = m_Versions[expr->Decl];
+        m_Variables[{ expr->Decl, version }] = number;
+        Record(number, Holder{ .Var = expr->Decl, .Version = version });
+    }
+    return number;
+}
+
+int ValueNumbering::VisitPrimary(Primary* primary) {
+    return std::visit(overloaded{ [&](int64_t value) { return LiteralNumber(value); },
+                          [&](const std::string&) { return VariableNumber(primary->Decl); },
+                          [&](Expression* e) { return VisitExpression(e); },
+                          [&](Subscript* element) {
+                              VisitExpression(element->Index);
+                              return ++m_NumberCount; // stores through other indexes may change it
+                          } },
+        primary->Value);
+}
+
+int ValueNumbering::VisitPostfix(PostfixExpression* expr) {
+    const int number = VisitPrimary(expr->Prim);
+    if (expr->CallList.empty()) {
+        return number;
+    }
+    for (const auto& args : expr->CallList) {
+        for (auto* arg : args) {
+            VisitAssignment(arg);
+        }
+    }
+    return ++m_NumberCount; // a call may return anything
+}
+
+template <typename T>
+int ValueNumbering::VisitChain(T* expr) {
+    if constexpr (std::is_same_v<T, PostfixExpression>) {
+        return VisitPostfix(expr);
+    } else {
+        // reuse the longest prefix of the chain whose value is available
+        size_t start = 0;
+        int number = 0;
+        for (size_t k = expr->Right.size(); k > 0; --k) {
+            std::optional<int> prefix = LookupPrefix(expr, k);
+            const Holder* holder = prefix ? Find(*prefix) : nullptr;
+            if (!holder) {
+                continue;
+            }
+
+            start = k;
+            number = *prefix;
+            m_Hits[expr] = { k, *holder };
+            if (!holder->Var && !m_Temps.contains(holder->Leader)) {
+                Declaration* temp = m_Builder.CreateTemporary("cse");
+                m_Temps[holder->Leader] = temp;
+                m_TempDecls.push_back(m_Builder.Item(temp));
+            }
+
+            T reused = *expr;
+            reused.Right.resize(k);
+            m_Remarks.Passed("gvn", m_Loc,
+                std::format("reused the value of '{}' from '{}'", ToString(&reused), HolderVariable(*holder)->Ident));
+            break;
+        }
+
+        if (!start) {
+            number = VisitChain(expr->Left);
+        }
+        for (size_t i = start; i < expr->Right.size(); ++i) {
+            const auto& [op, right] = expr->Right[i];
+            number = OperatorNumber(op, number, VisitChain(right));
+            Record(number, Holder{ .Leader = { expr, i + 1 } });
+        }
+        return number;
+    }
+}
+
+template <typename T>
+std::optional<int> ValueNumbering::Lookup(const T* expr, int depth) const {
+    if constexpr (std::is_same_v<T, Primary>) {
+        return std::visit(overloaded{ [&](int64_t value) -> std::optional<int> {
+                                         auto it = m_Literals.find(value);
+                                         return it != m_Literals.end() ? std::optional(it->second) : std::nullopt;
+                                     },
+                              [&](const std::string&) -> std::optional<int> {
+                                  auto version = m_Versions.find(expr->Decl);
+                                  auto it = m_Variables.find(
+                                      { expr->Decl, version != m_Versions.end() ? version->second : 0 });
+                                  return it != m_Variables.end() ? std::optional(it->second) : std::nullopt;
+                              },
+                              [&](const Expression* e) -> std::optional<int> {
+                                  if (e->Expr->Ident || e->Expr->Element || depth == MaxLookupDepth) {
+                                      return std::nullopt;
+                                  }
+                                  return Lookup(e->Expr->Expr, depth + 1);
+                              },
+                              [&](const Subscript*) -> std::optional<int> { return std::nullopt; } },
+            expr->Value);
+    } else if constexpr (std::is_same_v<T, PostfixExpression>) {
+        if (!expr->CallList.empty()) {
+            return std::nullopt;
+        }
+        return Lookup(expr->Prim, depth);
+    } else {
+        return LookupPrefix(expr, expr->Right.size(), depth);
+    }
+}
+
+template <typename T>
+std::optional<int> ValueNumbering::LookupPrefix(const T* expr, size_t prefix, int depth) const {
+    std::optional<int> number = Lookup(expr->Left, depth);
+    for (size_t i = 0; i < prefix && number; ++i) {
+        const auto& [op, right] = expr->Right[i];
+        std::optional<int> rhs = Lookup(right, depth);
+        if (!rhs) {
+            return std::nullopt;
+        }
+        auto it = m_Operators.find(Canonical(op, *number, *rhs));
+        number = it != m_Operators.end() ? std::optional(it->second) : std::nullopt;
+    }
+    return number;
+}
+
+int ValueNumbering::LiteralNumber(int64_t value) {
+    auto [it, inserted] = m_Literals.try_emplace(value, 0);
+    if (inserted) {
+        it->second = ++m_NumberCount;
+    }
+    return it->second;
+}
+
+int ValueNumbering::VariableNumber(const Declaration* decl) {
+    auto [it, inserted] = m_Variables.try_emplace({ decl, m_Versions[decl] }, 0);
+    if (inserted) {
+        it->second = ++m_NumberCount;
+    }
+    return it->second;
+}
+
+int ValueNumbering::OperatorNumber(BinaryOp op, int left, int right) {
+    auto [it, inserted] = m_Operators.try_emplace(Canonical(op, left, right), 0);
+    if (inserted) {
+        it->second = ++m_NumberCount;
+    }
+    return it->second;
+}
+
+std::tuple<BinaryOp, int, int> ValueNumbering::Canonical(BinaryOp op, int left, int right) {
+    switch (op) {
+    case BinaryOp::Add:
+    case BinaryOp::Mul:
+    case BinaryOp::Eq:
+    case BinaryOp::Ne:
+        return { op, std::min(left, right), std::max(left, right) };
+    case BinaryOp::Gt:
+        return { BinaryOp::Lt, right, left };
+    case BinaryOp::Ge:
+        return { BinaryOp::Le, right, left };
+    default:
+        return { op, left, right };
+    }
+}
+
+void ValueNumbering::Record(int number, const Holder& holder) {
+    Holder& added = m_Available[number].emplace_back(holder);
+    added.Region = m_Region;
+    m_Scopes.back().push_back(number);
+}
+
+const ValueNumbering::Holder* ValueNumbering::Find(int number) const {
+    auto it = m_Available.find(number);
+    if (it == m_Available.end()) {
+        return nullptr;
+    }
+
+    for (auto holder = it->second.rbegin(); holder != it->second.rend(); ++holder) {
+        if (m_Options.ValueNumbering == ValueNumberingScope::Local && holder->Region != m_Region) {
+            continue;
+        }
+        if (holder->Var) {
+            // the variable must still hold the value and be the one its name refers to here
+            auto version = m_Versions.find(holder->Var);
+            auto visible = m_Visible.find(holder->Var->Ident);
+            if (version->second != holder->Version || visible == m_Visible.end() || visible->second.empty() ||
+                visible->second.back() != holder->Var) {
+                continue;
+            }
+        }
+        return &*holder;
+    }
+    return nullptr;
+}
+
+void ValueNumbering::PopScope() {
+    for (auto number = m_Scopes.back().rbegin(); number != m_Scopes.back().rend(); ++number) {
+        m_Available[*number].pop_back();
+    }
+    m_Scopes.pop_back();
+}
+
+template <typename T>
+void ValueNumbering::Rewrite(T* expr) {
+    if constexpr (std::is_same_v<T, Primary>) {
+        if (auto* e = std::get_if<Expression*>(&expr->Value)) {
+            EnsureStack([&] { Rewrite((*e)->Expr); });
+        } else if (auto* element = std::get_if<Subscript*>(&expr->Value)) {
+            EnsureStack([&] { Rewrite((*element)->Index->Expr); });
+        }
+    } else if constexpr (std::is_same_v<T, PostfixExpression>) {
+        Rewrite(expr->Prim);
+        for (const auto& args : expr->CallList) {
+            for (auto* arg : args) {
+                Rewrite(arg);
+            }
+        }
+    } else {
+        using Operand = OperandOf_t<T>;
+        const size_t size = expr->Right.size();
+
+        auto hit = m_Hits.find(expr);
+        const size_t start = hit != m_Hits.end() ? hit->second.Prefix : 0;
+        if (!start) {
+            Rewrite(expr->Left);
+        }
+        for (size_t i = start; i < size; ++i) {
+            Rewrite(expr->Right[i].second);
+        }
+
+        if (start) {
+            expr->Left = m_Builder.Wrap<Operand>(m_Builder.Var(HolderVariable(hit->second.Source)));
+            expr->Right.erase(expr->Right.begin(), expr->Right.begin() + start);
+        }
+
+        // a reused prefix becomes (cse.N = prefix), innermost first
+        size_t consumed = start;
+        for (size_t k = start + 1; k <= size; ++k) {
+            auto temp = m_Temps.find({ expr, k });
+            if (temp == m_Temps.end()) {
+                continue;
+            }
+
+            const auto end = expr->Right.begin() + (k - consumed);
+            T* value = m_Builder.Make<T>(expr->Left);
+            value->Right.assign(expr->Right.begin(), end);
+            expr->Right.erase(expr->Right.begin(), end);
+
+            Expression* store = m_Builder.Assign(temp->second, m_Builder.Wrap<EqualityExpression>(value));
+            expr->Left = m_Builder.Wrap<Operand>(m_Builder.Make<Primary>(store));
+            consumed = k;
+        }
+    }
+}
+
+void ValueNumbering::Rewrite(AssignmentExpression* expr) {
+    if (expr->Element) {
+        EnsureStack([&] { Rewrite(expr->Element->Index->Expr); });
+    }
+    Rewrite(expr->Expr);
+}
+
+const Declaration* ValueNumbering::HolderVariable(const Holder& holder) const {
+    return holder.Var ? holder.Var : m_Temps.at(holder.Leader);
+}
+
+} // namespace Compiler
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "ast.h"
+#include "options.h"
+#include <map>
+#include <optional>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+
+namespace Compiler {
+
+class AstBuilder;
+class Remarks;
+struct Loop;
+
+// Common subexpression elimination by value numbering.
+//
+// Every operator prefix of an expression chain gets a value number from its operator and the
+// numbers of its operands; a variable is numbered by its declaration and a version bumped on
+// each assignment to it, and an assigned variable takes the number of the assigned value. A
+// computation whose number is already available is replaced by a read of a variable that
+// holds the value: either a variable that was assigned it and still has that version, or a
+// synthetic cse.N temporary that the first computation is rewritten to store into.
+//
+// Numbering is done on the AST, where the statement nesting gives the dominator tree: values
+// computed in an if arm or a loop body are only available inside it. At a loop header the
+// variables assigned in the loop get new versions, since the back edge may change them, and
+// after an if the variables assigned in either arm do. With local numbering values are only
+// reused inside the straight-line code they were computed in.
+class ValueNumbering {
+  public:
+    ValueNumbering(Block* body, AstBuilder& builder, const OptimizationOptions& options, Remarks& remarks);
+    void Run();
+
+  private:
+    using Occurrence = std::pair<const void*, size_t>; // chain node and operator prefix length
+
+    // Something that holds an available value.
+    struct Holder {
+        const Declaration* Var = nullptr; // a variable assigned the value, valid while at Version
+        int Version = 0;
+        Occurrence Leader{}; // or the first computation of the value
+        int Region = 0;      // straight-line region it was computed in
+    };
+
+    struct Hit {
+        size_t Prefix;
+        Holder Source;
+    };
+
+    void VisitBlock(Block* block);
+    void VisitStatement(Statement* stmt);
+    void VisitStatementHere(Statement* stmt); // on the current stack
+    void VisitIf(IfStatement* ifStmt);
+    void VisitWhile(WhileStatement* whileStmt);
+    int VisitExpression(Expression* expr);
+    int VisitAssignment(AssignmentExpression* expr);
+    int VisitPrimary(Primary* primary);
+    int VisitPostfix(PostfixExpression* expr);
+    template <typename T>
+    int VisitChain(T* expr);
+
+    // value number of an expression without visiting it, if every part is already numbered; parentheses
+    // nested more than MaxLookupDepth deep are not looked into, so that each lookup takes bounded time
+    static constexpr int MaxLookupDepth = 64;
+    template <typename T>
+    std::optional<int> Lookup(const T* expr, int depth = 0) const;
+    template <typename T>
+    std::optional<int> LookupPrefix(const T* expr, size_t prefix, int depth = 0) const;
+
+    int LiteralNumber(int64_t value);
+    int VariableNumber(const Declaration* decl);
+    int OperatorNumber(BinaryOp op, int left, int right);
+    static std::tuple<BinaryOp, int, int> Canonical(BinaryOp op, int left, int right);
+
+    void NewVersion(const Declaration* decl) { m_Versions[decl] = ++m_VersionCount; }
+    void Record(int number, const Holder& holder);
+    const Holder* Find(int number) const;
+    void PushScope() { m_Scopes.emplace_back(); }
+    void PopScope();
+
+    void Rewrite(AssignmentExpression* expr);
+    template <typename T>
+    void Rewrite(T* expr);
+    const Declaration* HolderVariable(const Holder& holder) const;
+
+    Block* m_Body;
+    AstBuilder& m_Builder;
+    const OptimizationOptions& m_Options;
+    Remarks& m_Remarks;
+
+    std::unordered_map<const WhileStatement*, const Loop*> m_Loops;
+    const Loop* m_Loop = nullptr; // innermost analyzed loop being visited
+    std::unordered_map<std::string_view, std::vector<const Declaration*>> m_Visible; // innermost last
+    SourceLocation m_Loc;
+
+    int m_NumberCount = 0;
+    std::map<int64_t, int> m_Literals;
+    std::map<std::pair<const Declaration*, int>, int> m_Variables;
+    std::map<std::tuple<BinaryOp, int, int>, int> m_Operators;
+
+    std::unordered_map<const Declaration*, int> m_Versions;
+    int m_VersionCount = 0;
+    int m_Region = 0;
+
+    std::unordered_map<int, std::vector<Holder>> m_Available;
+    std::vector<std::vector<int>> m_Scopes; // numbers recorded in each scope, to drop on exit
+
+    std::unordered_map<const void*, Hit> m_Hits;
+    std::map<Occurrence, const Declaration*> m_Temps; // leaders reused at least once
+    std::vector<BlockItem*> m_TempDecls;
+};
+
+} // namespace Compiler
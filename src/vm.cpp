@@ -0,0 +1,268 @@
+#include "vm.h"
+#include <algorithm>
+#include <charconv>
+#include <csignal>
+#include <limits>
+#include <vector>
+
+namespace Compiler {
+
+namespace {
+
+// Output is formatted into a buffer flushed when nearly full and when the program ends, as
+// programs print after every assignment.
+class Printer {
+  public:
+    explicit Printer(std::ostream& out) : m_Out(out) {}
+    ~Printer() { Flush(); }
+
+    void Print(int64_t value) {
+        if (m_Used + Reserve > sizeof(m_Buffer)) {
+            Flush();
+        }
+        char* end = std::to_chars(m_Buffer + m_Used, m_Buffer + sizeof(m_Buffer) - 1, value).ptr;
+        *end++ = '\n';
+        m_Used = static_cast<size_t>(end - m_Buffer);
+    }
+
+    void Flush() {
+        m_Out.write(m_Buffer, static_cast<std::streamsize>(m_Used));
+        m_Used = 0;
+    }
+
+  private:
+    static constexpr size_t Reserve = 24; // a 64-bit integer, its sign and the newline
+    std::ostream& m_Out;
+    char m_Buffer[64 * 1024];
+    size_t m_Used = 0;
+};
+
+// Two's complement arithmetic, as the machine does it, without the undefined behaviour.
+int64_t Wrap(uint64_t value) {
+    return static_cast<int64_t>(value);
+}
+
+bool Traps(int64_t dividend, int64_t divisor) {
+    return divisor == 0 || (divisor == -1 && dividend == std::numeric_limits<int64_t>::min());
+}
+
+// Calls are limited like the native stack: each takes the bytes its native frame would, and past
+// 8 MB, a call faults.
+constexpr size_t StackSize = 8 * 1024 * 1024;
+
+// A call in progress.
+struct Frame {
+    size_t Return; // the instruction after the call
+    size_t Base;   // the caller's first register
+    int32_t Dest;  // the caller's register the result goes to
+    int32_t Stack; // the bytes of stack the call took
+};
+
+struct Threaded {
+    const void* Handler;
+    Opcode Op;
+    int32_t A;
+    int32_t B;
+    int32_t D;
+    int64_t C;
+};
+
+} // namespace
+
+int RunBytecode(const Chunk& chunk, std::ostream& out) {
+    // each frame's registers start at its base; a frame needs at most RegisterCount of them
+    const auto frameSize = static_cast<size_t>(chunk.RegisterCount);
+    if (frameSize * sizeof(int64_t) > StackSize) {
+        return 128 + SIGSEGV; // the arrays of the main program do not fit
+    }
+    std::vector<int64_t> registers(frameSize);
+    int64_t* r = registers.data();
+    std::vector<Frame> frames;
+    size_t stack = 0; // the bytes the native calls in progress would take
+    Printer printer(out);
+
+#if defined(__GNUC__)
+    // in Opcode order
+    static const void* const handlers[] = { &&LoadI, &&Move, &&LoadElement, &&StoreElement, &&CheckIndex, &&Add,
+        &&Sub, &&Mul, &&Div, &&Mod, &&Eq, &&Ne, &&Lt, &&Le, &&Gt, &&Ge, &&AddI, &&SubI, &&MulI, &&DivI, &&ModI,
+        &&EqI, &&NeI, &&LtI, &&LeI, &&GtI, &&GeI, &&Jump, &&JumpIfZero, &&JumpIfNotZero, &&JumpIfEq, &&JumpIfNe, &&JumpIfLt, &&JumpIfLe,
+        &&JumpIfGt, &&JumpIfGe, &&JumpIfEqI, &&JumpIfNeI, &&JumpIfLtI, &&JumpIfLeI, &&JumpIfGtI, &&JumpIfGeI,
+        &&DecJumpIfNotZero, &&Call, &&Return, &&Print, &&Exit, &&Halt };
+    static_assert(std::size(handlers) == static_cast<size_t>(Opcode::Count));
+#define HANDLER(op) op:
+#define DISPATCH() goto* ip->Handler
+#else
+#define HANDLER(op) case Opcode::op:
+#define DISPATCH() goto dispatch
+#endif
+
+    std::vector<Threaded> code;
+    code.reserve(chunk.Code.size());
+    for (const Instruction& inst : chunk.Code) {
+#if defined(__GNUC__)
+        code.push_back({ handlers[static_cast<size_t>(inst.Op)], inst.Op, inst.A, inst.B, inst.D, inst.C });
+#else
+        code.push_back({ nullptr, inst.Op, inst.A, inst.B, inst.D, inst.C });
+#endif
+    }
+    const Threaded* const base = code.data();
+    const Threaded* ip = base;
+
+#define NEXT() \
+    ++ip;      \
+    DISPATCH()
+#define JUMP(target)      \
+    ip = base + (target); \
+    DISPATCH()
+#define ARITHMETIC(op, rhs, expr)   \
+    HANDLER(op) {                   \
+        const int64_t b = r[ip->B]; \
+        const int64_t c = rhs;      \
+        r[ip->A] = expr;            \
+        NEXT();                     \
+    }
+#define DIVISION(op, rhs, expr)     \
+    HANDLER(op) {                   \
+        const int64_t b = r[ip->B]; \
+        const int64_t c = rhs;      \
+        if (Traps(b, c)) {          \
+            return 128 + SIGFPE;    \
+        }                           \
+        r[ip->A] = expr;            \
+        NEXT();                     \
+    }
+#define BRANCH(op, lhs, rhs, target, cmp) \
+    HANDLER(op) {                         \
+        if (lhs cmp rhs) {                \
+            JUMP(target);                 \
+        }                                 \
+        NEXT();                           \
+    }
+
+#if defined(__GNUC__)
+    DISPATCH();
+#else
+dispatch:
+    switch (ip->Op) {
+#endif
+    HANDLER(LoadI) {
+        r[ip->A] = ip->C;
+        NEXT();
+    }
+    HANDLER(Move) {
+        r[ip->A] = r[ip->B];
+        NEXT();
+    }
+    HANDLER(LoadElement) {
+        r[ip->A] = r[ip->C + r[ip->B]];
+        NEXT();
+    }
+    HANDLER(StoreElement) {
+        r[ip->C + r[ip->B]] = r[ip->A];
+        NEXT();
+    }
+    HANDLER(CheckIndex) {
+        // as the native code, where an index out of bounds reaches a ud2
+        if (static_cast<uint64_t>(r[ip->A]) >= static_cast<uint64_t>(ip->C)) {
+            return 128 + SIGILL;
+        }
+        NEXT();
+    }
+    ARITHMETIC(Add, r[ip->C], Wrap(static_cast<uint64_t>(b) + static_cast<uint64_t>(c)))
+    ARITHMETIC(Sub, r[ip->C], Wrap(static_cast<uint64_t>(b) - static_cast<uint64_t>(c)))
+    ARITHMETIC(Mul, r[ip->C], Wrap(static_cast<uint64_t>(b) * static_cast<uint64_t>(c)))
+    DIVISION(Div, r[ip->C], b / c)
+    DIVISION(Mod, r[ip->C], b % c)
+    ARITHMETIC(Eq, r[ip->C], b == c)
+    ARITHMETIC(Ne, r[ip->C], b != c)
+    ARITHMETIC(Lt, r[ip->C], b < c)
+    ARITHMETIC(Le, r[ip->C], b <= c)
+    ARITHMETIC(Gt, r[ip->C], b > c)
+    ARITHMETIC(Ge, r[ip->C], b >= c)
+    ARITHMETIC(AddI, ip->C, Wrap(static_cast<uint64_t>(b) + static_cast<uint64_t>(c)))
+    ARITHMETIC(SubI, ip->C, Wrap(static_cast<uint64_t>(b) - static_cast<uint64_t>(c)))
+    ARITHMETIC(MulI, ip->C, Wrap(static_cast<uint64_t>(b) * static_cast<uint64_t>(c)))
+    DIVISION(DivI, ip->C, b / c)
+    DIVISION(ModI, ip->C, b % c)
+    ARITHMETIC(EqI, ip->C, b == c)
+    ARITHMETIC(NeI, ip->C, b != c)
+    ARITHMETIC(LtI, ip->C, b < c)
+    ARITHMETIC(LeI, ip->C, b <= c)
+    ARITHMETIC(GtI, ip->C, b > c)
+    ARITHMETIC(GeI, ip->C, b >= c)
+    HANDLER(Jump) {
+        JUMP(ip->C);
+    }
+    BRANCH(JumpIfZero, r[ip->A], 0, ip->C, ==)
+    BRANCH(JumpIfNotZero, r[ip->A], 0, ip->C, !=)
+    BRANCH(JumpIfEq, r[ip->A], r[ip->B], ip->C, ==)
+    BRANCH(JumpIfNe, r[ip->A], r[ip->B], ip->C, !=)
+    BRANCH(JumpIfLt, r[ip->A], r[ip->B], ip->C, <)
+    BRANCH(JumpIfLe, r[ip->A], r[ip->B], ip->C, <=)
+    BRANCH(JumpIfGt, r[ip->A], r[ip->B], ip->C, >)
+    BRANCH(JumpIfGe, r[ip->A], r[ip->B], ip->C, >=)
+    BRANCH(JumpIfEqI, r[ip->A], ip->C, ip->B, ==)
+    BRANCH(JumpIfNeI, r[ip->A], ip->C, ip->B, !=)
+    BRANCH(JumpIfLtI, r[ip->A], ip->C, ip->B, <)
+    BRANCH(JumpIfLeI, r[ip->A], ip->C, ip->B, <=)
+    BRANCH(JumpIfGtI, r[ip->A], ip->C, ip->B, >)
+    BRANCH(JumpIfGeI, r[ip->A], ip->C, ip->B, >=)
+    HANDLER(DecJumpIfNotZero) {
+        const int64_t value = r[ip->A] = Wrap(static_cast<uint64_t>(r[ip->A]) - 1);
+        if (ip->B) {
+            printer.Print(value);
+        }
+        if (value != 0) {
+            JUMP(ip->C);
+        }
+        NEXT();
+    }
+    HANDLER(Call) {
+        const auto caller = static_cast<size_t>(r - registers.data());
+        const size_t callee = caller + static_cast<size_t>(ip->B);
+        stack += static_cast<size_t>(ip->D);
+        if (stack > StackSize) {
+            return 128 + SIGSEGV;
+        }
+        if (callee + frameSize > registers.size()) {
+            registers.resize(std::max(callee + frameSize, 2 * registers.size()));
+        }
+        frames.push_back({ static_cast<size_t>(ip - base) + 1, caller, ip->A, ip->D });
+        r = registers.data() + callee;
+        JUMP(ip->C);
+    }
+    HANDLER(Return) {
+        const int64_t value = r[ip->A];
+        const Frame frame = frames.back();
+        frames.pop_back();
+        stack -= static_cast<size_t>(frame.Stack);
+        r = registers.data() + frame.Base;
+        r[frame.Dest] = value;
+        JUMP(frame.Return);
+    }
+    HANDLER(Print) {
+        printer.Print(r[ip->A]);
+        NEXT();
+    }
+    HANDLER(Exit) {
+        return static_cast<int>(r[ip->A] & 0xFF);
+    }
+    HANDLER(Halt) {
+        return 0;
+    }
+#if !defined(__GNUC__)
+    case Opcode::Count: break;
+    }
+    return 0;
+#endif
+
+#undef HANDLER
+#undef DISPATCH
+#undef NEXT
+#undef JUMP
+#undef ARITHMETIC
+#undef DIVISION
+#undef BRANCH
+}
+
+} // namespace Compiler
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "bytecode.h"
+#include <ostream>
+
+namespace Compiler {
+
+// Interprets a chunk, the reference the generated machine code is checked against: what it
+// prints goes to out and it returns the exit status the native program would, 136 (128 plus
+// SIGFPE) for a division that traps and 139 (SIGSEGV) for calls nested deeper than their native
+// frames would fit in an 8 MB stack. The code is first threaded, each instruction carrying the
+// address of its handler, and each handler jumps straight to the next one's (computed goto). Compilers without labels as values get the same handlers in a switch.
+int RunBytecode(const Chunk& chunk, std::ostream& out);
+
+} // namespace Compiler
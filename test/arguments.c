@@ -0,0 +1,26 @@
+// more than six arguments: the first six in registers, the rest on the stack
+int weigh(int a, int b, int c, int d, int e, int f, int g, int h, int i) {
+    return a + 2 * b + 3 * c + 4 * d + 5 * e + 6 * f + 7 * g + 8 * h + 9 * i;
+}
+
+// a stack argument assigned, and an odd number of them, which needs padding
+int rotate(int a, int b, int c, int d, int e, int f, int g) {
+    int t;
+    t = g;
+    g = a - b;
+    return t * 100 + g;
+}
+
+int nothing(int a) {
+    a = a + 1;
+}
+
+{
+    int x;
+    int y;
+
+    x = weigh(1, 2, 3, 4, 5, 6, 7, 8, 9);
+    y = weigh(x, x - 1, x - 2, x - 3, x - 4, x - 5, x - 6, x - 7, weigh(9, 8, 7, 6, 5, 4, 3, 2, 1));
+    x = rotate(7, 3, 0, 0, 0, 0, 5) + rotate(1, 1, 1, 1, 1, 1, 1);
+    y = nothing(x) + weigh(rotate(1, 2, 3, 4, 5, 6, 7), 0, 0, 0, 0, 0, 0, 0, 1);
+}
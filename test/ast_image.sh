@@ -0,0 +1,60 @@
+# ./ast_image.sh <compiler>
+# checks that corrupt AST images are rejected: writes the image of a small program, damages a copy
+# of it in each of a few ways and checks that compiling, running and interpreting the copy each
+# fail with "Corrupt AST image" and exit status 1, not a signal; prints the cases that don't
+compiler="$1"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+cat > "$dir/program.c" << 'PROGRAM'
+{
+    int a[4];
+    int i;
+
+    i = 0;
+    while (i < 4) {
+        a[i] = i;
+        i = i + 1;
+    }
+    if (a[1] == 1) {
+        i = 1;
+    } else {
+        i = 2;
+    }
+}
+PROGRAM
+"$compiler" --emit-ast -o "$dir/program.ast" "$dir/program.c" || exit 1
+
+u64() { # <offset>: the 64-bit integer in the image at offset
+    od -An -tu8 -j "$1" -N 8 "$dir/program.ast" | tr -d ' '
+}
+
+# <case> <offset> <bytes as printf escapes>: a copy of the image with bytes written at offset
+corrupt() {
+    cp "$dir/program.ast" "$dir/$1.ast"
+    printf "$3" | dd of="$dir/$1.ast" bs=1 seek="$2" conv=notrunc 2> /dev/null
+}
+
+# the header is the magic, the version, the root block, the size and then the tables, 16 bytes
+# each: strings, declarations, primaries, chains, operands, expressions, statements, ...
+statements=$(u64 120)
+# the reserved field of the if, the last statement, set as if it were a select
+ifs=$(($(u64 128) - 1))
+corrupt flag $((statements + ifs * 24 + 20)) '\001'
+# the statements' table past the end of the image
+corrupt offset 120 '\000\000\000\000\001\000\000\000'
+# the root block out of range
+corrupt index 12 '\000\000\000\177'
+
+status=0
+for case in flag offset index; do
+    for mode in "-o $dir/out.asm" --run --vm; do
+        output=$("$compiler" $mode "$dir/$case.ast" 2>&1)
+        code=$?
+        if [ "$code" -ne 1 ] || ! echo "$output" | grep -q "Corrupt AST image"; then
+            echo "$case: $mode exited $code: $output"
+            status=1
+        fi
+    done
+done
+exit $status
@@ -0,0 +1,27 @@
+# ./bench.sh <compiler> <program.c> [runs] [options...]
+# measures the cost of --profile-cycles: runs the program in-process <runs> times, 5 by default,
+# with and without the timers, and prints the median wall time of each and the overhead; the
+# program's output is discarded, as is the report
+compiler="$1"
+program="$2"
+runs="${3:-5}"
+shift 3 2>/dev/null || shift $#
+
+median() {
+    i=0
+    while [ "$i" -lt "$runs" ]; do
+        start=$(date +%s%N)
+        "$compiler" --run "$@" "$program" > /dev/null 2>&1
+        end=$(date +%s%N)
+        echo $(((end - start) / 1000))
+        i=$((i + 1))
+    done | sort -n | awk '{ t[NR] = $1 } END { print t[int((NR + 1) / 2)] }'
+}
+
+plain=$(median "$@")
+timed=$(median --profile-cycles "$@")
+awk -v plain="$plain" -v timed="$timed" 'BEGIN {
+    printf "plain:            %10.1f ms\n", plain / 1000
+    printf "--profile-cycles: %10.1f ms\n", timed / 1000
+    printf "overhead:         %10.1f %%\n", (timed - plain) * 100 / plain
+}'
@@ -0,0 +1,32 @@
+# ./check.sh <compiler> <program.c>...
+# runs each program in-process at every optimization level, and with the vectorized loops forced to
+# SSE2 at the levels that vectorize, both from source and from its AST image, and checks that its
+# output and exit status match the bytecode interpreter's; prints the programs that differ and fails
+# if any does
+compiler="$1"
+shift
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+status=0
+for program in "$@"; do
+    expected=$("$compiler" --vm -O0 "$program" 2>&1; echo "exit $?")
+    if ! "$compiler" --emit-ast -o "$dir/image.ast" "$program"; then
+        echo "$program: --emit-ast failed"
+        status=1
+        continue
+    fi
+    for options in -O0 -O1 -O2 -O3 "-O2 -mno-avx2" "-O3 -mno-avx2"; do
+        actual=$("$compiler" --run $options "$program" 2>&1; echo "exit $?")
+        if [ "$actual" != "$expected" ]; then
+            echo "$program: $options differs from --vm"
+            status=1
+        fi
+        actual=$("$compiler" --run $options "$dir/image.ast" 2>&1; echo "exit $?")
+        if [ "$actual" != "$expected" ]; then
+            echo "$program: $options on its AST image differs from --vm"
+            status=1
+        fi
+    done
+done
+exit $status
@@ -0,0 +1,8 @@
+{
+    int a[3];
+    int x;
+
+    a[1] = 5;
+    a[0] = 1 / a[1];
+    x = 3;
+}
@@ -0,0 +1,7 @@
+{
+    int a[3];
+    int x;
+
+    a[1] = 5;
+    x = (a[0] = a[1]);
+}
@@ -0,0 +1,21 @@
+# ./generate.sh <blocks> > large.c
+# writes a large valid program for benchmarking the compiler: <blocks> blocks of declarations,
+# arithmetic, branches and short loops, each block printing a few values
+awk -v blocks="${1:-1000}" 'BEGIN {
+    print "{"
+    print "    int total;"
+    print "    total = 0;"
+    for (i = 0; i < blocks; i++) {
+        print "    {"
+        printf "        int a%d;\n        int b%d;\n        int n%d;\n", i, i, i
+        printf "        a%d = %d * 7 + total %% 13 - (%d / 3);\n", i, i, i
+        printf "        b%d = (a%d + %d) * (a%d - 2) %% 1000;\n", i, i, i % 97, i
+        printf "        if (a%d > b%d) total = total + a%d - b%d; else total = total - (b%d - a%d) / 2;\n", i, i, i, i, i, i
+        printf "        n%d = %d;\n", i, i % 5 + 1
+        printf "        while (n%d > 0) {\n            total = total + n%d * 3 %% 7;\n            n%d = n%d - 1;\n        }\n", i, i, i, i
+        printf "        if (total == %d) { total = total + 1; }\n", i
+        print "    }"
+    }
+    print "    return total;"
+    print "}"
+}'
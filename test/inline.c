@@ -0,0 +1,47 @@
+int square(int n) {
+    return n * n;
+}
+
+int sum3(int a, int b, int c) {
+    int s;
+    s = square(a) + b;
+    return s + c;
+}
+
+// too large to inline
+int mix(int a, int b) {
+    int t;
+    t = a * 3 + b;
+    t = t - a / 2;
+    t = t * t - b;
+    t = t + a * b;
+    return t;
+}
+
+// assigns its parameter, so never inlined
+int bump(int n) {
+    n = n + 1;
+    return n;
+}
+
+// returns before its end, so never inlined
+int early(int n) {
+    if (n > 10) {
+        return 10;
+    }
+    return n;
+}
+
+{
+    int x;
+    int y;
+
+    x = square(7);
+    y = sum3(x, 2, 3);
+    square(y);
+    x = mix(x, y);
+    y = early(x) + early(4);
+    y = early(y);
+    x = bump(y);
+    x = sum3(y, square(2), y);
+}
@@ -0,0 +1,60 @@
+# ./nesting.sh <compiler> [depth]
+# checks that compiling deeply nested programs takes time linear in the depth: compiles nested
+# parentheses, blocks, while loops and calls, 20000 deep by default and twice as deep, to assembly
+# and to bytecode, and fails if doubling the depth more than triples the time; prints the times in ms
+compiler="$1"
+depth="${2:-20000}"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+program() { # <kind> <depth>
+    awk -v kind="$1" -v depth="$2" 'BEGIN {
+        if (kind == "calls") {
+            print "int f(int n) {"
+            print "    return n;"
+            print "}"
+        }
+        print "{"
+        print "    int x;"
+        if (kind == "parens" || kind == "calls") {
+            opening = kind == "calls" ? "f(" : "("
+            printf "    x = "
+            for (i = 0; i < depth; i++) printf opening
+            printf "1"
+            for (i = 0; i < depth; i++) printf ")"
+            print ";"
+        } else if (kind == "blocks") {
+            for (i = 0; i < depth; i++) printf "{"
+            printf "x = 1;"
+            for (i = 0; i < depth; i++) printf "}"
+            print ""
+        } else {
+            for (i = 0; i < depth; i++) printf "while (x) "
+            print "x = 0;"
+        }
+        print "}"
+    }'
+}
+
+milliseconds() { # <program.c>
+    start=$(date +%s%N)
+    "$compiler" -o "$dir/out.asm" "$1" || exit 1
+    "$compiler" --emit-bytecode -o "$dir/out.bc" "$1" || exit 1
+    end=$(date +%s%N)
+    echo $(((end - start) / 1000000))
+}
+
+status=0
+for kind in parens blocks loops calls; do
+    program "$kind" "$depth" > "$dir/single.c"
+    program "$kind" $((depth * 2)) > "$dir/double.c"
+    single=$(milliseconds "$dir/single.c") || { echo "$kind: failed at depth $depth"; status=1; continue; }
+    double=$(milliseconds "$dir/double.c") || { echo "$kind: failed at depth $((depth * 2))"; status=1; continue; }
+    echo "$kind: $single ms at depth $depth, $double ms at depth $((depth * 2))"
+    # a few ms of start-up make the ratio meaningless for fast compiles
+    if [ "$double" -gt 100 ] && [ "$double" -gt $((single * 3)) ]; then
+        echo "$kind: not linear in the depth"
+        status=1
+    fi
+done
+exit $status
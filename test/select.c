@@ -0,0 +1,36 @@
+{
+    int i;
+    int m;
+    int a;
+    int b;
+
+    // a maximum, an absolute value and a clamp, each an if/else assigning one variable
+    i = 0;
+    m = 0 - 5;
+    while (i < 9) {
+        a = i * 7 % 10 - 4;
+        if (a > m) {
+            m = a;
+        } else {
+            m = m;
+        }
+        if (a < 0) {
+            b = 0 - a;
+        } else {
+            b = a;
+        }
+        if (b >= 3) {
+            a = 3;
+        } else {
+            a = b + 1;
+        }
+        i = i + 1;
+    }
+
+    // a division in an arm can trap, so that if stays a branch
+    if (m != 0) {
+        a = 100 / m;
+    } else {
+        a = 0;
+    }
+}
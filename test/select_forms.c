@@ -0,0 +1,44 @@
+{
+    int a;
+    int b;
+    int x;
+    int i;
+
+    i = 0;
+    a = 0 - 3;
+    b = 5;
+    while (i < 4) {
+        // lea: times 3, 5 and 9, with a displacement, and scaled with a displacement
+        x = a * 3;
+        x = b * 5 + 7;
+        x = a * 9 - 2;
+        x = a + b * 4;
+        x = a * 8 + 12;
+
+        // imul by an immediate, from a register and from memory, a shift and a constant too
+        // large for an immediate
+        x = (a + b) * 7;
+        x = b * 100000;
+        x = a * 16;
+        x = b * 4294967297;
+
+        // negation, an update in place, division and remainder by an immediate
+        x = 0 - (a * b);
+        b = b + 3;
+        a = a - 1;
+        x = b / 3;
+        x = a % 4;
+
+        // comparisons of memory with an immediate and of a register with memory
+        if (b > 10) {
+            x = 1;
+        }
+        if (b * 2 >= a + 20) {
+            x = 2;
+        }
+        if (a * 2 != b) {
+            x = 3;
+        }
+        i = i + 1;
+    }
+}
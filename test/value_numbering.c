@@ -0,0 +1,45 @@
+{
+    int a;
+    int b;
+    int c;
+    int d;
+    int x;
+    int y;
+    int i;
+
+    a = 3;
+    b = 4;
+
+    // a * b + 1 reused, then recomputed after a changes
+    x = a * b + 1;
+    y = a * b + 1 + x;
+    a = a + 2;
+    c = a * b + 1;
+    d = c - (a * b + 1);
+
+    // a value held by a variable, until that variable is assigned
+    x = a + b;
+    y = a + b;
+    x = 7;
+    c = a + b - x;
+
+    // values computed before the loop change along its back edge
+    i = 0;
+    c = b * 2;
+    while (i < 5) {
+        d = b * 2 + i;
+        b = b + i;
+        x = b * 2 + c;
+        i = i + 1;
+    }
+    y = b * 2;
+
+    // after an if, the variables either arm assigned have new values
+    x = c + d;
+    if (x > 20) {
+        c = c + 1;
+    } else {
+        d = d + 1;
+    }
+    y = c + d;
+}
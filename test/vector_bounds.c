@@ -0,0 +1,13 @@
+{
+    int a[10];
+    int b[12];
+    int i;
+
+    // b fits every iteration, a traps at the eleventh, which the scalar loop runs
+    i = 0;
+    while (i < 12) {
+        b[i] = i;
+        a[i] = b[i] * 2;
+        i = i + 1;
+    }
+}
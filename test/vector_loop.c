@@ -0,0 +1,36 @@
+{
+    int a[16];
+    int b[16];
+    int c[16];
+    int i;
+    int k;
+    int x;
+
+    i = 0;
+    while (i < 16) {
+        a[i] = i * 3 - 7;
+        b[i] = 20 - i;
+        i = i + 1;
+    }
+
+    // element-wise, with an invariant and the counter in the values
+    k = 5;
+    i = 0;
+    while (i < 16) {
+        c[i] = a[i] * b[i] + k - i;
+        i = i + 1;
+    }
+
+    // an array stored to and read at the same offset
+    i = 0;
+    while (i < 16) {
+        a[i] = a[i] + c[i] * 2;
+        i = i + 1;
+    }
+
+    i = 0;
+    while (i < 16) {
+        x = a[i] + c[i];
+        i = i + 1;
+    }
+}
@@ -0,0 +1,26 @@
+{
+    int a[12];
+    int b[12];
+    int s[2];
+    int i;
+
+    i = 0;
+    while (i < 12) {
+        a[i] = i + 1;
+        b[i] = 12 - i * i;
+        i = i + 1;
+    }
+
+    // a dot product, and a difference summed into another element
+    s[0] = 0;
+    s[1] = 100;
+    i = 0;
+    while (i < 12) {
+        s[0] = s[0] + a[i] * b[i];
+        s[1] = s[1] - a[i];
+        i = i + 1;
+    }
+
+    i = s[0];
+    i = s[1];
+}
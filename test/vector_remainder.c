@@ -0,0 +1,29 @@
+{
+    int a[20];
+    int b[20];
+    int s[1];
+    int i;
+    int n;
+    int x;
+
+    // 7 and 19 iterations leave some for the scalar loop at either vector width, starting at 1 too
+    n = 7;
+    i = 0;
+    while (i < n) {
+        a[i] = i * i;
+        i = i + 1;
+    }
+    i = 1;
+    while (i < 20) {
+        b[i - 1] = a[i - 1] + i;
+        i = i + 1;
+    }
+
+    s[0] = 0;
+    i = 0;
+    while (i < 19) {
+        s[0] = s[0] + b[i];
+        i = i + 1;
+    }
+    x = s[0];
+}